@@ -0,0 +1,105 @@
+// Compares the array_algorithms.h kernels of every instruction set the CPU
+// supports on arrays that fit in L2, and ArrayRef::equals against the
+// element loop it replaced.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../foc/array_algorithms.h"
+
+namespace {
+
+using foc::SimdLevel;
+
+const size_t kSize = 16 * 1024;
+const size_t kRepetitions = 2000;
+
+// Keeps the compiler from optimizing away the benchmarked calls.
+volatile double g_sink;
+
+template <typename Fn>
+double run(Fn fn) {
+  double sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kRepetitions; i++) {
+    sink += (double)fn();
+  }
+  auto end = std::chrono::steady_clock::now();
+  g_sink = sink;
+  return std::chrono::duration<double, std::nano>(end - start).count() / (kRepetitions * kSize);
+}
+
+void report(const char *type, const char *kernel, const char *level, double ns_per_element) {
+  printf("%-8s %-8s %-8s %8.3f ns/element\n", type, kernel, level, ns_per_element);
+}
+
+template <typename T>
+void benchType(const char *type, const std::vector<SimdLevel> &levels) {
+  std::mt19937 rng(1);
+  std::vector<T> values(kSize);
+  std::vector<T> copy(kSize);
+  std::vector<int32_t> indices(kSize);
+  std::vector<uint8_t> selection(kSize);
+  std::vector<T> out(kSize);
+  for (size_t i = 0; i < kSize; i++) {
+    values[i] = copy[i] = (T)(rng() % 1000);
+    indices[i] = (int32_t)(rng() % kSize);
+    selection[i] = rng() % 2;
+  }
+
+  for (SimdLevel level : levels) {
+    foc::detail::ArrayKernels<T> k = foc::detail::array_kernels_for<T>(level);
+    const char *name = foc::simd_level_name(level);
+    const T *p = values.data();
+    report(type, "sum", name, run([&]() { return k.sum(p, kSize); }));
+    report(type, "min", name, run([&]() { return k.min(p, kSize); }));
+    report(type, "count", name, run([&]() { return k.count(p, kSize, (T)7); }));
+    report(type, "equals", name, run([&]() { return k.equals(p, copy.data(), kSize); }));
+    report(type, "gather", name, run([&]() {
+             k.gather(p, indices.data(), kSize, out.data());
+             return out[kSize / 2];
+           }));
+    report(type, "filter", name, run([&]() {
+             return k.filter(p, selection.data(), kSize, out.data());
+           }));
+  }
+}
+
+}  // namespace
+
+int main() {
+  std::vector<SimdLevel> levels = {SimdLevel::kScalar};
+  SimdLevel best = foc::simd_level();
+  if (best == SimdLevel::kNEON) {
+    levels.push_back(SimdLevel::kNEON);
+  } else {
+    for (SimdLevel level : {SimdLevel::kSSE42, SimdLevel::kAVX2, SimdLevel::kAVX512}) {
+      if ((int)level <= (int)best) {
+        levels.push_back(level);
+      }
+    }
+  }
+
+  benchType<int32_t>("int32_t", levels);
+  benchType<int64_t>("int64_t", levels);
+  benchType<float>("float", levels);
+  benchType<double>("double", levels);
+
+  std::vector<int64_t> a(kSize, 3);
+  std::vector<int64_t> b(kSize, 3);
+  foc::ArrayRef<int64_t> ra(a);
+  foc::ArrayRef<int64_t> rb(b);
+  // The store keeps the compiler from hoisting the comparison out of the loop.
+  report("int64_t", "equals", "std", run([&]() {
+           b[kSize - 1] = (int64_t)g_sink;
+           return std::equal(ra.begin(), ra.end(), rb.begin());
+         }));
+  report("int64_t", "equals", "ArrayRef", run([&]() {
+           b[kSize - 1] = (int64_t)g_sink;
+           return ra.equals(rb);
+         }));
+  return 0;
+}
@@ -0,0 +1,98 @@
+// Compares foc::ObjectPool, foc::LocalObjectPool and plain new/delete on a
+// workload that keeps a window of live objects and replaces them in a loop.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "../foc/object_pool.h"
+
+namespace {
+
+struct Record {
+  int64_t id;
+  int64_t timestamp;
+  char payload[48];
+
+  Record(int64_t _id, int64_t _timestamp) : id(_id), timestamp(_timestamp) { payload[0] = 0; }
+};
+
+const size_t kWindow = 4096;
+const size_t kIterations = 20 * 1000 * 1000;
+
+template <typename Create, typename Destroy>
+double run(Create create, Destroy destroy) {
+  std::vector<Record *> window(kWindow, nullptr);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kIterations; i++) {
+    // A cheap LCG spreads the frees over the window like a real workload.
+    size_t slot = (i * 2654435761u) % kWindow;
+    if (window[slot]) {
+      destroy(window[slot]);
+    }
+    window[slot] = create((int64_t)i);
+  }
+  for (auto record : window) {
+    if (record) {
+      destroy(record);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / kIterations;
+}
+
+void report(const char *name, double ns_per_op) { printf("%-32s %8.2f ns/op\n", name, ns_per_op); }
+
+}  // namespace
+
+int main() {
+  report("new/delete",
+         run([](int64_t i) { return new Record(i, i); }, [](Record *r) { delete r; }));
+
+  {
+    foc::ObjectPool<Record> pool(1024);
+    report("ObjectPool",
+           run([&pool](int64_t i) { return pool.create(i, i); },
+               [&pool](Record *r) { pool.destroy(r); }));
+  }
+
+  {
+    foc::SharedObjectPool<Record> shared(1024);
+    report("SharedObjectPool (locked)",
+           run([&shared](int64_t i) { return shared.create(i, i); },
+               [&shared](Record *r) { shared.destroy(r); }));
+  }
+
+  const unsigned num_threads = std::max(2u, std::thread::hardware_concurrency());
+  for (int use_pool = 0; use_pool < 2; use_pool++) {
+    foc::SharedObjectPool<Record> shared(1024);
+    std::vector<double> results(num_threads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; t++) {
+      threads.emplace_back([&shared, &results, t, use_pool]() {
+        if (use_pool) {
+          foc::LocalObjectPool<Record> local(shared, 64);
+          results[t] = run([&local](int64_t i) { return local.create(i, i); },
+                           [&local](Record *r) { local.destroy(r); });
+        } else {
+          results[t] = run([](int64_t i) { return new Record(i, i); }, [](Record *r) { delete r; });
+        }
+      });
+    }
+    double total = 0;
+    for (unsigned t = 0; t < num_threads; t++) {
+      threads[t].join();
+      total += results[t];
+    }
+    char name[64];
+    snprintf(name,
+             sizeof(name),
+             "%s x%u threads",
+             use_pool ? "LocalObjectPool" : "new/delete",
+             num_threads);
+    report(name, total / num_threads);
+  }
+  return 0;
+}
@@ -0,0 +1,157 @@
+// Runs 10K independent point lookups against a database file in the working
+// directory: one after another on a single connection, and all at once
+// through an Executor with futures and with callbacks. Reports throughput
+// and, for the Executor, the latency from submission to completion.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SMALL_VECTOR_IMPLEMENTATION
+#define SQLKIT_IMPLEMENTATION
+#include "../sqlkit.h"
+
+namespace {
+
+using sqlkit::Executor;
+using sqlkit::Handle;
+using sqlkit::LatencyHistogram;
+using sqlkit::OpenOptions;
+using sqlkit::QueryResult;
+using sqlkit::Stmt;
+using std::chrono::steady_clock;
+
+typedef std::tuple<int64_t, std::string> Row;
+
+const char *kFilename = "sqlkit_executor_bench.db";
+const char *kLookup = "SELECT k, v FROM kv WHERE k = ?";
+const int kNumRows = 100000;
+const int kNumRequests = 10000;
+
+uint64_t micros(steady_clock::duration d) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+void report(const char *mode, steady_clock::duration elapsed, const LatencyHistogram *latency) {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  printf("%-22s %10.0f requests/s", mode, kNumRequests / seconds);
+  if (latency) {
+    printf("   latency p50 %6llu us  p99 %6llu us",
+           (unsigned long long)latency->percentile(50),
+           (unsigned long long)latency->percentile(99));
+  }
+  printf("\n");
+}
+
+void createDatabase() {
+  remove(kFilename);
+  Handle db;
+  db.open(kFilename, OpenOptions::ingest());
+  db.execute("CREATE TABLE kv(k INTEGER PRIMARY KEY, v TEXT)");
+  Stmt insert = db.prepare("INSERT INTO kv VALUES (?, ?)");
+  db.batch(10000, [&](size_t i) {
+    if (i == (size_t)kNumRows) {
+      return SQLITE_DONE;
+    }
+    insert.bindAll((int64_t)i, "a value of a few dozen bytes to make rows realistic");
+    return insert.execute(db);
+  });
+  insert.finalize();
+  db.close();
+}
+
+void benchBlocking(const std::vector<int64_t> &keys) {
+  Handle db;
+  db.open(kFilename, OpenOptions::readHeavy());
+  sqlkit::Query<Row(int64_t)> lookup;
+  lookup.prepare(db, kLookup);
+  size_t found = 0;
+  auto start = steady_clock::now();
+  for (int64_t key : keys) {
+    if (lookup.query(db, key) == SQLITE_ROW) {
+      found++;
+    }
+  }
+  report("blocking", steady_clock::now() - start, nullptr);
+  if (found != keys.size()) {
+    fprintf(stderr, "Missing rows\n");
+  }
+  lookup.reset();
+}
+
+void benchFutures(const std::vector<int64_t> &keys, size_t num_workers) {
+  Executor executor;
+  executor.start(kFilename, num_workers, OpenOptions::readHeavy());
+  std::vector<std::future<QueryResult<Row>>> futures;
+  std::vector<steady_clock::time_point> submitted;
+  futures.reserve(keys.size());
+  submitted.reserve(keys.size());
+  LatencyHistogram latency;
+
+  auto start = steady_clock::now();
+  for (int64_t key : keys) {
+    submitted.push_back(steady_clock::now());
+    futures.push_back(executor.submit<Row>(kLookup, key));
+  }
+  for (size_t i = 0; i < futures.size(); i++) {
+    QueryResult<Row> result = futures[i].get();
+    latency.record(micros(steady_clock::now() - submitted[i]));
+    if (result.rows.size() != 1) {
+      fprintf(stderr, "Missing rows\n");
+    }
+  }
+  char mode[64];
+  snprintf(mode, sizeof(mode), "futures, %zu workers", num_workers);
+  report(mode, steady_clock::now() - start, &latency);
+}
+
+void benchCallbacks(const std::vector<int64_t> &keys, size_t num_workers) {
+  Executor executor;
+  executor.start(kFilename, num_workers, OpenOptions::readHeavy());
+  LatencyHistogram latency;
+  int completed = 0;
+
+  auto start = steady_clock::now();
+  for (int64_t key : keys) {
+    steady_clock::time_point submitted = steady_clock::now();
+    executor.post<Row>(
+        [&latency, &completed, submitted](QueryResult<Row> &) {
+          latency.record(micros(steady_clock::now() - submitted));
+          completed++;
+        },
+        kLookup, key);
+    // An event loop polls between requests.
+    executor.poll();
+  }
+  while (completed < kNumRequests) {
+    if (executor.poll() == 0) {
+      std::this_thread::yield();
+    }
+  }
+  char mode[64];
+  snprintf(mode, sizeof(mode), "callbacks, %zu workers", num_workers);
+  report(mode, steady_clock::now() - start, &latency);
+}
+
+}  // namespace
+
+int main() {
+  createDatabase();
+  std::mt19937 rng(1);
+  std::vector<int64_t> keys;
+  for (int i = 0; i < kNumRequests; i++) {
+    keys.push_back(rng() % kNumRows);
+  }
+
+  benchBlocking(keys);
+  size_t max_workers = std::max(2u, std::thread::hardware_concurrency());
+  for (size_t workers = 1; workers <= max_workers; workers *= 2) {
+    benchFutures(keys, workers);
+    benchCallbacks(keys, workers);
+  }
+  remove(kFilename);
+  return 0;
+}
@@ -0,0 +1,95 @@
+// Compares reading a result set row by row into per-column std::vectors with
+// Stmt::fetchColumns() filling columnar batches.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define SMALL_VECTOR_IMPLEMENTATION
+#define SQLKIT_IMPLEMENTATION
+#include "../sqlkit.h"
+
+namespace {
+
+using sqlkit::Handle;
+using sqlkit::Stmt;
+
+const int kNumRows = 1000000;
+const size_t kBatchSize = 4096;
+
+// Keeps the compiler from optimizing away the benchmarked loops.
+volatile double g_sink;
+
+template <typename Fn>
+void run(const char *name, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  double sink = fn();
+  auto end = std::chrono::steady_clock::now();
+  g_sink = sink;
+  printf("%-16s %8.2f ns/row\n", name,
+         std::chrono::duration<double, std::nano>(end - start).count() / kNumRows);
+}
+
+double rowByRow(Handle &db) {
+  Stmt stmt = db.prepare("SELECT id, price, symbol FROM trades");
+  std::vector<int64_t> ids;
+  std::vector<double> prices;
+  std::vector<std::string> symbols;
+  double sum = 0;
+  for (int s = stmt.query(db); s == SQLITE_ROW; s = stmt.step(db)) {
+    auto row = stmt.row();
+    ids.push_back(row.nextInt64());
+    prices.push_back(row.nextDouble());
+    symbols.push_back(row.nextString());
+    if (ids.size() == kBatchSize) {
+      sum += prices[0] + symbols[0].size();
+      ids.clear();
+      prices.clear();
+      symbols.clear();
+    }
+  }
+  return sum;
+}
+
+double columnar(Handle &db) {
+  Stmt stmt = db.prepare("SELECT id, price, symbol FROM trades");
+  foc::SmallVector<int64_t, 0> ids;
+  foc::SmallVector<double, 0> prices;
+  sqlkit::StringColumn symbols;
+  double sum = 0;
+  int status;
+  do {
+    status = stmt.fetchColumns(kBatchSize, ids, prices, symbols);
+    if (!ids.empty()) {
+      sum += prices[0] + symbols[0].size();
+    }
+    ids.clear();
+    prices.clear();
+    symbols.clear();
+  } while (status == SQLITE_ROW);
+  return sum;
+}
+
+}  // namespace
+
+int main() {
+  Handle db;
+  db.open(":memory:");
+  db.execute("CREATE TABLE trades(id INTEGER, price REAL, symbol TEXT)");
+  db.execute("BEGIN");
+  {
+    Stmt insert = db.prepare("INSERT INTO trades VALUES (?, ?, ?)");
+    const char *symbols[] = {"AAPL", "GOOGL", "MSFT", "AMZN", "a longer symbol to defeat SSO"};
+    for (int i = 0; i < kNumRows; i++) {
+      insert.bindAll(i, i * 0.25, symbols[i % 5]);
+      insert.execute(db);
+    }
+  }
+  db.execute("COMMIT");
+
+  run("row by row", [&db]() { return rowByRow(db); });
+  run("fetchColumns", [&db]() { return columnar(db); });
+  db.close();
+  return 0;
+}
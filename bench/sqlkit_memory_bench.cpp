@@ -0,0 +1,138 @@
+// Compares SQLite's default allocator and page cache with configureMemory()
+// on OLTP-style work against a WAL database in the working directory:
+// single-row insert transactions, point lookups and read-modify-write
+// transactions, from one thread and from several threads with a connection
+// each.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SMALL_VECTOR_IMPLEMENTATION
+#define SQLKIT_IMPLEMENTATION
+#include "../sqlkit.h"
+
+namespace {
+
+using sqlkit::Handle;
+using sqlkit::MemoryOptions;
+using sqlkit::OpenOptions;
+using sqlkit::Stmt;
+
+const char *kFilename = "sqlkit_memory_bench.db";
+const int kNumRows = 100000;
+const int kNumOperations = 100000;
+const int kNumThreads = 4;
+
+void removeDatabase() {
+  remove(kFilename);
+  remove((std::string(kFilename) + "-wal").c_str());
+  remove((std::string(kFilename) + "-shm").c_str());
+}
+
+OpenOptions benchOptions() {
+  OpenOptions options = OpenOptions::ingest();
+  // Small enough for the working set to churn through the page cache.
+  options.cache_size = 256;
+  return options;
+}
+
+template <typename Fn>
+void run(const char *config, const char *workload, int n, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  printf("%-12s %-22s %12.0f ops/s\n", config, workload, n / seconds);
+}
+
+// Point lookups with a read-modify-write transaction every `write_every`
+// operations.
+void oltp(int seed, int num_operations, int write_every) {
+  Handle db;
+  if (db.open(kFilename, benchOptions()) != SQLITE_OK) {
+    fprintf(stderr, "Failed to open %s\n", kFilename);
+    return;
+  }
+  Stmt select = db.prepare("SELECT balance, note FROM accounts WHERE id = ?");
+  Stmt update = db.prepare("UPDATE accounts SET balance = balance + ?, note = ? WHERE id = ?");
+  std::mt19937 rng(seed);
+  for (int i = 0; i < num_operations; i++) {
+    int64_t id = rng() % kNumRows;
+    if (write_every && i % write_every == 0) {
+      sqlkit::Transaction txn(db, sqlkit::Transaction::kImmediate);
+      select.bindAll(id);
+      if (db.query(select) == SQLITE_ROW) {
+        update.bindAll(select.column<int64_t>(0) % 7, "updated by the benchmark", id);
+        update.execute(db);
+      }
+      select.reset();
+      txn.commit();
+    } else {
+      select.bindAll(id);
+      db.query(select);
+      select.reset();
+    }
+  }
+  select.finalize();
+  update.finalize();
+  db.close();
+}
+
+void bench(const char *config) {
+  removeDatabase();
+  {
+    Handle db;
+    if (db.open(kFilename, benchOptions()) != SQLITE_OK) {
+      fprintf(stderr, "Failed to open %s\n", kFilename);
+      return;
+    }
+    db.execute("CREATE TABLE accounts(id INTEGER PRIMARY KEY, balance INTEGER, note TEXT)");
+    Stmt insert = db.prepare("INSERT INTO accounts VALUES (?, ?, ?)");
+    run(config, "insert transactions", kNumRows, [&]() {
+      for (int i = 0; i < kNumRows; i++) {
+        insert.bindAll((int64_t)i, (int64_t)i * 10, "a note of a few dozen bytes per account");
+        insert.execute(db);
+      }
+    });
+    insert.finalize();
+    db.close();
+  }
+
+  run(config, "lookups", kNumOperations, [&]() { oltp(1, kNumOperations, 0); });
+  run(config, "lookups, 1/10 writes", kNumOperations, [&]() { oltp(2, kNumOperations, 10); });
+  run(config, "4 threads, 1/10 writes", kNumOperations, [&]() {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; t++) {
+      threads.emplace_back([t]() { oltp(3 + t, kNumOperations / kNumThreads, 10); });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  });
+}
+
+}  // namespace
+
+int main() {
+  bench("default");
+
+  sqlite3_shutdown();
+  MemoryOptions options;
+  if (sqlkit::configureMemory(options) != SQLITE_OK) {
+    fprintf(stderr, "configureMemory() failed\n");
+    return 1;
+  }
+  bench("sizeclass");
+
+  sqlite3_shutdown();
+  options.memory_status = false;
+  sqlkit::configureMemory(options);
+  bench("no memstatus");
+
+  removeDatabase();
+  return 0;
+}
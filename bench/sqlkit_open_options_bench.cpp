@@ -0,0 +1,108 @@
+// Measures the OpenOptions presets on a database file in the working
+// directory: inserts in 1000-row transactions, single-row commits and random
+// point lookups.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#define SMALL_VECTOR_IMPLEMENTATION
+#define SQLKIT_IMPLEMENTATION
+#include "../sqlkit.h"
+
+namespace {
+
+using sqlkit::Handle;
+using sqlkit::OpenOptions;
+using sqlkit::Stmt;
+
+const char *kFilename = "sqlkit_open_options_bench.db";
+const int kNumRows = 200000;
+const int kNumCommits = 500;
+const int kNumLookups = 200000;
+
+void removeDatabase() {
+  remove(kFilename);
+  remove((std::string(kFilename) + "-wal").c_str());
+  remove((std::string(kFilename) + "-shm").c_str());
+}
+
+template <typename Fn>
+void run(const char *preset, const char *workload, int n, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  printf("%-10s %-16s %12.0f ops/s\n", preset, workload, n / seconds);
+}
+
+void benchWrites(const char *preset, const OpenOptions &options) {
+  removeDatabase();
+  Handle db;
+  if (db.open(kFilename, options) != SQLITE_OK) {
+    fprintf(stderr, "Failed to open %s\n", kFilename);
+    return;
+  }
+  db.execute("CREATE TABLE kv(k INTEGER PRIMARY KEY, v TEXT)");
+  Stmt insert = db.prepare("INSERT INTO kv VALUES (?, ?)");
+
+  run(preset, "batched inserts", kNumRows, [&]() {
+    db.batch(1000, [&](size_t i) {
+      if (i == (size_t)kNumRows) {
+        return SQLITE_DONE;
+      }
+      insert.bindAll((int64_t)i, "a value of a few dozen bytes to make rows realistic");
+      return insert.execute(db);
+    });
+  });
+  run(preset, "commits", kNumCommits, [&]() {
+    for (int i = 0; i < kNumCommits; i++) {
+      insert.bindAll((int64_t)(kNumRows + i), "single");
+      insert.execute(db);
+    }
+  });
+  insert.finalize();
+  db.close();
+}
+
+void benchReads(const char *preset, const OpenOptions &options) {
+  Handle db;
+  if (db.open(kFilename, options) != SQLITE_OK) {
+    fprintf(stderr, "Failed to open %s\n", kFilename);
+    return;
+  }
+  Stmt select = db.prepare("SELECT v FROM kv WHERE k = ?");
+  std::mt19937 rng(1);
+  size_t total = 0;
+  run(preset, "point lookups", kNumLookups, [&]() {
+    for (int i = 0; i < kNumLookups; i++) {
+      select.bindAll((int64_t)(rng() % kNumRows));
+      if (db.query(select) == SQLITE_ROW) {
+        total += select.column<foc::StringRef>(0).size();
+      }
+      select.reset();
+    }
+  });
+  if (total == 0) {
+    fprintf(stderr, "No rows found\n");
+  }
+  select.finalize();
+  db.close();
+}
+
+}  // namespace
+
+int main() {
+  OpenOptions defaults;
+  benchWrites("default", defaults);
+  benchWrites("durable", OpenOptions::durable());
+  benchWrites("ingest", OpenOptions::ingest());
+
+  OpenOptions read_only;
+  read_only.flags = SQLITE_OPEN_READONLY;
+  benchReads("default", read_only);
+  benchReads("readHeavy", OpenOptions::readHeavy());
+  removeDatabase();
+  return 0;
+}
@@ -1,7 +1,19 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdlib>
+
 namespace foc {
 
+// The allocators in foc are classes with the following interface:
+//
+//   void *allocate(size_t size_in_bytes, size_t alignment);  // nullptr on failure
+//   void deallocate(void *ptr, size_t size_in_bytes);
+//
+// They are stored by value in the containers that use them, so stateful
+// allocators should be cheap to copy (e.g. a pointer to an arena).
+// foc/memory_resource.h bridges them to std::pmr::memory_resource.
+
 class MallocAllocator {
  public:
   void *allocate(size_t size, size_t) { return malloc(size); }
@@ -0,0 +1,996 @@
+// Vectorized algorithms over arrays of int32_t, int64_t, float and double.
+//
+//   int64_t total = foc::sum(foc::makeArrayRef(prices));
+//   int32_t lowest = foc::min_value(foc::makeArrayRef(prices));
+//   size_t n = foc::filter(foc::makeArrayRef(prices), selection, out);
+//
+// Every algorithm has a portable scalar implementation and SIMD kernels for
+// SSE4.2, AVX2 and AVX-512 on x86 and NEON on ARM64. The x86 kernels are
+// compiled with function-level target attributes and the best one for the CPU
+// is picked at runtime, so binaries built for baseline x86-64 still use AVX2
+// or AVX-512 when the machine has it. NEON is part of the ARM64 baseline and
+// is used directly.
+//
+// The vectorized floating-point sums add the elements in a different order
+// than a sequential loop, so they can differ in the last bits from the scalar
+// result. min_value() and max_value() are unspecified for arrays with NaNs.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "array_ref.h"
+#include "support.h"
+
+// clang-format off
+#if defined(FOC_ARCH_CPU_X86_FAMILY) && (defined(__clang__) || FOC_GNUC_PREREQ(5, 0, 0))
+# include <immintrin.h>
+# define FOC_ARRAY_ALGORITHMS_X86 1
+#elif defined(FOC_ARCH_CPU_ARM64) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define FOC_ARRAY_ALGORITHMS_NEON 1
+#endif
+// clang-format on
+
+namespace foc {
+
+/// The instruction sets array_algorithms.h has kernels for.
+enum class SimdLevel { kScalar, kSSE42, kAVX2, kAVX512, kNEON };
+
+/// The best instruction set supported by this CPU. It's detected once.
+inline SimdLevel simd_level() {
+  struct Detect {
+    static SimdLevel run() {
+#if defined(FOC_ARRAY_ALGORITHMS_X86)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::kAVX512;
+      }
+      if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::kAVX2;
+      }
+      if (__builtin_cpu_supports("sse4.2")) {
+        return SimdLevel::kSSE42;
+      }
+      return SimdLevel::kScalar;
+#elif defined(FOC_ARRAY_ALGORITHMS_NEON)
+      return SimdLevel::kNEON;
+#else
+      return SimdLevel::kScalar;
+#endif
+    }
+  };
+  static const SimdLevel level = Detect::run();
+  return level;
+}
+
+inline const char *simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return "scalar";
+    case SimdLevel::kSSE42:
+      return "sse4.2";
+    case SimdLevel::kAVX2:
+      return "avx2";
+    case SimdLevel::kAVX512:
+      return "avx512f";
+    case SimdLevel::kNEON:
+      return "neon";
+  }
+  return "unknown";
+}
+
+namespace detail {
+
+template <typename T>
+struct IsArrayKernelType
+    : std::integral_constant<bool, std::is_same<T, int32_t>::value ||
+                                       std::is_same<T, int64_t>::value ||
+                                       std::is_same<T, float>::value ||
+                                       std::is_same<T, double>::value> {};
+
+// int32_t arrays are summed in 64 bits so they don't overflow.
+template <typename T>
+struct ArraySum {
+  typedef T type;
+};
+
+template <>
+struct ArraySum<int32_t> {
+  typedef int64_t type;
+};
+
+// Integer sums wrap around instead of being undefined on overflow.
+inline int64_t array_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+inline float array_add(float a, float b) { return a + b; }
+inline double array_add(double a, double b) { return a + b; }
+
+// The kernels of one instruction set for one element type.
+template <typename T>
+struct ArrayKernels {
+  static_assert(IsArrayKernelType<T>::value,
+                "array_algorithms.h supports int32_t, int64_t, float and double");
+  typedef typename ArraySum<T>::type Sum;
+
+  Sum (*sum)(const T *p, size_t n);
+  T (*min)(const T *p, size_t n);
+  T (*max)(const T *p, size_t n);
+  size_t (*count)(const T *p, size_t n, T value);
+  bool (*equals)(const T *a, const T *b, size_t n);
+  void (*gather)(const T *p, const int32_t *indices, size_t n, T *out);
+  size_t (*filter)(const T *p, const uint8_t *selection, size_t n, T *out);
+};
+
+namespace scalar_kernels {
+
+template <typename T>
+typename ArraySum<T>::type sum(const T *p, size_t n) {
+  typename ArraySum<T>::type s = 0;
+  for (size_t i = 0; i < n; i++) {
+    s = array_add(s, (typename ArraySum<T>::type)p[i]);
+  }
+  return s;
+}
+
+template <typename T, bool kMax>
+T extreme(const T *p, size_t n) {
+  T r = p[0];
+  for (size_t i = 1; i < n; i++) {
+    if (kMax ? r < p[i] : p[i] < r) {
+      r = p[i];
+    }
+  }
+  return r;
+}
+
+template <typename T>
+size_t count(const T *p, size_t n, T value) {
+  size_t c = 0;
+  for (size_t i = 0; i < n; i++) {
+    c += p[i] == value;
+  }
+  return c;
+}
+
+template <typename T>
+bool equals(const T *a, const T *b, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (!(a[i] == b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+void gather(const T *p, const int32_t *indices, size_t n, T *out) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = p[indices[i]];
+  }
+}
+
+// Branch-free: every element is written and the output position only
+// advances for the selected ones, so unpredictable selections are cheap.
+template <typename T>
+size_t filter(const T *p, const uint8_t *selection, size_t n, T *out) {
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    out[k] = p[i];
+    k += selection[i] != 0;
+  }
+  return k;
+}
+
+template <typename T>
+ArrayKernels<T> table() {
+  ArrayKernels<T> k = {&sum<T>,    &extreme<T, false>, &extreme<T, true>, &count<T>,
+                       &equals<T>, &gather<T>,         &filter<T>};
+  return k;
+}
+
+}  // namespace scalar_kernels
+
+#if defined(FOC_ARRAY_ALGORITHMS_X86) || defined(FOC_ARRAY_ALGORITHMS_NEON)
+
+// The vectorized kernels are written once against an `Ops` struct that wraps
+// the intrinsics of one instruction set for one element type:
+//
+//   Scalar, Sum           element and sum types
+//   Vector, Accumulator   a vector of elements and a vector of partial sums
+//   kLanes                number of elements in a Vector
+//   load, store, splat    unaligned memory access and broadcast
+//   zero, accumulate, combine, reduceSum
+//   min, max              lane-wise minimum and maximum
+//   countEqual, allEqual  lane-wise comparisons reduced to a count or a bool
+//   gather                (AVX2 and AVX-512 only) loads p[indices[0..kLanes)]
+//
+// GCC and Clang only inline intrinsics into functions compiled for their
+// instruction set, so the kernels are stamped out inside each target region
+// by this macro instead of being shared templates.
+#define FOC_ARRAY_KERNELS                                                                   \
+  template <class Ops>                                                                      \
+  typename Ops::Sum sum(const typename Ops::Scalar *p, size_t n) {                          \
+    typename Ops::Accumulator acc0 = Ops::zero(), acc1 = Ops::zero();                       \
+    size_t i = 0;                                                                           \
+    for (; i + 2 * Ops::kLanes <= n; i += 2 * Ops::kLanes) {                                \
+      acc0 = Ops::accumulate(acc0, Ops::load(p + i));                                       \
+      acc1 = Ops::accumulate(acc1, Ops::load(p + i + Ops::kLanes));                         \
+    }                                                                                       \
+    typename Ops::Sum s = Ops::reduceSum(Ops::combine(acc0, acc1));                         \
+    for (; i < n; i++) {                                                                    \
+      s = array_add(s, (typename Ops::Sum)p[i]);                                            \
+    }                                                                                       \
+    return s;                                                                               \
+  }                                                                                         \
+                                                                                            \
+  /* min and max are idempotent, so the last partial vector overlaps the previous one. */  \
+  template <class Ops, bool kMax>                                                           \
+  typename Ops::Scalar extreme(const typename Ops::Scalar *p, size_t n) {                   \
+    if (n < Ops::kLanes) {                                                                  \
+      return scalar_kernels::extreme<typename Ops::Scalar, kMax>(p, n);                     \
+    }                                                                                       \
+    typename Ops::Vector m = Ops::load(p);                                                  \
+    for (size_t i = Ops::kLanes; i + Ops::kLanes <= n; i += Ops::kLanes) {                  \
+      m = kMax ? Ops::max(m, Ops::load(p + i)) : Ops::min(m, Ops::load(p + i));            \
+    }                                                                                       \
+    typename Ops::Vector last = Ops::load(p + n - Ops::kLanes);                             \
+    m = kMax ? Ops::max(m, last) : Ops::min(m, last);                                       \
+    typename Ops::Scalar lanes[Ops::kLanes];                                                \
+    Ops::store(lanes, m);                                                                   \
+    return scalar_kernels::extreme<typename Ops::Scalar, kMax>(lanes, Ops::kLanes);         \
+  }                                                                                         \
+                                                                                            \
+  template <class Ops>                                                                      \
+  size_t count(const typename Ops::Scalar *p, size_t n, typename Ops::Scalar value) {       \
+    typename Ops::Vector needle = Ops::splat(value);                                        \
+    size_t c = 0;                                                                           \
+    size_t i = 0;                                                                           \
+    for (; i + Ops::kLanes <= n; i += Ops::kLanes) {                                        \
+      c += Ops::countEqual(Ops::load(p + i), needle);                                       \
+    }                                                                                       \
+    return c + scalar_kernels::count(p + i, n - i, value);                                  \
+  }                                                                                         \
+                                                                                            \
+  template <class Ops>                                                                      \
+  bool equals(const typename Ops::Scalar *a, const typename Ops::Scalar *b, size_t n) {     \
+    size_t i = 0;                                                                           \
+    for (; i + Ops::kLanes <= n; i += Ops::kLanes) {                                        \
+      if (!Ops::allEqual(Ops::load(a + i), Ops::load(b + i))) {                             \
+        return false;                                                                       \
+      }                                                                                     \
+    }                                                                                       \
+    return scalar_kernels::equals(a + i, b + i, n - i);                                     \
+  }                                                                                         \
+                                                                                            \
+  template <class Ops>                                                                      \
+  void gather(const typename Ops::Scalar *p, const int32_t *indices, size_t n,              \
+              typename Ops::Scalar *out) {                                                  \
+    size_t i = 0;                                                                           \
+    for (; i + Ops::kLanes <= n; i += Ops::kLanes) {                                        \
+      Ops::store(out + i, Ops::gather(p, indices + i));                                     \
+    }                                                                                       \
+    scalar_kernels::gather(p, indices + i, n - i, out + i);                                 \
+  }
+
+#endif  // FOC_ARRAY_ALGORITHMS_X86 || FOC_ARRAY_ALGORITHMS_NEON
+
+#if defined(FOC_ARRAY_ALGORITHMS_X86)
+
+// clang-format off
+#if defined(__clang__)
+# pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#else
+// GCC 12 reports the self-initialized "undefined" vectors in its own AVX-512
+// headers as uninitialized once they are inlined into target regions.
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wuninitialized"
+# pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+# pragma GCC push_options
+# pragma GCC target("sse4.2")
+#endif
+// clang-format on
+
+namespace sse42_kernels {
+
+template <typename T>
+struct Ops;
+
+template <>
+struct Ops<int32_t> {
+  typedef int32_t Scalar;
+  typedef int64_t Sum;
+  typedef __m128i Vector;
+  typedef __m128i Accumulator;
+  static const size_t kLanes = 4;
+
+  static Vector load(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+  static void store(int32_t *p, Vector v) { _mm_storeu_si128((__m128i *)p, v); }
+  static Vector splat(int32_t x) { return _mm_set1_epi32(x); }
+  static Accumulator zero() { return _mm_setzero_si128(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) {
+    acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(v));
+    return _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+  }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm_add_epi64(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return array_add(lanes[0], lanes[1]);
+  }
+  static Vector min(Vector a, Vector b) { return _mm_min_epi32(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm_max_epi32(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(a, b)) == 0xffff;
+  }
+};
+
+template <>
+struct Ops<int64_t> {
+  typedef int64_t Scalar;
+  typedef int64_t Sum;
+  typedef __m128i Vector;
+  typedef __m128i Accumulator;
+  static const size_t kLanes = 2;
+
+  static Vector load(const int64_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+  static void store(int64_t *p, Vector v) { _mm_storeu_si128((__m128i *)p, v); }
+  static Vector splat(int64_t x) { return _mm_set1_epi64x(x); }
+  static Accumulator zero() { return _mm_setzero_si128(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm_add_epi64(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm_add_epi64(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    int64_t lanes[2];
+    store(lanes, acc);
+    return array_add(lanes[0], lanes[1]);
+  }
+  static Vector min(Vector a, Vector b) { return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b)); }
+  static Vector max(Vector a, Vector b) { return _mm_blendv_epi8(b, a, _mm_cmpgt_epi64(a, b)); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(a, b))));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi64(a, b)) == 0xffff;
+  }
+};
+
+template <>
+struct Ops<float> {
+  typedef float Scalar;
+  typedef float Sum;
+  typedef __m128 Vector;
+  typedef __m128 Accumulator;
+  static const size_t kLanes = 4;
+
+  static Vector load(const float *p) { return _mm_loadu_ps(p); }
+  static void store(float *p, Vector v) { _mm_storeu_ps(p, v); }
+  static Vector splat(float x) { return _mm_set1_ps(x); }
+  static Accumulator zero() { return _mm_setzero_ps(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm_add_ps(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm_add_ps(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    float lanes[4];
+    store(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+  static Vector min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm_movemask_ps(_mm_cmpeq_ps(a, b)));
+  }
+  static bool allEqual(Vector a, Vector b) { return _mm_movemask_ps(_mm_cmpeq_ps(a, b)) == 0xf; }
+};
+
+template <>
+struct Ops<double> {
+  typedef double Scalar;
+  typedef double Sum;
+  typedef __m128d Vector;
+  typedef __m128d Accumulator;
+  static const size_t kLanes = 2;
+
+  static Vector load(const double *p) { return _mm_loadu_pd(p); }
+  static void store(double *p, Vector v) { _mm_storeu_pd(p, v); }
+  static Vector splat(double x) { return _mm_set1_pd(x); }
+  static Accumulator zero() { return _mm_setzero_pd(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm_add_pd(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm_add_pd(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    double lanes[2];
+    store(lanes, acc);
+    return lanes[0] + lanes[1];
+  }
+  static Vector min(Vector a, Vector b) { return _mm_min_pd(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm_max_pd(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm_movemask_pd(_mm_cmpeq_pd(a, b)));
+  }
+  static bool allEqual(Vector a, Vector b) { return _mm_movemask_pd(_mm_cmpeq_pd(a, b)) == 0x3; }
+};
+
+FOC_ARRAY_KERNELS
+
+// SSE has no gather instruction and no compress, so these use the scalar
+// kernels.
+template <typename T>
+ArrayKernels<T> table() {
+  typedef Ops<T> O;
+  ArrayKernels<T> k = {&sum<O>,    &extreme<O, false>,         &extreme<O, true>,
+                       &count<O>,  &equals<O>,                 &scalar_kernels::gather<T>,
+                       &scalar_kernels::filter<T>};
+  return k;
+}
+
+}  // namespace sse42_kernels
+
+// clang-format off
+#if defined(__clang__)
+# pragma clang attribute pop
+# pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+# pragma GCC pop_options
+# pragma GCC push_options
+# pragma GCC target("avx2")
+#endif
+// clang-format on
+
+namespace avx2_kernels {
+
+template <typename T>
+struct Ops;
+
+template <>
+struct Ops<int32_t> {
+  typedef int32_t Scalar;
+  typedef int64_t Sum;
+  typedef __m256i Vector;
+  typedef __m256i Accumulator;
+  static const size_t kLanes = 8;
+
+  static Vector load(const int32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+  static void store(int32_t *p, Vector v) { _mm256_storeu_si256((__m256i *)p, v); }
+  static Vector splat(int32_t x) { return _mm256_set1_epi32(x); }
+  static Accumulator zero() { return _mm256_setzero_si256(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) {
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm256_add_epi64(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return array_add(array_add(lanes[0], lanes[1]), array_add(lanes[2], lanes[3]));
+  }
+  static Vector min(Vector a, Vector b) { return _mm256_min_epi32(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm256_max_epi32(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, b)) == 0xffffffffu;
+  }
+  static Vector gather(const int32_t *p, const int32_t *indices) {
+    return _mm256_i32gather_epi32(p, _mm256_loadu_si256((const __m256i *)indices), 4);
+  }
+};
+
+template <>
+struct Ops<int64_t> {
+  typedef int64_t Scalar;
+  typedef int64_t Sum;
+  typedef __m256i Vector;
+  typedef __m256i Accumulator;
+  static const size_t kLanes = 4;
+
+  static Vector load(const int64_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+  static void store(int64_t *p, Vector v) { _mm256_storeu_si256((__m256i *)p, v); }
+  static Vector splat(int64_t x) { return _mm256_set1_epi64x(x); }
+  static Accumulator zero() { return _mm256_setzero_si256(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm256_add_epi64(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm256_add_epi64(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    int64_t lanes[4];
+    store(lanes, acc);
+    return array_add(array_add(lanes[0], lanes[1]), array_add(lanes[2], lanes[3]));
+  }
+  static Vector min(Vector a, Vector b) {
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+  }
+  static Vector max(Vector a, Vector b) {
+    return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+  }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b))));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi64(a, b)) == 0xffffffffu;
+  }
+  static Vector gather(const int64_t *p, const int32_t *indices) {
+    return _mm256_i32gather_epi64((const long long *)p,
+                                  _mm_loadu_si128((const __m128i *)indices), 8);
+  }
+};
+
+template <>
+struct Ops<float> {
+  typedef float Scalar;
+  typedef float Sum;
+  typedef __m256 Vector;
+  typedef __m256 Accumulator;
+  static const size_t kLanes = 8;
+
+  static Vector load(const float *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, Vector v) { _mm256_storeu_ps(p, v); }
+  static Vector splat(float x) { return _mm256_set1_ps(x); }
+  static Accumulator zero() { return _mm256_setzero_ps(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm256_add_ps(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm256_add_ps(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    __m128 v = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+  static Vector min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)) == 0xff;
+  }
+  static Vector gather(const float *p, const int32_t *indices) {
+    return _mm256_i32gather_ps(p, _mm256_loadu_si256((const __m256i *)indices), 4);
+  }
+};
+
+template <>
+struct Ops<double> {
+  typedef double Scalar;
+  typedef double Sum;
+  typedef __m256d Vector;
+  typedef __m256d Accumulator;
+  static const size_t kLanes = 4;
+
+  static Vector load(const double *p) { return _mm256_loadu_pd(p); }
+  static void store(double *p, Vector v) { _mm256_storeu_pd(p, v); }
+  static Vector splat(double x) { return _mm256_set1_pd(x); }
+  static Accumulator zero() { return _mm256_setzero_pd(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm256_add_pd(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm256_add_pd(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    double lanes[4];
+    store(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+  static Vector min(Vector a, Vector b) { return _mm256_min_pd(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm256_max_pd(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)) == 0xf;
+  }
+  static Vector gather(const double *p, const int32_t *indices) {
+    return _mm256_i32gather_pd(p, _mm_loadu_si128((const __m128i *)indices), 8);
+  }
+};
+
+FOC_ARRAY_KERNELS
+
+// AVX2 has no compress instruction, the branch-free scalar filter is faster
+// than emulating it with shuffle tables for these element sizes.
+template <typename T>
+ArrayKernels<T> table() {
+  typedef Ops<T> O;
+  ArrayKernels<T> k = {&sum<O>,   &extreme<O, false>, &extreme<O, true>,         &count<O>,
+                       &equals<O>, &gather<O>,         &scalar_kernels::filter<T>};
+  return k;
+}
+
+}  // namespace avx2_kernels
+
+// clang-format off
+#if defined(__clang__)
+# pragma clang attribute pop
+# pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#else
+# pragma GCC pop_options
+# pragma GCC push_options
+# pragma GCC target("avx512f")
+#endif
+// clang-format on
+
+namespace avx512_kernels {
+
+template <typename T>
+struct Ops;
+
+// Selection bytes are widened to one lane per byte and turned into a mask.
+// Compressing in a register and storing the whole vector is much faster
+// than a compress store to memory on some CPUs. The store may write past the
+// last selected element but never past out + n.
+
+template <>
+struct Ops<int32_t> {
+  typedef int32_t Scalar;
+  typedef int64_t Sum;
+  typedef __m512i Vector;
+  typedef __m512i Accumulator;
+  static const size_t kLanes = 16;
+
+  static Vector load(const int32_t *p) { return _mm512_loadu_si512(p); }
+  static void store(int32_t *p, Vector v) { _mm512_storeu_si512(p, v); }
+  static Vector splat(int32_t x) { return _mm512_set1_epi32(x); }
+  static Accumulator zero() { return _mm512_setzero_si512(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) {
+    acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+    return _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+  }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm512_add_epi64(a, b); }
+  static Sum reduceSum(Accumulator acc) { return _mm512_reduce_add_epi64(acc); }
+  static Vector min(Vector a, Vector b) { return _mm512_min_epi32(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm512_max_epi32(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm512_cmpeq_epi32_mask(a, b));
+  }
+  static bool allEqual(Vector a, Vector b) { return _mm512_cmpeq_epi32_mask(a, b) == 0xffff; }
+  static Vector gather(const int32_t *p, const int32_t *indices) {
+    return _mm512_i32gather_epi32(_mm512_loadu_si512(indices), p, 4);
+  }
+  static size_t compress(int32_t *out, Vector v, const uint8_t *selection) {
+    __m512i s = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)selection));
+    __mmask16 m = _mm512_test_epi32_mask(s, s);
+    _mm512_storeu_si512(out, _mm512_maskz_compress_epi32(m, v));
+    return __builtin_popcount(m);
+  }
+};
+
+template <>
+struct Ops<int64_t> {
+  typedef int64_t Scalar;
+  typedef int64_t Sum;
+  typedef __m512i Vector;
+  typedef __m512i Accumulator;
+  static const size_t kLanes = 8;
+
+  static Vector load(const int64_t *p) { return _mm512_loadu_si512(p); }
+  static void store(int64_t *p, Vector v) { _mm512_storeu_si512(p, v); }
+  static Vector splat(int64_t x) { return _mm512_set1_epi64(x); }
+  static Accumulator zero() { return _mm512_setzero_si512(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm512_add_epi64(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm512_add_epi64(a, b); }
+  static Sum reduceSum(Accumulator acc) { return _mm512_reduce_add_epi64(acc); }
+  static Vector min(Vector a, Vector b) { return _mm512_min_epi64(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm512_max_epi64(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm512_cmpeq_epi64_mask(a, b));
+  }
+  static bool allEqual(Vector a, Vector b) { return _mm512_cmpeq_epi64_mask(a, b) == 0xff; }
+  static Vector gather(const int64_t *p, const int32_t *indices) {
+    return _mm512_i32gather_epi64(_mm256_loadu_si256((const __m256i *)indices), p, 8);
+  }
+  static size_t compress(int64_t *out, Vector v, const uint8_t *selection) {
+    __m512i s = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *)selection));
+    __mmask8 m = _mm512_test_epi64_mask(s, s);
+    _mm512_storeu_si512(out, _mm512_maskz_compress_epi64(m, v));
+    return __builtin_popcount(m);
+  }
+};
+
+template <>
+struct Ops<float> {
+  typedef float Scalar;
+  typedef float Sum;
+  typedef __m512 Vector;
+  typedef __m512 Accumulator;
+  static const size_t kLanes = 16;
+
+  static Vector load(const float *p) { return _mm512_loadu_ps(p); }
+  static void store(float *p, Vector v) { _mm512_storeu_ps(p, v); }
+  static Vector splat(float x) { return _mm512_set1_ps(x); }
+  static Accumulator zero() { return _mm512_setzero_ps(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm512_add_ps(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm512_add_ps(a, b); }
+  static Sum reduceSum(Accumulator acc) { return _mm512_reduce_add_ps(acc); }
+  static Vector min(Vector a, Vector b) { return _mm512_min_ps(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm512_max_ps(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ) == 0xffff;
+  }
+  static Vector gather(const float *p, const int32_t *indices) {
+    return _mm512_i32gather_ps(_mm512_loadu_si512(indices), p, 4);
+  }
+  static size_t compress(float *out, Vector v, const uint8_t *selection) {
+    __m512i s = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)selection));
+    __mmask16 m = _mm512_test_epi32_mask(s, s);
+    _mm512_storeu_ps(out, _mm512_maskz_compress_ps(m, v));
+    return __builtin_popcount(m);
+  }
+};
+
+template <>
+struct Ops<double> {
+  typedef double Scalar;
+  typedef double Sum;
+  typedef __m512d Vector;
+  typedef __m512d Accumulator;
+  static const size_t kLanes = 8;
+
+  static Vector load(const double *p) { return _mm512_loadu_pd(p); }
+  static void store(double *p, Vector v) { _mm512_storeu_pd(p, v); }
+  static Vector splat(double x) { return _mm512_set1_pd(x); }
+  static Accumulator zero() { return _mm512_setzero_pd(); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return _mm512_add_pd(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return _mm512_add_pd(a, b); }
+  static Sum reduceSum(Accumulator acc) { return _mm512_reduce_add_pd(acc); }
+  static Vector min(Vector a, Vector b) { return _mm512_min_pd(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm512_max_pd(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return __builtin_popcount(_mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ));
+  }
+  static bool allEqual(Vector a, Vector b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ) == 0xff; }
+  static Vector gather(const double *p, const int32_t *indices) {
+    return _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)indices), p, 8);
+  }
+  static size_t compress(double *out, Vector v, const uint8_t *selection) {
+    __m512i s = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *)selection));
+    __mmask8 m = _mm512_test_epi64_mask(s, s);
+    _mm512_storeu_pd(out, _mm512_maskz_compress_pd(m, v));
+    return __builtin_popcount(m);
+  }
+};
+
+FOC_ARRAY_KERNELS
+
+template <class Ops>
+size_t filter(const typename Ops::Scalar *p, const uint8_t *selection, size_t n,
+              typename Ops::Scalar *out) {
+  size_t i = 0;
+  size_t k = 0;
+  for (; i + Ops::kLanes <= n; i += Ops::kLanes) {
+    k += Ops::compress(out + k, Ops::load(p + i), selection + i);
+  }
+  return k + scalar_kernels::filter(p + i, selection + i, n - i, out + k);
+}
+
+template <typename T>
+ArrayKernels<T> table() {
+  typedef Ops<T> O;
+  ArrayKernels<T> k = {&sum<O>,    &extreme<O, false>, &extreme<O, true>, &count<O>,
+                       &equals<O>, &gather<O>,         &filter<O>};
+  return k;
+}
+
+}  // namespace avx512_kernels
+
+// clang-format off
+#if defined(__clang__)
+# pragma clang attribute pop
+#else
+# pragma GCC pop_options
+# pragma GCC diagnostic pop
+#endif
+// clang-format on
+
+#elif defined(FOC_ARRAY_ALGORITHMS_NEON)
+
+namespace neon_kernels {
+
+template <typename T>
+struct Ops;
+
+template <>
+struct Ops<int32_t> {
+  typedef int32_t Scalar;
+  typedef int64_t Sum;
+  typedef int32x4_t Vector;
+  typedef int64x2_t Accumulator;
+  static const size_t kLanes = 4;
+
+  static Vector load(const int32_t *p) { return vld1q_s32(p); }
+  static void store(int32_t *p, Vector v) { vst1q_s32(p, v); }
+  static Vector splat(int32_t x) { return vdupq_n_s32(x); }
+  static Accumulator zero() { return vdupq_n_s64(0); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return vpadalq_s32(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return vaddq_s64(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    return array_add(vgetq_lane_s64(acc, 0), vgetq_lane_s64(acc, 1));
+  }
+  static Vector min(Vector a, Vector b) { return vminq_s32(a, b); }
+  static Vector max(Vector a, Vector b) { return vmaxq_s32(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return vaddvq_u32(vshrq_n_u32(vceqq_s32(a, b), 31));
+  }
+  static bool allEqual(Vector a, Vector b) { return vminvq_u32(vceqq_s32(a, b)) == 0xffffffffu; }
+};
+
+template <>
+struct Ops<int64_t> {
+  typedef int64_t Scalar;
+  typedef int64_t Sum;
+  typedef int64x2_t Vector;
+  typedef int64x2_t Accumulator;
+  static const size_t kLanes = 2;
+
+  static Vector load(const int64_t *p) { return vld1q_s64(p); }
+  static void store(int64_t *p, Vector v) { vst1q_s64(p, v); }
+  static Vector splat(int64_t x) { return vdupq_n_s64(x); }
+  static Accumulator zero() { return vdupq_n_s64(0); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return vaddq_s64(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return vaddq_s64(a, b); }
+  static Sum reduceSum(Accumulator acc) {
+    return array_add(vgetq_lane_s64(acc, 0), vgetq_lane_s64(acc, 1));
+  }
+  static Vector min(Vector a, Vector b) { return vbslq_s64(vcgtq_s64(a, b), b, a); }
+  static Vector max(Vector a, Vector b) { return vbslq_s64(vcgtq_s64(a, b), a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return vaddvq_u64(vshrq_n_u64(vceqq_s64(a, b), 63));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return vminvq_u32(vreinterpretq_u32_u64(vceqq_s64(a, b))) == 0xffffffffu;
+  }
+};
+
+template <>
+struct Ops<float> {
+  typedef float Scalar;
+  typedef float Sum;
+  typedef float32x4_t Vector;
+  typedef float32x4_t Accumulator;
+  static const size_t kLanes = 4;
+
+  static Vector load(const float *p) { return vld1q_f32(p); }
+  static void store(float *p, Vector v) { vst1q_f32(p, v); }
+  static Vector splat(float x) { return vdupq_n_f32(x); }
+  static Accumulator zero() { return vdupq_n_f32(0); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return vaddq_f32(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return vaddq_f32(a, b); }
+  static Sum reduceSum(Accumulator acc) { return vaddvq_f32(acc); }
+  static Vector min(Vector a, Vector b) { return vminq_f32(a, b); }
+  static Vector max(Vector a, Vector b) { return vmaxq_f32(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return vaddvq_u32(vshrq_n_u32(vceqq_f32(a, b), 31));
+  }
+  static bool allEqual(Vector a, Vector b) { return vminvq_u32(vceqq_f32(a, b)) == 0xffffffffu; }
+};
+
+template <>
+struct Ops<double> {
+  typedef double Scalar;
+  typedef double Sum;
+  typedef float64x2_t Vector;
+  typedef float64x2_t Accumulator;
+  static const size_t kLanes = 2;
+
+  static Vector load(const double *p) { return vld1q_f64(p); }
+  static void store(double *p, Vector v) { vst1q_f64(p, v); }
+  static Vector splat(double x) { return vdupq_n_f64(x); }
+  static Accumulator zero() { return vdupq_n_f64(0); }
+  static Accumulator accumulate(Accumulator acc, Vector v) { return vaddq_f64(acc, v); }
+  static Accumulator combine(Accumulator a, Accumulator b) { return vaddq_f64(a, b); }
+  static Sum reduceSum(Accumulator acc) { return vaddvq_f64(acc); }
+  static Vector min(Vector a, Vector b) { return vminq_f64(a, b); }
+  static Vector max(Vector a, Vector b) { return vmaxq_f64(a, b); }
+  static size_t countEqual(Vector a, Vector b) {
+    return vaddvq_u64(vshrq_n_u64(vceqq_f64(a, b), 63));
+  }
+  static bool allEqual(Vector a, Vector b) {
+    return vminvq_u32(vreinterpretq_u32_u64(vceqq_f64(a, b))) == 0xffffffffu;
+  }
+};
+
+FOC_ARRAY_KERNELS
+
+// NEON has no gather or compress instructions.
+template <typename T>
+ArrayKernels<T> table() {
+  typedef Ops<T> O;
+  ArrayKernels<T> k = {&sum<O>,    &extreme<O, false>,         &extreme<O, true>,
+                       &count<O>,  &equals<O>,                 &scalar_kernels::gather<T>,
+                       &scalar_kernels::filter<T>};
+  return k;
+}
+
+}  // namespace neon_kernels
+
+#endif
+
+#undef FOC_ARRAY_KERNELS
+
+/// The kernels for `level`. Levels the CPU doesn't support must not be
+/// requested, levels that weren't compiled in fall back to scalar kernels.
+template <typename T>
+ArrayKernels<T> array_kernels_for(SimdLevel level) {
+  switch (level) {
+#if defined(FOC_ARRAY_ALGORITHMS_X86)
+    case SimdLevel::kSSE42:
+      return sse42_kernels::table<T>();
+    case SimdLevel::kAVX2:
+      return avx2_kernels::table<T>();
+    case SimdLevel::kAVX512:
+      return avx512_kernels::table<T>();
+#elif defined(FOC_ARRAY_ALGORITHMS_NEON)
+    case SimdLevel::kNEON:
+      return neon_kernels::table<T>();
+#endif
+    default:
+      return scalar_kernels::table<T>();
+  }
+}
+
+/// The kernels for the best instruction set of this CPU.
+template <typename T>
+const ArrayKernels<T> &array_kernels() {
+  static const ArrayKernels<T> kernels = array_kernels_for<T>(simd_level());
+  return kernels;
+}
+
+}  // namespace detail
+
+/// @name Array Algorithms
+/// @{
+
+/// Sum of the elements. int32_t elements are summed in 64 bits and integer
+/// sums wrap around on overflow.
+template <typename T>
+typename detail::ArraySum<T>::type sum(ArrayRef<T> values) {
+  return detail::array_kernels<T>().sum(values.data(), values.size());
+}
+
+/// The smallest element. `values` must not be empty.
+template <typename T>
+T min_value(ArrayRef<T> values) {
+  assert(!values.empty());
+  return detail::array_kernels<T>().min(values.data(), values.size());
+}
+
+/// The largest element. `values` must not be empty.
+template <typename T>
+T max_value(ArrayRef<T> values) {
+  assert(!values.empty());
+  return detail::array_kernels<T>().max(values.data(), values.size());
+}
+
+/// Number of elements equal to `value`.
+template <typename T>
+size_t count(ArrayRef<T> values, T value) {
+  return detail::array_kernels<T>().count(values.data(), values.size(), value);
+}
+
+/// Element-wise equality with the semantics of operator== (NaNs are never
+/// equal, 0.0 and -0.0 are).
+template <typename T>
+bool equals(ArrayRef<T> a, ArrayRef<T> b) {
+  return a.size() == b.size() && detail::array_kernels<T>().equals(a.data(), b.data(), a.size());
+}
+
+/// out[i] = values[indices[i]] for every index. Indices must be in bounds.
+template <typename T>
+void gather(ArrayRef<T> values, ArrayRef<int32_t> indices, MutableArrayRef<T> out) {
+  assert(out.size() >= indices.size());
+  detail::array_kernels<T>().gather(values.data(), indices.data(), indices.size(), out.data());
+}
+
+/// Copies the elements whose selection byte is non-zero to the front of `out`
+/// and returns how many were copied. `out` must have room for values.size()
+/// elements since the kernels store whole vectors, and may be `values` itself
+/// to filter in place.
+template <typename T>
+size_t filter(ArrayRef<T> values, ArrayRef<uint8_t> selection, MutableArrayRef<T> out) {
+  assert(selection.size() == values.size());
+  assert(out.size() >= values.size());
+  return detail::array_kernels<T>().filter(values.data(), selection.data(), values.size(),
+                                           out.data());
+}
+
+/// @}
+
+}  // namespace foc
@@ -3,14 +3,26 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
+#include <type_traits>
 #include <vector>
 
-/* #include "llvm/ADT/Hashing.h" */
+#include "hashing.h"
 #include "none.h"
 #include "small_vector.h"
 
 namespace foc {
 
+namespace detail {
+
+/// Element types whose equality is equality of their bytes.
+template <typename T>
+struct IsBytewiseComparable
+    : std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value ||
+                                       std::is_pointer<T>::value> {};
+
+}  // namespace detail
+
 /// ArrayRef - Represent a constant reference to an array (0 or more elements
 /// consecutively in memory), i.e. a start pointer and a length.  It allows
 /// various APIs to take consecutive elements easily and conveniently.
@@ -138,12 +150,14 @@ class ArrayRef {
     return ArrayRef<T>(buffer, length);
   }
 
-  /// equals - Check for element-wise equality.
+  /// equals - Check for element-wise equality. Arrays of integers, enums and
+  /// pointers are compared with memcmp, which libc already vectorizes. See
+  /// foc::equals in array_algorithms.h for float and double arrays.
   bool equals(ArrayRef rhs) const {
     if (length != rhs.length) {
       return false;
     }
-    return std::equal(begin(), end(), rhs.begin());
+    return equalsImpl(rhs, detail::IsBytewiseComparable<T>());
   }
 
   /// slice(n) - Chop off the first n elements of the array.
@@ -190,6 +204,15 @@ class ArrayRef {
   operator std::vector<T>() const { return std::vector<T>(_data, _data + length); }
 
   /// @}
+
+ private:
+  bool equalsImpl(ArrayRef rhs, std::true_type) const {
+    return length == 0 || memcmp(_data, rhs._data, length * sizeof(T)) == 0;
+  }
+
+  bool equalsImpl(ArrayRef rhs, std::false_type) const {
+    return std::equal(begin(), end(), rhs.begin());
+  }
 };
 
 /// MutableArrayRef - Represent a mutable reference to an array (0 or more
@@ -371,11 +394,34 @@ template <typename T> struct isPodLike<ArrayRef<T> > {
 };
 */
 
-/*
-TODO(philix): bring hashing from llvm/ADT
-template <typename T> hash_code hash_value(ArrayRef<T> S) {
-  return hash_combine_range(S.begin(), S.end());
+/// @name ArrayRef Hashing
+/// @{
+
+/// Hash the contents of an ArrayRef. Arrays of integers, enums and pointers
+/// are hashed as a single byte range, other element types are hashed one by
+/// one with foc::Hash<T>.
+template <typename T>
+typename std::enable_if<detail::IsBytewiseComparable<T>::value, uint64_t>::type
+hash_value(ArrayRef<T> s) {
+  return hash_bytes(s.data(), s.size() * sizeof(T));
 }
-*/
+
+template <typename T>
+typename std::enable_if<!detail::IsBytewiseComparable<T>::value, uint64_t>::type
+hash_value(ArrayRef<T> s) {
+  Hash<T> hasher;
+  uint64_t h = hash_integer(s.size());
+  for (const T &element : s) {
+    h = hash_combine(h, hasher(element));
+  }
+  return h;
+}
+
+template <typename T>
+struct Hash<ArrayRef<T>> {
+  size_t operator()(ArrayRef<T> s) const { return (size_t)hash_value(s); }
+};
+
+/// @}
 
 }  // end namespace foc
@@ -18,6 +18,7 @@
 #include <utility>
 
 #include "allocator.h"
+#include "hashing.h"
 #include "support.h"
 
 #ifndef VISIBLE_IN_TESTS
@@ -28,16 +29,6 @@
 #endif
 #endif
 
-// This needs to be a per-execution seed to avoid denial-of-service attacks
-// and you should not rely on the same hashes being generated on different
-// runs of the program.
-//
-// Users of this library can define this macro before including the file to be
-// any expression (e.g. a function call) that returns a 64-bit seed.
-#ifndef FOC_GET_HASH_SEED
-#define FOC_GET_HASH_SEED 0xff51afd7ed558ccdULL
-#endif
-
 namespace foc {
 
 namespace detail {
@@ -217,7 +208,6 @@ class HAMTConstForwardIterator {
   HAMTConstForwardIterator(const Node *node) noexcept : _node(node) {}
   // TODO: implement HAMTForwardIterator
   // HAMTConstForwardIterator(const HAMTForwardIterator& it) noexcept : _node(it._node) {}
-  HAMTConstForwardIterator(const HAMTConstForwardIterator &it) noexcept : _node(it._node) {}
 
   reference operator*() const noexcept { return _node->asEntry(); }
   pointer operator->() const noexcept { return &_node->asEntry(); }
@@ -851,7 +841,7 @@ NodeTemplate<Entry, Allocator> *BitmapTrieTemplate<Entry, Allocator>::insertEntr
         new_base[j] = std::move(_base[j - 1]);
       }
 
-      allocator.deallocate(_base, _capacity);
+      allocator.deallocate(_base, _capacity * sizeof(Node));
       _base = new_base;
       _capacity = alloc_size;
     }
@@ -916,7 +906,7 @@ NodeTemplate<Entry, Allocator> *BitmapTrieTemplate<Entry, Allocator>::allocate(A
 template <class Entry, class Allocator>
 void BitmapTrieTemplate<Entry, Allocator>::deallocate(Allocator &allocator) {
   if (_base) {
-    allocator.deallocate(_base, _capacity);
+    allocator.deallocate(_base, _capacity * sizeof(Node));
   }
 }
 
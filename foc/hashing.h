@@ -0,0 +1,176 @@
+// Fast non-cryptographic hashing of byte ranges and integers.
+//
+// hash_bytes() is based on wyhash by Wang Yi (public domain,
+// https://github.com/wangyi-fudan/wyhash). Inputs longer than 48 bytes are
+// consumed by three independent multiply-mix lanes so the 64x64->128-bit
+// multiplications of consecutive 16-byte blocks can execute in parallel.
+//
+// foc::Hash<T> is a hash functor for the foc containers (e.g.
+// HashArrayMappedTrie). It uses these functions for integers and strings and
+// falls back to std::hash<T> for everything else. hash_value() overloads for
+// ArrayRef and StringRef live next to these classes.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+#include "support.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
+
+// This needs to be a per-execution seed to avoid denial-of-service attacks
+// and you should not rely on the same hashes being generated on different
+// runs of the program.
+//
+// Users of this library can define this macro before including the file to be
+// any expression (e.g. a function call) that returns a 64-bit seed.
+#ifndef FOC_GET_HASH_SEED
+#define FOC_GET_HASH_SEED 0xff51afd7ed558ccdULL
+#endif
+
+namespace foc {
+
+namespace detail {
+
+const uint64_t kHashSecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL};
+
+// 64x64->128-bit multiplication. `*a` receives the low half and `*b` the
+// high half.
+FOC_ATTRIBUTE_ALWAYS_INLINE inline void hash_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *a;
+  r *= *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *a = _umul128(*a, *b, b);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+FOC_ATTRIBUTE_ALWAYS_INLINE inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  hash_mum(&a, &b);
+  return a ^ b;
+}
+
+FOC_ATTRIBUTE_ALWAYS_INLINE inline uint64_t hash_read8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+FOC_ATTRIBUTE_ALWAYS_INLINE inline uint64_t hash_read4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+// Reads 1, 2 or 3 bytes.
+FOC_ATTRIBUTE_ALWAYS_INLINE inline uint64_t hash_read3(const uint8_t *p, size_t k) {
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+}  // namespace detail
+
+/// Hash `len` bytes starting at `data`.
+inline uint64_t hash_bytes(const void *data, size_t len, uint64_t seed = FOC_GET_HASH_SEED) {
+  using namespace detail;
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  const uint64_t *secret = kHashSecret;
+  seed ^= hash_mix(seed ^ secret[0], secret[1]);
+  uint64_t a, b;
+  if (FOC_LIKELY(len <= 16)) {
+    if (FOC_LIKELY(len >= 4)) {
+      a = (hash_read4(p) << 32) | hash_read4(p + ((len >> 3) << 2));
+      b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - ((len >> 3) << 2));
+    } else if (FOC_LIKELY(len > 0)) {
+      a = hash_read3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (FOC_UNLIKELY(i > 48)) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = hash_mix(hash_read8(p) ^ secret[1], hash_read8(p + 8) ^ seed);
+        see1 = hash_mix(hash_read8(p + 16) ^ secret[2], hash_read8(p + 24) ^ see1);
+        see2 = hash_mix(hash_read8(p + 32) ^ secret[3], hash_read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (FOC_LIKELY(i > 48));
+      seed ^= see1 ^ see2;
+    }
+    while (FOC_UNLIKELY(i > 16)) {
+      seed = hash_mix(hash_read8(p) ^ secret[1], hash_read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = hash_read8(p + i - 16);
+    b = hash_read8(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= seed;
+  hash_mum(&a, &b);
+  return hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+/// Hash a single integer. Unlike std::hash, every bit of the result depends on
+/// every bit of the input, which matters for HashArrayMappedTrie since it
+/// consumes the hash 5 bits at a time.
+inline uint64_t hash_integer(uint64_t value, uint64_t seed = FOC_GET_HASH_SEED) {
+  return detail::hash_mix(value ^ detail::kHashSecret[0], seed ^ detail::kHashSecret[1]);
+}
+
+/// Combine two hash values.
+inline uint64_t hash_combine(uint64_t seed, uint64_t value) {
+  return detail::hash_mix(seed ^ detail::kHashSecret[2], value ^ detail::kHashSecret[3]);
+}
+
+inline uint64_t hash_value(const std::string &s) { return hash_bytes(s.data(), s.size()); }
+
+namespace detail {
+
+template <typename T, typename Enable = void>
+struct HashImpl {
+  size_t operator()(const T &value) const { return std::hash<T>()(value); }
+};
+
+template <typename T>
+struct HashImpl<T,
+                typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value ||
+                                        std::is_pointer<T>::value>::type> {
+  size_t operator()(T value) const { return (size_t)hash_integer((uint64_t)(uintptr_t)value); }
+};
+
+}  // namespace detail
+
+/// Hash functor that can be passed as the Hash parameter of the foc
+/// containers. Specializations for ArrayRef and StringRef are defined in
+/// array_ref.h and string_ref.h.
+template <typename T>
+struct Hash : detail::HashImpl<T> {};
+
+template <>
+struct Hash<std::string> {
+  size_t operator()(const std::string &s) const { return (size_t)hash_value(s); }
+};
+
+}  // namespace foc
@@ -44,6 +44,7 @@
 
 #ifdef FOC_LOGGING_IMPLEMENTATION
 # include <vector>
+# include "string_ref.h"
 #endif
 
 #if defined(FOC_OS_POSIX) || defined(FOC_OS_FUCHSIA)
@@ -2267,19 +2268,12 @@ LogMessage::~LogMessage() {
 
 // writes the common header info to the stream
 void LogMessage::Init(const char* file, int line) {
-  // Find last \ or / and change file to be only the suffix after \ or /
-  const size_t len = strlen(file);
-  const char *p = (file + len) - 1;
-  for (; p > file; p--) {
-    if (*p == '\\' || *p == '/') {
-      file = p + 1;
-      break;
-    }
+  // Change file to be only the suffix after the last \ or /
+  StringRef filename(file);
+  size_t last_slash_pos = filename.find_last_of("\\/");
+  if (last_slash_pos != StringRef::npos) {
+    file += last_slash_pos + 1;
   }
-  /* base::StringPiece filename(file); */
-  /* size_t last_slash_pos = filename.find_last_of("\\/"); */
-  /* if (last_slash_pos != base::StringPiece::npos) */
-  /*   filename.remove_prefix(last_slash_pos + 1); */
 
   // TODO(darin): It might be nice if the columns were fixed width.
 
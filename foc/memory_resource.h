@@ -0,0 +1,134 @@
+// Bridges between foc allocators and std::pmr::memory_resource.
+//
+// MemoryResourceAllocator is a foc allocator that forwards to a
+// memory_resource, and AllocatorMemoryResource<Allocator> is a
+// memory_resource that forwards to a foc allocator. Together they let a single
+// per-request arena serve std::pmr containers and foc containers like
+// HashArrayMappedTrie:
+//
+//   std::pmr::monotonic_buffer_resource arena(64 * 1024);
+//   std::pmr::vector<int64_t> ids(&arena);
+//   HashArrayMappedTrie<int64_t, int64_t, std::hash<int64_t>, std::equal_to<int64_t>,
+//                       MemoryResourceAllocator> index(MemoryResourceAllocator(&arena));
+//
+// std::pmr requires C++17. FOC_HAS_MEMORY_RESOURCE is defined to 0 and this
+// header is empty when <memory_resource> isn't available.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "allocator.h"
+#include "support.h"
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#define FOC_HAS_MEMORY_RESOURCE 1
+#endif
+#endif
+#ifndef FOC_HAS_MEMORY_RESOURCE
+#define FOC_HAS_MEMORY_RESOURCE 0
+#endif
+
+#if FOC_HAS_MEMORY_RESOURCE
+
+#include <memory_resource>
+#include <new>
+
+namespace foc {
+
+// A foc allocator that allocates from a std::pmr::memory_resource.
+//
+// foc allocators don't pass the alignment to deallocate(), but memory
+// resources expect the same alignment in both calls. Every block is allocated
+// with alignof(std::max_align_t), which is enough for all the containers in
+// foc.
+class MemoryResourceAllocator {
+ public:
+  static constexpr size_t kAlignment = alignof(std::max_align_t);
+
+  MemoryResourceAllocator() noexcept : _resource(std::pmr::get_default_resource()) {}
+  /*implicit*/ MemoryResourceAllocator(std::pmr::memory_resource *resource) noexcept
+      : _resource(resource) {
+    assert(resource);
+  }
+
+  // Returns nullptr when the memory resource throws std::bad_alloc.
+  void *allocate(size_t size, size_t alignment) {
+    assert(alignment <= kAlignment && "Over-aligned allocations are not supported");
+    try {
+      return _resource->allocate(size, kAlignment);
+    } catch (const std::bad_alloc &) {
+      return nullptr;
+    }
+  }
+
+  void deallocate(void *ptr, size_t size) { _resource->deallocate(ptr, size, kAlignment); }
+
+  std::pmr::memory_resource *resource() const { return _resource; }
+
+  friend bool operator==(const MemoryResourceAllocator &a, const MemoryResourceAllocator &b) {
+    return a._resource == b._resource || a._resource->is_equal(*b._resource);
+  }
+
+  friend bool operator!=(const MemoryResourceAllocator &a, const MemoryResourceAllocator &b) {
+    return !(a == b);
+  }
+
+ private:
+  std::pmr::memory_resource *_resource;
+};
+
+// A std::pmr::memory_resource that allocates from a foc allocator, so
+// std::pmr containers can share an ObjectPool, an arena or any other foc
+// allocator with foc containers.
+template <class Allocator>
+class AllocatorMemoryResource : public std::pmr::memory_resource {
+ public:
+  AllocatorMemoryResource() = default;
+  explicit AllocatorMemoryResource(const Allocator &allocator) : _allocator(allocator) {}
+
+  Allocator &allocator() { return _allocator; }
+  const Allocator &allocator() const { return _allocator; }
+
+ private:
+  // foc allocators are only required to honor fundamental alignments. Larger
+  // alignments are satisfied by over-allocating and keeping the original
+  // pointer right before the aligned block.
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    if (FOC_LIKELY(alignment <= alignof(std::max_align_t))) {
+      void *ptr = _allocator.allocate(bytes, alignment);
+      if (FOC_UNLIKELY(ptr == nullptr)) {
+        throw std::bad_alloc();
+      }
+      return ptr;
+    }
+    void *ptr = _allocator.allocate(bytes + alignment + sizeof(void *), alignof(void *));
+    if (FOC_UNLIKELY(ptr == nullptr)) {
+      throw std::bad_alloc();
+    }
+    void *aligned = reinterpret_cast<void *>(
+        align_addr(static_cast<char *>(ptr) + sizeof(void *), alignment));
+    static_cast<void **>(aligned)[-1] = ptr;
+    return aligned;
+  }
+
+  void do_deallocate(void *ptr, size_t bytes, size_t alignment) override {
+    if (FOC_LIKELY(alignment <= alignof(std::max_align_t))) {
+      _allocator.deallocate(ptr, bytes);
+    } else {
+      _allocator.deallocate(static_cast<void **>(ptr)[-1], bytes + alignment + sizeof(void *));
+    }
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+  Allocator _allocator;
+};
+
+}  // namespace foc
+
+#endif  // FOC_HAS_MEMORY_RESOURCE
@@ -0,0 +1,95 @@
+// Intrusive lock-free multi-producer single-consumer queue.
+//
+// Based on Dmitry Vyukov's non-intrusive MPSC node-based queue
+// (http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue).
+// push() is wait-free: a single atomic exchange. pop() is lock-free but can
+// report an empty queue while a push() is halfway done, so consumers must
+// not treat nullptr as proof that nothing was pushed. Pair the queue with a
+// counter or a wakeup protocol when that matters.
+//
+//   struct Task : foc::MpscNode {
+//     int id;
+//   };
+//
+//   foc::MpscQueue<Task> queue;
+//   queue.push(new Task());       // any thread
+//   while (Task *task = queue.pop()) {  // the consumer thread
+//     ...
+//   }
+#pragma once
+
+#include <atomic>
+
+#include "support.h"
+
+namespace foc {
+
+/// Base class of the elements of an MpscQueue.
+struct MpscNode {
+  std::atomic<MpscNode *> mpsc_next;
+};
+
+/// T must derive from MpscNode. The queue doesn't own the elements, the
+/// destructor doesn't free the elements still in the queue.
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() : _head(&_stub), _tail(&_stub) { _stub.mpsc_next.store(nullptr); }
+
+  /// Can be called from any thread.
+  void push(T *element) { pushNode(static_cast<MpscNode *>(element)); }
+
+  /// Must only be called from the consumer thread. Returns nullptr if the
+  /// queue is empty or the oldest push() hasn't finished yet.
+  T *pop() {
+    MpscNode *tail = _tail;
+    MpscNode *next = tail->mpsc_next.load(std::memory_order_acquire);
+    if (tail == &_stub) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      _tail = next;
+      tail = next;
+      next = next->mpsc_next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      _tail = next;
+      return static_cast<T *>(tail);
+    }
+    if (tail != _head.load(std::memory_order_acquire)) {
+      // A producer swapped _head but hasn't linked its node yet.
+      return nullptr;
+    }
+    // `tail` is the last node. Push the stub behind it so it can be unlinked.
+    pushNode(&_stub);
+    next = tail->mpsc_next.load(std::memory_order_acquire);
+    if (next) {
+      _tail = next;
+      return static_cast<T *>(tail);
+    }
+    return nullptr;
+  }
+
+  /// Must only be called from the consumer thread.
+  bool empty() const {
+    return _tail == &_stub && _stub.mpsc_next.load(std::memory_order_acquire) == nullptr &&
+           _head.load(std::memory_order_acquire) == &_stub;
+  }
+
+ private:
+  void pushNode(MpscNode *node) {
+    node->mpsc_next.store(nullptr, std::memory_order_relaxed);
+    MpscNode *prev = _head.exchange(node, std::memory_order_acq_rel);
+    prev->mpsc_next.store(node, std::memory_order_release);
+  }
+
+  // Producers push at the head and the consumer pops from the tail. They are
+  // on different cache lines so producers don't invalidate the consumer's.
+  alignas(64) std::atomic<MpscNode *> _head;
+  alignas(64) MpscNode *_tail;
+  MpscNode _stub;
+
+  FOC_DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace foc
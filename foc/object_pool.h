@@ -0,0 +1,412 @@
+// Object pools for fixed-size objects.
+//
+// ObjectPool<T> carves objects out of large slabs and recycles destroyed
+// objects through an intrusive free list (the storage of a dead object holds
+// the link to the next free slot), so creating and destroying objects in a
+// steady state never touches the system allocator.
+//
+// SharedObjectPool<T> is the thread-safe version. It hands out and takes back
+// free slots in batches so that LocalObjectPool<T>, a per-thread cache meant to
+// be kept in a thread_local variable, only takes the lock once every
+// `batch_size` operations.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#include "allocator.h"
+#include "support.h"
+
+namespace foc {
+
+namespace detail {
+
+// The storage of a free slot is reused to link it into a free list.
+struct PoolFreeSlot {
+  PoolFreeSlot *next;
+};
+
+// Slot size and alignment for objects of type T. A slot must be able to hold
+// either a T or a PoolFreeSlot.
+template <typename T>
+struct PoolSlotLayout {
+  static constexpr size_t alignment =
+      alignof(T) > alignof(PoolFreeSlot) ? alignof(T) : alignof(PoolFreeSlot);
+  static constexpr size_t min_size =
+      sizeof(T) > sizeof(PoolFreeSlot) ? sizeof(T) : sizeof(PoolFreeSlot);
+  static constexpr size_t size = (min_size + alignment - 1) & ~(alignment - 1);
+};
+
+template <typename T>
+constexpr size_t PoolSlotLayout<T>::alignment;
+template <typename T>
+constexpr size_t PoolSlotLayout<T>::min_size;
+template <typename T>
+constexpr size_t PoolSlotLayout<T>::size;
+
+// Bump allocator of fixed-size slots backed by a linked list of slabs. Slots
+// are never returned to the arena, the pools keep them in free lists instead.
+// All slabs are released when the arena is destroyed.
+template <class Allocator>
+class SlabArena {
+ private:
+  struct Slab {
+    Slab *next;
+    size_t size_in_bytes;
+  };
+
+  Slab *_slabs;
+  char *_cursor;
+  char *_end;
+  size_t _slot_size;
+  size_t _slot_alignment;
+  size_t _slots_per_slab;
+  size_t _num_slabs;
+  Allocator _allocator;
+
+ public:
+  SlabArena(size_t slot_size,
+            size_t slot_alignment,
+            size_t slots_per_slab,
+            const Allocator &allocator)
+      : _slabs(nullptr),
+        _cursor(nullptr),
+        _end(nullptr),
+        _slot_size(slot_size),
+        _slot_alignment(slot_alignment),
+        _slots_per_slab(slots_per_slab > 0 ? slots_per_slab : 1),
+        _num_slabs(0),
+        _allocator(allocator) {
+    assert(is_power_of2_64(slot_alignment) && "alignment is not a power of two!");
+  }
+
+  ~SlabArena() noexcept {
+    Slab *slab = _slabs;
+    while (slab) {
+      Slab *next = slab->next;
+      _allocator.deallocate(slab, slab->size_in_bytes);
+      slab = next;
+    }
+  }
+
+  FOC_DISALLOW_COPY_AND_ASSIGN(SlabArena);
+
+  // Returns nullptr if the underlying allocator fails.
+  FOC_ATTRIBUTE_ALWAYS_INLINE
+  void *allocateSlot() {
+    if (FOC_UNLIKELY(_cursor == _end)) {
+      if (!grow()) {
+        return nullptr;
+      }
+    }
+    void *slot = _cursor;
+    _cursor += _slot_size;
+    return slot;
+  }
+
+  size_t numSlabs() const { return _num_slabs; }
+  size_t slotsPerSlab() const { return _slots_per_slab; }
+
+ private:
+  FOC_ATTRIBUTE_NOINLINE bool grow() {
+    // Over-allocate so the first slot can be aligned regardless of the
+    // alignment guarantees of the underlying allocator.
+    size_t size_in_bytes = sizeof(Slab) + _slot_alignment + _slots_per_slab * _slot_size;
+    void *ptr = _allocator.allocate(size_in_bytes, alignof(Slab));
+    if (ptr == nullptr) {
+      return false;
+    }
+    Slab *slab = static_cast<Slab *>(ptr);
+    slab->next = _slabs;
+    slab->size_in_bytes = size_in_bytes;
+    _slabs = slab;
+    _num_slabs++;
+
+    _cursor = reinterpret_cast<char *>(align_addr(slab + 1, _slot_alignment));
+    _end = _cursor + _slots_per_slab * _slot_size;
+    return true;
+  }
+};
+
+}  // namespace detail
+
+// Single-threaded pool of objects of type T.
+//
+// All objects created by the pool must be destroyed through the pool before
+// the pool itself is destroyed.
+template <typename T, class Allocator = MallocAllocator>
+class ObjectPool {
+ private:
+  using Layout = detail::PoolSlotLayout<T>;
+  using FreeSlot = detail::PoolFreeSlot;
+
+  detail::SlabArena<Allocator> _arena;
+  FreeSlot *_free_list;
+  size_t _num_live_objects;
+
+ public:
+  explicit ObjectPool(size_t objects_per_slab = 64, const Allocator &allocator = Allocator())
+      : _arena(Layout::size, Layout::alignment, objects_per_slab, allocator),
+        _free_list(nullptr),
+        _num_live_objects(0) {}
+
+  ~ObjectPool() noexcept { assert(_num_live_objects == 0 && "Objects outlived their pool"); }
+
+  FOC_DISALLOW_COPY_AND_ASSIGN(ObjectPool);
+
+  // Returns nullptr if memory for a new slab could not be allocated.
+  template <typename... Args>
+  T *create(Args &&... args) {
+    void *slot = allocate();
+    if (FOC_UNLIKELY(slot == nullptr)) {
+      return nullptr;
+    }
+    return new (slot) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T *object) {
+    if (object) {
+      object->~T();
+      deallocate(object);
+    }
+  }
+
+  // Raw slot API. The memory returned by allocate() is suitable for a T but
+  // no constructor is run.
+
+  FOC_ATTRIBUTE_ALWAYS_INLINE
+  void *allocate() {
+    void *slot;
+    if (FOC_LIKELY(_free_list != nullptr)) {
+      slot = _free_list;
+      _free_list = _free_list->next;
+    } else {
+      slot = _arena.allocateSlot();
+      if (FOC_UNLIKELY(slot == nullptr)) {
+        return nullptr;
+      }
+    }
+    _num_live_objects++;
+    return slot;
+  }
+
+  FOC_ATTRIBUTE_ALWAYS_INLINE
+  void deallocate(void *ptr) {
+    assert(ptr);
+    assert(_num_live_objects > 0);
+    FreeSlot *slot = static_cast<FreeSlot *>(ptr);
+    slot->next = _free_list;
+    _free_list = slot;
+    _num_live_objects--;
+  }
+
+  size_t numLiveObjects() const { return _num_live_objects; }
+  size_t numSlabs() const { return _arena.numSlabs(); }
+  size_t capacity() const { return _arena.numSlabs() * _arena.slotsPerSlab(); }
+};
+
+// Thread-safe pool of objects of type T.
+//
+// Threads that create and destroy objects at a high rate should go through a
+// LocalObjectPool instead of calling create()/destroy() directly.
+template <typename T, class Allocator = MallocAllocator>
+class SharedObjectPool {
+ private:
+  using Layout = detail::PoolSlotLayout<T>;
+  using FreeSlot = detail::PoolFreeSlot;
+
+  std::mutex _mutex;
+  detail::SlabArena<Allocator> _arena;
+  FreeSlot *_free_list;
+  size_t _num_live_objects;
+
+ public:
+  explicit SharedObjectPool(size_t objects_per_slab = 1024,
+                            const Allocator &allocator = Allocator())
+      : _arena(Layout::size, Layout::alignment, objects_per_slab, allocator),
+        _free_list(nullptr),
+        _num_live_objects(0) {}
+
+  ~SharedObjectPool() noexcept {
+    assert(_num_live_objects == 0 && "Objects (or LocalObjectPools) outlived their pool");
+  }
+
+  FOC_DISALLOW_COPY_AND_ASSIGN(SharedObjectPool);
+
+  template <typename... Args>
+  T *create(Args &&... args) {
+    void *slot = allocate();
+    if (FOC_UNLIKELY(slot == nullptr)) {
+      return nullptr;
+    }
+    return new (slot) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T *object) {
+    if (object) {
+      object->~T();
+      deallocate(object);
+    }
+  }
+
+  void *allocate() {
+    FreeSlot *slot = nullptr;
+    allocateBatch(1, &slot);
+    return slot;
+  }
+
+  void deallocate(void *ptr) {
+    assert(ptr);
+    FreeSlot *slot = static_cast<FreeSlot *>(ptr);
+    slot->next = nullptr;
+    deallocateBatch(slot, slot, 1);
+  }
+
+  // Pops up to `n` slots and returns them as a nullptr-terminated list in
+  // `*head`. Returns the number of slots in the list, which is less than `n`
+  // only when the underlying allocator fails.
+  size_t allocateBatch(size_t n, detail::PoolFreeSlot **head) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    FreeSlot *list = nullptr;
+    size_t count = 0;
+    while (count < n) {
+      FreeSlot *slot = _free_list;
+      if (slot) {
+        _free_list = slot->next;
+      } else {
+        slot = static_cast<FreeSlot *>(_arena.allocateSlot());
+        if (FOC_UNLIKELY(slot == nullptr)) {
+          break;
+        }
+      }
+      slot->next = list;
+      list = slot;
+      count++;
+    }
+    _num_live_objects += count;
+    *head = list;
+    return count;
+  }
+
+  // Pushes a list of `n` slots going from `head` to `tail` back into the pool.
+  void deallocateBatch(detail::PoolFreeSlot *head, detail::PoolFreeSlot *tail, size_t n) {
+    assert(head && tail && n > 0);
+    std::lock_guard<std::mutex> lock(_mutex);
+    assert(_num_live_objects >= n);
+    tail->next = _free_list;
+    _free_list = head;
+    _num_live_objects -= n;
+  }
+
+  // Number of slots that are either holding a live object or cached in a
+  // LocalObjectPool.
+  size_t numLiveObjects() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _num_live_objects;
+  }
+
+  size_t numSlabs() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _arena.numSlabs();
+  }
+};
+
+// A single-threaded cache of free slots in front of a SharedObjectPool.
+//
+// Slots are taken from the shared pool `batch_size` at a time and given back
+// in batches of the same size once more than 2 * `batch_size` slots are free
+// locally. Objects can be destroyed through a different LocalObjectPool than
+// the one that created them as long as both sit on the same SharedObjectPool.
+//
+//   SharedObjectPool<LogRecord> g_record_pool;
+//   thread_local LocalObjectPool<LogRecord> t_record_pool(g_record_pool);
+template <typename T, class Allocator = MallocAllocator>
+class LocalObjectPool {
+ private:
+  using FreeSlot = detail::PoolFreeSlot;
+
+  SharedObjectPool<T, Allocator> &_shared;
+  FreeSlot *_free_list;
+  size_t _num_free;
+  size_t _batch_size;
+
+ public:
+  explicit LocalObjectPool(SharedObjectPool<T, Allocator> &shared, size_t batch_size = 32)
+      : _shared(shared), _free_list(nullptr), _num_free(0), _batch_size(batch_size) {
+    assert(batch_size > 0);
+  }
+
+  ~LocalObjectPool() noexcept {
+    if (_num_free > 0) {
+      FreeSlot *tail = _free_list;
+      while (tail->next) {
+        tail = tail->next;
+      }
+      _shared.deallocateBatch(_free_list, tail, _num_free);
+    }
+  }
+
+  FOC_DISALLOW_COPY_AND_ASSIGN(LocalObjectPool);
+
+  template <typename... Args>
+  T *create(Args &&... args) {
+    void *slot = allocate();
+    if (FOC_UNLIKELY(slot == nullptr)) {
+      return nullptr;
+    }
+    return new (slot) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T *object) {
+    if (object) {
+      object->~T();
+      deallocate(object);
+    }
+  }
+
+  FOC_ATTRIBUTE_ALWAYS_INLINE
+  void *allocate() {
+    if (FOC_UNLIKELY(_free_list == nullptr)) {
+      _num_free = _shared.allocateBatch(_batch_size, &_free_list);
+      if (FOC_UNLIKELY(_free_list == nullptr)) {
+        return nullptr;
+      }
+    }
+    FreeSlot *slot = _free_list;
+    _free_list = slot->next;
+    _num_free--;
+    return slot;
+  }
+
+  FOC_ATTRIBUTE_ALWAYS_INLINE
+  void deallocate(void *ptr) {
+    assert(ptr);
+    FreeSlot *slot = static_cast<FreeSlot *>(ptr);
+    slot->next = _free_list;
+    _free_list = slot;
+    _num_free++;
+    if (FOC_UNLIKELY(_num_free > 2 * _batch_size)) {
+      releaseBatch();
+    }
+  }
+
+  size_t numCachedSlots() const { return _num_free; }
+
+ private:
+  FOC_ATTRIBUTE_NOINLINE void releaseBatch() {
+    FreeSlot *head = _free_list;
+    FreeSlot *tail = head;
+    for (size_t i = 1; i < _batch_size; i++) {
+      tail = tail->next;
+    }
+    _free_list = tail->next;
+    _num_free -= _batch_size;
+    _shared.deallocateBatch(head, tail, _batch_size);
+  }
+};
+
+}  // namespace foc
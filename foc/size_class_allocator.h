@@ -0,0 +1,153 @@
+// Thread-caching allocator of small blocks.
+//
+// Sizes up to kMaxSize bytes are rounded up to a power of two (a size class)
+// and served by one SharedObjectPool per size class, with a LocalObjectPool
+// per thread in front of each. Allocating and freeing in a steady state only
+// pops and pushes thread-local free lists. Larger sizes go to malloc().
+//
+// SizeClassAllocator has no state of its own and follows the foc allocator
+// interface (see allocator.h), so it can be passed by value to containers:
+//
+//   foc::HashArrayMappedTrie<K, V, foc::Hash<K>, foc::SizeClassAllocator> map;
+//
+// Memory freed to a size class is kept for reuse by that size class and is
+// never returned to the system.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+
+#include "object_pool.h"
+#include "support.h"
+
+namespace foc {
+
+namespace detail {
+
+template <size_t Size>
+struct alignas(16) SizeClassBlock {
+  unsigned char bytes[Size];
+};
+
+// The blocks of one size class.
+template <size_t Size>
+class SizeClass {
+ private:
+  typedef SizeClassBlock<Size> Block;
+
+  enum ThreadState { kUnused, kAlive, kDestroyed };
+
+  struct ThreadCache {
+    LocalObjectPool<Block> pool;
+
+    ThreadCache() : pool(shared()) { state() = kAlive; }
+    // `pool` returns the cached blocks after this.
+    ~ThreadCache() { state() = kDestroyed; }
+  };
+
+  // Never destroyed: blocks can still be freed by static and thread_local
+  // destructors that run after it would be.
+  static SharedObjectPool<Block> &shared() {
+    static SharedObjectPool<Block> *pool =
+        new SharedObjectPool<Block>(Size < 4096 ? 65536 / Size : 16);
+    return *pool;
+  }
+
+  // Trivially destructible, so it can be read during thread exit to tell if
+  // the cache was destroyed already.
+  static int &state() {
+    static thread_local int thread_state = kUnused;
+    return thread_state;
+  }
+
+  static ThreadCache &cache() {
+    static thread_local ThreadCache thread_cache;
+    return thread_cache;
+  }
+
+ public:
+  static void *allocate() {
+    if (FOC_UNLIKELY(state() == kDestroyed)) {
+      return shared().allocate();
+    }
+    return cache().pool.allocate();
+  }
+
+  static void deallocate(void *ptr) {
+    if (FOC_UNLIKELY(state() == kDestroyed)) {
+      shared().deallocate(ptr);
+      return;
+    }
+    cache().pool.deallocate(ptr);
+  }
+};
+
+}  // namespace detail
+
+class SizeClassAllocator {
+ public:
+  static const size_t kMinSize = 16;
+  static const size_t kMaxSize = 4096;
+  static const size_t kNumSizeClasses = 9;
+  // Alignment of every block. Blocks larger than kMaxSize get malloc()'s.
+  static const size_t kAlignment = 16;
+
+  // Index of the size class of `size`, which must be at most kMaxSize.
+  static size_t sizeClass(size_t size) {
+    assert(size <= kMaxSize);
+    if (size <= kMinSize) {
+      return 0;
+    }
+    // ceil(log2(size)) - log2(kMinSize)
+    return (sizeof(unsigned long long) * 8 - __builtin_clzll(size - 1)) - 4;
+  }
+
+  // The usable size of a block allocated for `size` bytes.
+  static size_t roundUp(size_t size) {
+    return size > kMaxSize ? size : kMinSize << sizeClass(size);
+  }
+
+  void *allocate(size_t size, size_t alignment = kAlignment) {
+    assert(alignment <= kAlignment && "SizeClassAllocator can't align to more than 16 bytes");
+    (void)alignment;
+    if (size > kMaxSize) {
+      return malloc(size);
+    }
+    switch (sizeClass(size)) {
+      case 0: return detail::SizeClass<16>::allocate();
+      case 1: return detail::SizeClass<32>::allocate();
+      case 2: return detail::SizeClass<64>::allocate();
+      case 3: return detail::SizeClass<128>::allocate();
+      case 4: return detail::SizeClass<256>::allocate();
+      case 5: return detail::SizeClass<512>::allocate();
+      case 6: return detail::SizeClass<1024>::allocate();
+      case 7: return detail::SizeClass<2048>::allocate();
+      default: return detail::SizeClass<4096>::allocate();
+    }
+  }
+
+  // `size` must be the size passed to allocate().
+  void deallocate(void *ptr, size_t size) {
+    if (ptr == nullptr) {
+      return;
+    }
+    if (size > kMaxSize) {
+      free(ptr);
+      return;
+    }
+    switch (sizeClass(size)) {
+      case 0: detail::SizeClass<16>::deallocate(ptr); break;
+      case 1: detail::SizeClass<32>::deallocate(ptr); break;
+      case 2: detail::SizeClass<64>::deallocate(ptr); break;
+      case 3: detail::SizeClass<128>::deallocate(ptr); break;
+      case 4: detail::SizeClass<256>::deallocate(ptr); break;
+      case 5: detail::SizeClass<512>::deallocate(ptr); break;
+      case 6: detail::SizeClass<1024>::deallocate(ptr); break;
+      case 7: detail::SizeClass<2048>::deallocate(ptr); break;
+      default: detail::SizeClass<4096>::deallocate(ptr); break;
+    }
+  }
+};
+
+}  // namespace foc
@@ -0,0 +1,570 @@
+// String Reference.  Based on llvm/ADT/StringRef.h
+//
+// StringRef is an ArrayRef<char> with string operations. The byte searches
+// (find, rfind, find_first_of, find_last_of and split) are vectorized with
+// SSE2, AVX2 or NEON. The instruction set is chosen at compile time: SSE2 is
+// always available on x86-64, AVX2 is used when compiling with -mavx2 (or
+// -march=native on a machine that supports it).
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "array_ref.h"
+#include "hashing.h"
+#include "small_vector.h"
+#include "support.h"
+
+// clang-format off
+#if defined(FOC_ARCH_CPU_X86_FAMILY) && defined(__AVX2__)
+# include <immintrin.h>
+# define FOC_STRING_REF_AVX2 1
+#elif defined(FOC_ARCH_CPU_X86_FAMILY) && (defined(__SSE2__) || defined(_M_X64))
+# include <emmintrin.h>
+# define FOC_STRING_REF_SSE2 1
+#elif defined(FOC_ARCH_CPU_ARM64) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define FOC_STRING_REF_NEON 1
+#endif
+// clang-format on
+
+namespace foc {
+
+namespace detail {
+
+// Byte vector operations used by the string search functions. `Mask` is the
+// result of a vector comparison packed in an integer.
+
+#if defined(FOC_STRING_REF_AVX2)
+
+struct ByteVector {
+  typedef __m256i Vector;
+  typedef uint32_t Mask;
+  static const size_t kWidth = 32;
+
+  static Vector load(const char *p) { return _mm256_loadu_si256((const __m256i *)p); }
+  static Vector splat(char c) { return _mm256_set1_epi8(c); }
+  static Vector eq(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+  static Vector any(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+  static Vector both(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+  static Mask mask(Vector v) { return (Mask)_mm256_movemask_epi8(v); }
+  static size_t firstIndex(Mask m) { return __builtin_ctz(m); }
+  static size_t lastIndex(Mask m) { return 31 - __builtin_clz(m); }
+  static Mask clearFirst(Mask m) { return m & (m - 1); }
+};
+
+#elif defined(FOC_STRING_REF_SSE2)
+
+struct ByteVector {
+  typedef __m128i Vector;
+  typedef uint32_t Mask;
+  static const size_t kWidth = 16;
+
+  static Vector load(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+  static Vector splat(char c) { return _mm_set1_epi8(c); }
+  static Vector eq(Vector a, Vector b) { return _mm_cmpeq_epi8(a, b); }
+  static Vector any(Vector a, Vector b) { return _mm_or_si128(a, b); }
+  static Vector both(Vector a, Vector b) { return _mm_and_si128(a, b); }
+  static Mask mask(Vector v) { return (Mask)_mm_movemask_epi8(v); }
+  static size_t firstIndex(Mask m) { return __builtin_ctz(m); }
+  static size_t lastIndex(Mask m) { return 31 - __builtin_clz(m); }
+  static Mask clearFirst(Mask m) { return m & (m - 1); }
+};
+
+#elif defined(FOC_STRING_REF_NEON)
+
+// NEON has no movemask. Narrowing each 16-bit lane by 4 bits packs the
+// comparison result in a 64-bit mask with 4 bits per byte.
+struct ByteVector {
+  typedef uint8x16_t Vector;
+  typedef uint64_t Mask;
+  static const size_t kWidth = 16;
+
+  static Vector load(const char *p) { return vld1q_u8((const uint8_t *)p); }
+  static Vector splat(char c) { return vdupq_n_u8((uint8_t)c); }
+  static Vector eq(Vector a, Vector b) { return vceqq_u8(a, b); }
+  static Vector any(Vector a, Vector b) { return vorrq_u8(a, b); }
+  static Vector both(Vector a, Vector b) { return vandq_u8(a, b); }
+  static Mask mask(Vector v) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+  }
+  static size_t firstIndex(Mask m) { return __builtin_ctzll(m) / 4; }
+  static size_t lastIndex(Mask m) { return (63 - __builtin_clzll(m)) / 4; }
+  static Mask clearFirst(Mask m) { return m & ~((Mask)0xf << (firstIndex(m) * 4)); }
+};
+
+#endif
+
+#if defined(FOC_STRING_REF_AVX2) || defined(FOC_STRING_REF_SSE2) || defined(FOC_STRING_REF_NEON)
+#define FOC_STRING_REF_SIMD 1
+#endif
+
+// Returns a pointer to the first `c` in [s, s + n) or nullptr.
+inline const char *find_byte(const char *s, size_t n, char c) {
+#ifdef FOC_STRING_REF_SIMD
+  typedef ByteVector V;
+  const char *p = s;
+  const char *end = s + n;
+  const V::Vector needle = V::splat(c);
+  for (; (size_t)(end - p) >= V::kWidth; p += V::kWidth) {
+    V::Mask m = V::mask(V::eq(V::load(p), needle));
+    if (m) {
+      return p + V::firstIndex(m);
+    }
+  }
+  for (; p < end; p++) {
+    if (*p == c) {
+      return p;
+    }
+  }
+  return nullptr;
+#else
+  return n ? static_cast<const char *>(memchr(s, c, n)) : nullptr;
+#endif
+}
+
+// Returns a pointer to the last `c` in [s, s + n) or nullptr.
+inline const char *rfind_byte(const char *s, size_t n, char c) {
+  const char *p = s + n;
+#ifdef FOC_STRING_REF_SIMD
+  typedef ByteVector V;
+  const V::Vector needle = V::splat(c);
+  while ((size_t)(p - s) >= V::kWidth) {
+    p -= V::kWidth;
+    V::Mask m = V::mask(V::eq(V::load(p), needle));
+    if (m) {
+      return p + V::lastIndex(m);
+    }
+  }
+#endif
+  while (p > s) {
+    if (*--p == c) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+// Sets with up to this many bytes are matched with one vector comparison per
+// byte in the set. Larger sets use a 256-bit table.
+const size_t kMaxVectorByteSetSize = 8;
+
+struct ByteSet {
+  uint64_t bits[4];
+
+  explicit ByteSet(const char *set, size_t set_size) {
+    bits[0] = bits[1] = bits[2] = bits[3] = 0;
+    for (size_t i = 0; i < set_size; i++) {
+      uint8_t b = (uint8_t)set[i];
+      bits[b >> 6] |= (uint64_t)1 << (b & 63);
+    }
+  }
+
+  bool contains(char c) const {
+    uint8_t b = (uint8_t)c;
+    return (bits[b >> 6] >> (b & 63)) & 1;
+  }
+};
+
+#ifdef FOC_STRING_REF_SIMD
+inline ByteVector::Mask match_byte_set(ByteVector::Vector v,
+                                       const ByteVector::Vector *set,
+                                       size_t set_size) {
+  ByteVector::Vector matches = ByteVector::eq(v, set[0]);
+  for (size_t i = 1; i < set_size; i++) {
+    matches = ByteVector::any(matches, ByteVector::eq(v, set[i]));
+  }
+  return ByteVector::mask(matches);
+}
+#endif
+
+// Returns a pointer to the first byte in [s, s + n) that is in `set` or nullptr.
+inline const char *find_first_of_bytes(const char *s,
+                                       size_t n,
+                                       const char *set,
+                                       size_t set_size) {
+  if (set_size == 0) {
+    return nullptr;
+  }
+  if (set_size == 1) {
+    return find_byte(s, n, set[0]);
+  }
+  const char *p = s;
+  const char *end = s + n;
+#ifdef FOC_STRING_REF_SIMD
+  typedef ByteVector V;
+  if (set_size <= kMaxVectorByteSetSize) {
+    V::Vector needles[kMaxVectorByteSetSize];
+    for (size_t i = 0; i < set_size; i++) {
+      needles[i] = V::splat(set[i]);
+    }
+    for (; (size_t)(end - p) >= V::kWidth; p += V::kWidth) {
+      V::Mask m = match_byte_set(V::load(p), needles, set_size);
+      if (m) {
+        return p + V::firstIndex(m);
+      }
+    }
+  }
+#endif
+  ByteSet byte_set(set, set_size);
+  for (; p < end; p++) {
+    if (byte_set.contains(*p)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+// Returns a pointer to the last byte in [s, s + n) that is in `set` or nullptr.
+inline const char *find_last_of_bytes(const char *s, size_t n, const char *set, size_t set_size) {
+  if (set_size == 0) {
+    return nullptr;
+  }
+  if (set_size == 1) {
+    return rfind_byte(s, n, set[0]);
+  }
+  const char *p = s + n;
+#ifdef FOC_STRING_REF_SIMD
+  typedef ByteVector V;
+  if (set_size <= kMaxVectorByteSetSize) {
+    V::Vector needles[kMaxVectorByteSetSize];
+    for (size_t i = 0; i < set_size; i++) {
+      needles[i] = V::splat(set[i]);
+    }
+    while ((size_t)(p - s) >= V::kWidth) {
+      p -= V::kWidth;
+      V::Mask m = match_byte_set(V::load(p), needles, set_size);
+      if (m) {
+        return p + V::lastIndex(m);
+      }
+    }
+  }
+#endif
+  ByteSet byte_set(set, set_size);
+  while (p > s) {
+    if (byte_set.contains(*--p)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+// Returns a pointer to the first occurrence of `needle` in [s, s + n) or
+// nullptr.
+//
+// Candidate positions are found by comparing the first and the last byte of
+// the needle against a whole vector of positions at once and only the
+// candidates are compared with memcmp.
+inline const char *find_bytes(const char *s,
+                              size_t n,
+                              const char *needle,
+                              size_t needle_size) {
+  if (needle_size == 0) {
+    return s;
+  }
+  if (needle_size > n) {
+    return nullptr;
+  }
+  if (needle_size == 1) {
+    return find_byte(s, n, needle[0]);
+  }
+  const char *p = s;
+  // Last position where the needle can start
+  const char *last = s + (n - needle_size);
+#ifdef FOC_STRING_REF_SIMD
+  typedef ByteVector V;
+  const V::Vector first_byte = V::splat(needle[0]);
+  const V::Vector last_byte = V::splat(needle[needle_size - 1]);
+  for (; (size_t)(last - p) + 1 >= V::kWidth; p += V::kWidth) {
+    V::Mask m = V::mask(V::both(V::eq(V::load(p), first_byte),
+                                V::eq(V::load(p + needle_size - 1), last_byte)));
+    while (m) {
+      const char *candidate = p + V::firstIndex(m);
+      if (memcmp(candidate + 1, needle + 1, needle_size - 2) == 0) {
+        return candidate;
+      }
+      m = V::clearFirst(m);
+    }
+  }
+#endif
+  for (; p <= last; p++) {
+    if (*p == needle[0] && memcmp(p + 1, needle + 1, needle_size - 1) == 0) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace detail
+
+/// StringRef - Represent a constant reference to a string, i.e. a character
+/// array and a length, which need not be null terminated.
+///
+/// This class does not own the string data, it is expected to be used in
+/// situations where the character data resides in some other buffer, whose
+/// lifetime extends past that of the StringRef. For this reason, it is not in
+/// general safe to store a StringRef.
+class StringRef : public ArrayRef<char> {
+ public:
+  enum : size_t { npos = ~size_t(0) };
+
+  /// @name Constructors
+  /// @{
+
+  /// Construct an empty string ref.
+  /*implicit*/ StringRef() : ArrayRef<char>() {}
+
+  /// Construct a string ref from a cstring.
+  /*implicit*/ StringRef(const char *str) : ArrayRef<char>(str, str ? strlen(str) : 0) {}
+
+  /// Construct a string ref from a pointer and length.
+  /*implicit*/ StringRef(const char *data, size_t length) : ArrayRef<char>(data, length) {}
+
+  /// Construct a string ref from an std::string.
+  /*implicit*/ StringRef(const std::string &str) : ArrayRef<char>(str.data(), str.size()) {}
+
+  /// Construct a string ref from an array of chars.
+  /*implicit*/ StringRef(ArrayRef<char> chars) : ArrayRef<char>(chars) {}
+
+  /// @}
+  /// @name String Operations
+  /// @{
+
+  /// str - Get the contents as an std::string.
+  std::string str() const { return empty() ? std::string() : std::string(data(), size()); }
+
+  /// equals - Check for string equality. memcmp is already vectorized by
+  /// every libc worth using.
+  bool equals(StringRef rhs) const {
+    return size() == rhs.size() && (empty() || memcmp(data(), rhs.data(), size()) == 0);
+  }
+
+  /// compare - Compare two strings; the result is -1, 0, or 1 if this string
+  /// is lexicographically less than, equal to, or greater than the \p rhs.
+  int compare(StringRef rhs) const {
+    size_t min_size = size() < rhs.size() ? size() : rhs.size();
+    if (min_size > 0) {
+      int res = memcmp(data(), rhs.data(), min_size);
+      if (res != 0) {
+        return res < 0 ? -1 : 1;
+      }
+    }
+    if (size() == rhs.size()) {
+      return 0;
+    }
+    return size() < rhs.size() ? -1 : 1;
+  }
+
+  /// Check if this string starts with the given \p prefix.
+  bool startswith(StringRef prefix) const {
+    return size() >= prefix.size() && StringRef(data(), prefix.size()).equals(prefix);
+  }
+
+  /// Check if this string ends with the given \p suffix.
+  bool endswith(StringRef suffix) const {
+    return size() >= suffix.size() &&
+           StringRef(data() + size() - suffix.size(), suffix.size()).equals(suffix);
+  }
+
+  /// @}
+  /// @name String Searching
+  /// @{
+
+  /// Search for the first character \p c in the string.
+  ///
+  /// \returns The index of the first occurrence of \p c, or npos if not
+  /// found.
+  size_t find(char c, size_t from = 0) const {
+    if (from >= size()) {
+      return npos;
+    }
+    return toIndex(detail::find_byte(data() + from, size() - from, c));
+  }
+
+  /// Search for the first string \p str in the string.
+  ///
+  /// \returns The index of the first occurrence of \p str, or npos if not
+  /// found.
+  size_t find(StringRef str, size_t from = 0) const {
+    if (from > size()) {
+      return npos;
+    }
+    return toIndex(detail::find_bytes(data() + from, size() - from, str.data(), str.size()));
+  }
+
+  /// Search for the last character \p c in the string.
+  ///
+  /// \returns The index of the last occurrence of \p c, or npos if not
+  /// found.
+  size_t rfind(char c, size_t from = npos) const {
+    size_t n = from < size() ? from : size();
+    return toIndex(detail::rfind_byte(data(), n, c));
+  }
+
+  /// Search for the last string \p str in the string.
+  ///
+  /// \returns The index of the last occurrence of \p str, or npos if not
+  /// found.
+  size_t rfind(StringRef str) const {
+    size_t n = str.size();
+    if (n > size()) {
+      return npos;
+    }
+    if (n == 0) {
+      return size();
+    }
+    // Find the last byte of the needle from the back and check each candidate.
+    size_t end = size();
+    while (end >= n) {
+      const char *p = detail::rfind_byte(data() + n - 1, end - n + 1, str.back());
+      if (p == nullptr) {
+        break;
+      }
+      size_t start = (size_t)(p - data()) + 1 - n;
+      if (memcmp(data() + start, str.data(), n) == 0) {
+        return start;
+      }
+      end = (size_t)(p - data());
+    }
+    return npos;
+  }
+
+  /// Find the first character in the string that is \p c, or npos if not
+  /// found. Same as find.
+  size_t find_first_of(char c, size_t from = 0) const { return find(c, from); }
+
+  /// Find the first character in the string that is in \p chars, or npos if
+  /// not found.
+  size_t find_first_of(StringRef chars, size_t from = 0) const {
+    if (from >= size()) {
+      return npos;
+    }
+    return toIndex(
+        detail::find_first_of_bytes(data() + from, size() - from, chars.data(), chars.size()));
+  }
+
+  /// Find the last character in the string that is \p c, or npos if not
+  /// found.
+  size_t find_last_of(char c, size_t from = npos) const { return rfind(c, from); }
+
+  /// Find the last character in the string that is in \p chars, or npos if
+  /// not found. Like rfind(), only positions before \p from are considered.
+  size_t find_last_of(StringRef chars, size_t from = npos) const {
+    size_t n = from < size() ? from : size();
+    return toIndex(detail::find_last_of_bytes(data(), n, chars.data(), chars.size()));
+  }
+
+  /// Return true if the given string is a substring of *this, and false
+  /// otherwise.
+  bool contains(StringRef other) const { return find(other) != npos; }
+
+  /// @}
+  /// @name Substring Operations
+  /// @{
+
+  /// Return a reference to the substring from [start, start + n).
+  StringRef substr(size_t start, size_t n = npos) const {
+    start = start < size() ? start : size();
+    size_t max_n = size() - start;
+    return StringRef(data() + start, n < max_n ? n : max_n);
+  }
+
+  /// Return a StringRef equal to 'this' but with the first \p n elements
+  /// dropped.
+  StringRef drop_front(size_t n = 1) const {
+    assert(size() >= n && "Dropping more elements than exist");
+    return substr(n);
+  }
+
+  /// Return a StringRef equal to 'this' but with the last \p n elements
+  /// dropped.
+  StringRef drop_back(size_t n = 1) const {
+    assert(size() >= n && "Dropping more elements than exist");
+    return substr(0, size() - n);
+  }
+
+  /// Split into two substrings around the first occurrence of a separator
+  /// character.
+  ///
+  /// If \p separator is in the string, then the result is a pair (LHS, RHS)
+  /// such that (*this == LHS + separator + RHS) is true and RHS is
+  /// maximal. If \p separator is not in the string, then the result is a
+  /// pair (LHS, RHS) where (*this == LHS) and (RHS == "").
+  std::pair<StringRef, StringRef> split(char separator) const {
+    size_t idx = find(separator);
+    if (idx == npos) {
+      return std::make_pair(*this, StringRef());
+    }
+    return std::make_pair(substr(0, idx), substr(idx + 1));
+  }
+
+  /// Split into two substrings around the first occurrence of a separator
+  /// string.
+  std::pair<StringRef, StringRef> split(StringRef separator) const {
+    size_t idx = find(separator);
+    if (idx == npos) {
+      return std::make_pair(*this, StringRef());
+    }
+    return std::make_pair(substr(0, idx), substr(idx + separator.size()));
+  }
+
+  /// Split into substrings around the occurrences of a separator character.
+  ///
+  /// Each substring is stored in \p pieces. If \p max_split is >= 0, at most
+  /// \p max_split splits are done and consequently <= \p max_split + 1
+  /// elements are added to \p pieces. If \p keep_empty is false, empty
+  /// strings are not added to \p pieces.
+  void split(SmallVectorImpl<StringRef> &pieces,
+             char separator,
+             int max_split = -1,
+             bool keep_empty = true) const {
+    StringRef s = *this;
+    while (max_split-- != 0) {
+      size_t idx = s.find(separator);
+      if (idx == npos) {
+        break;
+      }
+      if (keep_empty || idx > 0) {
+        pieces.push_back(s.substr(0, idx));
+      }
+      s = s.substr(idx + 1);
+    }
+    if (keep_empty || !s.empty()) {
+      pieces.push_back(s);
+    }
+  }
+
+  /// @}
+
+ private:
+  size_t toIndex(const char *p) const { return p ? (size_t)(p - data()) : npos; }
+};
+
+/// @name StringRef Comparison Operators
+/// @{
+
+inline bool operator==(StringRef lhs, StringRef rhs) { return lhs.equals(rhs); }
+
+inline bool operator!=(StringRef lhs, StringRef rhs) { return !(lhs == rhs); }
+
+inline bool operator<(StringRef lhs, StringRef rhs) { return lhs.compare(rhs) == -1; }
+
+inline bool operator<=(StringRef lhs, StringRef rhs) { return lhs.compare(rhs) != 1; }
+
+inline bool operator>(StringRef lhs, StringRef rhs) { return lhs.compare(rhs) == 1; }
+
+inline bool operator>=(StringRef lhs, StringRef rhs) { return lhs.compare(rhs) != -1; }
+
+/// @}
+
+inline uint64_t hash_value(StringRef s) { return hash_bytes(s.data(), s.size()); }
+
+template <>
+struct Hash<StringRef> {
+  size_t operator()(StringRef s) const { return (size_t)hash_value(s); }
+};
+
+}  // namespace foc
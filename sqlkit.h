@@ -1,8 +1,33 @@
 // vim:foldenable fdm=marker
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "foc/mpsc_queue.h"
+#include "foc/size_class_allocator.h"
+#include "foc/small_vector.h"
+#include "foc/string_ref.h"
 
 #ifndef _SQLITE3_H_
 #include "sqlite3.h"
@@ -27,11 +52,18 @@ namespace detail {
 // const unsigned char * | sqlite3_column_text
 // const char *          | sqlite3_column_text
 // std::string           | sqlite3_column_text
+// foc::StringRef        | sqlite3_column_text, sqlite3_column_bytes
+// foc::ArrayRef<uint8_t>| sqlite3_column_blob, sqlite3_column_bytes
 // sqlite3_value *       | sqlite3_column_value   https://www.sqlite.org/c3ref/value.html
 //
 // There's no type for sqlite3_column_text16 (UTF-16 strings). Special functions
 // in the Stmt and PositionedRow classes are provided for it.
 //
+// Like the pointers, the StringRef and ArrayRef views point into memory owned
+// by the statement. They don't copy the value, but are only valid until the
+// next step, reset or finalize of the statement. Prefer them to std::string
+// when scanning many rows.
+//
 // 'ColumnExtractor's {{{
 
 template <typename T>
@@ -98,6 +130,25 @@ struct ColumnExtractor<std::string> {
   }
 };
 
+template <>
+struct ColumnExtractor<foc::StringRef> {
+  foc::StringRef operator()(sqlite3_stmt *stmt, unsigned int i) {
+    // sqlite3_column_bytes() must be called after sqlite3_column_text() for
+    // the size to match the converted text. NULL becomes an empty StringRef.
+    const char *text = (const char *)sqlite3_column_text(stmt, i);
+    return foc::StringRef(text, sqlite3_column_bytes(stmt, i));
+  }
+};
+
+template <>
+struct ColumnExtractor<foc::ArrayRef<uint8_t>> {
+  foc::ArrayRef<uint8_t> operator()(sqlite3_stmt *stmt, unsigned int i) {
+    // Empty for NULL and zero-length blobs.
+    const uint8_t *blob = (const uint8_t *)sqlite3_column_blob(stmt, i);
+    return foc::ArrayRef<uint8_t>(blob, sqlite3_column_bytes(stmt, i));
+  }
+};
+
 template <>
 struct ColumnExtractor<sqlite3_value *> {
   sqlite3_value *operator()(sqlite3_stmt *stmt, unsigned int i) {
@@ -108,626 +159,5250 @@ struct ColumnExtractor<sqlite3_value *> {
 
 // }}}
 
-}  // namespace detail
+// Typed binding and row decoding {{{
 
-class Handle;
-class PositionedRow;
+template <size_t... Is>
+struct IndexSequence {};
 
-class Stmt {
- public:
-  Stmt() : _handle(nullptr) {}
+template <size_t N, size_t... Is>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {};
 
-  Stmt(Stmt &&rhs) : _handle(rhs._handle) { rhs._handle = nullptr; }
+template <size_t... Is>
+struct MakeIndexSequence<0, Is...> {
+  typedef IndexSequence<Is...> type;
+};
 
-  Stmt &operator=(Stmt &&rhs) {
-    if (this != &rhs) {
-      if (_handle != rhs._handle) {
-        finalize();
-      }
-      _handle = rhs._handle;
-      rhs._handle = nullptr;
-    }
-    return *this;
+// Bind a single value to the 1-based parameter `i`. Text and blobs are
+// bound with their exact size and copied by SQLite.
+
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, int value) {
+  return sqlite3_bind_int(stmt, i, value);
+}
+
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, int64_t value) {
+  return sqlite3_bind_int64(stmt, i, value);
+}
+
+// Other integer types (long long, unsigned, size_t, bool, ...). The ones
+// an int can't hold are bound as 64-bit integers. Unsigned values above
+// INT64_MAX wrap around.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, int>::value &&
+                            !std::is_same<T, int64_t>::value,
+                        int>::type
+bindValue(sqlite3_stmt *stmt, unsigned int i, T value) {
+  if (sizeof(T) > sizeof(int) || (sizeof(T) == sizeof(int) && std::is_unsigned<T>::value)) {
+    return sqlite3_bind_int64(stmt, i, (sqlite3_int64)value);
   }
+  return sqlite3_bind_int(stmt, i, (int)value);
+}
 
-  ~Stmt() noexcept { finalize(); }
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, double value) {
+  return sqlite3_bind_double(stmt, i, value);
+}
 
-  bool isInitialized() const { return _handle != nullptr; }
-  sqlite3_stmt *raw() { return _handle; };
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, std::nullptr_t) {
+  return sqlite3_bind_null(stmt, i);
+}
 
-  const char *sql() const { return sqlite3_sql(_handle); }
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, foc::StringRef value) {
+  return sqlite3_bind_text(stmt, i, value.data(), (int)value.size(), SQLITE_TRANSIENT);
+}
 
-  // Called by the destructor.
-  //
-  // https://www.sqlite.org/c3ref/finalize.html
-  int finalize() {
-    // Invoking sqlite3_finalize() on a NULL pointer is a harmless no-op.
-    int status = sqlite3_finalize(_handle);
-    if (status != SQLITE_OK) {
-#ifndef NDEBUG
-      fprintf(stderr, "sqlkit: Something went wrong while finalizing prepared statement");
-#endif
-    }
-    // From https://www.sqlite.org/c3ref/finalize.html
-    //
-    // The application must finalize every prepared statement in order to avoid
-    // resource leaks. It is a grievous error for the application to try to use a
-    // prepared statement after it has been finalized. Any use of a prepared
-    // statement after it has been finalized can result in undefined and
-    // undesirable behavior such as segfaults and heap corruption.
-    _handle = nullptr;
-    return status;
-  }
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, const char *value) {
+  return value ? bindValue(stmt, i, foc::StringRef(value)) : sqlite3_bind_null(stmt, i);
+}
 
-  // Binding API {{{
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, const std::string &value) {
+  return bindValue(stmt, i, foc::StringRef(value));
+}
 
-  // 1-based index of binding parameter named `param`.
-  //
-  // @return 0 if parameter is not found
-  unsigned int index(const char *param) {
-    unsigned int i = (unsigned int)sqlite3_bind_parameter_index(_handle, param);
-    if (i < 1) {
-#ifndef NDEBUG
-      fprintf(stderr, "sqlkit: Couldn't find binding parameter: %s", param);
-#endif
-    }
-    return i;
-  }
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, foc::ArrayRef<uint8_t> value) {
+  return sqlite3_bind_blob(stmt, i, value.data(), (int)value.size(), SQLITE_TRANSIENT);
+}
 
-  // method       | typeof(value)         | sqlite3 API
-  // -------------+-----------------------+----------------------
-  // bind         | const void *          | sqlite3_bind_blob64
-  // bindStatic   | const void *          | sqlite3_bind_blob64
-  // bind         | double                | sqlite3_bind_double
-  // bind         | int                   | sqlite3_bind_int
-  // bind         | int64_t               | sqlite3_bind_int64
-  // bindNull     | N/A                   | sqlite3_bind_null
-  // bind         | const char *          | sqlite3_bind_text
-  // bind         | std::string           | sqlite3_bind_text
-  // bindStatic   | const char *          | sqlite3_bind_text
-  // bindStatic   | std::string           | sqlite3_bind_text
-  // bind         | sqlite3_value *       | sqlite3_bind_value
-  // bindZeroblob | N/A                   | sqlite3_bind_zeroblob64
-  //
-  // `sqlite3_bind_text16` and `sqlite3_bind_text64` are not covered.
-  // `sqlite3_bind_blob` and `sqlite3_bind_zeroblob` are not used in favor of
-  // `sqlite3_bind_blob64` and `sqlite3_bind_zeroblob64`.
+inline int bindValue(sqlite3_stmt *stmt, unsigned int i, const std::vector<uint8_t> &value) {
+  return bindValue(stmt, i, foc::ArrayRef<uint8_t>(value));
+}
 
-  // Bind BLOB
+// Set the result of an SQL function or virtual table column. Text and blobs
+// are copied by SQLite.
 
-  int bind(unsigned int i, const void *value, size_t size) {
-    int status = sqlite3_bind_blob64(_handle, i, value, size, SQLITE_TRANSIENT);
-    assert(status == SQLITE_OK);
-    return status;
-  }
+inline void resultValue(sqlite3_context *context, int value) {
+  sqlite3_result_int(context, value);
+}
 
-  int bind(const char *param, const void *value, size_t size) {
-    return bind(index(param), value, size);
-  }
+inline void resultValue(sqlite3_context *context, int64_t value) {
+  sqlite3_result_int64(context, value);
+}
 
-  int bindStatic(unsigned int i, const void *value, size_t size) {
-    int status = sqlite3_bind_blob64(_handle, i, value, size, SQLITE_STATIC);
-    assert(status == SQLITE_OK);
-    return status;
+// Other integral types: int64_t if they don't fit in an int.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, int>::value &&
+                            !std::is_same<T, int64_t>::value>::type
+resultValue(sqlite3_context *context, T value) {
+  if (sizeof(T) > sizeof(int) || (sizeof(T) == sizeof(int) && std::is_unsigned<T>::value)) {
+    sqlite3_result_int64(context, (sqlite3_int64)value);
+  } else {
+    sqlite3_result_int(context, (int)value);
   }
+}
 
-  int bindStatic(const char *param, const void *value, size_t size) {
-    return bindStatic(index(param), value, size);
-  }
+inline void resultValue(sqlite3_context *context, double value) {
+  sqlite3_result_double(context, value);
+}
 
-  // Bind double
+inline void resultValue(sqlite3_context *context, std::nullptr_t) {
+  sqlite3_result_null(context);
+}
 
-  int bind(unsigned int i, double value) {
-    int status = sqlite3_bind_double(_handle, i, value);
-    assert(status == SQLITE_OK);
-    return status;
+inline void resultValue(sqlite3_context *context, foc::StringRef value) {
+  sqlite3_result_text(context, value.data(), (int)value.size(), SQLITE_TRANSIENT);
+}
+
+inline void resultValue(sqlite3_context *context, const char *value) {
+  if (value) {
+    resultValue(context, foc::StringRef(value));
+  } else {
+    sqlite3_result_null(context);
   }
+}
 
-  int bind(const char *param, double value) { return bind(index(param), value); }
+inline void resultValue(sqlite3_context *context, const std::string &value) {
+  resultValue(context, foc::StringRef(value));
+}
 
-  // Bind int
+inline void resultValue(sqlite3_context *context, foc::ArrayRef<uint8_t> value) {
+  sqlite3_result_blob(context, value.data(), (int)value.size(), SQLITE_TRANSIENT);
+}
 
-  int bind(unsigned int i, int value) {
-    int status = sqlite3_bind_int(_handle, i, value);
-    assert(status == SQLITE_OK);
-    return status;
-  }
+inline void resultValue(sqlite3_context *context, const std::vector<uint8_t> &value) {
+  resultValue(context, foc::ArrayRef<uint8_t>(value));
+}
 
-  int bind(const char *param, int value) { return bind(index(param), value); }
+// The type that keeps a copy of a parameter of type T: views become the
+// containers they view.
+template <typename T>
+struct OwnedValue {
+  typedef T type;
+  static const T &copy(const T &value) { return value; }
+  static T &&copy(T &&value) { return std::move(value); }
+};
 
-  // Bind int64
+template <>
+struct OwnedValue<foc::StringRef> {
+  typedef std::string type;
+  static std::string copy(foc::StringRef value) { return value.str(); }
+};
 
-  int bind(unsigned int i, int64_t value) {
-    int status = sqlite3_bind_int64(_handle, i, value);
-    assert(status == SQLITE_OK);
-    return status;
+template <>
+struct OwnedValue<const char *> {
+  typedef std::string type;
+  static std::string copy(const char *value) { return value; }
+};
+
+template <>
+struct OwnedValue<char *> : OwnedValue<const char *> {};
+
+template <>
+struct OwnedValue<foc::ArrayRef<uint8_t>> {
+  typedef std::vector<uint8_t> type;
+  static std::vector<uint8_t> copy(foc::ArrayRef<uint8_t> value) {
+    return std::vector<uint8_t>(value.begin(), value.end());
   }
+};
 
-  int bind(const char *param, int64_t value) { return bind(index(param), value); }
+inline int bindValues(sqlite3_stmt *, unsigned int) { return SQLITE_OK; }
+
+// Bind `value, tail...` to the parameters `i, i + 1, ...`. Stops at the first
+// error.
+template <typename T, typename... Tail>
+int bindValues(sqlite3_stmt *stmt, unsigned int i, const T &value, const Tail &... tail) {
+  int status = bindValue(stmt, i, value);
+  return status != SQLITE_OK ? status : bindValues(stmt, i + 1, tail...);
+}
+
+template <typename Tuple, size_t... Is>
+int bindTupleImpl(sqlite3_stmt *stmt, const Tuple &tuple, IndexSequence<Is...>) {
+  return bindValues(stmt, 1, std::get<Is>(tuple)...);
+}
+
+// Bind the elements of `tuple` to the parameters 1, 2, ... of `stmt`.
+template <typename... Ts>
+int bindTuple(sqlite3_stmt *stmt, const std::tuple<Ts...> &tuple) {
+  return bindTupleImpl(stmt, tuple, typename MakeIndexSequence<sizeof...(Ts)>::type());
+}
+
+// A data member of `Struct` listed in SQLKIT_FIELDS.
+template <typename Struct, typename T, T Struct::*Member>
+struct Field {
+  typedef T type;
+
+  static T &get(Struct &obj) { return obj.*Member; }
+  static const T &get(const Struct &obj) { return obj.*Member; }
+};
 
-  // Bind NULL
+template <typename... Fields>
+struct FieldList {
+  static const unsigned int kNumFields = sizeof...(Fields);
+};
 
-  int bindNull(unsigned int i) {
-    int status = sqlite3_bind_null(_handle, i);
-    assert(status == SQLITE_OK);
-    return status;
-  }
+// True if SQLKIT_FIELDS(T, ...) is visible through argument-dependent lookup.
+template <typename T>
+struct HasFields {
+  template <typename U>
+  static char test(decltype(sqlkitFields((const U *)nullptr)) *);
+  template <typename U>
+  static long test(...);
 
-  int bindNull(const char *param) { return bindNull(index(param)); }
+  static const bool value = sizeof(test<T>(nullptr)) == 1;
+};
 
-  // Bind const char *
+template <typename Struct>
+struct FieldsOf {
+  typedef decltype(sqlkitFields((const Struct *)nullptr)) type;
+};
 
-  int bind(unsigned int i, const char *value, size_t size) {
-    int status = sqlite3_bind_text(_handle, i, value, size, SQLITE_TRANSIENT);
-    assert(status == SQLITE_OK);
-    return status;
-  }
+template <typename Struct, typename... Fields>
+int bindFields(sqlite3_stmt *stmt, const Struct &obj, FieldList<Fields...>) {
+  return bindValues(stmt, 1, Fields::get(obj)...);
+}
+
+template <typename Struct, typename... Fields, size_t... Is>
+void extractFields(sqlite3_stmt *stmt, Struct &obj, FieldList<Fields...>, IndexSequence<Is...>) {
+  // Expand the assignments in order inside an array initializer.
+  int expand[] = {0, (Fields::get(obj) = ColumnExtractor<typename Fields::type>()(stmt, Is), 0)...};
+  (void)expand;
+  (void)stmt;
+}
+
+// Decodes the current row of a statement into a `Row`: a std::tuple of
+// column types, a struct mapped with SQLKIT_FIELDS, a single column type or
+// void for statements without results.
+template <typename Row, bool = HasFields<Row>::value>
+struct RowDecoder {
+  typedef Row value_type;
+  static const unsigned int kNumColumns = 1;
+
+  static Row decode(sqlite3_stmt *stmt) { return ColumnExtractor<Row>()(stmt, 0); }
+};
 
-  int bindStatic(unsigned int i, const char *value, size_t size) {
-    int status = sqlite3_bind_text(_handle, i, value, size, SQLITE_STATIC);
-    assert(status == SQLITE_OK);
-    return status;
+template <typename Struct>
+struct RowDecoder<Struct, true> {
+  typedef Struct value_type;
+  typedef typename FieldsOf<Struct>::type Fields;
+  static const unsigned int kNumColumns = Fields::kNumFields;
+
+  static Struct decode(sqlite3_stmt *stmt) {
+    Struct obj;
+    extractFields(stmt, obj, Fields(), typename MakeIndexSequence<kNumColumns>::type());
+    return obj;
   }
+};
 
-  int bind(const char *param, const char *value, size_t size) {
-    return bind(index(param), value, size);
+template <typename... Ts>
+struct RowDecoder<std::tuple<Ts...>> {
+  typedef std::tuple<Ts...> value_type;
+  static const unsigned int kNumColumns = sizeof...(Ts);
+
+  static std::tuple<Ts...> decode(sqlite3_stmt *stmt) {
+    return decode(stmt, typename MakeIndexSequence<sizeof...(Ts)>::type());
   }
 
-  int bindStatic(const char *param, const char *text, size_t size) {
-    return bindStatic(index(param), text, size);
+  template <size_t... Is>
+  static std::tuple<Ts...> decode(sqlite3_stmt *stmt, IndexSequence<Is...>) {
+    (void)stmt;  // Unused when the tuple is empty.
+    return std::tuple<Ts...>(ColumnExtractor<Ts>()(stmt, Is)...);
   }
+};
 
-  // Bind std::string
+template <>
+struct RowDecoder<void> {
+  static const unsigned int kNumColumns = 0;
+};
 
-  int bind(unsigned int i, const std::string &value) {
-    return bind(i, value.c_str(), value.size() + 1);
+// The decoder of Stmt::rows<Ts...>(): tuples, or a struct mapped with
+// SQLKIT_FIELDS.
+template <typename... Ts>
+struct RowsDecoder {
+  typedef RowDecoder<std::tuple<Ts...>> type;
+};
+
+template <typename T>
+struct RowsDecoder<T> {
+  typedef typename std::conditional<HasFields<T>::value, RowDecoder<T>,
+                                    RowDecoder<std::tuple<T>>>::type type;
+};
+
+// Decodes the columns into the members of the aggregate `Struct` in order.
+template <typename Struct, typename... Cols>
+struct StructDecoder {
+  typedef Struct value_type;
+  static const unsigned int kNumColumns = sizeof...(Cols);
+
+  static Struct decode(sqlite3_stmt *stmt) {
+    return decode(stmt, typename MakeIndexSequence<sizeof...(Cols)>::type());
   }
 
-  int bindStatic(unsigned int i, const std::string &value) {
-    return bindStatic(i, value.c_str(), value.size() + 1);
+  template <size_t... Is>
+  static Struct decode(sqlite3_stmt *stmt, IndexSequence<Is...>) {
+    return Struct{ColumnExtractor<Cols>()(stmt, Is)...};
   }
+};
 
-  int bind(const char *param, const std::string &value) { return bind(index(param), value); }
+// constexpr helpers of sqlParameterCount(). C++11 constexpr functions are
+// a single return statement, so these recurse once per character.
+
+constexpr bool isSqlIdentifierChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+         (unsigned char)c >= 0x80;
+}
+
+constexpr const char *skipSqlIdentifier(const char *s) {
+  return isSqlIdentifierChar(*s) ? skipSqlIdentifier(s + 1) : s;
+}
+
+constexpr const char *skipSqlDigits(const char *s) {
+  return (*s >= '0' && *s <= '9') ? skipSqlDigits(s + 1) : s;
+}
+
+// Skip to the character after the closing `quote`. Doubled quotes escape it.
+constexpr const char *skipSqlQuoted(const char *s, char quote) {
+  return *s == '\0' ? s
+                    : *s == quote ? (s[1] == quote ? skipSqlQuoted(s + 2, quote) : s + 1)
+                                  : skipSqlQuoted(s + 1, quote);
+}
+
+constexpr const char *skipSqlLineComment(const char *s) {
+  return *s == '\0' ? s : *s == '\n' ? s + 1 : skipSqlLineComment(s + 1);
+}
+
+constexpr const char *skipSqlBlockComment(const char *s) {
+  return *s == '\0' ? s : (*s == '*' && s[1] == '/') ? s + 2 : skipSqlBlockComment(s + 1);
+}
+
+// Skip a string literal, quoted identifier or comment starting at `s`.
+// Returns `s` if there's none.
+constexpr const char *skipSqlLiteralOrComment(const char *s) {
+  return (*s == '\'' || *s == '"' || *s == '`') ? skipSqlQuoted(s + 1, *s)
+         : *s == '['                          ? skipSqlQuoted(s + 1, ']')
+         : (*s == '-' && s[1] == '-')         ? skipSqlLineComment(s + 2)
+         : (*s == '/' && s[1] == '*')         ? skipSqlBlockComment(s + 2)
+                                              : s;
+}
+
+constexpr bool isSqlNamedParameter(const char *s) {
+  return (*s == ':' || *s == '@' || *s == '$') && isSqlIdentifierChar(s[1]);
+}
 
-  int bindStatic(const char *param, const std::string &value) {
-    return bindStatic(index(param), value);
+// }}}
+
+}  // namespace detail
+
+// Count the parameters of an SQL statement at compile time: `?`, `?NNN`,
+// `:name`, `@name` and `$name` outside of string literals, quoted
+// identifiers and comments. Unlike sqlite3_bind_parameter_count(), every
+// placeholder counts, so reusing a named parameter or numbering them out of
+// order breaks the count. The recursion is one level per character, which
+// limits this to statements shorter than the compiler's constexpr depth
+// (512 by default on GCC and Clang).
+//
+//   static_assert(sqlParameterCount("SELECT name FROM users WHERE id = ?") == 1, "");
+constexpr unsigned int sqlParameterCount(const char *s) {
+  return *s == '\0' ? 0
+         : detail::skipSqlLiteralOrComment(s) != s
+             ? sqlParameterCount(detail::skipSqlLiteralOrComment(s))
+         : *s == '?' ? 1 + sqlParameterCount(detail::skipSqlDigits(s + 1))
+         : detail::isSqlNamedParameter(s) ? 1 + sqlParameterCount(detail::skipSqlIdentifier(s + 1))
+                                          : sqlParameterCount(s + 1);
+}
+
+// Map the data members of a struct to statement parameters and columns
+//
+//   struct User {
+//     int64_t id;
+//     std::string name;
+//     double score;
+//   };
+//   SQLKIT_FIELDS(User, id, name, score)
+//
+//   insert.bindStruct(user);                     // bind(1, id), bind(2, name), ...
+//   User user = select.row<User>();              // column 0 to id, 1 to name, ...
+//   for (User user : select.rows<User>()) {}
+//   Query<User(int64_t)> by_id;
+//
+// Use it in the namespace of the struct, where it declares a function found
+// by argument-dependent lookup. Fields are bound and extracted through their
+// members directly, without intermediate tuples. The struct must be
+// default-constructible. Up to 16 fields are supported.
+#define SQLKIT_FIELDS(Struct, ...)                                                          \
+  inline ::sqlkit::detail::FieldList<SQLKIT_FIELDS_LIST(Struct, __VA_ARGS__)> sqlkitFields( \
+      const Struct *) {                                                                     \
+    return {};                                                                              \
+  }                                                                                         \
+  inline const char *sqlkitFieldNames(const Struct *) { return #__VA_ARGS__; }
+
+#define SQLKIT_FIELDS_LIST(Struct, ...) \
+  SQLKIT_FIELDS_PP_CAT(SQLKIT_FIELDS_, SQLKIT_FIELDS_PP_NARGS(__VA_ARGS__))(Struct, __VA_ARGS__)
+#define SQLKIT_FIELDS_PP_CAT(a, b) SQLKIT_FIELDS_PP_CAT_(a, b)
+#define SQLKIT_FIELDS_PP_CAT_(a, b) a##b
+#define SQLKIT_FIELDS_PP_NARGS(...) \
+  SQLKIT_FIELDS_PP_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define SQLKIT_FIELDS_PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, \
+                                _16, N, ...)                                                     \
+  N
+
+#define SQLKIT_FIELD(S, f) ::sqlkit::detail::Field<S, decltype(S::f), &S::f>
+#define SQLKIT_FIELDS_1(S, f) SQLKIT_FIELD(S, f)
+#define SQLKIT_FIELDS_2(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_1(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_3(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_2(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_4(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_3(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_5(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_4(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_6(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_5(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_7(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_6(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_8(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_7(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_9(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_8(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_10(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_9(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_11(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_10(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_12(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_11(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_13(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_12(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_14(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_13(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_15(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_14(S, __VA_ARGS__)
+#define SQLKIT_FIELDS_16(S, f, ...) SQLKIT_FIELD(S, f), SQLKIT_FIELDS_15(S, __VA_ARGS__)
+
+// Connection options {{{
+
+// How Handle::open() configures a connection. The defaults leave SQLite's
+// own defaults alone: rollback journal, no memory mapping, a 2MB page cache
+// and synchronous=FULL. Start from one of the presets, which target the
+// common workloads, and adjust.
+//
+//   OpenOptions options = OpenOptions::ingest();
+//   options.cache_size = -256 * 1024;  // 256MB
+//   db.open("events.db", options);
+//
+// See https://www.sqlite.org/pragma.html for the PRAGMAs behind each field.
+struct OpenOptions {
+  enum JournalMode {
+    kJournalDefault,  //> Leave the database's journal mode unchanged
+    kJournalDelete,
+    kJournalTruncate,
+    kJournalPersist,
+    kJournalMemory,
+    kJournalWAL,
+    kJournalOff,
+  };
+
+  enum Synchronous {
+    kSynchronousDefault = -1,
+    kSynchronousOff = 0,
+    kSynchronousNormal = 1,
+    kSynchronousFull = 2,
+    kSynchronousExtra = 3,
+  };
+
+  enum TempStore {
+    kTempStoreDefault = 0,
+    kTempStoreFile = 1,
+    kTempStoreMemory = 2,
+  };
+
+  // SQLITE_OPEN_* flags of sqlite3_open_v2(), e.g. SQLITE_OPEN_READONLY,
+  // SQLITE_OPEN_NOMUTEX for connections used by one thread at a time, or
+  // SQLITE_OPEN_SHAREDCACHE.
+  int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+  int busy_timeout_ms = 0;
+  JournalMode journal_mode = kJournalDefault;
+  // Pages of WAL after which a commit checkpoints. 0 disables automatic
+  // checkpoints and -1 keeps the default (1000).
+  int wal_autocheckpoint = -1;
+  // Bytes of the database file to access through mmap(). -1 keeps the
+  // default (usually 0, no memory mapping).
+  int64_t mmap_size = -1;
+  // Page cache size. Positive values are pages, negative values KiB. 0 keeps
+  // the default (-2000, i.e. ~2MB).
+  int cache_size = 0;
+  TempStore temp_store = kTempStoreDefault;
+  Synchronous synchronous = kSynchronousDefault;
+
+  // Read-only connections serving many queries: large mmap and page cache,
+  // temporary tables and indices in memory.
+  static OpenOptions readHeavy() {
+    OpenOptions options;
+    options.flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+    options.busy_timeout_ms = 5000;
+    options.mmap_size = 256 << 20;
+    options.cache_size = -64 * 1024;
+    options.temp_store = kTempStoreMemory;
+    return options;
   }
 
-  // Bind const sqlite3_value *
+  // Bulk loading: WAL with synchronous=NORMAL only syncs on checkpoints, and
+  // rarer checkpoints keep the WAL appends sequential. A power loss can undo
+  // the latest commits but doesn't corrupt the database.
+  static OpenOptions ingest() {
+    OpenOptions options;
+    options.flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+    options.busy_timeout_ms = 5000;
+    options.journal_mode = kJournalWAL;
+    options.wal_autocheckpoint = 10000;
+    options.cache_size = -64 * 1024;
+    options.temp_store = kTempStoreMemory;
+    options.synchronous = kSynchronousNormal;
+    return options;
+  }
 
-  // TODO: test
-  int bind(unsigned int i, const sqlite3_value *value) {
-    int status = sqlite3_bind_value(_handle, i, value);
-    assert(status == SQLITE_OK);
-    return status;
+  // Every commit is synced before it returns.
+  static OpenOptions durable() {
+    OpenOptions options;
+    options.flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+    options.busy_timeout_ms = 5000;
+    options.journal_mode = kJournalWAL;
+    options.synchronous = kSynchronousFull;
+    return options;
   }
+};
 
-  int bind(const char *param, const sqlite3_value *value) { return bind(index(param), value); }
+// }}}
 
-  // Bind zeroed BLOB
+// Process-wide memory {{{
+
+// What configureMemory() replaces.
+struct MemoryOptions {
+  // Serve SQLite's allocations from foc::SizeClassAllocator's thread caches
+  // instead of malloc().
+  bool allocator = true;
+  // Replace the page cache with one that takes no locks: each connection
+  // gets its own cache, which SQLite only touches while holding the
+  // connection's mutex, and pages come from the thread caches.
+  bool page_cache = true;
+  // false stops SQLite's memory accounting, which takes a global mutex on
+  // every allocation. sqlite3_memory_used() then returns 0 and the soft and
+  // hard heap limits don't work.
+  bool memory_status = true;
+};
 
-  int bindZeroblob(unsigned int i, size_t size) {
-    int status = sqlite3_bind_zeroblob64(_handle, i, size);
-    assert(status == SQLITE_OK);
-    return status;
-  }
+// Installs the allocator and page cache selected by `options` for every
+// connection of the process. Returns SQLITE_MISUSE unless it runs before
+// SQLite is initialized (i.e. before the first connection is opened) or
+// after sqlite3_shutdown().
+int configureMemory(const MemoryOptions &options = MemoryOptions());
 
-  int bindZeroblob(const char *param, size_t size) { return bindZeroblob(index(param), size); }
+// }}}
 
-  // }}}
+// Array parameters {{{
 
-  // Result extraction API {{{
+namespace detail {
 
-  // Get the number of columns in the result set
-  unsigned int numColumns() { return sqlite3_column_count(_handle); }
+// What Stmt::bindArray() binds: a view of the caller's array.
+struct ArrayParameter {
+  enum Type { kInt64, kDouble, kText };
 
-  // Byte size methods
+  Type type;
+  const void *data;
+  size_t size;
+};
 
-  int blobColumnSize(unsigned int i) { return sqlite3_column_bytes(_handle, i); }
-  int utf8ColumnSizeInBytes(unsigned int i) { return sqlite3_column_bytes(_handle, i); }
-  int utf16ColumnSizeInBytes(unsigned int i) { return sqlite3_column_bytes16(_handle, i); }
+// The pointer type of ArrayParameter for sqlite3_bind_pointer().
+inline const char *arrayPointerType() { return "sqlkit_array"; }
 
-  // Get the default datatype of the column in the result:
-  //
-  // SQLITE_INTEGER  1
-  // SQLITE_FLOAT    2
-  // SQLITE_BLOB     4
-  // SQLITE_NULL     5
-  // SQLITE_TEXT     3
-  //
-  // See https://www.sqlite.org/c3ref/c_blob.html
-  int columnType(unsigned int i) { return sqlite3_column_type(_handle, i); }
+}  // namespace detail
 
-  bool columnIsNull(unsigned int i) { return sqlite3_column_type(_handle, i) == SQLITE_NULL; }
+// Register the sqlkit_array() table-valued function on `db`. Handle::open()
+// registers it on every connection. It yields the elements of an array bound
+// with Stmt::bindArray() as the `value` column, so one statement serves
+// lists of any length:
+//
+//   SELECT name FROM users WHERE id IN sqlkit_array(?)
+//   SELECT u.name FROM sqlkit_array(?) a JOIN users u ON u.id = a.value
+//
+// Needs SQLite 3.20 (sqlite3_bind_pointer()), it does nothing with older
+// versions.
+int registerArrayFunction(sqlite3 *db);
 
-  const char *columnName(unsigned int i) {
-    assert(i < numColumns());
-    return sqlite3_column_name(_handle, i);
-  }
+// }}}
 
-  const void *columnNameUtf16(unsigned int i) {
-    assert(i < numColumns());
-    return sqlite3_column_name16(_handle, i);
-  }
+// Virtual tables {{{
 
-  // Extract value of a single column.
-  //
-  // column() and column16() take a 0-based index.
+namespace detail {
 
-  template <typename T>
-  T column(unsigned int i) {
-    assert(i < numColumns());
-    detail::ColumnExtractor<T> extract;
-    return extract(_handle, i);
+// The column names of a struct mapped with SQLKIT_FIELDS, comma separated.
+template <typename Struct>
+std::string fieldColumns() {
+  std::string columns;
+  for (const char *s = sqlkitFieldNames((const Struct *)nullptr); *s; s++) {
+    if (*s != ' ' && *s != '\t' && *s != '\n') {
+      columns += *s;
+    }
   }
+  return columns;
+}
 
-  const void *columnUtf16(unsigned int i) {
-    assert(i < numColumns());
-    return sqlite3_column_text16(_handle, i);
-  }
+// The columns of a table whose rows are values of type T: a single `value`
+// column or, for a struct mapped with SQLKIT_FIELDS, one column per field.
+template <typename T, bool = HasFields<T>::value>
+struct ValueColumns {
+  static const int kNumColumns = 1;
 
-  // Extract value of all columns as a tuple
+  static std::string declaration() { return "value"; }
 
-  template <typename T0>
-  std::tuple<T0> tuple() {
-    assert(1 <= numColumns() && "Trying to extract too many columns");
-    auto _0 = column<T0>(0);
-    return std::make_tuple(_0);
-  }
-
-  template <typename T0, typename T1>
-  std::tuple<T0, T1> tuple() {
-    assert(2 <= numColumns() && "Trying to extract too many columns");
-    auto _0 = column<T0>(0);
-    auto _1 = column<T1>(1);
-    return std::make_tuple(_0, _1);
-  }
-
-  template <typename T0, typename T1, typename T2>
-  std::tuple<T0, T1, T2> tuple() {
-    assert(3 <= numColumns() && "Trying to extract too many columns");
-    auto _0 = column<T0>(0);
-    auto _1 = column<T1>(1);
-    auto _2 = column<T2>(2);
-    return std::make_tuple(_0, _1, _2);
-  }
-
-  template <typename T0, typename T1, typename T2, typename T3>
-  std::tuple<T0, T1, T2, T3> tuple() {
-    assert(4 <= numColumns() && "Trying to extract too many columns");
-    auto _0 = column<T0>(0);
-    auto _1 = column<T1>(1);
-    auto _2 = column<T2>(2);
-    auto _3 = column<T3>(3);
-    return std::make_tuple(_0, _1, _2, _3);
-  }
-
-  template <typename T0, typename T1, typename T2, typename T3, typename T4>
-  std::tuple<T0, T1, T2, T3, T4> tuple() {
-    assert(5 <= numColumns() && "Trying to extract too many columns");
-    auto _0 = column<T0>(0);
-    auto _1 = column<T1>(1);
-    auto _2 = column<T2>(2);
-    auto _3 = column<T3>(3);
-    auto _4 = column<T4>(4);
-    return std::make_tuple(_0, _1, _2, _3, _4);
-  }
-
-  // We use variadic templates (more complicated to debug when things go awry)
-  // to support any number of parameters.
-  template <typename T0,
-            typename T1,
-            typename T2,
-            typename T3,
-            typename T4,
-            typename T5,
-            typename... TailTypes>
-  std::tuple<T0, T1, T2, T3, T4, T5, TailTypes...> tuple() {
-    assert(6 + sizeof...(TailTypes) <= numColumns() && "Trying to extract too many columns");
-    typedef std::tuple<T0, T1, T2, T3, T4, T5, TailTypes...> TupleType;
-    TupleType tuple;
-    tailColumns<TupleType, 0, T0, T1, T2, T3, T4, T5, TailTypes...>(tuple);
-    return tuple;
+  static void result(sqlite3_context *context, const T &value, int) {
+    resultValue(context, value);
+  }
+};
+
+template <typename Struct>
+struct ValueColumns<Struct, true> {
+  typedef typename FieldsOf<Struct>::type Fields;
+  typedef void (*ResultFunction)(sqlite3_context *, const Struct &);
+
+  static const int kNumColumns = Fields::kNumFields;
+
+  static std::string declaration() { return fieldColumns<Struct>(); }
+
+  static void result(sqlite3_context *context, const Struct &obj, int column) {
+    resultFunctions(Fields())[column](context, obj);
+  }
+
+ private:
+  template <typename Field>
+  static void resultField(sqlite3_context *context, const Struct &obj) {
+    resultValue(context, Field::get(obj));
+  }
+
+  // One function per column, so xColumn doesn't walk the fields.
+  template <typename... Fs>
+  static const ResultFunction *resultFunctions(FieldList<Fs...>) {
+    static const ResultFunction functions[] = {&resultField<Fs>...};
+    return functions;
+  }
+};
+
+// Converts the right-hand side of `key = ?` to a key of type Key. Fails if
+// no key of that type compares equal to the value in SQL (e.g. TEXT for an
+// integer key), so the lookup finds nothing, like the comparison would.
+template <typename Key, bool = std::is_integral<Key>::value,
+          bool = std::is_floating_point<Key>::value>
+struct KeyFromValue {
+  static const bool kSupported = false;
+
+  static bool get(sqlite3_value *, Key *) { return false; }
+};
+
+template <typename Key>
+struct KeyFromValue<Key, true, false> {
+  static const bool kSupported = true;
+
+  static bool get(sqlite3_value *value, Key *key) {
+    int64_t i;
+    switch (sqlite3_value_type(value)) {
+      case SQLITE_INTEGER:
+        i = sqlite3_value_int64(value);
+        break;
+      case SQLITE_FLOAT: {
+        double d = sqlite3_value_double(value);
+        // Out of the range of int64_t (or NaN) or not integral.
+        if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0) ||
+            d != (double)(int64_t)d) {
+          return false;
+        }
+        i = (int64_t)d;
+        break;
+      }
+      default:
+        return false;
+    }
+    *key = (Key)i;
+    return (int64_t)*key == i;
+  }
+};
+
+template <typename Key>
+struct KeyFromValue<Key, false, true> {
+  static const bool kSupported = true;
+
+  static bool get(sqlite3_value *value, Key *key) {
+    int type = sqlite3_value_type(value);
+    if (type != SQLITE_INTEGER && type != SQLITE_FLOAT) {
+      return false;
+    }
+    *key = (Key)sqlite3_value_double(value);
+    return true;
+  }
+};
+
+template <>
+struct KeyFromValue<std::string, false, false> {
+  static const bool kSupported = true;
+
+  static bool get(sqlite3_value *value, std::string *key) {
+    if (sqlite3_value_type(value) != SQLITE_TEXT) {
+      return false;
+    }
+    const char *text = reinterpret_cast<const char *>(sqlite3_value_text(value));
+    key->assign(text, sqlite3_value_bytes(value));
+    return true;
+  }
+};
+
+// The rows of registerMapTable(): the columns are `key` and the columns of
+// the mapped values. `key = ?` is answered with a single find().
+template <typename Map>
+class MapSource {
+ public:
+  typedef typename Map::key_type Key;
+  typedef typename Map::mapped_type Value;
+  // HashArrayMappedTrie declares its iterators const.
+  typedef typename std::remove_const<typename Map::const_iterator>::type Iterator;
+
+  struct Cursor {
+    Iterator it;
+    Iterator end;
+  };
+
+  explicit MapSource(const Map &map) : _map(map) {}
+
+  std::string declaration() const {
+    return "CREATE TABLE x(key, " + ValueColumns<Value>::declaration() + ")";
+  }
+
+  void bestIndex(sqlite3_index_info *info) const {
+    if (KeyFromValue<Key>::kSupported) {
+      for (int i = 0; i < info->nConstraint; i++) {
+        const auto &constraint = info->aConstraint[i];
+        if (constraint.usable && constraint.iColumn == 0 &&
+            constraint.op == SQLITE_INDEX_CONSTRAINT_EQ) {
+          info->aConstraintUsage[i].argvIndex = 1;
+          info->aConstraintUsage[i].omit = 1;
+          info->idxNum = kKeyLookup;
+          info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+          info->estimatedCost = 1;
+          info->estimatedRows = 1;
+          return;
+        }
+      }
+    }
+    info->idxNum = kScan;
+    info->estimatedCost = (double)_map.size() + 1;
+    info->estimatedRows = (sqlite3_int64)_map.size();
+  }
+
+  void filter(Cursor *cursor, int idx_num, sqlite3_value **argv) const {
+    cursor->end = _map.end();
+    if (idx_num == kScan) {
+      cursor->it = _map.begin();
+      return;
+    }
+    Key key;
+    cursor->it = KeyFromValue<Key>::get(argv[0], &key) ? _map.find(key) : _map.end();
+    if (cursor->it != cursor->end) {
+      cursor->end = std::next(cursor->it);
+    }
+  }
+
+  void next(Cursor *cursor) const { ++cursor->it; }
+
+  bool eof(const Cursor &cursor) const { return cursor.it == cursor.end; }
+
+  void column(const Cursor &cursor, sqlite3_context *context, int column) const {
+    if (column == 0) {
+      resultValue(context, cursor.it->first);
+    } else {
+      ValueColumns<Value>::result(context, cursor.it->second, column - 1);
+    }
+  }
+
+  // The address of the entry: unique and the same in every scan.
+  sqlite3_int64 rowid(const Cursor &cursor) const {
+    return (sqlite3_int64) reinterpret_cast<intptr_t>(&*cursor.it);
+  }
+
+ private:
+  enum { kScan, kKeyLookup };
+
+  const Map &_map;
+};
+
+// The rows of registerArrayTable(). The rowid is the index plus one.
+template <typename T>
+class ArraySource {
+ public:
+  struct Cursor {
+    size_t i;
+    size_t end;
+  };
+
+  explicit ArraySource(foc::ArrayRef<T> rows) : _rows(rows) {}
+
+  std::string declaration() const {
+    return "CREATE TABLE x(" + ValueColumns<T>::declaration() + ")";
+  }
+
+  void bestIndex(sqlite3_index_info *info) const {
+    for (int i = 0; i < info->nConstraint; i++) {
+      const auto &constraint = info->aConstraint[i];
+      if (constraint.usable && constraint.iColumn == -1 &&
+          constraint.op == SQLITE_INDEX_CONSTRAINT_EQ) {
+        info->aConstraintUsage[i].argvIndex = 1;
+        info->aConstraintUsage[i].omit = 1;
+        info->idxNum = kRowidLookup;
+        info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+        info->estimatedCost = 1;
+        info->estimatedRows = 1;
+        return;
+      }
+    }
+    info->idxNum = kScan;
+    info->estimatedCost = (double)_rows.size() + 1;
+    info->estimatedRows = (sqlite3_int64)_rows.size();
+  }
+
+  void filter(Cursor *cursor, int idx_num, sqlite3_value **argv) const {
+    cursor->i = 0;
+    cursor->end = _rows.size();
+    if (idx_num == kScan) {
+      return;
+    }
+    int64_t rowid;
+    if (KeyFromValue<int64_t>::get(argv[0], &rowid) && rowid >= 1 &&
+        (uint64_t)rowid <= _rows.size()) {
+      cursor->i = (size_t)rowid - 1;
+      cursor->end = cursor->i + 1;
+    } else {
+      cursor->end = 0;
+    }
+  }
+
+  void next(Cursor *cursor) const { cursor->i++; }
+
+  bool eof(const Cursor &cursor) const { return cursor.i >= cursor.end; }
+
+  void column(const Cursor &cursor, sqlite3_context *context, int column) const {
+    ValueColumns<T>::result(context, _rows[cursor.i], column);
+  }
+
+  sqlite3_int64 rowid(const Cursor &cursor) const { return (sqlite3_int64)cursor.i + 1; }
+
+ private:
+  enum { kScan, kRowidLookup };
+
+  foc::ArrayRef<T> _rows;
+};
+
+// A read-only, eponymous-only virtual table module over the rows of a
+// `Source`, which is the module's client data.
+template <typename Source>
+struct TableModule {
+  struct Table {
+    sqlite3_vtab base;
+    const Source *source;
+  };
+
+  struct Cursor {
+    sqlite3_vtab_cursor base;
+    typename Source::Cursor state;
+  };
+
+  static const Source &source(sqlite3_vtab_cursor *cursor) {
+    return *reinterpret_cast<Table *>(cursor->pVtab)->source;
+  }
+
+  static Cursor *cursorOf(sqlite3_vtab_cursor *cursor) {
+    return reinterpret_cast<Cursor *>(cursor);
+  }
+
+  static int xConnect(sqlite3 *db, void *aux, int, const char *const *, sqlite3_vtab **vtab,
+                      char **) {
+    const Source *source = static_cast<const Source *>(aux);
+    int status = sqlite3_declare_vtab(db, source->declaration().c_str());
+    if (status != SQLITE_OK) {
+      return status;
+    }
+    Table *table = new (std::nothrow) Table();
+    if (table == nullptr) {
+      return SQLITE_NOMEM;
+    }
+    table->source = source;
+    *vtab = &table->base;
+    return SQLITE_OK;
+  }
+
+  static int xDisconnect(sqlite3_vtab *vtab) {
+    delete reinterpret_cast<Table *>(vtab);
+    return SQLITE_OK;
+  }
+
+  static int xBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    reinterpret_cast<Table *>(vtab)->source->bestIndex(info);
+    return SQLITE_OK;
+  }
+
+  static int xOpen(sqlite3_vtab *, sqlite3_vtab_cursor **cursor) {
+    Cursor *table_cursor = new (std::nothrow) Cursor();
+    if (table_cursor == nullptr) {
+      return SQLITE_NOMEM;
+    }
+    *cursor = &table_cursor->base;
+    return SQLITE_OK;
+  }
+
+  static int xClose(sqlite3_vtab_cursor *cursor) {
+    delete cursorOf(cursor);
+    return SQLITE_OK;
+  }
+
+  static int xFilter(sqlite3_vtab_cursor *cursor, int idx_num, const char *, int,
+                     sqlite3_value **argv) {
+    source(cursor).filter(&cursorOf(cursor)->state, idx_num, argv);
+    return SQLITE_OK;
+  }
+
+  static int xNext(sqlite3_vtab_cursor *cursor) {
+    source(cursor).next(&cursorOf(cursor)->state);
+    return SQLITE_OK;
+  }
+
+  static int xEof(sqlite3_vtab_cursor *cursor) {
+    return source(cursor).eof(cursorOf(cursor)->state);
+  }
+
+  static int xColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column) {
+    source(cursor).column(cursorOf(cursor)->state, context, column);
+    return SQLITE_OK;
+  }
+
+  static int xRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid) {
+    *rowid = source(cursor).rowid(cursorOf(cursor)->state);
+    return SQLITE_OK;
+  }
+
+  static void destroy(void *source) { delete static_cast<Source *>(source); }
+
+  // See ArrayModule::methods().
+  static sqlite3_module methods() {
+    sqlite3_module module;
+    memset(&module, 0, sizeof(module));
+    module.xConnect = xConnect;
+    module.xBestIndex = xBestIndex;
+    module.xDisconnect = xDisconnect;
+    module.xOpen = xOpen;
+    module.xClose = xClose;
+    module.xFilter = xFilter;
+    module.xNext = xNext;
+    module.xEof = xEof;
+    module.xColumn = xColumn;
+    module.xRowid = xRowid;
+    return module;
+  }
+};
+
+template <typename Source>
+int registerTable(sqlite3 *db, const char *name, Source *source) {
+  static const sqlite3_module module = TableModule<Source>::methods();
+  // Deletes `source` when the module is dropped, or now if this fails.
+  return sqlite3_create_module_v2(db, name, &module, source, TableModule<Source>::destroy);
+}
+
+}  // namespace detail
+
+// Present `map` as the read-only table `name` of `db`, so SQL can join with
+// it without copying it into a table first:
+//
+//   struct Price {
+//     double amount;
+//     std::string currency;
+//   };
+//   SQLKIT_FIELDS(Price, amount, currency)
+//
+//   foc::HashArrayMappedTrie<int64_t, Price> prices;
+//   registerMapTable(db.raw(), "prices", prices);
+//
+//   SELECT o.id, p.amount FROM orders o JOIN prices p ON p.key = o.product_id
+//
+// The columns are `key` and `value`, or `key` and the fields of a struct
+// mapped with SQLKIT_FIELDS. `key = ?` is a single find() rather than a
+// scan, for integer, floating-point and std::string keys. Any map with
+// find(), begin(), end() and size() works (e.g. std::unordered_map).
+//
+// The table reads `map` directly: it must outlive `db` and must not be
+// modified while a statement reads the table.
+template <typename Map>
+int registerMapTable(sqlite3 *db, const char *name, const Map &map) {
+  return detail::registerTable(db, name, new detail::MapSource<Map>(map));
+}
+
+// Present `rows` as the read-only table `name` of `db`. The columns are
+// `value`, or the fields of a struct mapped with SQLKIT_FIELDS. The rowid is
+// the index of the row plus one, `rowid = ?` reads a single element. The
+// array must outlive `db`.
+template <typename T>
+int registerArrayTable(sqlite3 *db, const char *name, foc::ArrayRef<T> rows) {
+  return detail::registerTable(db, name, new detail::ArraySource<T>(rows));
+}
+
+// }}}
+
+// SQL functions {{{
+
+// Flags of Handle::function() and Handle::aggregate().
+enum FunctionFlags {
+  // Same result for the same arguments: calls with constant arguments are
+  // evaluated once and the function can be used in indexes.
+  kDeterministic = 1,
+  // Free of side effects, so schemas (views, triggers) can use it. Needs
+  // SQLite 3.31, ignored with older versions.
+  kInnocuous = 2,
+  // Only callable from top-level SQL, not from schemas. Needs SQLite 3.31.
+  kDirectOnly = 4,
+};
+
+namespace detail {
+
+// Converts an argument of an SQL function to T like ColumnExtractor does for
+// columns. Text and blobs are views valid until the function returns.
+template <typename T, typename Enable = void>
+struct ValueExtractor;
+
+// Other integral types, converted from int64.
+template <typename T>
+struct ValueExtractor<T, typename std::enable_if<std::is_integral<T>::value &&
+                                                 !std::is_same<T, int>::value &&
+                                                 !std::is_same<T, int64_t>::value>::type> {
+  T operator()(sqlite3_value *value) { return (T)sqlite3_value_int64(value); }
+};
+
+template <>
+struct ValueExtractor<int> {
+  int operator()(sqlite3_value *value) { return sqlite3_value_int(value); }
+};
+
+template <>
+struct ValueExtractor<int64_t> {
+  int64_t operator()(sqlite3_value *value) { return sqlite3_value_int64(value); }
+};
+
+template <>
+struct ValueExtractor<double> {
+  double operator()(sqlite3_value *value) { return sqlite3_value_double(value); }
+};
+
+template <>
+struct ValueExtractor<const char *> {
+  // nullptr if the value is NULL.
+  const char *operator()(sqlite3_value *value) {
+    return (const char *)sqlite3_value_text(value);
+  }
+};
+
+template <>
+struct ValueExtractor<foc::StringRef> {
+  foc::StringRef operator()(sqlite3_value *value) {
+    // sqlite3_value_bytes() must be called after sqlite3_value_text().
+    const char *text = (const char *)sqlite3_value_text(value);
+    return foc::StringRef(text, sqlite3_value_bytes(value));
+  }
+};
+
+template <>
+struct ValueExtractor<std::string> {
+  std::string operator()(sqlite3_value *value) {
+    return ValueExtractor<foc::StringRef>()(value).str();
+  }
+};
+
+template <>
+struct ValueExtractor<foc::ArrayRef<uint8_t>> {
+  foc::ArrayRef<uint8_t> operator()(sqlite3_value *value) {
+    const uint8_t *blob = (const uint8_t *)sqlite3_value_blob(value);
+    return foc::ArrayRef<uint8_t>(blob, sqlite3_value_bytes(value));
+  }
+};
+
+template <>
+struct ValueExtractor<sqlite3_value *> {
+  sqlite3_value *operator()(sqlite3_value *value) { return value; }
+};
+
+template <typename... Ts>
+struct TypeList {};
+
+// The result and the (decayed) parameter types of a function pointer or a
+// lambda.
+template <typename F>
+struct FunctionTraits : FunctionTraits<decltype(&F::operator())> {};
+
+template <typename R, typename... Args>
+struct FunctionTraits<R (*)(Args...)> {
+  typedef R result_type;
+  typedef TypeList<typename std::decay<Args>::type...> arguments;
+};
+
+template <typename C, typename R, typename... Args>
+struct FunctionTraits<R (C::*)(Args...) const> : FunctionTraits<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct FunctionTraits<R (C::*)(Args...)> : FunctionTraits<R (*)(Args...)> {};
+
+// Call `fn` and make what it returns the result of the SQL function.
+template <typename R>
+struct Invoker {
+  template <typename F, typename... Args>
+  static void call(sqlite3_context *context, F &fn, Args &&... args) {
+    resultValue(context, fn(std::forward<Args>(args)...));
+  }
+};
+
+template <>
+struct Invoker<void> {
+  // The result stays NULL.
+  template <typename F, typename... Args>
+  static void call(sqlite3_context *, F &fn, Args &&... args) {
+    fn(std::forward<Args>(args)...);
+  }
+};
+
+inline int functionTextRep(int flags) {
+  int text_rep = SQLITE_UTF8;
+  if (flags & kDeterministic) {
+    text_rep |= SQLITE_DETERMINISTIC;
+  }
+#ifdef SQLITE_INNOCUOUS
+  if (flags & kInnocuous) {
+    text_rep |= SQLITE_INNOCUOUS;
+  }
+#endif
+#ifdef SQLITE_DIRECTONLY
+  if (flags & kDirectOnly) {
+    text_rep |= SQLITE_DIRECTONLY;
+  }
+#endif
+  return text_rep;
+}
+
+// The xFunc of Handle::function(). The user data is the F.
+template <typename F, typename Args = typename FunctionTraits<F>::arguments>
+struct ScalarFunction;
+
+template <typename F, typename... Args>
+struct ScalarFunction<F, TypeList<Args...>> {
+  static const int kNumArgs = sizeof...(Args);
+
+  static void call(sqlite3_context *context, int, sqlite3_value **argv) {
+    call(context, argv, typename MakeIndexSequence<sizeof...(Args)>::type());
+  }
+
+  template <size_t... Is>
+  static void call(sqlite3_context *context, sqlite3_value **argv, IndexSequence<Is...>) {
+    F &fn = *static_cast<F *>(sqlite3_user_data(context));
+    Invoker<typename FunctionTraits<F>::result_type>::call(
+        context, fn, ValueExtractor<Args>()(argv[Is])...);
+    (void)argv;
+  }
+
+  static void destroy(void *fn) { delete static_cast<F *>(fn); }
+};
+
+// The xStep and xFinal of Handle::aggregate(). The user data is a
+// Functions. Each group's State lives in the memory SQLite allocates for the
+// group with sqlite3_aggregate_context(), which is zeroed.
+template <typename State, typename Step, typename Final,
+          typename Args = typename FunctionTraits<Step>::arguments>
+struct AggregateFunction {
+  static_assert(sizeof(Args) == 0, "The first parameter of step must be State &");
+};
+
+template <typename State, typename Step, typename Final, typename... Args>
+struct AggregateFunction<State, Step, Final, TypeList<State, Args...>> {
+  static const int kNumArgs = sizeof...(Args);
+
+  struct Functions {
+    Step step;
+    Final final;
+  };
+
+  struct Slot {
+    bool constructed;
+    typename std::aligned_storage<sizeof(State), alignof(State)>::type state;
+  };
+  // sqlite3_malloc() aligns to 8 bytes.
+  static_assert(alignof(Slot) <= 8, "State is overaligned");
+
+  static void step(sqlite3_context *context, int, sqlite3_value **argv) {
+    Slot *slot = static_cast<Slot *>(sqlite3_aggregate_context(context, sizeof(Slot)));
+    if (slot == nullptr) {
+      sqlite3_result_error_nomem(context);
+      return;
+    }
+    if (!slot->constructed) {
+      new (&slot->state) State();
+      slot->constructed = true;
+    }
+    step(context, *reinterpret_cast<State *>(&slot->state), argv,
+         typename MakeIndexSequence<sizeof...(Args)>::type());
+  }
+
+  template <size_t... Is>
+  static void step(sqlite3_context *context, State &state, sqlite3_value **argv,
+                   IndexSequence<Is...>) {
+    Functions &fns = *static_cast<Functions *>(sqlite3_user_data(context));
+    fns.step(state, ValueExtractor<Args>()(argv[Is])...);
+    (void)argv;
+  }
+
+  // Also called when the statement is reset or finalized midway, so the
+  // state is always destroyed.
+  static void final(sqlite3_context *context) {
+    typedef typename FunctionTraits<Final>::result_type Result;
+    Functions &fns = *static_cast<Functions *>(sqlite3_user_data(context));
+    Slot *slot = static_cast<Slot *>(sqlite3_aggregate_context(context, 0));
+    if (slot && slot->constructed) {
+      State &state = *reinterpret_cast<State *>(&slot->state);
+      Invoker<Result>::call(context, fns.final, state);
+      state.~State();
+    } else {
+      // No rows in the group.
+      State state;
+      Invoker<Result>::call(context, fns.final, state);
+    }
+  }
+
+  static void destroy(void *fns) { delete static_cast<Functions *>(fns); }
+};
+
+}  // namespace detail
+
+// }}}
+
+// Owned parameters {{{
+
+namespace detail {
+
+// Below this size Stmt::bindOwned() copies the bytes instead, which is
+// cheaper than handing them over.
+const size_t kMinOwnedSize = 1024;
+
+// The owner of the bytes of a parameter bound with Stmt::bindOwned().
+struct OwnedBuffer {
+  virtual ~OwnedBuffer() {}
+};
+
+template <typename Owner>
+struct OwnedBufferOf : OwnedBuffer {
+  explicit OwnedBufferOf(Owner &&owner) : owner(std::move(owner)) {}
+
+  Owner owner;
+};
+
+// Calls `release` when SQLite is done with the bytes.
+template <typename Release>
+struct ReleasedBuffer : OwnedBuffer {
+  explicit ReleasedBuffer(Release release) : release(std::move(release)) {}
+  ~ReleasedBuffer() { release(); }
+
+  Release release;
+};
+
+inline int bindCopy(sqlite3_stmt *stmt, unsigned int i, const void *data, size_t size,
+                    bool text) {
+  // A null pointer would bind NULL.
+  data = data ? data : "";
+  return text ? sqlite3_bind_text64(stmt, i, static_cast<const char *>(data), size,
+                                    SQLITE_TRANSIENT, SQLITE_UTF8)
+              : sqlite3_bind_blob64(stmt, i, data, size, SQLITE_TRANSIENT);
+}
+
+// Bind the `size` bytes at `data` as text or a blob without copying them.
+// `owner` keeps them alive and is deleted exactly once: when SQLite is done
+// with the value, or before returning if binding fails.
+int bindOwnedBuffer(sqlite3_stmt *stmt, unsigned int i, const void *data, size_t size, bool text,
+                    OwnedBuffer *owner);
+
+}  // namespace detail
+
+// }}}
+
+class Handle;
+class PositionedRow;
+
+// Result rows {{{
+
+// An input range over the rows of a statement, decoded by `Decoder` (see
+// detail::RowDecoder). The statement is stepped lazily as the range is
+// iterated, so rows are never materialized into a container.
+//
+//   auto users = stmt.rows<int64_t, foc::StringRef>();
+//   for (const auto &user : users) {
+//     ...
+//   }
+//   if (users.status() != SQLITE_DONE) {
+//     // The iteration stopped because of an error.
+//   }
+//
+// Like the statement, the range can only be iterated once. begin() takes the
+// first step. Views in the rows are valid until the iterator is incremented.
+template <typename Decoder>
+class RowRange {
+ public:
+  typedef typename Decoder::value_type value_type;
+
+  class iterator {
+   public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef typename Decoder::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type *pointer;
+    typedef value_type reference;
+
+    iterator() : _range(nullptr) {}
+    explicit iterator(RowRange *range) : _range(range) {}
+
+    // Rows are decoded on access.
+    value_type operator*() const {
+      assert(_range && _range->_status == SQLITE_ROW && "Dereferencing the end of a RowRange");
+      return Decoder::decode(_range->_stmt);
+    }
+
+    iterator &operator++() {
+      _range->step();
+      return *this;
+    }
+
+    void operator++(int) { ++*this; }
+
+    bool operator==(const iterator &rhs) const { return atEnd() == rhs.atEnd(); }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+
+   private:
+    bool atEnd() const { return _range == nullptr || _range->_status != SQLITE_ROW; }
+
+    RowRange *_range;
+  };
+
+  // A range created with an error `status` (e.g. from binding) is empty and
+  // reports that error.
+  explicit RowRange(sqlite3_stmt *stmt, int status = SQLITE_OK)
+      : _stmt(stmt), _status(status), _started(false) {
+    assert((unsigned int)sqlite3_column_count(stmt) >= Decoder::kNumColumns &&
+           "Trying to extract too many columns");
+  }
+
+  iterator begin() {
+    assert(!_started && "RowRange can only be iterated once");
+    _started = true;
+    if (_status == SQLITE_OK) {
+      step();
+    }
+    return iterator(this);
+  }
+
+  iterator end() { return iterator(); }
+
+  // SQLITE_OK before the iteration, SQLITE_ROW during it and SQLITE_DONE
+  // after all rows were visited. Any other value is the error that stopped it.
+  int status() const { return _status; }
+
+ private:
+  void step() {
+    _status = sqlite3_step(_stmt);
+#ifndef NDEBUG
+    if (_status != SQLITE_ROW && _status != SQLITE_DONE) {
+      fprintf(stderr, "sqlkit: Failed to step through query results: %s",
+              sqlite3_errmsg(sqlite3_db_handle(_stmt)));
+    }
+#endif
+  }
+
+  sqlite3_stmt *_stmt;
+  int _status;
+  bool _started;
+};
+
+// }}}
+
+// Columnar batches {{{
+
+// A column of strings stored back to back in one arena. The i-th string is
+// `arena[offsets[i], offsets[i + 1])`, so a column of N strings is two
+// allocations instead of N.
+class StringColumn {
+ public:
+  StringColumn() { _offsets.push_back(0); }
+
+  size_t size() const { return _offsets.size() - 1; }
+  bool empty() const { return size() == 0; }
+
+  foc::StringRef operator[](size_t i) const {
+    assert(i < size());
+    return foc::StringRef(_arena.data() + _offsets[i], _offsets[i + 1] - _offsets[i]);
+  }
+
+  // Bytes of strings a column can hold, the limit of the 32-bit offsets.
+  static const size_t kMaxBytes = UINT32_MAX;
+
+  // Whether `num_bytes` more bytes of strings fit.
+  bool fits(size_t num_bytes) const { return num_bytes <= kMaxBytes - _arena.size(); }
+
+  void push_back(foc::StringRef str) {
+    assert(fits(str.size()) && "StringColumn arena is full");
+    _arena.append(str.begin(), str.end());
+    _offsets.push_back((uint32_t)_arena.size());
+  }
+
+  void reserve(size_t num_strings, size_t num_bytes) {
+    _offsets.reserve(num_strings + 1);
+    _arena.reserve(num_bytes);
+  }
+
+  void clear() {
+    _arena.clear();
+    _offsets.resize(1);
+  }
+
+  foc::ArrayRef<char> arena() const { return _arena; }
+  // size() + 1 offsets starting with 0
+  foc::ArrayRef<uint32_t> offsets() const { return _offsets; }
+
+ private:
+  foc::SmallVector<char, 64> _arena;
+  foc::SmallVector<uint32_t, 16> _offsets;
+};
+
+namespace detail {
+
+// Append column `i` of the current row to a column buffer. Unlike the
+// ColumnExtractors, NULL is accepted and appended as 0 or an empty string.
+
+inline void appendColumn(sqlite3_stmt *stmt, unsigned int i, foc::SmallVectorImpl<int> &column) {
+  column.push_back(sqlite3_column_int(stmt, i));
+}
+
+inline void appendColumn(sqlite3_stmt *stmt,
+                         unsigned int i,
+                         foc::SmallVectorImpl<int64_t> &column) {
+  column.push_back(sqlite3_column_int64(stmt, i));
+}
+
+inline void appendColumn(sqlite3_stmt *stmt,
+                         unsigned int i,
+                         foc::SmallVectorImpl<double> &column) {
+  column.push_back(sqlite3_column_double(stmt, i));
+}
+
+inline void appendColumn(sqlite3_stmt *stmt, unsigned int i, StringColumn &column) {
+  column.push_back(ColumnExtractor<foc::StringRef>()(stmt, i));
+}
+
+// Whether column `i` of the current row fits in a column buffer. Only a
+// StringColumn can be full.
+
+template <typename T>
+bool columnFits(sqlite3_stmt *, unsigned int, const foc::SmallVectorImpl<T> &) {
+  return true;
+}
+
+inline bool columnFits(sqlite3_stmt *stmt, unsigned int i, const StringColumn &column) {
+  // sqlite3_column_bytes() must follow sqlite3_column_text() to count the
+  // converted text. appendColumn() reuses the conversion.
+  sqlite3_column_text(stmt, i);
+  return column.fits(sqlite3_column_bytes(stmt, i));
+}
+
+inline bool columnsFit(sqlite3_stmt *, unsigned int) { return true; }
+
+template <typename Column, typename... Tail>
+bool columnsFit(sqlite3_stmt *stmt, unsigned int i, const Column &column, const Tail &... tail) {
+  return columnFits(stmt, i, column) && columnsFit(stmt, i + 1, tail...);
+}
+
+inline void appendColumns(sqlite3_stmt *, unsigned int) {}
+
+template <typename Column, typename... Tail>
+void appendColumns(sqlite3_stmt *stmt, unsigned int i, Column &column, Tail &... tail) {
+  appendColumn(stmt, i, column);
+  appendColumns(stmt, i + 1, tail...);
+}
+
+template <typename T>
+void reserveColumn(size_t n, foc::SmallVectorImpl<T> &column) {
+  column.reserve(column.size() + n);
+}
+
+inline void reserveColumn(size_t n, StringColumn &column) {
+  // Only the offsets. The arena grows geometrically.
+  column.reserve(column.size() + n, column.arena().size());
+}
+
+inline void reserveColumns(size_t) {}
+
+template <typename Column, typename... Tail>
+void reserveColumns(size_t n, Column &column, Tail &... tail) {
+  reserveColumn(n, column);
+  reserveColumns(n, tail...);
+}
+
+}  // namespace detail
+
+// }}}
+
+class Stmt {
+ public:
+  Stmt() : _handle(nullptr) {}
+
+  Stmt(Stmt &&rhs) : _handle(rhs._handle) { rhs._handle = nullptr; }
+
+  Stmt &operator=(Stmt &&rhs) {
+    if (this != &rhs) {
+      if (_handle != rhs._handle) {
+        finalize();
+      }
+      _handle = rhs._handle;
+      rhs._handle = nullptr;
+    }
+    return *this;
+  }
+
+  ~Stmt() noexcept { finalize(); }
+
+  bool isInitialized() const { return _handle != nullptr; }
+  sqlite3_stmt *raw() { return _handle; };
+
+  const char *sql() const { return sqlite3_sql(_handle); }
+
+  // A performance counter of the statement, e.g. SQLITE_STMTSTATUS_FULLSCAN_STEP
+  // or SQLITE_STMTSTATUS_VM_STEP. `reset` zeroes it after reading.
+  //
+  // https://www.sqlite.org/c3ref/stmt_status.html
+  int counter(int op, bool reset = false) { return sqlite3_stmt_status(_handle, op, reset); }
+
+  // Called by the destructor.
+  //
+  // https://www.sqlite.org/c3ref/finalize.html
+  int finalize() {
+    // Invoking sqlite3_finalize() on a NULL pointer is a harmless no-op.
+    int status = sqlite3_finalize(_handle);
+    if (status != SQLITE_OK) {
+#ifndef NDEBUG
+      fprintf(stderr, "sqlkit: Something went wrong while finalizing prepared statement");
+#endif
+    }
+    // From https://www.sqlite.org/c3ref/finalize.html
+    //
+    // The application must finalize every prepared statement in order to avoid
+    // resource leaks. It is a grievous error for the application to try to use a
+    // prepared statement after it has been finalized. Any use of a prepared
+    // statement after it has been finalized can result in undefined and
+    // undesirable behavior such as segfaults and heap corruption.
+    _handle = nullptr;
+    return status;
+  }
+
+  // Binding API {{{
+
+  // 1-based index of binding parameter named `param`.
+  //
+  // @return 0 if parameter is not found
+  unsigned int index(const char *param) {
+    unsigned int i = (unsigned int)sqlite3_bind_parameter_index(_handle, param);
+    if (i < 1) {
+#ifndef NDEBUG
+      fprintf(stderr, "sqlkit: Couldn't find binding parameter: %s", param);
+#endif
+    }
+    return i;
+  }
+
+  // method       | typeof(value)         | sqlite3 API
+  // -------------+-----------------------+----------------------
+  // bind         | const void *          | sqlite3_bind_blob64
+  // bindStatic   | const void *          | sqlite3_bind_blob64
+  // bind         | double                | sqlite3_bind_double
+  // bind         | int                   | sqlite3_bind_int
+  // bind         | int64_t               | sqlite3_bind_int64
+  // bindNull     | N/A                   | sqlite3_bind_null
+  // bind         | const char *          | sqlite3_bind_text
+  // bind         | std::string           | sqlite3_bind_text
+  // bindStatic   | const char *          | sqlite3_bind_text
+  // bindStatic   | std::string           | sqlite3_bind_text
+  // bind         | sqlite3_value *       | sqlite3_bind_value
+  // bindZeroblob | N/A                   | sqlite3_bind_zeroblob64 (fill it with Blob)
+  // bindOwned    | std::string           | sqlite3_bind_text64
+  // bindOwned    | SmallVector<char>     | sqlite3_bind_text64
+  // bindOwned    | std::vector<uint8_t>  | sqlite3_bind_blob64
+  // bindOwned    | StringRef, release    | sqlite3_bind_text64
+  // bindOwned    | ArrayRef<uint8_t>, .. | sqlite3_bind_blob64
+  // bindArray    | ArrayRef<int64_t>     | sqlite3_bind_pointer
+  // bindArray    | ArrayRef<double>      | sqlite3_bind_pointer
+  // bindArray    | ArrayRef<StringRef>   | sqlite3_bind_pointer
+  //
+  // `sqlite3_bind_text16` is not covered.
+  // `sqlite3_bind_blob` and `sqlite3_bind_zeroblob` are not used in favor of
+  // `sqlite3_bind_blob64` and `sqlite3_bind_zeroblob64`.
+
+  // Bind BLOB
+
+  int bind(unsigned int i, const void *value, size_t size) {
+    int status = sqlite3_bind_blob64(_handle, i, value, size, SQLITE_TRANSIENT);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bind(const char *param, const void *value, size_t size) {
+    return bind(index(param), value, size);
+  }
+
+  int bindStatic(unsigned int i, const void *value, size_t size) {
+    int status = sqlite3_bind_blob64(_handle, i, value, size, SQLITE_STATIC);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bindStatic(const char *param, const void *value, size_t size) {
+    return bindStatic(index(param), value, size);
+  }
+
+  // Bind double
+
+  int bind(unsigned int i, double value) {
+    int status = sqlite3_bind_double(_handle, i, value);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bind(const char *param, double value) { return bind(index(param), value); }
+
+  // Bind int
+
+  int bind(unsigned int i, int value) {
+    int status = sqlite3_bind_int(_handle, i, value);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bind(const char *param, int value) { return bind(index(param), value); }
+
+  // Bind int64
+
+  int bind(unsigned int i, int64_t value) {
+    int status = sqlite3_bind_int64(_handle, i, value);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bind(const char *param, int64_t value) { return bind(index(param), value); }
+
+  // Bind NULL
+
+  int bindNull(unsigned int i) {
+    int status = sqlite3_bind_null(_handle, i);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bindNull(const char *param) { return bindNull(index(param)); }
+
+  // Bind const char *
+
+  int bind(unsigned int i, const char *value, size_t size) {
+    int status = sqlite3_bind_text(_handle, i, value, size, SQLITE_TRANSIENT);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bindStatic(unsigned int i, const char *value, size_t size) {
+    int status = sqlite3_bind_text(_handle, i, value, size, SQLITE_STATIC);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bind(const char *param, const char *value, size_t size) {
+    return bind(index(param), value, size);
+  }
+
+  int bindStatic(const char *param, const char *text, size_t size) {
+    return bindStatic(index(param), text, size);
+  }
+
+  // Bind std::string
+
+  int bind(unsigned int i, const std::string &value) {
+    return bind(i, value.c_str(), value.size());
+  }
+
+  int bindStatic(unsigned int i, const std::string &value) {
+    return bindStatic(i, value.c_str(), value.size());
+  }
+
+  int bind(const char *param, const std::string &value) { return bind(index(param), value); }
+
+  int bindStatic(const char *param, const std::string &value) {
+    return bindStatic(index(param), value);
+  }
+
+  // Bind const sqlite3_value *
+
+  // TODO: test
+  int bind(unsigned int i, const sqlite3_value *value) {
+    int status = sqlite3_bind_value(_handle, i, value);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bind(const char *param, const sqlite3_value *value) { return bind(index(param), value); }
+
+  // Bind zeroed BLOB
+
+  int bindZeroblob(unsigned int i, size_t size) {
+    int status = sqlite3_bind_zeroblob64(_handle, i, size);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  int bindZeroblob(const char *param, size_t size) { return bindZeroblob(index(param), size); }
+
+  // Bind text or a blob without copying it: SQLite takes over the value and
+  // destroys it when it's done with it (when the parameter is bound again,
+  // the bindings are cleared or the statement is finalized), exactly once.
+  // Values smaller than detail::kMinOwnedSize bytes are copied instead.
+  //
+  //   std::string json = encode(document);
+  //   stmt.bindOwned(1, std::move(json));
+  //
+  // std::string and SmallVector<char> are bound as text, std::vector<uint8_t>
+  // as a blob.
+
+  int bindOwned(unsigned int i, std::string &&value) {
+    return bindOwnedValue(i, std::move(value), true);
+  }
+
+  template <unsigned N>
+  int bindOwned(unsigned int i, foc::SmallVector<char, N> &&value) {
+    return bindOwnedValue(i, std::move(value), true);
+  }
+
+  int bindOwned(unsigned int i, std::vector<uint8_t> &&value) {
+    return bindOwnedValue(i, std::move(value), false);
+  }
+
+  int bindOwned(const char *param, std::string &&value) {
+    return bindOwned(index(param), std::move(value));
+  }
+
+  template <unsigned N>
+  int bindOwned(const char *param, foc::SmallVector<char, N> &&value) {
+    return bindOwned(index(param), std::move(value));
+  }
+
+  int bindOwned(const char *param, std::vector<uint8_t> &&value) {
+    return bindOwned(index(param), std::move(value));
+  }
+
+  // Bind text or a blob owned by something else, e.g. an arena, without
+  // copying it. `release()` is called exactly once when SQLite is done with
+  // the bytes, which must stay alive and unchanged until then. The same
+  // bytes can be bound to several parameters or statements; the releases are
+  // then called as the bindings are dropped, in no particular order.
+
+  template <typename Release>
+  int bindOwned(unsigned int i, foc::StringRef text, Release release) {
+    return bindReleased(i, text.data(), text.size(), true, std::move(release));
+  }
+
+  template <typename Release>
+  int bindOwned(unsigned int i, foc::ArrayRef<uint8_t> blob, Release release) {
+    return bindReleased(i, blob.data(), blob.size(), false, std::move(release));
+  }
+
+  template <typename Release>
+  int bindOwned(const char *param, foc::StringRef text, Release release) {
+    return bindOwned(index(param), text, std::move(release));
+  }
+
+  template <typename Release>
+  int bindOwned(const char *param, foc::ArrayRef<uint8_t> blob, Release release) {
+    return bindOwned(index(param), blob, std::move(release));
+  }
+
+  // Bind an array for sqlkit_array() (see registerArrayFunction()) without
+  // copying it. The array must stay alive and unchanged until the statement
+  // is reset.
+
+  int bindArray(unsigned int i, foc::ArrayRef<int64_t> values) {
+    return bindArray(i, detail::ArrayParameter::kInt64, values.data(), values.size());
+  }
+
+  int bindArray(unsigned int i, foc::ArrayRef<double> values) {
+    return bindArray(i, detail::ArrayParameter::kDouble, values.data(), values.size());
+  }
+
+  int bindArray(unsigned int i, foc::ArrayRef<foc::StringRef> values) {
+    return bindArray(i, detail::ArrayParameter::kText, values.data(), values.size());
+  }
+
+  template <typename T>
+  int bindArray(const char *param, foc::ArrayRef<T> values) {
+    return bindArray(index(param), values);
+  }
+
+  // Bind all parameters at once
+  //
+  //   stmt.bindAll(id, name, 3.5);  // bind(1, id), bind(2, name), bind(3, 3.5)
+  //
+  // The bind function of each argument is picked at compile time. Supported
+  // types are int, int64_t, double, nullptr, const char *, std::string,
+  // foc::StringRef (bound as TEXT) and foc::ArrayRef<uint8_t> (bound as BLOB).
+  // Strings and blobs are copied by SQLite.
+
+  template <typename... Args>
+  int bindAll(const Args &... args) {
+    assert(sizeof...(Args) == (size_t)sqlite3_bind_parameter_count(_handle) &&
+           "Number of arguments doesn't match the number of parameters");
+    int status = detail::bindValues(_handle, 1, args...);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  // Bind the fields of a struct mapped with SQLKIT_FIELDS to the parameters
+  // 1, 2, ... in order.
+
+  template <typename Struct>
+  int bindStruct(const Struct &obj) {
+    typedef typename detail::FieldsOf<Struct>::type Fields;
+    assert(Fields::kNumFields == (unsigned int)sqlite3_bind_parameter_count(_handle) &&
+           "Number of fields doesn't match the number of parameters");
+    int status = detail::bindFields(_handle, obj, Fields());
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+  // }}}
+
+  // Result extraction API {{{
+
+  // Get the number of columns in the result set
+  unsigned int numColumns() { return sqlite3_column_count(_handle); }
+
+  // Byte size methods
+
+  int blobColumnSize(unsigned int i) { return sqlite3_column_bytes(_handle, i); }
+  int utf8ColumnSizeInBytes(unsigned int i) { return sqlite3_column_bytes(_handle, i); }
+  int utf16ColumnSizeInBytes(unsigned int i) { return sqlite3_column_bytes16(_handle, i); }
+
+  // Get the default datatype of the column in the result:
+  //
+  // SQLITE_INTEGER  1
+  // SQLITE_FLOAT    2
+  // SQLITE_BLOB     4
+  // SQLITE_NULL     5
+  // SQLITE_TEXT     3
+  //
+  // See https://www.sqlite.org/c3ref/c_blob.html
+  int columnType(unsigned int i) { return sqlite3_column_type(_handle, i); }
+
+  bool columnIsNull(unsigned int i) { return sqlite3_column_type(_handle, i) == SQLITE_NULL; }
+
+  const char *columnName(unsigned int i) {
+    assert(i < numColumns());
+    return sqlite3_column_name(_handle, i);
+  }
+
+  const void *columnNameUtf16(unsigned int i) {
+    assert(i < numColumns());
+    return sqlite3_column_name16(_handle, i);
+  }
+
+  // Extract value of a single column.
+  //
+  // column() and column16() take a 0-based index.
+
+  template <typename T>
+  T column(unsigned int i) {
+    assert(i < numColumns());
+    detail::ColumnExtractor<T> extract;
+    return extract(_handle, i);
+  }
+
+  const void *columnUtf16(unsigned int i) {
+    assert(i < numColumns());
+    return sqlite3_column_text16(_handle, i);
+  }
+
+  // Extract value of all columns as a tuple
+
+  template <typename... Ts>
+  std::tuple<Ts...> tuple() {
+    assert(sizeof...(Ts) <= numColumns() && "Trying to extract too many columns");
+    return detail::RowDecoder<std::tuple<Ts...>>::decode(_handle);
+  }
+
+  // Extract the current row into a struct mapped with SQLKIT_FIELDS
+
+  template <typename Struct>
+  Struct row() {
+    static_assert(detail::HasFields<Struct>::value, "Map the struct with SQLKIT_FIELDS");
+    assert(detail::RowDecoder<Struct>::kNumColumns <= numColumns() &&
+           "Trying to extract too many columns");
+    return detail::RowDecoder<Struct>::decode(_handle);
+  }
+
+  // Iterate over the remaining rows as tuples or aggregates
+  //
+  //   for (std::tuple<int, std::string> row : stmt.rows<int, std::string>()) {
+  //   }
+  //
+  //   struct Point {
+  //     double x, y;
+  //   };
+  //   for (Point p : stmt.rowsAs<Point, double, double>()) {
+  //   }
+  //
+  // See RowRange.
+
+  // rows<Struct>() yields the structs if Struct is mapped with SQLKIT_FIELDS.
+  template <typename... Ts>
+  RowRange<typename detail::RowsDecoder<Ts...>::type> rows() {
+    return RowRange<typename detail::RowsDecoder<Ts...>::type>(_handle);
+  }
+
+  template <typename Struct, typename... Cols>
+  RowRange<detail::StructDecoder<Struct, Cols...>> rowsAs() {
+    return RowRange<detail::StructDecoder<Struct, Cols...>>(_handle);
+  }
+
+  // Fetch up to `batch_size` rows and append each column to its own buffer
+  //
+  //   foc::SmallVector<int64_t, 0> ids;
+  //   foc::SmallVector<double, 0> prices;
+  //   StringColumn names;
+  //   int status;
+  //   do {
+  //     status = stmt.fetchColumns(4096, ids, prices, names);
+  //     process(ids, prices, names);  // Up to 4096 rows, maybe none
+  //     ids.clear(), prices.clear(), names.clear();
+  //   } while (status == SQLITE_ROW);
+  //
+  // Columns are foc::SmallVectorImpl<int>, foc::SmallVectorImpl<int64_t>,
+  // foc::SmallVectorImpl<double> or StringColumn (for TEXT), and are mapped
+  // to the result columns 0, 1, 2, ... in order. NULLs are appended as 0 or
+  // as an empty string.
+  //
+  // Returns SQLITE_ROW if the batch was filled and there may be more rows,
+  // SQLITE_DONE if the results were exhausted or an error. The rows fetched
+  // before an error are kept. SQLITE_TOOBIG means a row didn't fit in a
+  // StringColumn (see StringColumn::kMaxBytes); that row is skipped and
+  // none of its columns are appended.
+  //
+  // Like any use of foc::SmallVector, this needs SMALL_VECTOR_IMPLEMENTATION
+  // defined in one translation unit.
+
+  template <typename... Columns>
+  int fetchColumns(size_t batch_size, Columns &... columns) {
+    assert(sizeof...(Columns) <= numColumns() && "Trying to extract too many columns");
+    // Don't trust huge batch sizes meaning "everything" with the reservation.
+    detail::reserveColumns(std::min(batch_size, (size_t)65536), columns...);
+    for (size_t n = 0; n < batch_size; n++) {
+      int status = sqlite3_step(_handle);
+      if (status != SQLITE_ROW) {
+#ifndef NDEBUG
+        if (status != SQLITE_DONE) {
+          fprintf(stderr, "sqlkit: Failed to step through query results: %s",
+                  sqlite3_errmsg(sqlite3_db_handle(_handle)));
+        }
+#endif
+        return status;
+      }
+      if (!detail::columnsFit(_handle, 0, columns...)) {
+#ifndef NDEBUG
+        fprintf(stderr, "sqlkit: Row doesn't fit in a StringColumn");
+#endif
+        return SQLITE_TOOBIG;
+      }
+      detail::appendColumns(_handle, 0, columns...);
+    }
+    return SQLITE_ROW;
+  }
+
+  // }}}
+
+ public:
+  int execute(Handle &db);
+  int query(Handle &db);
+  int step(Handle &db);
+  PositionedRow row();
+
+  int reset() { return sqlite3_reset(_handle); }
+
+  int clearBindings() {
+    int status = sqlite3_clear_bindings(_handle);
+    assert(status == SQLITE_OK);
+    return status;
+  }
+
+ private:
+  int bindArray(unsigned int i, detail::ArrayParameter::Type type, const void *data, size_t size) {
+#if SQLITE_VERSION_NUMBER >= 3020000
+    // SQLite frees the descriptor when the parameter is rebound, even if
+    // binding fails.
+    detail::ArrayParameter *array = new detail::ArrayParameter{type, data, size};
+    int status = sqlite3_bind_pointer(_handle, i, array, detail::arrayPointerType(), &freeArray);
+    assert(status == SQLITE_OK);
+    return status;
+#else
+    (void)i, (void)type, (void)data, (void)size;
+    return SQLITE_MISUSE;
+#endif
+  }
+
+  static void freeArray(void *array) { delete static_cast<detail::ArrayParameter *>(array); }
+
+  template <typename Owner>
+  int bindOwnedValue(unsigned int i, Owner &&value, bool text) {
+    if (value.size() < detail::kMinOwnedSize) {
+      return detail::bindCopy(_handle, i, value.data(), value.size(), text);
+    }
+    typedef detail::OwnedBufferOf<typename std::decay<Owner>::type> Buffer;
+    // Moving keeps the bytes where they are: only the owner is allocated.
+    Buffer *buffer = new Buffer(std::move(value));
+    return detail::bindOwnedBuffer(_handle, i, buffer->owner.data(), buffer->owner.size(), text,
+                                   buffer);
+  }
+
+  template <typename Release>
+  int bindReleased(unsigned int i, const void *data, size_t size, bool text, Release release) {
+    if (size < detail::kMinOwnedSize) {
+      int status = detail::bindCopy(_handle, i, data, size, text);
+      release();
+      return status;
+    }
+    return detail::bindOwnedBuffer(_handle, i, data, size, text,
+                                   new detail::ReleasedBuffer<Release>(std::move(release)));
+  }
+
+  sqlite3_stmt *_handle;
+
+  // Disallow copy constructors
+  Stmt(const Stmt &);
+  void operator=(const Stmt &);
+
+  // Allow database Handle methods to get access to the sqlite3_stmt handle.
+  friend class Handle;
+};
+
+class PositionedRow {
+ public:
+  explicit PositionedRow(Stmt *stmt) : _stmt(stmt), _pos(0) {}
+
+  bool nextIsNull() { return _stmt->columnIsNull(_pos); }
+
+  template <typename T>
+  T next() {
+    return _stmt->column<T>(_pos++);
+  }
+
+  const void *nextBlob(size_t *size) {
+    if (size) {
+      *size = _stmt->blobColumnSize(_pos);
+    }
+    return next<const void *>();
+  }
+
+  double nextDouble() {
+    assert(!nextIsNull());
+    return next<double>();
+  }
+
+  int nextInt() {
+    assert(!nextIsNull());
+    return next<int>();
+  }
+
+  int64_t nextInt64() {
+    assert(!nextIsNull());
+    return next<int64_t>();
+  }
+
+  std::string nextString() {
+    assert(!nextIsNull());
+    return next<std::string>();
+  }
+
+  // Views valid until the statement is stepped again. See ColumnExtractor.
+
+  foc::StringRef nextStringRef() { return next<foc::StringRef>(); }
+
+  foc::ArrayRef<uint8_t> nextBytes() { return next<foc::ArrayRef<uint8_t>>(); }
+
+  // Return value may be nullptr
+  const char *nextCStr(size_t *size) {
+    if (size) {
+      *size = _stmt->blobColumnSize(_pos);
+    }
+    return next<const char *>();
+  }
+
+  // Return value may be nullptr
+  const char *nextCStr() { return nextCStr(nullptr); }
+
+  // Return value may be nullptr
+  const sqlite3_value *nextValue() { return next<sqlite3_value *>(); }
+
+  unsigned int currentPos() const { return _pos; }
+  unsigned int numColumns() { return _stmt->numColumns(); }
+  bool hasMoreColumns() { return _pos < _stmt->numColumns(); }
+  void restart() { _pos = 0; }
+
+  void skip() {
+    assert(_pos < _stmt->numColumns());
+    _pos++;
+  }
+
+  void rewind() {
+    assert(_pos > 0);
+    if (_pos > 0) {
+      _pos--;
+    }
+  }
+
+  sqlite3_stmt *rawStmt() { return _stmt->raw(); }
+
+ private:
+  Stmt *_stmt;
+  unsigned int _pos;
+};
+
+// Statement cache {{{
+
+class CachedStmt;
+
+// An LRU cache of prepared statements keyed by their SQL text. Every Handle
+// owns one and Handle::prepareCached() leases statements from it, so hot
+// queries are compiled by SQLite only once.
+//
+// The cache is bounded both by the number of statements and by the memory
+// SQLite reports for them (SQLITE_STMTSTATUS_MEMUSED). Statements that are
+// leased out aren't counted since they can't be evicted. Like the Handle, the
+// cache must only be used by one thread at a time.
+class StmtCache {
+ public:
+  static const size_t kDefaultCapacity = 64;
+  static const size_t kDefaultMemoryBudget = 2 * 1024 * 1024;
+
+  explicit StmtCache(size_t capacity = kDefaultCapacity,
+                     size_t memory_budget = kDefaultMemoryBudget)
+      : _capacity(capacity),
+        _memory_budget(memory_budget),
+        _memory_used(0),
+        _hits(0),
+        _misses(0),
+        _evictions(0),
+        _head(nullptr),
+        _tail(nullptr) {}
+
+  ~StmtCache() { clear(); }
+
+  // Number of idle statements in the cache.
+  size_t size() const { return _map.size(); }
+  size_t memoryUsed() const { return _memory_used; }
+
+  size_t capacity() const { return _capacity; }
+  size_t memoryBudget() const { return _memory_budget; }
+
+  // A capacity of 0 disables caching.
+  void setCapacity(size_t capacity) {
+    _capacity = capacity;
+    evict();
+  }
+
+  void setMemoryBudget(size_t memory_budget) {
+    _memory_budget = memory_budget;
+    evict();
+  }
+
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+  uint64_t evictions() const { return _evictions; }
+
+  // Finalize all the idle statements. Leased statements are finalized when
+  // they are returned if the cache is full by then.
+  void clear() {
+    while (_tail) {
+      Entry *entry = _tail;
+      remove(entry);
+      delete entry;
+    }
+  }
+
+ private:
+  struct Entry {
+    Entry(foc::StringRef _sql, Stmt &&_stmt)
+        : sql(_sql.str()), stmt(std::move(_stmt)), memory(0), prev(nullptr), next(nullptr) {}
+
+    std::string sql;
+    Stmt stmt;
+    size_t memory;
+    Entry *prev;  //> More recently used
+    Entry *next;  //> Less recently used
+  };
+
+  // Remove the idle statement for `sql` from the cache and return it.
+  Entry *take(foc::StringRef sql) {
+    auto it = _map.find(sql);
+    if (it == _map.end()) {
+      _misses++;
+      return nullptr;
+    }
+    _hits++;
+    Entry *entry = it->second;
+    remove(entry);
+    return entry;
+  }
+
+  // Make a returned statement the most recently used one.
+  void put(Entry *entry) {
+    entry->stmt.reset();
+    entry->stmt.clearBindings();
+    if (_map.count(foc::StringRef(entry->sql))) {
+      // The same SQL was leased twice and the other copy came back first.
+      delete entry;
+      return;
+    }
+#ifdef SQLITE_STMTSTATUS_MEMUSED
+    entry->memory =
+        entry->sql.size() + sqlite3_stmt_status(entry->stmt.raw(), SQLITE_STMTSTATUS_MEMUSED, 0);
+#else
+    entry->memory = entry->sql.size();
+#endif
+    _map.emplace(foc::StringRef(entry->sql), entry);
+    entry->next = _head;
+    if (_head) {
+      _head->prev = entry;
+    } else {
+      _tail = entry;
+    }
+    _head = entry;
+    _memory_used += entry->memory;
+    evict();
+  }
+
+  void remove(Entry *entry) {
+    _map.erase(foc::StringRef(entry->sql));
+    if (entry->prev) {
+      entry->prev->next = entry->next;
+    } else {
+      _head = entry->next;
+    }
+    if (entry->next) {
+      entry->next->prev = entry->prev;
+    } else {
+      _tail = entry->prev;
+    }
+    entry->prev = entry->next = nullptr;
+    _memory_used -= entry->memory;
+  }
+
+  void evict() {
+    while (_tail && (_map.size() > _capacity || _memory_used > _memory_budget)) {
+      Entry *entry = _tail;
+      remove(entry);
+      delete entry;
+      _evictions++;
+    }
+  }
+
+  size_t _capacity;
+  size_t _memory_budget;
+  size_t _memory_used;
+  uint64_t _hits;
+  uint64_t _misses;
+  uint64_t _evictions;
+  // The keys point to Entry::sql.
+  std::unordered_map<foc::StringRef, Entry *, foc::Hash<foc::StringRef>> _map;
+  Entry *_head;  //> Most recently used
+  Entry *_tail;  //> Least recently used
+
+  // Disallow copy constructors
+  StmtCache(const StmtCache &);
+  void operator=(const StmtCache &);
+
+  friend class CachedStmt;
+  friend class Handle;
+};
+
+// A statement leased from a StmtCache. It's returned to the cache, reset and
+// with its bindings cleared, when the lease is destroyed.
+//
+//   CachedStmt stmt = db.prepareCached("SELECT name FROM users WHERE id = ?");
+//   stmt->bind(1, id);
+//   if (stmt->query(db) == SQLITE_ROW) { ... }
+//
+// Leases must be released before the Handle is closed.
+class CachedStmt {
+ public:
+  CachedStmt() : _cache(nullptr), _entry(nullptr) {}
+
+  CachedStmt(CachedStmt &&rhs) : _cache(rhs._cache), _entry(rhs._entry) {
+    rhs._cache = nullptr;
+    rhs._entry = nullptr;
+  }
+
+  CachedStmt &operator=(CachedStmt &&rhs) {
+    if (this != &rhs) {
+      release();
+      _cache = rhs._cache;
+      _entry = rhs._entry;
+      rhs._cache = nullptr;
+      rhs._entry = nullptr;
+    }
+    return *this;
+  }
+
+  ~CachedStmt() noexcept { release(); }
+
+  bool isInitialized() const { return _entry != nullptr; }
+
+  Stmt &stmt() {
+    assert(_entry);
+    return _entry->stmt;
+  }
+
+  Stmt &operator*() { return stmt(); }
+  Stmt *operator->() { return &stmt(); }
+
+  // Return the statement to the cache before the lease is destroyed.
+  void release() {
+    if (_entry) {
+      _cache->put(_entry);
+      _cache = nullptr;
+      _entry = nullptr;
+    }
+  }
+
+ private:
+  CachedStmt(StmtCache *cache, StmtCache::Entry *entry) : _cache(cache), _entry(entry) {}
+
+  StmtCache *_cache;
+  StmtCache::Entry *_entry;
+
+  // Disallow copy constructors
+  CachedStmt(const CachedStmt &);
+  void operator=(const CachedStmt &);
+
+  friend class Handle;
+};
+
+// }}}
+
+class Handle {
+ public:
+  // VM instructions between deadline checks of the calls with a deadline.
+  static const int kDeadlineCheckInterval = 1000;
+
+  Handle() noexcept : _handle(nullptr), _has_deadline(false) {}
+  Handle(Handle &&other) noexcept
+      : _handle(other._handle),
+        _stmt_cache(std::move(other._stmt_cache)),
+        _has_deadline(false) {
+    other._handle = nullptr;
+  }
+
+  Handle &operator=(Handle &&rhs) {
+    if (this != &rhs) {
+      if (_handle != rhs._handle) {
+        if (_handle) {
+          close();
+        }
+        _handle = rhs._handle;
+        _stmt_cache = std::move(rhs._stmt_cache);
+      }
+      rhs._handle = nullptr;
+    }
+    return *this;
+  }
+
+  ~Handle() noexcept {
+    if (_handle) {
+      close();
+    }
+  }
+
+  int open(const char *filename) {
+    int status = sqlite3_open(filename, &_handle);
+    if (status == SQLITE_OK) {
+      status = registerArrayFunction(_handle);
+    }
+    if (status != SQLITE_OK) {
+      // TODO: log debug
+      /*
+      assert(false && "Couldn't open/create database! filename=(%s), error=(%s)",
+              filename,
+              sqlite3_errmsg(_handle));
+      */
+      close();
+    }
+    return status;
+  }
+
+  // `flags` are the SQLITE_OPEN_* flags of sqlite3_open_v2().
+  int open(const char *filename, int flags) {
+    int status = sqlite3_open_v2(filename, &_handle, flags, nullptr);
+    if (status == SQLITE_OK) {
+      status = registerArrayFunction(_handle);
+    }
+    if (status != SQLITE_OK) {
+      close();
+    }
+    return status;
+  }
+
+  // Open and configure the connection. If a setting can't be applied (e.g.
+  // WAL on an in-memory database) the connection is closed and the error
+  // returned.
+  int open(const char *filename, const OpenOptions &options) {
+    int status = open(filename, options.flags);
+    if (status != SQLITE_OK) {
+      return status;
+    }
+    status = configure(options);
+    if (status != SQLITE_OK) {
+      close();
+    }
+    return status;
+  }
+
+  // Apply the settings of `options` other than the flags.
+  int configure(const OpenOptions &options) {
+    static const char *const kJournalModes[] = {
+        nullptr, "delete", "truncate", "persist", "memory", "wal", "off"};
+    char sql[64];
+    int status;
+    if (options.busy_timeout_ms > 0) {
+      sqlite3_busy_timeout(_handle, options.busy_timeout_ms);
+    }
+    if (options.journal_mode != OpenOptions::kJournalDefault) {
+      const char *mode = kJournalModes[options.journal_mode];
+      std::string result;
+      snprintf(sql, sizeof(sql), "PRAGMA journal_mode=%s", mode);
+      status = pragma(sql, &result);
+      if (status != SQLITE_OK) {
+        return status;
+      }
+      // SQLite answers with the mode in effect when it can't switch.
+      if (result != mode) {
+#ifndef NDEBUG
+        fprintf(stderr, "sqlkit: Can't set journal_mode=%s, it's %s", mode, result.c_str());
+#endif
+        return SQLITE_ERROR;
+      }
+    }
+    if (options.wal_autocheckpoint >= 0) {
+      status = sqlite3_wal_autocheckpoint(_handle, options.wal_autocheckpoint);
+      if (status != SQLITE_OK) {
+        return status;
+      }
+    }
+    if (options.mmap_size >= 0) {
+      snprintf(sql, sizeof(sql), "PRAGMA mmap_size=%lld", (long long)options.mmap_size);
+      if ((status = pragma(sql)) != SQLITE_OK) {
+        return status;
+      }
+    }
+    if (options.cache_size != 0) {
+      snprintf(sql, sizeof(sql), "PRAGMA cache_size=%d", options.cache_size);
+      if ((status = pragma(sql)) != SQLITE_OK) {
+        return status;
+      }
+    }
+    if (options.temp_store != OpenOptions::kTempStoreDefault) {
+      snprintf(sql, sizeof(sql), "PRAGMA temp_store=%d", (int)options.temp_store);
+      if ((status = pragma(sql)) != SQLITE_OK) {
+        return status;
+      }
+    }
+    if (options.synchronous != OpenOptions::kSynchronousDefault) {
+      snprintf(sql, sizeof(sql), "PRAGMA synchronous=%d", (int)options.synchronous);
+      if ((status = pragma(sql)) != SQLITE_OK) {
+        return status;
+      }
+    }
+    return SQLITE_OK;
+  }
+
+  // Run a PRAGMA (or any statement) to completion, optionally returning the
+  // first column of the first row as text. PRAGMAs aren't cached since they
+  // can't have parameters and rarely repeat.
+  int pragma(const char *sql, std::string *result = nullptr) {
+    Stmt stmt = prepare(sql);
+    if (!stmt.isInitialized()) {
+      return sqlite3_errcode(_handle);
+    }
+    int status = step(stmt);
+    if (status == SQLITE_ROW && result) {
+      *result = stmt.column<foc::StringRef>(0).str();
+    }
+    while (status == SQLITE_ROW) {
+      status = step(stmt);
+    }
+    return status == SQLITE_DONE ? SQLITE_OK : status;
+  }
+
+  // SQL functions {{{
+
+  // Define the SQL function `name` as `fn`, a function pointer or a lambda
+  // (or other function object with one operator()):
+  //
+  //   db.function("discount", [](double price, int64_t pct) { return price * (100 - pct) / 100; });
+  //   db.function("initials", [](foc::StringRef name) { return name.substr(0, 1).str(); });
+  //
+  //   SELECT discount(price, 15) FROM items WHERE initials(name) = 'A'
+  //
+  // The parameter types (any type with a detail::ValueExtractor: integral
+  // types, double, const char *, foc::StringRef, std::string,
+  // foc::ArrayRef<uint8_t> and sqlite3_value *) fix the number of arguments
+  // and how they are converted, and the return type how the result is set
+  // (see detail::resultValue()); a void function returns NULL. `fn` is moved
+  // into the connection once, calls don't allocate unless a std::string is
+  // converted or returned. Prefer foc::StringRef parameters.
+  //
+  // The default flags let SQLite evaluate calls with constant arguments once
+  // and use the function in indexes and views. Pass 0 (or kDirectOnly) for
+  // functions that aren't pure. Redefining a function replaces it.
+  template <typename F>
+  int function(const char *name, F fn, int flags = kDeterministic | kInnocuous) {
+    typedef detail::ScalarFunction<F> Function;
+    return sqlite3_create_function_v2(_handle, name, Function::kNumArgs,
+                                      detail::functionTextRep(flags), new F(std::move(fn)),
+                                      Function::call, nullptr, nullptr, Function::destroy);
+  }
+
+  // Define the aggregate function `name`. Each group gets a
+  // value-initialized State that `step`, a `void(State &, Args...)`, updates
+  // for each row. `final`, an `R(State &)`, returns the result and is also
+  // called for empty groups. Arguments and results are converted as in
+  // function().
+  //
+  //   struct Stats {
+  //     int64_t n;
+  //     double sum;
+  //   };
+  //   db.aggregate<Stats>(
+  //       "mean", [](Stats &s, double x) { s.n++, s.sum += x; },
+  //       [](Stats &s) { return s.n ? s.sum / s.n : 0.0; });
+  //
+  // The state lives in the memory SQLite allocates for the group and is
+  // destroyed after `final` runs.
+  template <typename State, typename Step, typename Final>
+  int aggregate(const char *name, Step step, Final final,
+                int flags = kDeterministic | kInnocuous) {
+    typedef detail::AggregateFunction<State, Step, Final> Function;
+    typename Function::Functions *fns =
+        new typename Function::Functions{std::move(step), std::move(final)};
+    return sqlite3_create_function_v2(_handle, name, Function::kNumArgs,
+                                      detail::functionTextRep(flags), fns, nullptr,
+                                      Function::step, Function::final, Function::destroy);
+  }
+
+  // }}}
+
+  int close() {
+    // Cached statements would keep the database open.
+    if (_stmt_cache) {
+      _stmt_cache->clear();
+    }
+    int status = sqlite3_close(_handle);
+    if (status == SQLITE_OK) {
+      _handle = nullptr;
+    } else {
+#ifndef NDEBUG
+      fprintf(stderr,
+              "sqlkit: Something wrong happened when trying to close database! (%s)",
+              lastErrorMessage());
+#endif
+    }
+    return status;
+  }
+
+  bool isInitialized() const { return _handle != nullptr; }
+  sqlite3 *raw() { return _handle; }
+
+  // Prepare (compile) statements
+
+  Stmt prepare(const char *sql) { return prepare(sql, -1); }
+
+  Stmt prepare(const std::string &sql) { return prepare(sql.c_str(), sql.size()); }
+
+  Stmt prepare(foc::StringRef sql) { return prepare(sql.data(), (int)sql.size()); }
+
+  Stmt prepare(const char *sql, int num_sql_bytes) { return prepare(sql, num_sql_bytes, 0); }
+
+  // `prep_flags` are the SQLITE_PREPARE_* flags of sqlite3_prepare_v3(). They
+  // are ignored with SQLite versions older than 3.20.
+  Stmt prepare(const char *sql, int num_sql_bytes, unsigned int prep_flags) {
+    Stmt stmt;
+#if SQLITE_VERSION_NUMBER >= 3020000
+    int status =
+        sqlite3_prepare_v3(_handle, sql, num_sql_bytes, prep_flags, &stmt._handle, nullptr);
+#else
+    (void)prep_flags;
+    int status = sqlite3_prepare_v2(_handle, sql, num_sql_bytes, &stmt._handle, nullptr);
+#endif
+
+    if (status != SQLITE_OK) {
+#ifndef NDEBUG
+      fprintf(stderr,
+              "sqlkit: Failed to prepare \"%s\". error_code %d, error_msg \"%s\"",
+              sql,
+              status,
+              lastErrorMessage());
+#endif
+    }
+
+    return stmt;
+  }
+
+  // Lease a prepared statement from the statement cache, preparing it on a
+  // miss. The lease isn't initialized if the SQL fails to compile.
+  //
+  // The statement is only compiled for the first SQL statement in `sql`.
+
+  CachedStmt prepareCached(foc::StringRef sql) {
+    StmtCache &cache = stmtCache();
+    StmtCache::Entry *entry = cache.take(sql);
+    if (entry == nullptr) {
+#ifdef SQLITE_PREPARE_PERSISTENT
+      Stmt stmt = prepare(sql.data(), (int)sql.size(), SQLITE_PREPARE_PERSISTENT);
+#else
+      Stmt stmt = prepare(sql.data(), (int)sql.size());
+#endif
+      if (!stmt.isInitialized()) {
+        return CachedStmt();
+      }
+      entry = new StmtCache::Entry(sql, std::move(stmt));
+    }
+    return CachedStmt(&cache, entry);
+  }
+
+  CachedStmt prepareCached(const char *sql) { return prepareCached(foc::StringRef(sql)); }
+  CachedStmt prepareCached(const std::string &sql) { return prepareCached(foc::StringRef(sql)); }
+
+  // The statement cache used by prepareCached() and execute(). It's created
+  // on first use.
+  StmtCache &stmtCache() {
+    if (!_stmt_cache) {
+      _stmt_cache.reset(new StmtCache());
+    }
+    return *_stmt_cache;
+  }
+
+  // Execute result-less statements
+  //
+  // Statements given as SQL text are prepared through the statement cache.
+
+  int execute(const char *sql, int num_sql_bytes) {
+    foc::StringRef sql_ref = num_sql_bytes < 0 ? foc::StringRef(sql)
+                                               : foc::StringRef(sql, (size_t)num_sql_bytes);
+    CachedStmt stmt = prepareCached(sql_ref);
+    if (!stmt.isInitialized()) {
+      return sqlite3_errcode(_handle);
+    }
+    return execute(*stmt);
+  }
+
+  int execute(const char *sql) { return execute(foc::StringRef(sql)); }
+  int execute(const std::string &sql) { return execute(foc::StringRef(sql)); }
+  int execute(foc::StringRef sql) { return execute(sql.data(), (int)sql.size()); }
+
+  int execute(Stmt &stmt) {
+    int status = sqlite3_step(stmt._handle);
+
+    assert(status != SQLITE_ROW && stmt.numColumns() == 0 &&
+           "Use query() for queries and execute() for result-less statements.");
+
+    switch (status) {
+      case SQLITE_OK:
+      case SQLITE_DONE:
+      case SQLITE_ROW:
+        break;
+      default:
+#ifndef NDEBUG
+        fprintf(stderr, "sqlkit: Failed to execute prepared statement: %s", lastErrorMessage());
+#endif
+        break;
+    }
+
+    // sqlite3_reset() the statement when done, otherwise subsequent calls to
+    // sqlite3_bind_* will crash.
+    return sqlite3_reset(stmt._handle);
+  }
+
+  // Perform queries and step through query results
+
+  int query(Stmt &stmt) {
+    int status = sqlite3_step(stmt._handle);
+
+    assert(status != SQLITE_OK && stmt.numColumns() > 0 &&
+           "Use execute() instead of query() for result-less statements.");
+
+    switch (status) {
+      case SQLITE_OK:
+      case SQLITE_DONE:
+      case SQLITE_ROW:
+        break;
+      default:
+#ifndef NDEBUG
+        fprintf(stderr, "sqlkit: Failed to perform query: %s", lastErrorMessage());
+#endif
+        break;
+    }
+    return status;
+  }
+
+  int step(Stmt &stmt) {
+    int status = sqlite3_step(stmt._handle);
+    switch (status) {
+      case SQLITE_OK:
+      case SQLITE_DONE:
+      case SQLITE_ROW:
+        break;
+      default:
+#ifndef NDEBUG
+        fprintf(stderr, "sqlkit: Failed to step through query results: %s", lastErrorMessage());
+#endif
+        break;
+    }
+    return status;
+  }
+
+  // Deadlines
+  //
+  // The overloads taking a deadline abort the statement with SQLITE_INTERRUPT
+  // once std::chrono::steady_clock passes it, checking the clock every
+  // kDeadlineCheckInterval VM instructions through the progress handler. An
+  // interrupted statement is reset so it doesn't hold on to locks, and an
+  // interrupted write rolls back the transaction.
+  //
+  //   auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+  //   int status = db.query(stmt, deadline);
+  //   if (status == SQLITE_INTERRUPT) {
+  //     ...  // timed out
+  //   }
+
+  int execute(Stmt &stmt, std::chrono::steady_clock::time_point deadline) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return SQLITE_INTERRUPT;
+    }
+    return withDeadline(deadline, [&]() { return execute(stmt); });
+  }
+
+  int query(Stmt &stmt, std::chrono::steady_clock::time_point deadline) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return SQLITE_INTERRUPT;
+    }
+    int status = withDeadline(deadline, [&]() { return query(stmt); });
+    if (status == SQLITE_INTERRUPT) {
+      sqlite3_reset(stmt._handle);
+    }
+    return status;
+  }
+
+  int step(Stmt &stmt, std::chrono::steady_clock::time_point deadline) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      sqlite3_reset(stmt._handle);
+      return SQLITE_INTERRUPT;
+    }
+    int status = withDeadline(deadline, [&]() { return step(stmt); });
+    if (status == SQLITE_INTERRUPT) {
+      sqlite3_reset(stmt._handle);
+    }
+    return status;
+  }
+
+  // Run `fn()` with every statement it runs on this connection bounded by
+  // `deadline`, e.g. to iterate over a whole result set or run a typed
+  // Query:
+  //
+  //   int status = db.withDeadline(deadline, [&]() {
+  //     return by_name.forEach(db, callback, name);
+  //   });
+  //
+  // Statements interrupted inside `fn` are not reset. Calls can nest, the
+  // earliest deadline applies.
+  template <typename Fn>
+  auto withDeadline(std::chrono::steady_clock::time_point deadline, Fn fn) -> decltype(fn()) {
+    DeadlineScope scope(this, deadline);
+    return fn();
+  }
+
+  // Abort the statements running on this connection with SQLITE_INTERRUPT.
+  // Safe to call from any thread while the connection is open, e.g. to
+  // cancel a request. Statements started after the running ones finish are
+  // not affected.
+  void interrupt() {
+    if (_handle) {
+      sqlite3_interrupt(_handle);
+    }
+  }
+
+  int64_t lastInsertRowId() {
+    // If a separate thread performs a new INSERT on the same database
+    // handle while the sqlite3_last_insert_rowid() function is
+    // running and thus changes the last insert rowid, then the value
+    // returned by sqlite3_last_insert_rowid() is unpredictable and might
+    // not equal either the old or the new last insert rowid.
+    return sqlite3_last_insert_rowid(_handle);
+  }
+
+  // Utility methods
+
+  const char *lastErrorMessage() { return sqlite3_errmsg(_handle); }
+
+  int vacuum() {
+    auto stmt = prepare("VACUUM;");
+    return execute(stmt);
+  }
+
+  // True between BEGIN and COMMIT/ROLLBACK
+  bool inTransaction() { return sqlite3_get_autocommit(_handle) == 0; }
+
+  // Group many writes into few transactions
+  //
+  //   int status = db.batch(1000, [&](size_t i) {
+  //     if (i == rows.size()) {
+  //       return SQLITE_DONE;
+  //     }
+  //     insert.bindStruct(rows[i]);
+  //     return insert.execute(db);
+  //   });
+  //
+  // Calls `fn(0)`, `fn(1)`, ... inside BEGIN IMMEDIATE ... COMMIT, committing
+  // and starting a new transaction every `batch_size` calls, until `fn`
+  // returns SQLITE_DONE. Returns SQLITE_OK once everything is committed.
+  //
+  // If `fn` returns an error, the current batch is rolled back and the error
+  // returned. The batches before it stay committed.
+  template <typename Fn>
+  int batch(size_t batch_size, Fn fn) {
+    assert(batch_size > 0);
+    int status = execute("BEGIN IMMEDIATE");
+    for (size_t i = 0; status == SQLITE_OK; i++) {
+      if (i > 0 && i % batch_size == 0) {
+        status = execute("COMMIT");
+        if (status != SQLITE_OK) {
+          break;
+        }
+        status = execute("BEGIN IMMEDIATE");
+        if (status != SQLITE_OK) {
+          return status;
+        }
+      }
+      status = fn(i);
+    }
+    if (status == SQLITE_DONE) {
+      status = execute("COMMIT");
+      if (status == SQLITE_OK) {
+        return SQLITE_OK;
+      }
+    }
+    if (inTransaction()) {
+      execute("ROLLBACK");
+    }
+    return status;
+  }
+
+ private:
+  // Installs the progress handler checking `deadline` and restores the
+  // previous deadline, if any, when destroyed.
+  class DeadlineScope {
+   public:
+    DeadlineScope(Handle *db, std::chrono::steady_clock::time_point deadline)
+        : _db(db), _had_deadline(db->_has_deadline), _previous(db->_deadline) {
+      _db->_deadline = _had_deadline ? std::min(_previous, deadline) : deadline;
+      _db->_has_deadline = true;
+      sqlite3_progress_handler(_db->_handle, kDeadlineCheckInterval, &Handle::checkDeadline, _db);
+    }
+
+    ~DeadlineScope() {
+      _db->_deadline = _previous;
+      _db->_has_deadline = _had_deadline;
+      if (!_had_deadline) {
+        sqlite3_progress_handler(_db->_handle, 0, nullptr, nullptr);
+      }
+    }
+
+   private:
+    Handle *_db;
+    bool _had_deadline;
+    std::chrono::steady_clock::time_point _previous;
+  };
+
+  static int checkDeadline(void *db) {
+    return std::chrono::steady_clock::now() >= static_cast<Handle *>(db)->_deadline;
+  }
+
+  sqlite3 *_handle;  //> SQLite3 database handle
+  std::unique_ptr<StmtCache> _stmt_cache;
+  bool _has_deadline;
+  std::chrono::steady_clock::time_point _deadline;
+
+  // Disallow copy constructors
+  Handle(const Handle &);
+  void operator=(const Handle &);
+};
+
+// Transactions {{{
+
+// Begins a transaction on construction and rolls it back on destruction
+// unless committed, so early returns don't leave transactions open.
+//
+//   Transaction txn(db, Transaction::kImmediate);
+//   if (txn.status() != SQLITE_OK) {
+//     return txn.status();
+//   }
+//   ...
+//   return txn.commit();
+//
+// The BEGIN, COMMIT and ROLLBACK statements come from the Handle's
+// statement cache, so they are only compiled once per connection.
+class Transaction {
+ public:
+  // See https://www.sqlite.org/lang_transaction.html
+  enum Mode {
+    kDeferred,   //> Locks are taken by the first read or write
+    kImmediate,  //> Take the write lock now. Other writers get SQLITE_BUSY here.
+    kExclusive,  //> Same as kImmediate in WAL mode; also blocks readers otherwise
+  };
+
+  explicit Transaction(Handle &db, Mode mode = kDeferred) : _db(&db), _active(false) {
+    static const char *const kBegin[] = {"BEGIN DEFERRED", "BEGIN IMMEDIATE", "BEGIN EXCLUSIVE"};
+    _status = _db->execute(kBegin[mode]);
+    _active = _status == SQLITE_OK;
+  }
+
+  ~Transaction() {
+    if (_active) {
+      rollback();
+    }
+  }
+
+  // The result of BEGIN
+  int status() const { return _status; }
+
+  bool isActive() const { return _active; }
+
+  // If COMMIT fails with SQLITE_BUSY the transaction is still active and the
+  // commit can be retried.
+  int commit() {
+    assert(_active && "Transaction is not active");
+    int status = _db->execute("COMMIT");
+    _active = _db->inTransaction();
+    return status;
+  }
+
+  int rollback() {
+    assert(_active && "Transaction is not active");
+    _active = false;
+    // SQLite may have rolled back already (e.g. after SQLITE_FULL).
+    return _db->inTransaction() ? _db->execute("ROLLBACK") : SQLITE_OK;
+  }
+
+ private:
+  Handle *_db;
+  int _status;
+  bool _active;
+
+  // Disallow copy constructors
+  Transaction(const Transaction &);
+  void operator=(const Transaction &);
+};
+
+// A nestable transaction. Rolls back to the point of its construction on
+// destruction unless released. Savepoints can be used inside or outside a
+// Transaction and must be destroyed in reverse order of construction.
+//
+//   Savepoint savepoint(db);
+//   if (importRow(db, row) != SQLITE_OK) {
+//     return savepoint.rollback();  // Only undoes this row
+//   }
+//   return savepoint.release();
+class Savepoint {
+ public:
+  explicit Savepoint(Handle &db) : _db(&db) {
+    // Nested savepoints can share a name: RELEASE and ROLLBACK TO apply to
+    // the most recent one. A constant name keeps the statements cached.
+    _status = _db->execute("SAVEPOINT sqlkit_savepoint");
+    _active = _status == SQLITE_OK;
+  }
+
+  ~Savepoint() {
+    if (_active) {
+      rollback();
+    }
+  }
+
+  // The result of SAVEPOINT
+  int status() const { return _status; }
+
+  bool isActive() const { return _active; }
+
+  // Keep the changes. They are committed with the enclosing transaction, or
+  // now if this is the outermost savepoint and there's no transaction.
+  int release() {
+    assert(_active && "Savepoint is not active");
+    int status = _db->execute("RELEASE sqlkit_savepoint");
+    _active = status != SQLITE_OK && _db->inTransaction();
+    return status;
+  }
+
+  int rollback() {
+    assert(_active && "Savepoint is not active");
+    _active = false;
+    if (!_db->inTransaction()) {
+      return SQLITE_OK;
+    }
+    int status = _db->execute("ROLLBACK TO sqlkit_savepoint");
+    int release_status = _db->execute("RELEASE sqlkit_savepoint");
+    return status != SQLITE_OK ? status : release_status;
+  }
+
+ private:
+  Handle *_db;
+  int _status;
+  bool _active;
+
+  // Disallow copy constructors
+  Savepoint(const Savepoint &);
+  void operator=(const Savepoint &);
+};
+
+// }}}
+
+// Incremental BLOB I/O {{{
+
+// A BLOB read and written in place with sqlite3_blob_*(), a chunk at a time,
+// so multi-megabyte values never have to be in memory whole. A BLOB can't
+// change size: reserve the space with zeroblob() or Stmt::bindZeroblob()
+// and fill it after the INSERT.
+//
+//   insert.bindZeroblob(1, file_size);
+//   db.execute(insert);
+//   Blob blob;
+//   blob.open(db, "files", "data", db.lastInsertRowId(), Blob::kReadWrite);
+//   blob.writeChunks([&](uint8_t *buffer, size_t capacity) {
+//     return fread(buffer, 1, capacity, file);
+//   });
+//
+//   blob.reopen(other_rowid);
+//   blob.readChunks([&](foc::ArrayRef<uint8_t> chunk) { send(chunk); });
+//
+// Chunks go through one buffer owned by the Blob, which is reused by every
+// call. When the row is changed or deleted by something else, the Blob
+// expires and calls fail with SQLITE_ABORT. Blobs must be closed before the
+// connection.
+class Blob {
+ public:
+  enum Mode {
+    kReadOnly,
+    kReadWrite,
+  };
+
+  static const size_t kDefaultChunkSize = 64 * 1024;
+
+  Blob() : _handle(nullptr) {}
+  Blob(Blob &&other) : _handle(other._handle), _buffer(std::move(other._buffer)) {
+    other._handle = nullptr;
+  }
+
+  Blob &operator=(Blob &&rhs) {
+    if (this != &rhs) {
+      close();
+      _handle = rhs._handle;
+      _buffer = std::move(rhs._buffer);
+      rhs._handle = nullptr;
+    }
+    return *this;
+  }
+
+  ~Blob() { close(); }
+
+  // Open the BLOB in `column` of the row `rowid` of `table`. `database` is
+  // "main", "temp" or the name of an attached database.
+  int open(Handle &db, const char *table, const char *column, int64_t rowid,
+           Mode mode = kReadOnly, const char *database = "main") {
+    close();
+    int status = sqlite3_blob_open(db.raw(), database, table, column, rowid,
+                                   mode == kReadWrite ? 1 : 0, &_handle);
+    if (status != SQLITE_OK) {
+#ifndef NDEBUG
+      fprintf(stderr, "sqlkit: Failed to open BLOB %s.%s: %s", table, column,
+              db.lastErrorMessage());
+#endif
+    }
+    return status;
+  }
+
+  // Move to the BLOB in the same column of another row, which is faster
+  // than opening it again. If it fails, or the BLOB expired, the Blob must
+  // be opened again: every other call returns SQLITE_ABORT.
+  int reopen(int64_t rowid) {
+    assert(_handle && "Blob is not open");
+    return sqlite3_blob_reopen(_handle, rowid);
+  }
+
+  int close() {
+    int status = sqlite3_blob_close(_handle);
+    _handle = nullptr;
+    return status;
+  }
+
+  bool isOpen() const { return _handle != nullptr; }
+  sqlite3_blob *raw() { return _handle; }
+
+  size_t size() const {
+    assert(_handle && "Blob is not open");
+    return (size_t)sqlite3_blob_bytes(_handle);
+  }
+
+  // Read or write `size` bytes at `offset`. Fails with SQLITE_ERROR if the
+  // range goes past the end of the BLOB.
+
+  int read(void *buffer, size_t size, size_t offset) {
+    assert(_handle && "Blob is not open");
+    return sqlite3_blob_read(_handle, buffer, (int)size, (int)offset);
+  }
+
+  int write(const void *data, size_t size, size_t offset) {
+    assert(_handle && "Blob is not open");
+    return sqlite3_blob_write(_handle, data, (int)size, (int)offset);
+  }
+
+  // Call `sink(foc::ArrayRef<uint8_t> chunk)` with the bytes from `offset`
+  // to the end, `chunk_size` bytes at a time. Chunks are only valid during
+  // the call.
+  template <typename Sink>
+  int readChunks(Sink sink, size_t offset = 0, size_t chunk_size = kDefaultChunkSize) {
+    uint8_t *buffer = reserveBuffer(chunk_size);
+    const size_t end = size();
+    while (offset < end) {
+      size_t n = end - offset < chunk_size ? end - offset : chunk_size;
+      int status = read(buffer, n, offset);
+      if (status != SQLITE_OK) {
+        return status;
+      }
+      sink(foc::ArrayRef<uint8_t>(buffer, n));
+      offset += n;
+    }
+    return SQLITE_OK;
+  }
+
+  // Fill the BLOB from `offset` with the bytes `source(uint8_t *buffer,
+  // size_t capacity)` writes into `buffer`, until it returns 0 or the BLOB
+  // is full. `capacity` never exceeds the bytes left in the BLOB.
+  // `num_written` is set to the number of bytes written.
+  template <typename Source>
+  int writeChunks(Source source, size_t offset = 0, size_t chunk_size = kDefaultChunkSize,
+                  size_t *num_written = nullptr) {
+    uint8_t *buffer = reserveBuffer(chunk_size);
+    const size_t begin = offset;
+    const size_t end = size();
+    int status = SQLITE_OK;
+    while (offset < end) {
+      size_t n = source(buffer, end - offset < chunk_size ? end - offset : chunk_size);
+      if (n == 0) {
+        break;
+      }
+      status = write(buffer, n, offset);
+      if (status != SQLITE_OK) {
+        break;
+      }
+      offset += n;
+    }
+    if (num_written) {
+      *num_written = offset - begin;
+    }
+    return status;
+  }
+
+ private:
+  uint8_t *reserveBuffer(size_t size) {
+    if (_buffer.size() < size) {
+      _buffer.resize(size);
+    }
+    return _buffer.data();
+  }
+
+  sqlite3_blob *_handle;         //> SQLite3 BLOB handle
+  std::vector<uint8_t> _buffer;  //> The chunks of readChunks() and writeChunks()
+
+  // Disallow copy constructors
+  Blob(const Blob &);
+  void operator=(const Blob &);
+};
+
+// }}}
+
+// Online backup {{{
+
+class Backup;
+
+// How Backup::run() paces a backup.
+struct BackupOptions {
+  // Pages copied by each step. The source is only read-locked during a
+  // step, so smaller steps let its writers in more often. -1 copies
+  // everything in one step.
+  int pages_per_step = 256;
+  // Bytes copied per second at most, to leave I/O to the application. 0
+  // doesn't throttle.
+  int64_t max_bytes_per_second = 0;
+  // Wait before retrying a step that found a database locked.
+  int busy_sleep_ms = 10;
+  // Retries of locked steps before run() gives up and returns SQLITE_BUSY or
+  // SQLITE_LOCKED, about a second with the default wait. -1 retries forever.
+  int max_busy_retries = 100;
+  // Writes to the source through another connection restart the copy. After
+  // this many restarts, the rest is copied in one step, which holds the
+  // source's read lock until it's done. -1 never gives up on stepping.
+  int max_restarts = 3;
+  // Called after every step, e.g. to report remaining() / pageCount().
+  std::function<void(const Backup &)> progress;
+};
+
+// Copies a live database with sqlite3_backup_*(), a few pages at a time, so
+// the source stays available to readers and writers in between.
+//
+//   Backup backup;
+//   backup.init(dest, db);
+//   BackupOptions options;
+//   options.max_bytes_per_second = 20 << 20;
+//   int status = backup.run(options);
+//
+// Writes through the source connection are copied as they happen. Writes
+// through other connections (or processes) restart the copy from the first
+// page, so the result is always a consistent snapshot; see
+// BackupOptions::max_restarts. The destination can't be used until the
+// backup is finished.
+class Backup {
+ public:
+  Backup() : _handle(nullptr), _page_size(0), _copied(0), _restarts(0) {}
+
+  ~Backup() { finish(); }
+
+  // Start copying database `source_name` ("main", "temp" or an attached
+  // database) of `source` over `dest_name` of `dest`.
+  int init(Handle &dest, Handle &source, const char *dest_name = "main",
+           const char *source_name = "main") {
+    finish();
+    char sql[128];
+    std::string page_size;
+    snprintf(sql, sizeof(sql), "PRAGMA \"%s\".page_size", source_name);
+    int status = source.pragma(sql, &page_size);
+    if (status != SQLITE_OK) {
+      return status;
+    }
+    _handle = sqlite3_backup_init(dest.raw(), dest_name, source.raw(), source_name);
+    if (_handle == nullptr) {
+#ifndef NDEBUG
+      fprintf(stderr, "sqlkit: Failed to start backup: %s", dest.lastErrorMessage());
+#endif
+      return sqlite3_errcode(dest.raw());
+    }
+    _page_size = atoi(page_size.c_str());
+    _copied = 0;
+    _restarts = 0;
+    return SQLITE_OK;
+  }
+
+  // Copy up to `pages` pages, or all with -1. Returns SQLITE_OK if there
+  // are pages left and SQLITE_DONE once the copy is complete. SQLITE_BUSY
+  // and SQLITE_LOCKED mean a database was locked and the step can be
+  // retried later. Other errors are fatal: finish() the backup.
+  int step(int pages) {
+    assert(_handle && "Backup is not initialized");
+    int status = sqlite3_backup_step(_handle, pages);
+    if (status == SQLITE_OK || status == SQLITE_DONE) {
+      int copied = pageCount() - remaining();
+      // A step that didn't finish copied at least a page, unless the copy
+      // started over.
+      if (status == SQLITE_OK && copied <= _copied) {
+        _restarts++;
+      }
+      _copied = copied;
+    }
+    return status;
+  }
+
+  // Release the backup. Returns the error of the last step, if any.
+  int finish() {
+    if (_handle == nullptr) {
+      return SQLITE_OK;
+    }
+    int status = sqlite3_backup_finish(_handle);
+    _handle = nullptr;
+    return status;
+  }
+
+  bool isActive() const { return _handle != nullptr; }
+
+  // Pages left to copy and pages of the source, as of the latest step.
+  int remaining() const { return sqlite3_backup_remaining(_handle); }
+  int pageCount() const { return sqlite3_backup_pagecount(_handle); }
+
+  // Times the copy started over because of writes to the source.
+  int restarts() const { return _restarts; }
+
+  // Step until the copy is complete or fails, pacing the steps according to
+  // `options`, and finish(). Locked databases are retried up to
+  // BackupOptions::max_busy_retries times, then the lock's status is
+  // returned.
+  int run(const BackupOptions &options = BackupOptions()) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    int64_t bytes = 0;
+    int busy_retries = 0;
+    int status;
+    for (;;) {
+      bool give_up = options.max_restarts >= 0 && _restarts > options.max_restarts;
+      int pages = give_up ? -1 : options.pages_per_step;
+      status = step(pages);
+      if (status == SQLITE_BUSY || status == SQLITE_LOCKED) {
+        if (options.max_busy_retries >= 0 && busy_retries >= options.max_busy_retries) {
+#ifndef NDEBUG
+          fprintf(stderr, "sqlkit: Backup gave up on a locked database");
+#endif
+          break;
+        }
+        busy_retries++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.busy_sleep_ms));
+        continue;
+      }
+      if (status != SQLITE_OK && status != SQLITE_DONE) {
+        break;
+      }
+      if (options.progress) {
+        options.progress(*this);
+      }
+      if (status == SQLITE_DONE) {
+        break;
+      }
+      if (options.max_bytes_per_second > 0) {
+        // Sleep until the bytes copied so far fit the budget.
+        bytes += (int64_t)pages * _page_size;
+        std::this_thread::sleep_until(
+            start + std::chrono::microseconds(bytes * 1000000 / options.max_bytes_per_second));
+      }
+    }
+    int finish_status = finish();
+    return status == SQLITE_DONE ? finish_status : status;
+  }
+
+  // Write a copy of `source` to the file `filename` in a single step, e.g. to
+  // persist an in-memory database. The copy goes to `filename`.tmp without a
+  // journal and is renamed to `filename` once complete, so `filename` is
+  // never a partial database.
+  static int snapshot(Handle &source, const char *filename, const char *source_name = "main") {
+    std::string tmp_filename = std::string(filename) + ".tmp";
+    remove(tmp_filename.c_str());
+    int status;
+    {
+      Handle dest;
+      status = dest.open(tmp_filename.c_str());
+      if (status == SQLITE_OK) {
+        status = dest.pragma("PRAGMA journal_mode=OFF");
+      }
+      if (status == SQLITE_OK) {
+        Backup backup;
+        status = backup.init(dest, source, "main", source_name);
+        if (status == SQLITE_OK) {
+          BackupOptions options;
+          options.pages_per_step = -1;
+          status = backup.run(options);
+        }
+      }
+    }
+    if (status == SQLITE_OK && rename(tmp_filename.c_str(), filename) != 0) {
+      status = SQLITE_IOERR;
+    }
+    if (status != SQLITE_OK) {
+      remove(tmp_filename.c_str());
+    }
+    return status;
+  }
+
+ private:
+  sqlite3_backup *_handle;  //> SQLite3 backup handle
+  int _page_size;           //> Bytes per page of the source
+  int _copied;              //> Pages copied as of the latest step
+  int _restarts;
+
+  // Disallow copy constructors
+  Backup(const Backup &);
+  void operator=(const Backup &);
+};
+
+// }}}
+
+// Typed queries {{{
+
+// A prepared statement with typed parameters and rows. The function type
+// lists the row and the parameter types. The row is a std::tuple of column
+// types, a single column type, or void for statements without results.
+//
+//   Query<std::tuple<int64_t, foc::StringRef>(int)> adults;
+//   adults.prepare(db, "SELECT id, name FROM users WHERE age >= ?");
+//   for (int s = adults.query(db, 18); s == SQLITE_ROW; s = adults.step(db)) {
+//     std::tuple<int64_t, foc::StringRef> row = adults.row();
+//   }
+//
+//   Query<void(foc::StringRef, int)> insert;
+//   insert.prepare(db, "INSERT INTO users(name, age) VALUES (?, ?)");
+//   insert.execute(db, "Ana", 30);
+//
+// The bind and column functions are picked at compile time. prepare()
+// asserts that the numbers of parameters and columns match the types. When
+// the SQL is a literal, the parameters can also be checked at compile time:
+//
+//   static_assert(sqlParameterCount(kInsertUserSql) == InsertUser::kNumParameters, "");
+template <typename Signature>
+class Query;
+
+template <typename Row, typename... Args>
+class Query<Row(Args...)> {
+ public:
+  static const unsigned int kNumParameters = sizeof...(Args);
+  static const unsigned int kNumColumns = detail::RowDecoder<Row>::kNumColumns;
+
+  Query() {}
+
+  int prepare(Handle &db, const char *sql) {
+    _stmt = db.prepare(sql);
+    if (!_stmt.isInitialized()) {
+      return sqlite3_errcode(db.raw());
+    }
+    assert(sqlite3_bind_parameter_count(_stmt.raw()) == (int)kNumParameters &&
+           "Number of parameters of the Query type doesn't match the SQL");
+    assert(_stmt.numColumns() == kNumColumns &&
+           "Number of columns of the Query type doesn't match the SQL");
+    return SQLITE_OK;
+  }
+
+  bool isInitialized() const { return _stmt.isInitialized(); }
+
+  // Bind `args` and step to the first row. Returns SQLITE_ROW, SQLITE_DONE or
+  // an error.
+  int query(Handle &db, const Args &... args) {
+    static_assert(kNumColumns > 0, "Use execute() for statements without results");
+    int status = rebind(args...);
+    return status != SQLITE_OK ? status : db.query(_stmt);
+  }
+
+  int step(Handle &db) { return db.step(_stmt); }
+
+  // Bind `args` and return a range over the rows. See RowRange.
+  RowRange<detail::RowDecoder<Row>> rows(const Args &... args) {
+    static_assert(kNumColumns > 0, "Use execute() for statements without results");
+    return RowRange<detail::RowDecoder<Row>>(_stmt.raw(), rebind(args...));
+  }
+
+  // Decode the current row. Views (foc::StringRef, foc::ArrayRef<uint8_t>)
+  // are valid until the next step.
+  Row row() { return detail::RowDecoder<Row>::decode(_stmt.raw()); }
+
+  // Call `fn(row)` for every row. Returns SQLITE_OK if all rows were visited.
+  template <typename Fn>
+  int forEach(Handle &db, Fn fn, const Args &... args) {
+    int status;
+    for (status = query(db, args...); status == SQLITE_ROW; status = step(db)) {
+      fn(row());
+    }
+    _stmt.reset();
+    return status == SQLITE_DONE ? SQLITE_OK : status;
+  }
+
+  int execute(Handle &db, const Args &... args) {
+    static_assert(kNumColumns == 0, "Use query() for statements with results");
+    int status = rebind(args...);
+    return status != SQLITE_OK ? status : db.execute(_stmt);
+  }
+
+  int reset() { return _stmt.reset(); }
+
+  Stmt &stmt() { return _stmt; }
+
+ private:
+  int rebind(const Args &... args) {
+    assert(_stmt.isInitialized());
+    // Binding fails on statements that were stepped and not reset.
+    _stmt.reset();
+    return detail::bindValues(_stmt.raw(), 1, args...);
+  }
+
+  Stmt _stmt;
+};
+
+// }}}
+
+// Connection pool {{{
+
+// A histogram of durations, in the unit of the caller. Buckets are log-linear
+// like HdrHistogram's: every power of two is split in kSubBuckets linear
+// buckets, so the bounds are within 1/kSubBuckets (6.25%) of the recorded
+// values, and values below 2 * kSubBuckets get a bucket each.
+class LatencyHistogram {
+ public:
+  static const size_t kSubBucketBits = 4;
+  static const size_t kSubBuckets = 1 << kSubBucketBits;
+  static const size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() { reset(); }
+
+  void record(uint64_t value) {
+    _buckets[bucketIndex(value)]++;
+    _count++;
+    _sum += value;
+    if (value > _max) {
+      _max = value;
+    }
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      _buckets[i] += other._buckets[i];
+    }
+    _count += other._count;
+    _sum += other._sum;
+    if (other._max > _max) {
+      _max = other._max;
+    }
+  }
+
+  void reset() {
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = _sum = _max = 0;
+  }
+
+  uint64_t count() const { return _count; }
+  uint64_t sum() const { return _sum; }
+  uint64_t max() const { return _max; }
+  double mean() const { return _count ? (double)_sum / _count : 0.0; }
+
+  uint64_t bucketCount(size_t i) const { return _buckets[i]; }
+
+  static size_t bucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+      return (size_t)value;
+    }
+    // The kSubBucketBits bits after the highest set bit pick the sub-bucket.
+    size_t shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + (size_t)((value >> shift) - kSubBuckets);
+  }
+
+  static uint64_t bucketUpperBound(size_t i) {
+    if (i < kSubBuckets) {
+      return i;
+    }
+    size_t shift = i / kSubBuckets - 1;
+    uint64_t lower = (uint64_t)(kSubBuckets + i % kSubBuckets) << shift;
+    return lower + ((1ULL << shift) - 1);
+  }
+
+  // An upper bound of the `p`th percentile (0 < p <= 100): the upper bound of
+  // the bucket it falls in, or the maximum if that's smaller.
+  uint64_t percentile(double p) const {
+    uint64_t rank = (uint64_t)(p / 100.0 * _count + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      seen += _buckets[i];
+      if (seen >= rank && seen > 0) {
+        uint64_t bound = bucketUpperBound(i);
+        return bound < _max ? bound : _max;
+      }
+    }
+    return _max;
+  }
+
+ private:
+  uint64_t _buckets[kNumBuckets];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _max;
+};
+
+struct PoolStats {
+  LatencyHistogram reader_waits;  //> Microseconds waited for a reader
+  LatencyHistogram writer_waits;  //> Microseconds waited for the writer
+  uint64_t reader_timeouts = 0;
+  uint64_t writer_timeouts = 0;
+};
+
+class Pool;
+
+// A connection leased from a Pool. It goes back to the pool when the lease is
+// destroyed. The lease isn't initialized if the wait timed out.
+class PooledHandle {
+ public:
+  PooledHandle() : _pool(nullptr), _handle(nullptr), _is_writer(false) {}
+
+  PooledHandle(PooledHandle &&rhs)
+      : _pool(rhs._pool), _handle(rhs._handle), _is_writer(rhs._is_writer) {
+    rhs._pool = nullptr;
+    rhs._handle = nullptr;
+  }
+
+  PooledHandle &operator=(PooledHandle &&rhs) {
+    if (this != &rhs) {
+      release();
+      _pool = rhs._pool;
+      _handle = rhs._handle;
+      _is_writer = rhs._is_writer;
+      rhs._pool = nullptr;
+      rhs._handle = nullptr;
+    }
+    return *this;
+  }
+
+  ~PooledHandle() noexcept { release(); }
+
+  bool isInitialized() const { return _handle != nullptr; }
+  bool isWriter() const { return _is_writer; }
+
+  Handle &handle() {
+    assert(_handle);
+    return *_handle;
+  }
+
+  Handle &operator*() { return handle(); }
+  Handle *operator->() { return &handle(); }
+
+  // Return the connection to the pool before the lease is destroyed.
+  inline void release();
+
+ private:
+  PooledHandle(Pool *pool, Handle *handle, bool is_writer)
+      : _pool(pool), _handle(handle), _is_writer(is_writer) {}
+
+  Pool *_pool;
+  Handle *_handle;
+  bool _is_writer;
+
+  // Disallow copy constructors
+  PooledHandle(const PooledHandle &);
+  void operator=(const PooledHandle &);
+
+  friend class Pool;
+};
+
+// A thread-safe pool of connections to a WAL database: N read-only
+// connections and the single writer connection SQLite allows at a time.
+// Readers don't block each other or the writer, so read throughput scales
+// with the number of readers.
+//
+//   Pool pool;
+//   pool.open("app.db", std::thread::hardware_concurrency());
+//   PooledHandle db = pool.reader();
+//   if (db.isInitialized()) {
+//     CachedStmt stmt = db->prepareCached("SELECT ...");
+//     ...
+//   }
+//
+// Idle connections are handed out most recently used first, so the
+// statement caches of the connections in use stay warm. Threads wait at most
+// the given timeout for a connection and the waits are recorded in
+// histograms (see stats()).
+//
+// All the leases must be released before the pool is closed.
+class Pool {
+ public:
+  static const int kDefaultBusyTimeoutMs = 5000;
+
+  Pool() {}
+  ~Pool() { close(); }
+
+  // Open the writer connection, switch the database to WAL mode and open
+  // `num_readers` read-only connections. The database must be a file since
+  // in-memory databases can't be shared by connections.
+  //
+  // `busy_timeout_ms` is passed to sqlite3_busy_timeout() on every
+  // connection.
+  int open(const char *filename, size_t num_readers, int busy_timeout_ms = kDefaultBusyTimeoutMs) {
+    OpenOptions writer_options;
+    writer_options.flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+    writer_options.busy_timeout_ms = busy_timeout_ms;
+    writer_options.journal_mode = OpenOptions::kJournalWAL;
+    OpenOptions reader_options;
+    reader_options.flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+    reader_options.busy_timeout_ms = busy_timeout_ms;
+    return open(filename, num_readers, writer_options, reader_options);
+  }
+
+  // Open the pool with custom options (e.g. OpenOptions::ingest() and
+  // OpenOptions::readHeavy()). The writer must use WAL and NOMUTEX, the
+  // readers NOMUTEX.
+  int open(const char *filename,
+           size_t num_readers,
+           const OpenOptions &writer_options,
+           const OpenOptions &reader_options) {
+    assert(!isOpen() && "Pool is already open");
+    assert(writer_options.journal_mode == OpenOptions::kJournalWAL);
+    std::unique_ptr<Handle> writer(new Handle());
+    int status = writer->open(filename, writer_options);
+    if (status != SQLITE_OK) {
+      return status;
+    }
+
+    std::vector<std::unique_ptr<Handle>> readers;
+    for (size_t i = 0; i < num_readers; i++) {
+      std::unique_ptr<Handle> reader(new Handle());
+      status = reader->open(filename, reader_options);
+      if (status != SQLITE_OK) {
+        return status;
+      }
+      readers.push_back(std::move(reader));
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _writer = std::move(writer);
+    _idle_writer.push_back(_writer.get());
+    _readers = std::move(readers);
+    for (auto &reader : _readers) {
+      _idle_readers.push_back(reader.get());
+    }
+    return SQLITE_OK;
+  }
+
+  // Close all the connections. Returns the first error.
+  int close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    assert(_idle_readers.size() == _readers.size() && _idle_writer.size() == (_writer ? 1 : 0) &&
+           "Closing a Pool with leased connections");
+    int result = SQLITE_OK;
+    for (auto &reader : _readers) {
+      int status = reader->close();
+      if (result == SQLITE_OK) {
+        result = status;
+      }
+    }
+    if (_writer) {
+      int status = _writer->close();
+      if (result == SQLITE_OK) {
+        result = status;
+      }
+    }
+    _idle_readers.clear();
+    _idle_writer.clear();
+    _readers.clear();
+    _writer.reset();
+    return result;
+  }
+
+  bool isOpen() const { return _writer != nullptr; }
+  size_t numReaders() const { return _readers.size(); }
+
+  // Lease a read-only connection, waiting at most `timeout` for one.
+  PooledHandle reader(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+    Handle *handle = acquire(_idle_readers, _reader_available, timeout, &_stats.reader_waits,
+                             &_stats.reader_timeouts);
+    return PooledHandle(handle ? this : nullptr, handle, false);
+  }
+
+  // Lease the writer connection, waiting at most `timeout` for it.
+  PooledHandle writer(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+    Handle *handle = acquire(_idle_writer, _writer_available, timeout, &_stats.writer_waits,
+                             &_stats.writer_timeouts);
+    return PooledHandle(handle ? this : nullptr, handle, true);
+  }
+
+  PoolStats stats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  void resetStats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = PoolStats();
   }
 
  private:
-  template <typename TupleType, unsigned int i>
-  void tailColumns(TupleType &) {}
+  Handle *acquire(std::vector<Handle *> &idle,
+                  std::condition_variable &available,
+                  std::chrono::milliseconds timeout,
+                  LatencyHistogram *waits,
+                  uint64_t *timeouts) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (idle.empty()) {
+      auto start = std::chrono::steady_clock::now();
+      bool acquired = available.wait_for(lock, timeout, [&idle] { return !idle.empty(); });
+      auto waited = std::chrono::steady_clock::now() - start;
+      waits->record(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+      if (!acquired) {
+        (*timeouts)++;
+        return nullptr;
+      }
+    } else {
+      waits->record(0);
+    }
+    Handle *handle = idle.back();
+    idle.pop_back();
+    return handle;
+  }
 
-  template <typename TupleType, unsigned int i, typename T, typename... TailTypes>
-  void tailColumns(TupleType &tuple) {
-    detail::ColumnExtractor<T> extract;
-    std::get<i>(tuple) = extract(_handle, i);
-    tailColumns<TupleType, i + 1, TailTypes...>(tuple);
+  void release(Handle *handle, bool is_writer) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      (is_writer ? _idle_writer : _idle_readers).push_back(handle);
+    }
+    (is_writer ? _writer_available : _reader_available).notify_one();
   }
 
-  // }}}
+  std::mutex _mutex;
+  std::condition_variable _reader_available;
+  std::condition_variable _writer_available;
+  std::vector<std::unique_ptr<Handle>> _readers;
+  std::unique_ptr<Handle> _writer;
+  std::vector<Handle *> _idle_readers;  //> Most recently used last
+  std::vector<Handle *> _idle_writer;
+  PoolStats _stats;
+
+  // Disallow copy constructors
+  Pool(const Pool &);
+  void operator=(const Pool &);
+
+  friend class PooledHandle;
+};
+
+void PooledHandle::release() {
+  if (_handle) {
+    _pool->release(_handle, _is_writer);
+    _pool = nullptr;
+    _handle = nullptr;
+  }
+}
+
+// }}}
+
+// Profiling {{{
+
+// Normalize SQL for grouping statements that only differ in literals and
+// formatting: literals and parameters become `?`, comments are dropped and
+// whitespace runs become a single space.
+//
+//   normalizeSql("SELECT * FROM t  WHERE id = 42 -- by id") == "SELECT * FROM t WHERE id = ?"
+std::string normalizeSql(const char *sql);
+
+// What Profiler collected about the executions of one normalized statement.
+struct StmtProfile {
+  std::string sql;
+  LatencyHistogram latency;  //> Nanoseconds from the first step to the reset
+  // Sums of the sqlite3_stmt_status() counters of every execution
+  uint64_t fullscan_steps = 0;
+  uint64_t sorts = 0;
+  uint64_t autoindexes = 0;
+  uint64_t vm_steps = 0;
+  uint64_t reprepares = 0;
+};
 
+// Times every statement executed by the attached connections and aggregates
+// the timings and statement counters by normalized SQL.
+//
+//   Profiler profiler;
+//   profiler.attach(db);
+//   ...
+//   fputs(profiler.report(10).c_str(), stderr);  // the 10 most expensive
+//   profiler.detach(db);
+//
+// The profiler is driven by sqlite3_trace_v2(SQLITE_TRACE_STMT |
+// SQLITE_TRACE_PROFILE), which SQLite only calls for connections with a
+// trace callback, so connections that aren't attached pay nothing. The
+// statements are timed with std::chrono::steady_clock between the two
+// events: the times SQLite reports have millisecond resolution, which would
+// round most cached lookups down to 0. Attaching replaces any other trace
+// callback of the connection. Connections must be detached before the
+// profiler is destroyed. One profiler can be attached to many connections
+// used by different threads.
+class Profiler {
  public:
-  int execute(Handle &db);
-  int query(Handle &db);
-  int step(Handle &db);
-  PositionedRow row();
+  enum SortKey {
+    kTotalTime,
+    kCalls,
+    kMaxTime,
+    kP99,
+    kFullscanSteps,
+    kVmSteps,
+  };
+
+  Profiler() : _num_attached(0) {}
+
+  ~Profiler() { assert(_num_attached == 0 && "Connections still attached to the profiler"); }
+
+  int attach(Handle &db) {
+    int status = sqlite3_trace_v2(db.raw(), SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE,
+                                  &Profiler::trace, this);
+    if (status == SQLITE_OK) {
+      _num_attached++;
+    }
+    return status;
+  }
+
+  int detach(Handle &db) {
+    int status = sqlite3_trace_v2(db.raw(), 0, nullptr, nullptr);
+    if (status == SQLITE_OK) {
+      _num_attached--;
+      // Statements still running won't be recorded.
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto it = _starts.begin(); it != _starts.end();) {
+        it = it->second.first == db.raw() ? _starts.erase(it) : std::next(it);
+      }
+    }
+    return status;
+  }
+
+  // Account an execution of `stmt` that took `nanos`. Reads and resets the
+  // statement's counters. Called by the trace callback.
+  void record(sqlite3_stmt *stmt, int64_t nanos) {
+    uint64_t fullscan_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+    uint64_t sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+    uint64_t autoindexes = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+    uint64_t vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+    uint64_t reprepares = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 1);
+#else
+    uint64_t reprepares = 0;
+#endif
+    // Normalized outside of the lock.
+    std::string sql = normalizeSql(sqlite3_sql(stmt));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    StmtProfile &profile = _profiles[sql];
+    if (profile.sql.empty()) {
+      profile.sql = std::move(sql);
+    }
+    profile.latency.record(nanos > 0 ? (uint64_t)nanos : 0);
+    profile.fullscan_steps += fullscan_steps;
+    profile.sorts += sorts;
+    profile.autoindexes += autoindexes;
+    profile.vm_steps += vm_steps;
+    profile.reprepares += reprepares;
+  }
+
+  // The `n` statements with the largest `key`, largest first.
+  std::vector<StmtProfile> top(size_t n, SortKey key = kTotalTime) const {
+    std::vector<StmtProfile> profiles;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      profiles.reserve(_profiles.size());
+      for (const auto &entry : _profiles) {
+        profiles.push_back(entry.second);
+      }
+    }
+    auto sort_value = [key](const StmtProfile &profile) -> uint64_t {
+      switch (key) {
+        case kTotalTime: return profile.latency.sum();
+        case kCalls: return profile.latency.count();
+        case kMaxTime: return profile.latency.max();
+        case kP99: return profile.latency.percentile(99);
+        case kFullscanSteps: return profile.fullscan_steps;
+        case kVmSteps: return profile.vm_steps;
+      }
+      return 0;
+    };
+    n = std::min(n, profiles.size());
+    std::partial_sort(profiles.begin(), profiles.begin() + n, profiles.end(),
+                      [&sort_value](const StmtProfile &a, const StmtProfile &b) {
+                        return sort_value(a) > sort_value(b);
+                      });
+    profiles.resize(n);
+    return profiles;
+  }
+
+  // A table of top(n, key), one statement per line. Times in microseconds.
+  std::string report(size_t n = 20, SortKey key = kTotalTime) const {
+    std::string out;
+    char line[256];
+    snprintf(line, sizeof(line), "%10s %12s %10s %10s %10s %10s %10s %6s %8s %12s %6s  %s\n",
+             "calls", "total_us", "mean_us", "p50_us", "p99_us", "max_us", "fullscan", "sorts",
+             "autoidx", "vm_steps", "reprep", "sql");
+    out += line;
+    for (const StmtProfile &profile : top(n, key)) {
+      const LatencyHistogram &latency = profile.latency;
+      snprintf(line, sizeof(line),
+               "%10llu %12.1f %10.2f %10.2f %10.2f %10.2f %10llu %6llu %8llu %12llu %6llu  ",
+               (unsigned long long)latency.count(), latency.sum() / 1000.0,
+               latency.mean() / 1000.0, latency.percentile(50) / 1000.0,
+               latency.percentile(99) / 1000.0, latency.max() / 1000.0,
+               (unsigned long long)profile.fullscan_steps, (unsigned long long)profile.sorts,
+               (unsigned long long)profile.autoindexes, (unsigned long long)profile.vm_steps,
+               (unsigned long long)profile.reprepares);
+      out += line;
+      out += profile.sql;
+      out += '\n';
+    }
+    return out;
+  }
+
+  size_t numStatements() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _profiles.size();
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _profiles.clear();
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  static int trace(unsigned type, void *context, void *p, void *x) {
+    Profiler *profiler = static_cast<Profiler *>(context);
+    sqlite3_stmt *stmt = static_cast<sqlite3_stmt *>(p);
+    if (type == SQLITE_TRACE_STMT) {
+      profiler->start(stmt);
+    } else if (type == SQLITE_TRACE_PROFILE) {
+      profiler->record(stmt, profiler->finish(stmt, *static_cast<int64_t *>(x)));
+    }
+    return 0;
+  }
+
+  void start(sqlite3_stmt *stmt) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Triggers fire SQLITE_TRACE_STMT again for the same statement, keep the
+    // first start.
+    _starts.emplace(stmt, std::make_pair(sqlite3_db_handle(stmt), now));
+  }
+
+  // Nanoseconds since start(stmt), or SQLite's `nanos` if the statement
+  // started before the profiler was attached.
+  int64_t finish(sqlite3_stmt *stmt, int64_t nanos) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _starts.find(stmt);
+    if (it == _starts.end()) {
+      return nanos;
+    }
+    nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now - it->second.second).count();
+    _starts.erase(it);
+    return nanos;
+  }
+
+  mutable std::mutex _mutex;
+  std::unordered_map<std::string, StmtProfile> _profiles;
+  // Statements being executed, with their connection and start
+  std::unordered_map<sqlite3_stmt *, std::pair<sqlite3 *, Clock::time_point>> _starts;
+  std::atomic<int> _num_attached;
+
+  // Disallow copy constructors
+  Profiler(const Profiler &);
+  void operator=(const Profiler &);
+};
+
+// }}}
+
+// Write-behind batching {{{
+
+// Coalesces small writes into transactions on a background thread.
+//
+// Every row handed to write() is copied into a lock-free queue, including
+// the bytes behind views like foc::StringRef and const char *. A dedicated
+// thread binds the rows to a single prepared statement and executes them in
+// batches inside BEGIN IMMEDIATE ... COMMIT, so thousands of tiny inserts
+// cost one commit (and one fsync) instead of one each.
+//
+//   BatchWriter<int64_t, std::string> events;
+//   events.start(db, "INSERT INTO events(ts, payload) VALUES (?, ?)");
+//   std::future<int> done = events.write(now, payload);
+//   ...
+//   done.get() == SQLITE_OK;  // the row is committed
+//
+// A batch is committed when it has `max_batch_size` rows or `max_delay`
+// after its first row arrived, whichever comes first. The status passed to
+// the callbacks (or futures) is the result of executing the row if that
+// failed, or the result of the COMMIT otherwise.
+//
+// The Handle is used by the writer thread between start() and stop() and
+// must not be used by other threads meanwhile.
+template <typename... Args>
+class BatchWriter {
+ public:
+  typedef std::function<void(int status)> Callback;
+
+  BatchWriter()
+      : _db(nullptr),
+        _max_batch_size(0),
+        _pending(0),
+        _sleeping(false),
+        _stopping(true),
+        _running(false),
+        _num_batches(0),
+        _num_rows(0) {}
+
+  ~BatchWriter() { stop(); }
+
+  // Prepare `sql` and start the writer thread.
+  int start(Handle &db,
+            const char *sql,
+            size_t max_batch_size = 1024,
+            std::chrono::microseconds max_delay = std::chrono::milliseconds(5)) {
+    assert(!_running && "BatchWriter is already running");
+    assert(max_batch_size > 0);
+    _stmt = db.prepare(sql);
+    if (!_stmt.isInitialized()) {
+      return sqlite3_errcode(db.raw());
+    }
+    _db = &db;
+    _max_batch_size = max_batch_size;
+    _max_delay = max_delay;
+    _stopping.store(false);
+    _running = true;
+    _thread = std::thread(&BatchWriter::run, this);
+    return SQLITE_OK;
+  }
+
+  // Commit the rows already written and stop the writer thread.
+  void stop() {
+    if (!_running) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping.store(true);
+    }
+    _wakeup.notify_one();
+    _thread.join();
+    _stmt.finalize();
+    _db = nullptr;
+    _running = false;
+  }
+
+  bool isRunning() const { return _running; }
+
+  // Queue a row. `callback` is called from the writer thread once the row is
+  // committed or failed. Rows written while the writer is not running fail
+  // with SQLITE_MISUSE right away. write() must not race with stop().
+  void write(Callback callback, Args... args) {
+    Row *row = new Row(std::move(callback), std::move(args)...);
+    if (_stopping.load()) {
+      fail(row, SQLITE_MISUSE);
+      return;
+    }
+    _queue.push(row);
+    size_t pending = _pending.fetch_add(1) + 1;
+    // Wake the writer when the first row arrives or a batch is full.
+    if ((pending == 1 || pending >= _max_batch_size) && _sleeping.load()) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _wakeup.notify_one();
+    }
+  }
+
+  // Queue a row and return a future with its status.
+  std::future<int> write(Args... args) {
+    std::shared_ptr<std::promise<int>> promise = std::make_shared<std::promise<int>>();
+    std::future<int> future = promise->get_future();
+    write([promise](int status) { promise->set_value(status); }, std::move(args)...);
+    return future;
+  }
+
+  uint64_t numBatches() const { return _num_batches.load(); }
+  uint64_t numRows() const { return _num_rows.load(); }
+
+ private:
+  struct Row : foc::MpscNode {
+    Row(Callback &&_callback, Args &&... args)
+        : callback(std::move(_callback)),
+          values(detail::OwnedValue<typename std::decay<Args>::type>::copy(std::move(args))...) {}
+
+    Callback callback;
+    // Views (foc::StringRef, const char *, ...) are copied: the writer thread
+    // binds them after write() returns.
+    std::tuple<typename detail::OwnedValue<typename std::decay<Args>::type>::type...> values;
+  };
+
+  static void fail(Row *row, int status) {
+    if (row->callback) {
+      row->callback(status);
+    }
+    delete row;
+  }
+
+  // Wait until `ready()` or the timeout. Producers only take the mutex to
+  // wake the writer up when it's sleeping.
+  template <typename Ready>
+  void sleep(std::chrono::microseconds timeout, Ready ready) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _sleeping.store(true);
+    _wakeup.wait_for(lock, timeout, ready);
+    _sleeping.store(false);
+  }
+
+  Row *popRow() {
+    Row *row;
+    // pop() can miss a row whose push() is still in progress.
+    while ((row = _queue.pop()) == nullptr) {
+      std::this_thread::yield();
+    }
+    _pending.fetch_sub(1);
+    return row;
+  }
+
+  void run() {
+    std::vector<std::pair<Row *, int>> batch;
+    batch.reserve(_max_batch_size);
+    for (;;) {
+      sleep(std::chrono::milliseconds(100),
+            [this] { return _pending.load() > 0 || _stopping.load(); });
+      if (_pending.load() == 0) {
+        if (_stopping.load()) {
+          break;
+        }
+        continue;
+      }
+      // Linger for a full batch unless we are stopping.
+      if (!_stopping.load()) {
+        sleep(_max_delay,
+              [this] { return _pending.load() >= _max_batch_size || _stopping.load(); });
+      }
+
+      int status = _db->execute("BEGIN IMMEDIATE");
+      size_t n = std::min(_pending.load(), _max_batch_size);
+      for (size_t i = 0; i < n; i++) {
+        Row *row = popRow();
+        int row_status = status;
+        if (status == SQLITE_OK) {
+          row_status = detail::bindTuple(_stmt.raw(), row->values);
+          if (row_status == SQLITE_OK) {
+            row_status = _db->execute(_stmt);
+          }
+          _stmt.clearBindings();
+        }
+        batch.push_back(std::make_pair(row, row_status));
+      }
+      if (status == SQLITE_OK) {
+        status = _db->execute("COMMIT");
+        if (status != SQLITE_OK) {
+          _db->execute("ROLLBACK");
+        }
+      }
+
+      _num_batches++;
+      _num_rows += n;
+      for (auto &entry : batch) {
+        Row *row = entry.first;
+        int row_status = entry.second != SQLITE_OK ? entry.second : status;
+        if (row->callback) {
+          row->callback(row_status);
+        }
+        delete row;
+      }
+      batch.clear();
+    }
+  }
+
+  Handle *_db;
+  Stmt _stmt;
+  size_t _max_batch_size;
+  std::chrono::microseconds _max_delay;
+  foc::MpscQueue<Row> _queue;
+  std::atomic<size_t> _pending;  //> Rows pushed and not popped yet
+  std::atomic<bool> _sleeping;
+  std::atomic<bool> _stopping;
+  bool _running;
+  std::mutex _mutex;
+  std::condition_variable _wakeup;
+  std::thread _thread;
+  std::atomic<uint64_t> _num_batches;
+  std::atomic<uint64_t> _num_rows;
+
+  // Disallow copy constructors
+  BatchWriter(const BatchWriter &);
+  void operator=(const BatchWriter &);
+};
+
+// }}}
+
+// Async queries {{{
+
+// The rows of a query run by an Executor. Row is decoded like the rows of a
+// Query<Row(...)> and must own its data (std::string rather than StringRef).
+template <typename Row>
+struct QueryResult {
+  int status = SQLITE_OK;  //> SQLITE_OK once every row was read, or the error
+  std::vector<Row> rows;
+};
+
+// The result of a statement without rows.
+template <>
+struct QueryResult<void> {
+  int status = SQLITE_OK;
+  int changes = 0;  //> Rows changed by the statement
+};
+
+// Runs statements on a pool of worker threads with a connection each, so
+// threads running an event loop never block on SQLite.
+//
+//   Executor executor;
+//   executor.start("app.db", 4, OpenOptions::readHeavy());
+//
+//   std::future<QueryResult<std::tuple<int64_t, std::string>>> users =
+//       executor.submit<std::tuple<int64_t, std::string>>(
+//           "SELECT id, name FROM users WHERE team = ?", team);
+//
+//   executor.post<int64_t>([](QueryResult<int64_t> &result) { ... },
+//                          "SELECT count(*) FROM users");
+//   ...
+//   executor.poll();  // on the event loop: runs the callbacks of finished posts
+//
+// Workers take queued statements in order, several per wakeup, and run them
+// through their connection's statement cache, so independent statements run
+// in parallel and repeated SQL is compiled once per worker. The parameters
+// are copied (StringRef and ArrayRef become std::string and
+// std::vector<uint8_t>), so the caller's buffers can go away right after the
+// call.
+//
+// Futures are fulfilled by the workers. The callbacks of post() go through a
+// lock-free completion queue instead and run on the thread that calls
+// poll(); setNotifier() tells the event loop when there is something to
+// poll.
+class Executor {
+ public:
+  // Called by a worker after it queues a completion, e.g. to write to an
+  // eventfd the event loop watches.
+  typedef std::function<void()> Notifier;
+
+  // Most statements a worker takes from the queue at once.
+  static const size_t kMaxTasksPerWakeup = 16;
+
+  Executor() : _running(false), _stopping(true), _num_workers(0) {}
+
+  // Runs the callbacks that are still queued.
+  ~Executor() {
+    stop();
+    poll();
+  }
+
+  // Open `num_workers` connections to `filename` and start their threads.
+  int start(const char *filename,
+            size_t num_workers,
+            const OpenOptions &options = OpenOptions()) {
+    assert(!_running && "Executor is already running");
+    assert(num_workers > 0);
+    std::vector<std::unique_ptr<Handle>> handles;
+    for (size_t i = 0; i < num_workers; i++) {
+      std::unique_ptr<Handle> db(new Handle());
+      int status = db->open(filename, options);
+      if (status != SQLITE_OK) {
+        return status;
+      }
+      handles.push_back(std::move(db));
+    }
+    _handles = std::move(handles);
+    _num_workers = num_workers;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = false;
+    }
+    _running = true;
+    for (auto &db : _handles) {
+      _threads.emplace_back(&Executor::work, this, db.get());
+    }
+    return SQLITE_OK;
+  }
+
+  // Run the statements already submitted, then stop the workers and close
+  // their connections. Callbacks of post() still have to be poll()ed.
+  void stop() {
+    if (!_running) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wakeup.notify_all();
+    for (auto &thread : _threads) {
+      thread.join();
+    }
+    _threads.clear();
+    _handles.clear();
+    _running = false;
+  }
+
+  bool isRunning() const { return _running; }
+
+  // Must be set before start().
+  void setNotifier(Notifier notifier) {
+    assert(!_running);
+    _notifier = std::move(notifier);
+  }
+
+  // Run `sql` with `args` bound to its parameters on a worker and return
+  // its rows. Statements submitted while the executor is not running fail
+  // with SQLITE_MISUSE.
+  template <typename Row = void, typename... Args>
+  std::future<QueryResult<Row>> submit(std::string sql, const Args &... args) {
+    typedef FutureTask<Row, typename std::decay<Args>::type...> Task;
+    Task *task = new Task(std::move(sql), args...);
+    std::future<QueryResult<Row>> future = task->promise.get_future();
+    enqueue(task);
+    return future;
+  }
+
+  // Like submit(), but `callback` is called with the result by poll().
+  template <typename Row = void, typename... Args>
+  void post(std::function<void(QueryResult<Row> &)> callback,
+            std::string sql,
+            const Args &... args) {
+    typedef CallbackTask<Row, typename std::decay<Args>::type...> Task;
+    enqueue(new Task(std::move(callback), std::move(sql), args...));
+  }
+
+  // Run the callbacks of finished post()s, at most `max_callbacks` of them.
+  // Returns how many ran. Must only be called by one thread at a time.
+  size_t poll(size_t max_callbacks = SIZE_MAX) {
+    size_t n = 0;
+    while (n < max_callbacks) {
+      Task *task = _completions.pop();
+      if (task == nullptr) {
+        break;
+      }
+      task->complete();
+      delete task;
+      n++;
+    }
+    return n;
+  }
+
+ private:
+  struct Task : foc::MpscNode {
+    virtual ~Task() {}
+    virtual void run(Handle &db) = 0;
+    virtual void fail(int status) = 0;
+    // Callbacks to run on the poll() thread after run() or fail()
+    virtual bool hasCompletion() const { return false; }
+    virtual void complete() {}
+  };
+
+  template <typename Row, typename Enable = void>
+  struct Runner {
+    template <typename Values>
+    static void run(Handle &db, const std::string &sql, const Values &values,
+                    QueryResult<Row> *result) {
+      CachedStmt stmt = db.prepareCached(sql);
+      if (!stmt.isInitialized()) {
+        result->status = sqlite3_errcode(db.raw());
+        return;
+      }
+      int status = detail::bindTuple(stmt->raw(), values);
+      if (status == SQLITE_OK) {
+        while ((status = db.step(*stmt)) == SQLITE_ROW) {
+          result->rows.push_back(detail::RowDecoder<Row>::decode(stmt->raw()));
+        }
+        if (status == SQLITE_DONE) {
+          status = SQLITE_OK;
+        }
+      }
+      result->status = status;
+    }
+  };
+
+  template <typename Row>
+  struct Runner<Row, typename std::enable_if<std::is_void<Row>::value>::type> {
+    template <typename Values>
+    static void run(Handle &db, const std::string &sql, const Values &values,
+                    QueryResult<void> *result) {
+      CachedStmt stmt = db.prepareCached(sql);
+      if (!stmt.isInitialized()) {
+        result->status = sqlite3_errcode(db.raw());
+        return;
+      }
+      int status = detail::bindTuple(stmt->raw(), values);
+      if (status == SQLITE_OK) {
+        status = db.execute(*stmt);
+        result->changes = sqlite3_changes(db.raw());
+      }
+      result->status = status;
+    }
+  };
+
+  template <typename Row, typename... Args>
+  struct FutureTask : Task {
+    FutureTask(std::string &&_sql, const Args &... args)
+        : sql(std::move(_sql)), values(detail::OwnedValue<Args>::copy(args)...) {}
+
+    void run(Handle &db) override {
+      QueryResult<Row> result;
+      Runner<Row>::run(db, sql, values, &result);
+      promise.set_value(std::move(result));
+    }
+
+    void fail(int status) override {
+      QueryResult<Row> result;
+      result.status = status;
+      promise.set_value(std::move(result));
+    }
+
+    std::string sql;
+    std::tuple<typename detail::OwnedValue<Args>::type...> values;
+    std::promise<QueryResult<Row>> promise;
+  };
+
+  template <typename Row, typename... Args>
+  struct CallbackTask : Task {
+    CallbackTask(std::function<void(QueryResult<Row> &)> &&_callback,
+                 std::string &&_sql,
+                 const Args &... args)
+        : callback(std::move(_callback)),
+          sql(std::move(_sql)),
+          values(detail::OwnedValue<Args>::copy(args)...) {}
+
+    void run(Handle &db) override { Runner<Row>::run(db, sql, values, &result); }
+    void fail(int status) override { result.status = status; }
+    bool hasCompletion() const override { return true; }
+
+    void complete() override {
+      if (callback) {
+        callback(result);
+      }
+    }
+
+    std::function<void(QueryResult<Row> &)> callback;
+    std::string sql;
+    std::tuple<typename detail::OwnedValue<Args>::type...> values;
+    QueryResult<Row> result;
+  };
+
+  void enqueue(Task *task) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_stopping) {
+        _tasks.push_back(task);
+        task = nullptr;
+      }
+    }
+    if (task) {
+      task->fail(SQLITE_MISUSE);
+      finish(task);
+      return;
+    }
+    _wakeup.notify_one();
+  }
+
+  void finish(Task *task) {
+    if (task->hasCompletion()) {
+      _completions.push(task);
+      if (_notifier) {
+        _notifier();
+      }
+    } else {
+      delete task;
+    }
+  }
+
+  void work(Handle *db) {
+    std::vector<Task *> tasks;
+    tasks.reserve(kMaxTasksPerWakeup);
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wakeup.wait(lock, [this] { return !_tasks.empty() || _stopping; });
+        if (_tasks.empty()) {
+          break;  // Stopping
+        }
+        // A fair share of the queue, so a burst is spread over the workers.
+        size_t n = (_tasks.size() + _num_workers - 1) / _num_workers;
+        if (n > kMaxTasksPerWakeup) {
+          n = kMaxTasksPerWakeup;
+        }
+        for (size_t i = 0; i < n; i++) {
+          tasks.push_back(_tasks.front());
+          _tasks.pop_front();
+        }
+        if (!_tasks.empty()) {
+          _wakeup.notify_one();
+        }
+      }
+      for (Task *task : tasks) {
+        task->run(*db);
+        finish(task);
+      }
+      tasks.clear();
+    }
+  }
+
+  bool _running;
+  bool _stopping;  //> Guarded by _mutex
+  size_t _num_workers;
+  std::vector<std::unique_ptr<Handle>> _handles;
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _wakeup;
+  std::deque<Task *> _tasks;  //> Guarded by _mutex
+  foc::MpscQueue<Task> _completions;
+  Notifier _notifier;
+
+  // Disallow copy constructors
+  Executor(const Executor &);
+  void operator=(const Executor &);
+};
+
+// }}}
+
+#ifdef SQLKIT_IMPLEMENTATION
+
+int Stmt::execute(Handle &db) { return db.execute(*this); }
+
+int Stmt::query(Handle &db) { return db.query(*this); }
+
+int Stmt::step(Handle &db) { return db.step(*this); }
+
+PositionedRow Stmt::row() { return PositionedRow{this}; }
+
+std::string normalizeSql(const char *sql) {
+  std::string out;
+  const char *s = sql;
+  bool space = false;
+  while (*s) {
+    const char *end = detail::skipSqlLiteralOrComment(s);
+    char c = *s;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+        (end != s && (c == '-' || c == '/'))) {
+      // Comments separate tokens like whitespace does.
+      space = !out.empty();
+      s = end != s ? end : s + 1;
+      continue;
+    }
+    if (space) {
+      out += ' ';
+      space = false;
+    }
+    if (end != s) {
+      if (c == '\'') {
+        out += '?';
+      } else {
+        out.append(s, end);  // Quoted identifier
+      }
+      s = end;
+    } else if ((c == 'x' || c == 'X') && s[1] == '\'' &&
+               (out.empty() || !detail::isSqlIdentifierChar(out.back()))) {
+      out += '?';  // Blob literal
+      s = detail::skipSqlQuoted(s + 2, '\'');
+    } else if (c == '?') {
+      out += '?';
+      s = detail::skipSqlDigits(s + 1);
+    } else if (detail::isSqlNamedParameter(s)) {
+      out += '?';
+      s = detail::skipSqlIdentifier(s + 1);
+    } else if (((c >= '0' && c <= '9') || (c == '.' && s[1] >= '0' && s[1] <= '9')) &&
+               (out.empty() || !detail::isSqlIdentifierChar(out.back()))) {
+      // Numbers, including 1.5e-3 and 0x1F
+      out += '?';
+      s = detail::skipSqlIdentifier(s);
+      if (*s == '.') {
+        s = detail::skipSqlIdentifier(s + 1);
+      }
+      if ((s[-1] == 'e' || s[-1] == 'E') && (*s == '+' || *s == '-')) {
+        s = detail::skipSqlDigits(s + 1);
+      }
+    } else if (detail::isSqlIdentifierChar(c)) {
+      const char *word_end = detail::skipSqlIdentifier(s);
+      out.append(s, word_end);
+      s = word_end;
+    } else {
+      out += c;
+      s++;
+    }
+  }
+  return out;
+}
+
+// Array parameters {{{
+
+namespace detail {
+
+struct ArrayCursor {
+  sqlite3_vtab_cursor base;
+  const ArrayParameter *array;
+  size_t i;
+};
+
+// An eponymous-only virtual table module in the style of SQLite's carray
+// extension. The hidden `pointer` column is the argument of sqlkit_array().
+struct ArrayModule {
+  enum Column { kValue, kPointer };
+
+  static int xConnect(sqlite3 *db, void *, int, const char *const *, sqlite3_vtab **vtab,
+                      char **) {
+    int status = sqlite3_declare_vtab(db, "CREATE TABLE x(value, pointer HIDDEN)");
+    if (status != SQLITE_OK) {
+      return status;
+    }
+    *vtab = static_cast<sqlite3_vtab *>(sqlite3_malloc(sizeof(sqlite3_vtab)));
+    if (*vtab == nullptr) {
+      return SQLITE_NOMEM;
+    }
+    memset(*vtab, 0, sizeof(sqlite3_vtab));
+    return SQLITE_OK;
+  }
+
+  static int xDisconnect(sqlite3_vtab *vtab) {
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+  }
+
+  static int xBestIndex(sqlite3_vtab *, sqlite3_index_info *info) {
+    for (int i = 0; i < info->nConstraint; i++) {
+      const auto &constraint = info->aConstraint[i];
+      if (constraint.usable && constraint.iColumn == kPointer &&
+          constraint.op == SQLITE_INDEX_CONSTRAINT_EQ) {
+        info->aConstraintUsage[i].argvIndex = 1;
+        info->aConstraintUsage[i].omit = 1;
+        info->estimatedCost = 1;
+        info->estimatedRows = 100;
+        return SQLITE_OK;
+      }
+    }
+    // Without the array there's nothing to scan. Make the planner find a
+    // plan that passes it.
+    info->estimatedCost = 2147483647;
+    info->estimatedRows = 2147483647;
+    return SQLITE_OK;
+  }
+
+  static int xOpen(sqlite3_vtab *, sqlite3_vtab_cursor **cursor) {
+    ArrayCursor *array_cursor = static_cast<ArrayCursor *>(sqlite3_malloc(sizeof(ArrayCursor)));
+    if (array_cursor == nullptr) {
+      return SQLITE_NOMEM;
+    }
+    memset(array_cursor, 0, sizeof(ArrayCursor));
+    *cursor = &array_cursor->base;
+    return SQLITE_OK;
+  }
+
+  static int xClose(sqlite3_vtab_cursor *cursor) {
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+  }
+
+  static int xFilter(sqlite3_vtab_cursor *cursor, int, const char *, int argc,
+                     sqlite3_value **argv) {
+    ArrayCursor *array_cursor = reinterpret_cast<ArrayCursor *>(cursor);
+    array_cursor->array =
+        argc > 0 ? static_cast<const ArrayParameter *>(
+                       sqlite3_value_pointer(argv[0], arrayPointerType()))
+                 : nullptr;
+    array_cursor->i = 0;
+    return SQLITE_OK;
+  }
+
+  static int xNext(sqlite3_vtab_cursor *cursor) {
+    reinterpret_cast<ArrayCursor *>(cursor)->i++;
+    return SQLITE_OK;
+  }
+
+  static int xEof(sqlite3_vtab_cursor *cursor) {
+    ArrayCursor *array_cursor = reinterpret_cast<ArrayCursor *>(cursor);
+    return array_cursor->array == nullptr || array_cursor->i >= array_cursor->array->size;
+  }
+
+  static int xColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column) {
+    ArrayCursor *array_cursor = reinterpret_cast<ArrayCursor *>(cursor);
+    if (column != kValue) {
+      return SQLITE_OK;  // NULL
+    }
+    const ArrayParameter &array = *array_cursor->array;
+    switch (array.type) {
+      case ArrayParameter::kInt64:
+        sqlite3_result_int64(context, static_cast<const int64_t *>(array.data)[array_cursor->i]);
+        break;
+      case ArrayParameter::kDouble:
+        sqlite3_result_double(context, static_cast<const double *>(array.data)[array_cursor->i]);
+        break;
+      case ArrayParameter::kText: {
+        foc::StringRef text = static_cast<const foc::StringRef *>(array.data)[array_cursor->i];
+        sqlite3_result_text(context, text.data(), (int)text.size(), SQLITE_TRANSIENT);
+        break;
+      }
+    }
+    return SQLITE_OK;
+  }
 
-  int reset() { return sqlite3_reset(_handle); }
+  static int xRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid) {
+    *rowid = (sqlite3_int64)reinterpret_cast<ArrayCursor *>(cursor)->i + 1;
+    return SQLITE_OK;
+  }
 
-  int clearBindings() {
-    int status = sqlite3_clear_bindings(_handle);
-    assert(status == SQLITE_OK);
-    return status;
+  // Set field by field, the fields at the end vary between SQLite versions.
+  static sqlite3_module methods() {
+    sqlite3_module module;
+    memset(&module, 0, sizeof(module));
+    // xCreate stays null: the table is eponymous-only.
+    module.xConnect = xConnect;
+    module.xBestIndex = xBestIndex;
+    module.xDisconnect = xDisconnect;
+    module.xOpen = xOpen;
+    module.xClose = xClose;
+    module.xFilter = xFilter;
+    module.xNext = xNext;
+    module.xEof = xEof;
+    module.xColumn = xColumn;
+    module.xRowid = xRowid;
+    return module;
   }
+};
 
- private:
-  sqlite3_stmt *_handle;
+}  // namespace detail
 
-  // Disallow copy constructors
-  Stmt(const Stmt &);
-  void operator=(const Stmt &);
+int registerArrayFunction(sqlite3 *db) {
+#if SQLITE_VERSION_NUMBER >= 3020000
+  static const sqlite3_module module = detail::ArrayModule::methods();
+  return sqlite3_create_module(db, "sqlkit_array", &module, nullptr);
+#else
+  (void)db;
+  return SQLITE_OK;
+#endif
+}
 
-  // Allow database Handle methods to get access to the sqlite3_stmt handle.
-  friend class Handle;
-};
+// }}}
 
-class PositionedRow {
- public:
-  explicit PositionedRow(Stmt *stmt) : _stmt(stmt), _pos(0) {}
+// Process-wide memory {{{
 
-  bool nextIsNull() { return _stmt->columnIsNull(_pos); }
+namespace detail {
 
-  template <typename T>
-  T next() {
-    return _stmt->column<T>(_pos++);
+// sqlite3_mem_methods over foc::SizeClassAllocator. Every allocation starts
+// with an 8-byte header holding its usable size, which keeps the returned
+// pointers 8-byte aligned as SQLite requires. SQLite skips xRoundup() when
+// memory status is off, and callers then size their buffers from xSize(), so
+// all of the usable size must survive a realloc.
+struct SizeClassMemory {
+  static const size_t kHeaderSize = 8;
+
+  static size_t blockSize(int n) { return (size_t)n + kHeaderSize; }
+
+  // Bytes usable after the header of a block allocated for `n` bytes.
+  static int usableSize(int n) {
+    size_t size = blockSize(n);
+    if (size > foc::SizeClassAllocator::kMaxSize) {
+      return n;
+    }
+    return (int)(foc::SizeClassAllocator::roundUp(size) - kHeaderSize);
   }
 
-  const void *nextBlob(size_t *size) {
-    if (size) {
-      *size = _stmt->blobColumnSize(_pos);
+  static int *header(void *ptr) { return (int *)((char *)ptr - kHeaderSize); }
+
+  static void *xMalloc(int n) {
+    foc::SizeClassAllocator allocator;
+    int size = usableSize(n);
+    void *block = allocator.allocate(blockSize(size));
+    if (block == nullptr) {
+      return nullptr;
     }
-    return next<const void *>();
+    *(int *)block = size;
+    return (char *)block + kHeaderSize;
   }
 
-  double nextDouble() {
-    assert(!nextIsNull());
-    return next<double>();
+  static void xFree(void *ptr) {
+    foc::SizeClassAllocator allocator;
+    int *block = header(ptr);
+    allocator.deallocate(block, blockSize(*block));
   }
 
-  int nextInt() {
-    assert(!nextIsNull());
-    return next<int>();
+  static void *xRealloc(void *ptr, int n) {
+    int *block = header(ptr);
+    int old_size = *block;
+    if (usableSize(n) == old_size) {
+      // Same size class. SQLite grows strings and arrays one step at a time.
+      return ptr;
+    }
+    void *new_ptr = xMalloc(n);
+    if (new_ptr == nullptr) {
+      return nullptr;
+    }
+    memcpy(new_ptr, ptr, (size_t)std::min(n, old_size));
+    xFree(ptr);
+    return new_ptr;
   }
 
-  int64_t nextInt64() {
-    assert(!nextIsNull());
-    return next<int64_t>();
+  static int xSize(void *ptr) { return *header(ptr); }
+
+  static int xRoundup(int n) {
+    if (blockSize(n) > foc::SizeClassAllocator::kMaxSize) {
+      return (n + 7) & ~7;
+    }
+    return usableSize(n);
   }
 
-  std::string nextString() {
-    assert(!nextIsNull());
-    return next<std::string>();
+  static int xInit(void *) { return SQLITE_OK; }
+
+  static void xShutdown(void *) {}
+};
+
+struct CachedPage {
+  sqlite3_pcache_page base;  //> pBuf and pExtra, as SQLite sees the page
+  unsigned key;
+  bool pinned;
+  CachedPage *hash_next;
+  // The LRU list of unpinned pages
+  CachedPage *lru_prev;
+  CachedPage *lru_next;
+};
+
+// The page cache of one connection. SQLite only calls into it while holding
+// the connection's mutex, so it takes no locks of its own. Unpinned pages
+// are recycled in least recently used order once the cache is full.
+class PageCache {
+ public:
+  PageCache(int page_size, int extra_size, bool purgeable)
+      : _page_size(page_size),
+        _extra_size(extra_size),
+        _purgeable(purgeable),
+        _max_pages(0),
+        _num_pages(0),
+        _buckets(64, nullptr) {
+    _lru.lru_prev = _lru.lru_next = &_lru;
   }
 
-  // Return value may be nullptr
-  const char *nextCStr(size_t *size) {
-    if (size) {
-      *size = _stmt->blobColumnSize(_pos);
+  ~PageCache() {
+    for (CachedPage *bucket : _buckets) {
+      while (bucket) {
+        CachedPage *next = bucket->hash_next;
+        freePage(bucket);
+        bucket = next;
+      }
     }
-    return next<const char *>();
   }
 
-  // Return value may be nullptr
-  const char *nextCStr() { return nextCStr(nullptr); }
+  void setCacheSize(int max_pages) {
+    _max_pages = (unsigned)std::max(max_pages, 0);
+    if (_purgeable) {
+      while (_num_pages > _max_pages && _lru.lru_next != &_lru) {
+        discard(_lru.lru_next);
+      }
+    }
+  }
 
-  // Return value may be nullptr
-  const sqlite3_value *nextValue() { return next<sqlite3_value *>(); }
+  int pageCount() const { return (int)_num_pages; }
 
-  unsigned int currentPos() const { return _pos; }
-  unsigned int numColumns() { return _stmt->numColumns(); }
-  bool hasMoreColumns() { return _pos < _stmt->numColumns(); }
-  void restart() { _pos = 0; }
+  CachedPage *fetch(unsigned key, int create_flag) {
+    CachedPage *page = find(key);
+    if (page) {
+      if (!page->pinned) {
+        unlinkLru(page);
+        page->pinned = true;
+      }
+      return page;
+    }
+    if (create_flag == 0) {
+      return nullptr;
+    }
+    if (_purgeable && _num_pages >= _max_pages) {
+      if (_lru.lru_next != &_lru) {
+        // Recycle the least recently used page.
+        page = _lru.lru_next;
+        unlinkLru(page);
+        unhash(page);
+        _num_pages--;
+      } else if (create_flag == 1) {
+        return nullptr;
+      }
+    }
+    if (page == nullptr) {
+      page = allocatePage();
+      if (page == nullptr) {
+        return nullptr;
+      }
+    }
+    // SQLite expects the start of the extra bytes of new pages to be zero.
+    memset(page->base.pExtra, 0, std::min(sizeof(void *), (size_t)_extra_size));
+    page->key = key;
+    page->pinned = true;
+    insert(page);
+    return page;
+  }
 
-  void skip() {
-    assert(_pos < _stmt->numColumns());
-    _pos++;
+  void unpin(CachedPage *page, bool discard_page) {
+    if (discard_page || (_purgeable && _num_pages > _max_pages)) {
+      unhash(page);
+      _num_pages--;
+      freePage(page);
+      return;
+    }
+    page->pinned = false;
+    // Most recently used at the back.
+    page->lru_prev = _lru.lru_prev;
+    page->lru_next = &_lru;
+    _lru.lru_prev->lru_next = page;
+    _lru.lru_prev = page;
   }
 
-  void rewind() {
-    assert(_pos > 0);
-    if (_pos > 0) {
-      _pos--;
+  void rekey(CachedPage *page, unsigned new_key) {
+    if (CachedPage *existing = find(new_key)) {
+      discard(existing);
     }
+    unhash(page);
+    page->key = new_key;
+    hash(page);
   }
 
-  sqlite3_stmt *rawStmt() { return _stmt->raw(); }
+  // Discards the pages with keys >= limit, pinned or not.
+  void truncate(unsigned limit) {
+    for (CachedPage *&bucket : _buckets) {
+      CachedPage **link = &bucket;
+      while (CachedPage *page = *link) {
+        if (page->key >= limit) {
+          *link = page->hash_next;
+          if (!page->pinned) {
+            unlinkLru(page);
+          }
+          _num_pages--;
+          freePage(page);
+        } else {
+          link = &page->hash_next;
+        }
+      }
+    }
+  }
+
+  void shrink() {
+    while (_lru.lru_next != &_lru) {
+      discard(_lru.lru_next);
+    }
+  }
 
  private:
-  Stmt *_stmt;
-  unsigned int _pos;
-};
+  size_t headerSize() const { return sizeof(CachedPage) + (size_t)_extra_size; }
+
+  CachedPage *allocatePage() {
+    foc::SizeClassAllocator allocator;
+    void *header = allocator.allocate(headerSize());
+    void *buffer = allocator.allocate((size_t)_page_size);
+    if (header == nullptr || buffer == nullptr) {
+      allocator.deallocate(header, headerSize());
+      allocator.deallocate(buffer, (size_t)_page_size);
+      return nullptr;
+    }
+    CachedPage *page = static_cast<CachedPage *>(header);
+    page->base.pBuf = buffer;
+    page->base.pExtra = page + 1;
+    return page;
+  }
 
-class Handle {
- public:
-  Handle() noexcept : _handle(nullptr) {}
-  Handle(Handle &&other) noexcept : _handle(other._handle) { other._handle = nullptr; }
+  void freePage(CachedPage *page) {
+    foc::SizeClassAllocator allocator;
+    allocator.deallocate(page->base.pBuf, (size_t)_page_size);
+    allocator.deallocate(page, headerSize());
+  }
 
-  Handle &operator=(Handle &&rhs) {
-    if (this != &rhs) {
-      if (_handle != rhs._handle) {
-        if (_handle) {
-          close();
-        }
-        _handle = rhs._handle;
-      }
-      rhs._handle = nullptr;
+  CachedPage *find(unsigned key) const {
+    CachedPage *page = _buckets[key & (_buckets.size() - 1)];
+    while (page && page->key != key) {
+      page = page->hash_next;
     }
-    return *this;
+    return page;
   }
 
-  ~Handle() noexcept {
-    if (_handle) {
-      close();
-    }
+  void hash(CachedPage *page) {
+    CachedPage *&bucket = _buckets[page->key & (_buckets.size() - 1)];
+    page->hash_next = bucket;
+    bucket = page;
   }
 
-  int open(const char *filename) {
-    int status = sqlite3_open(filename, &_handle);
-    if (status != SQLITE_OK) {
-      // TODO: log debug
-      /*
-      assert(false && "Couldn't open/create database! filename=(%s), error=(%s)",
-              filename,
-              sqlite3_errmsg(_handle));
-      */
-      close();
+  void unhash(CachedPage *page) {
+    CachedPage **link = &_buckets[page->key & (_buckets.size() - 1)];
+    while (*link != page) {
+      link = &(*link)->hash_next;
     }
-    return status;
+    *link = page->hash_next;
   }
 
-  int close() {
-    int status = sqlite3_close(_handle);
-    if (status == SQLITE_OK) {
-      _handle = nullptr;
-    } else {
-#ifndef NDEBUG
-      fprintf(stderr,
-              "sqlkit: Something wrong happened when trying to close database! (%s)",
-              lastErrorMessage());
-#endif
+  void insert(CachedPage *page) {
+    if (_num_pages >= _buckets.size()) {
+      rehash(_buckets.size() * 2);
     }
-    return status;
+    hash(page);
+    _num_pages++;
   }
 
-  bool isInitialized() const { return _handle != nullptr; }
-  sqlite3 *raw() { return _handle; }
+  void rehash(size_t num_buckets) {
+    std::vector<CachedPage *> buckets(num_buckets, nullptr);
+    buckets.swap(_buckets);
+    for (CachedPage *bucket : buckets) {
+      while (bucket) {
+        CachedPage *next = bucket->hash_next;
+        hash(bucket);
+        bucket = next;
+      }
+    }
+  }
 
-  // Prepare (compile) statements
+  void unlinkLru(CachedPage *page) {
+    page->lru_prev->lru_next = page->lru_next;
+    page->lru_next->lru_prev = page->lru_prev;
+  }
 
-  Stmt prepare(const char *sql) { return prepare(sql, -1); }
+  // Frees an unpinned page.
+  void discard(CachedPage *page) {
+    assert(!page->pinned);
+    unlinkLru(page);
+    unhash(page);
+    _num_pages--;
+    freePage(page);
+  }
 
-  Stmt prepare(const std::string &sql) { return prepare(sql.c_str(), sql.size()); }
+  const int _page_size;
+  const int _extra_size;
+  const bool _purgeable;
+  unsigned _max_pages;
+  unsigned _num_pages;
+  // Page numbers are mostly sequential, so the low bits make a good hash.
+  std::vector<CachedPage *> _buckets;
+  CachedPage _lru;  //> Sentinel of the LRU list
 
-  Stmt prepare(const char *sql, int num_sql_bytes) {
-    Stmt stmt;
-    int status = sqlite3_prepare_v2(_handle, sql, num_sql_bytes, &stmt._handle, nullptr);
+  // Disallow copy constructors
+  PageCache(const PageCache &);
+  void operator=(const PageCache &);
+};
 
-    if (status != SQLITE_OK) {
-#ifndef NDEBUG
-      fprintf(stderr,
-              "sqlkit: Failed to prepare \"%s\". error_code %d, error_msg \"%s\"",
-              sql,
-              status,
-              lastErrorMessage());
-#endif
-    }
+struct PageCacheMethods {
+  static PageCache *cache(sqlite3_pcache *p) { return reinterpret_cast<PageCache *>(p); }
 
-    return stmt;
-  }
+  static int xInit(void *) { return SQLITE_OK; }
 
-  // Execute result-less statements
+  static void xShutdown(void *) {}
 
-  int execute(const char *sql, int num_sql_bytes) {
-    Stmt stmt = prepare(sql, num_sql_bytes);
-    return execute(stmt);
+  static sqlite3_pcache *xCreate(int page_size, int extra_size, int purgeable) {
+    PageCache *cache = new (std::nothrow) PageCache(page_size, extra_size, purgeable != 0);
+    return reinterpret_cast<sqlite3_pcache *>(cache);
   }
 
-  int execute(const char *sql) { return execute(sql, -1); }
-  int execute(const std::string &sql) { return execute(sql.c_str(), sql.size()); }
+  static void xCachesize(sqlite3_pcache *p, int max_pages) { cache(p)->setCacheSize(max_pages); }
 
-  int execute(Stmt &stmt) {
-    int status = sqlite3_step(stmt._handle);
+  static int xPagecount(sqlite3_pcache *p) { return cache(p)->pageCount(); }
 
-    assert(status != SQLITE_ROW && stmt.numColumns() == 0 &&
-           "Use query() for queries and execute() for result-less statements.");
+  static sqlite3_pcache_page *xFetch(sqlite3_pcache *p, unsigned key, int create_flag) {
+    CachedPage *page = cache(p)->fetch(key, create_flag);
+    return page ? &page->base : nullptr;
+  }
 
-    switch (status) {
-      case SQLITE_OK:
-      case SQLITE_DONE:
-      case SQLITE_ROW:
-        break;
-      default:
-#ifndef NDEBUG
-        fprintf(stderr, "sqlkit: Failed to execute prepared statement: %s", lastErrorMessage());
-#endif
-        break;
-    }
+  static void xUnpin(sqlite3_pcache *p, sqlite3_pcache_page *page, int discard) {
+    cache(p)->unpin(reinterpret_cast<CachedPage *>(page), discard != 0);
+  }
 
-    // sqlite3_reset() the statement when done, otherwise subsequent calls to
-    // sqlite3_bind_* will crash.
-    return sqlite3_reset(stmt._handle);
+  static void xRekey(sqlite3_pcache *p, sqlite3_pcache_page *page, unsigned, unsigned new_key) {
+    cache(p)->rekey(reinterpret_cast<CachedPage *>(page), new_key);
   }
 
-  // Perform queries and step through query results
+  static void xTruncate(sqlite3_pcache *p, unsigned limit) { cache(p)->truncate(limit); }
 
-  int query(Stmt &stmt) {
-    int status = sqlite3_step(stmt._handle);
+  static void xDestroy(sqlite3_pcache *p) { delete cache(p); }
 
-    assert(status != SQLITE_OK && stmt.numColumns() > 0 &&
-           "Use execute() instead of query() for result-less statements.");
+  static void xShrink(sqlite3_pcache *p) { cache(p)->shrink(); }
+};
 
-    switch (status) {
-      case SQLITE_OK:
-      case SQLITE_DONE:
-      case SQLITE_ROW:
-        break;
-      default:
+}  // namespace detail
+
+int configureMemory(const MemoryOptions &options) {
+  int status = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, options.memory_status ? 1 : 0);
+  if (status != SQLITE_OK) {
 #ifndef NDEBUG
-        fprintf(stderr, "sqlkit: Failed to perform query: %s", lastErrorMessage());
+    fprintf(stderr, "sqlkit: configureMemory() must run before SQLite is initialized\n");
 #endif
-        break;
-    }
     return status;
   }
-
-  int step(Stmt &stmt) {
-    int status = sqlite3_step(stmt._handle);
-    switch (status) {
-      case SQLITE_OK:
-      case SQLITE_DONE:
-      case SQLITE_ROW:
-        break;
-      default:
-#ifndef NDEBUG
-        fprintf(stderr, "sqlkit: Failed to step through query results: %s", lastErrorMessage());
-#endif
-        break;
+  if (options.allocator) {
+    static const sqlite3_mem_methods methods = {
+        detail::SizeClassMemory::xMalloc,  detail::SizeClassMemory::xFree,
+        detail::SizeClassMemory::xRealloc, detail::SizeClassMemory::xSize,
+        detail::SizeClassMemory::xRoundup, detail::SizeClassMemory::xInit,
+        detail::SizeClassMemory::xShutdown, nullptr,
+    };
+    status = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+    if (status != SQLITE_OK) {
+      return status;
     }
-    return status;
   }
-
-  int64_t lastInsertRowId() {
-    // If a separate thread performs a new INSERT on the same database
-    // handle while the sqlite3_last_insert_rowid() function is
-    // running and thus changes the last insert rowid, then the value
-    // returned by sqlite3_last_insert_rowid() is unpredictable and might
-    // not equal either the old or the new last insert rowid.
-    return sqlite3_last_insert_rowid(_handle);
+  if (options.page_cache) {
+    static const sqlite3_pcache_methods2 methods = {
+        1,
+        nullptr,
+        detail::PageCacheMethods::xInit,
+        detail::PageCacheMethods::xShutdown,
+        detail::PageCacheMethods::xCreate,
+        detail::PageCacheMethods::xCachesize,
+        detail::PageCacheMethods::xPagecount,
+        detail::PageCacheMethods::xFetch,
+        detail::PageCacheMethods::xUnpin,
+        detail::PageCacheMethods::xRekey,
+        detail::PageCacheMethods::xTruncate,
+        detail::PageCacheMethods::xDestroy,
+        detail::PageCacheMethods::xShrink,
+    };
+    status = sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods);
   }
+  return status;
+}
 
-  // Utility methods
+// }}}
 
-  const char *lastErrorMessage() { return sqlite3_errmsg(_handle); }
+// Owned parameters {{{
 
-  int vacuum() {
-    auto stmt = prepare("VACUUM;");
-    return execute(stmt);
+namespace detail {
+
+// SQLite passes the destructor of a bound value just the address of its
+// bytes, so the owners of the bytes are looked up by that address. The same
+// bytes can be bound to several parameters, each with its own owner, and
+// every destructor call deletes one of them. The map is sharded to keep
+// threads binding on different connections apart.
+class OwnedBufferRegistry {
+ public:
+  // Never destroyed: statements can be finalized by static destructors.
+  static OwnedBufferRegistry &instance() {
+    static OwnedBufferRegistry *registry = new OwnedBufferRegistry();
+    return *registry;
+  }
+
+  void add(const void *data, OwnedBuffer *owner) {
+    Shard &shard = shardOf(data);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.owners.emplace(data, owner);
+  }
+
+  // The destructor passed to SQLite.
+  static void release(void *data) {
+    Shard &shard = instance().shardOf(data);
+    OwnedBuffer *owner;
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = shard.owners.find(data);
+      assert(it != shard.owners.end());
+      owner = it->second;
+      shard.owners.erase(it);
+    }
+    delete owner;
   }
 
  private:
-  sqlite3 *_handle;  //> SQLite3 database handle
+  static const size_t kNumShards = 16;
 
-  // Disallow copy constructors
-  Handle(const Handle &);
-  void operator=(const Handle &);
-};
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_multimap<const void *, OwnedBuffer *> owners;
+  };
 
-#ifdef SQLKIT_IMPLEMENTATION
+  Shard &shardOf(const void *data) {
+    return _shards[(reinterpret_cast<uintptr_t>(data) >> 6) % kNumShards];
+  }
 
-int Stmt::execute(Handle &db) { return db.execute(*this); }
+  Shard _shards[kNumShards];
+};
 
-int Stmt::query(Handle &db) { return db.query(*this); }
+int bindOwnedBuffer(sqlite3_stmt *stmt, unsigned int i, const void *data, size_t size, bool text,
+                    OwnedBuffer *owner) {
+  assert(data != nullptr);
+  OwnedBufferRegistry::instance().add(data, owner);
+  // SQLite calls the destructor even if binding fails.
+  return text ? sqlite3_bind_text64(stmt, i, static_cast<const char *>(data), size,
+                                    OwnedBufferRegistry::release, SQLITE_UTF8)
+              : sqlite3_bind_blob64(stmt, i, data, size, OwnedBufferRegistry::release);
+}
 
-int Stmt::step(Handle &db) { return db.step(*this); }
+}  // namespace detail
 
-PositionedRow Stmt::row() { return PositionedRow{this}; }
+// }}}
 
 #endif  // SQLKIT_IMPLEMENTATION
 
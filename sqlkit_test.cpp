@@ -1,13 +1,22 @@
 #include <algorithm>
+#include <atomic>
 #include <cstdarg>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 
+#define SMALL_VECTOR_IMPLEMENTATION
 #define SQLKIT_IMPLEMENTATION
 #include "sqlkit.h"
 
+#define HAMT_IMPLEMENTATION
+#include "foc/hash_array_mapped_trie.h"
+
 namespace sqlkit {
 
 TEST_CASE("SQLKit handle lifecycle", "[SQLKit]") {
@@ -140,10 +149,12 @@ TEST_CASE("SQLKit API", "[SQLKit]") {
     auto stmt1 = db.prepare(sql.c_str());
     auto stmt2 = db.prepare("DROP TABLE barZZZZ", sql.size());
     auto stmt3 = db.prepare(sql);
+    auto stmt4 = db.prepare(foc::StringRef("DROP TABLE barZZZZ", sql.size()));
 
     REQUIRE(sql == stmt1.sql());
     REQUIRE(sql == stmt2.sql());
     REQUIRE(sql == stmt3.sql());
+    REQUIRE(sql == stmt4.sql());
 
     status = stmt1.execute(db);
     REQUIRE(status == SQLITE_OK);
@@ -218,25 +229,64 @@ TEST_CASE("SQLKit API", "[SQLKit]") {
     {
       auto stmt = db.prepare("SELECT 1, 2, 3, 4, 5, 6, 3 + 4");
       db.query(stmt);
-      auto cols = stmt.tuple<int, int, int, int, int, int>();
+      auto cols = stmt.tuple<int, int, int, int, int, int, int>();
       REQUIRE(cols == std::make_tuple(1, 2, 3, 4, 5, 6, 7));
     }
 
     {
       auto stmt = db.prepare("SELECT 1, 2, 3, 4, 5, 6, 3 + 4, 8");
       db.query(stmt);
-      auto cols = stmt.tuple<int, int, int, int, int, int, int>();
+      auto cols = stmt.tuple<int, int, int, int, int, int, int, int>();
       REQUIRE(cols == std::make_tuple(1, 2, 3, 4, 5, 6, 7, 8));
     }
 
     {
       auto stmt = db.prepare("SELECT 1, 2, 3, 4, 5, 6, 3 + 4, 8, 9");
       db.query(stmt);
-      auto cols = stmt.tuple<int, int, int, int, int, int, int, int>();
+      auto cols = stmt.tuple<int, int, int, int, int, int, int, int, int>();
       REQUIRE(cols == std::make_tuple(1, 2, 3, 4, 5, 6, 7, 8, 9));
     }
   }
 
+  SECTION("column views") {
+    auto stmt = db.prepare("SELECT 'ab', x'00ff10', NULL, x'', 42, 1.5");
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+
+    foc::StringRef text = stmt.column<foc::StringRef>(0);
+    REQUIRE(text.size() == 2);
+    REQUIRE(text == "ab");
+
+    auto row = stmt.row();
+    REQUIRE(row.nextStringRef() == "ab");
+    foc::ArrayRef<uint8_t> blob = row.nextBytes();
+    REQUIRE(blob.size() == 3);
+    REQUIRE(blob[0] == 0x00);
+    REQUIRE(blob[1] == 0xff);
+    REQUIRE(blob[2] == 0x10);
+    REQUIRE(row.nextStringRef().empty());
+    REQUIRE(row.nextBytes().empty());
+    // Numbers are converted to text.
+    REQUIRE(row.nextStringRef() == "42");
+
+    auto cols = stmt.tuple<foc::StringRef, foc::ArrayRef<uint8_t>, foc::StringRef>();
+    REQUIRE(std::get<0>(cols) == "ab");
+    REQUIRE(std::get<1>(cols).size() == 3);
+    REQUIRE(std::get<2>(cols).empty());
+
+    auto many = stmt.tuple<foc::StringRef, foc::ArrayRef<uint8_t>, foc::StringRef,
+                           foc::ArrayRef<uint8_t>, foc::StringRef, foc::StringRef>();
+    REQUIRE(std::get<4>(many) == "42");
+    REQUIRE(std::get<5>(many) == "1.5");
+    REQUIRE(stmt.reset() == SQLITE_OK);
+
+    // Text with embedded NULs keeps its full size.
+    auto embedded = db.prepare("SELECT ?");
+    embedded.bind(1, "x\0y", 3);
+    REQUIRE(db.query(embedded) == SQLITE_ROW);
+    REQUIRE(embedded.column<foc::StringRef>(0).size() == 3);
+    REQUIRE(embedded.reset() == SQLITE_OK);
+  }
+
   SECTION("result set iteration") {
     // Navigate a result set with a single result
     {
@@ -393,4 +443,1845 @@ TEST_CASE("SQLKit API", "[SQLKit]") {
   }
 }
 
+// Checked at compile time.
+static_assert(sqlParameterCount("SELECT 1") == 0, "");
+static_assert(sqlParameterCount("SELECT ?, ?2, :a, @b, $c") == 5, "");
+static_assert(sqlParameterCount("SELECT '?', \"?\", [?], `?` -- ?\n, ? /* :x */") == 1, "");
+static_assert(sqlParameterCount("SELECT 'it''s ?', ?") == 1, "");
+
+TEST_CASE("SQLKit typed binding and queries", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE users(id INTEGER PRIMARY KEY, name TEXT, score REAL, "
+                     "avatar BLOB)") == SQLITE_OK);
+
+  SECTION("bindAll") {
+    Stmt insert = db.prepare("INSERT INTO users VALUES (?, ?, ?, ?)");
+    const uint8_t avatar[] = {1, 2, 3};
+    REQUIRE(insert.bindAll(1, "Ana", 3.5, foc::ArrayRef<uint8_t>(avatar)) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+    REQUIRE(insert.bindAll(int64_t(2), std::string("Bia"), 4.0, nullptr) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+    REQUIRE(insert.bindAll(3, foc::StringRef("Caio"), nullptr, nullptr) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+
+    Stmt select = db.prepare("SELECT id, name, length(avatar) FROM users ORDER BY id");
+    REQUIRE(db.query(select) == SQLITE_ROW);
+    REQUIRE((select.tuple<int, std::string, int>()) == std::make_tuple(1, std::string("Ana"), 3));
+    REQUIRE(db.step(select) == SQLITE_ROW);
+    REQUIRE(select.column<std::string>(1) == "Bia");
+    REQUIRE(select.columnIsNull(2));
+    REQUIRE(db.step(select) == SQLITE_ROW);
+    REQUIRE(db.step(select) == SQLITE_DONE);
+  }
+
+  SECTION("bind and bindAll store the same text") {
+    Stmt insert = db.prepare("INSERT INTO users(id, name) VALUES (?, ?)");
+    REQUIRE(insert.bind(1, 1) == SQLITE_OK);
+    REQUIRE(insert.bind(2, std::string("Ana")) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+    REQUIRE(insert.bindAll(2, std::string("Bia")) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+    const std::string caio = "Caio";
+    REQUIRE(insert.bind(1, 3) == SQLITE_OK);
+    REQUIRE(insert.bindStatic(2, caio) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+
+    Stmt select = db.prepare("SELECT id, length(CAST(name AS BLOB)) FROM users WHERE name = ?");
+    REQUIRE(select.bindAll(std::string("Ana")) == SQLITE_OK);
+    REQUIRE(db.query(select) == SQLITE_ROW);
+    REQUIRE((select.tuple<int, int>()) == std::make_tuple(1, 3));
+    select.reset();
+    REQUIRE(select.bind(1, std::string("Bia")) == SQLITE_OK);
+    REQUIRE(db.query(select) == SQLITE_ROW);
+    REQUIRE((select.tuple<int, int>()) == std::make_tuple(2, 3));
+    select.reset();
+    REQUIRE(select.bindAll(foc::StringRef("Caio")) == SQLITE_OK);
+    REQUIRE(db.query(select) == SQLITE_ROW);
+    REQUIRE((select.tuple<int, int>()) == std::make_tuple(3, 4));
+  }
+
+  SECTION("bindAll with other integer types") {
+    Stmt stmt = db.prepare("SELECT ?, ?, ?, ?, ?, typeof(?)");
+    std::vector<int> sizes(3);
+    REQUIRE(stmt.bindAll((long long)-5000000000LL, (sqlite3_int64)6000000000LL, 4000000000u,
+                         sizes.size(), (short)-7, true) == SQLITE_OK);
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<int64_t>(0) == -5000000000LL);
+    REQUIRE(stmt.column<int64_t>(1) == 6000000000LL);
+    REQUIRE(stmt.column<int64_t>(2) == 4000000000LL);
+    REQUIRE(stmt.column<int64_t>(3) == 3);
+    REQUIRE(stmt.column<int>(4) == -7);
+    REQUIRE(stmt.column<std::string>(5) == "integer");
+    stmt.reset();
+
+    Query<int64_t(size_t, unsigned)> sum;
+    REQUIRE(sum.prepare(db, "SELECT ? + ?") == SQLITE_OK);
+    REQUIRE(sum.query(db, (size_t)1 << 40, 3u) == SQLITE_ROW);
+    REQUIRE(sum.row() == ((int64_t)1 << 40) + 3);
+  }
+
+  SECTION("Query") {
+    Query<void(int64_t, foc::StringRef, double)> insert;
+    REQUIRE(insert.prepare(db, "INSERT INTO users(id, name, score) VALUES (?, ?, ?)") ==
+            SQLITE_OK);
+    REQUIRE(insert.execute(db, 1, "Ana", 3.5) == SQLITE_OK);
+    REQUIRE(insert.execute(db, 2, "Bia", 4.0) == SQLITE_OK);
+    REQUIRE(insert.execute(db, 3, "Caio", 1.0) == SQLITE_OK);
+    REQUIRE(insert.execute(db, 3, "Duplicate", 0.0) == SQLITE_CONSTRAINT);
+
+    typedef Query<std::tuple<int64_t, foc::StringRef>(double)> ByScore;
+    static_assert(ByScore::kNumParameters == 1 && ByScore::kNumColumns == 2, "");
+    ByScore by_score;
+    REQUIRE(by_score.prepare(db, "SELECT id, name FROM users WHERE score >= ? ORDER BY id") ==
+            SQLITE_OK);
+    REQUIRE(by_score.query(db, 3.0) == SQLITE_ROW);
+    REQUIRE(std::get<0>(by_score.row()) == 1);
+    REQUIRE(std::get<1>(by_score.row()) == "Ana");
+    // Querying again without reset() starts over.
+    REQUIRE(by_score.query(db, 4.0) == SQLITE_ROW);
+    REQUIRE(std::get<1>(by_score.row()) == "Bia");
+    REQUIRE(by_score.step(db) == SQLITE_DONE);
+
+    std::vector<std::string> names;
+    REQUIRE(by_score.forEach(db,
+                             [&names](const std::tuple<int64_t, foc::StringRef> &row) {
+                               names.push_back(std::get<1>(row).str());
+                             },
+                             0.0) == SQLITE_OK);
+    REQUIRE(names == std::vector<std::string>({"Ana", "Bia", "Caio"}));
+
+    Query<int64_t()> count;
+    REQUIRE(count.prepare(db, "SELECT count(*) FROM users") == SQLITE_OK);
+    REQUIRE(count.query(db) == SQLITE_ROW);
+    REQUIRE(count.row() == 3);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+namespace {
+
+struct Player {
+  int64_t id;
+  std::string name;
+  double score;
+};
+
+}  // namespace
+
+TEST_CASE("SQLKit row ranges", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE players(id INTEGER PRIMARY KEY, name TEXT, score REAL)") ==
+          SQLITE_OK);
+  const char *names[] = {"Ana", "Bia", "Caio", "Davi"};
+  {
+    Stmt insert = db.prepare("INSERT INTO players VALUES (?, ?, ?)");
+    for (int i = 0; i < 4; i++) {
+      insert.bindAll(i + 1, names[i], i * 1.5);
+      REQUIRE(insert.execute(db) == SQLITE_OK);
+    }
+  }
+
+  SECTION("tuples") {
+    Stmt stmt = db.prepare("SELECT id, name FROM players ORDER BY id");
+    auto rows = stmt.rows<int, foc::StringRef>();
+    REQUIRE(rows.status() == SQLITE_OK);
+    std::vector<std::string> visited;
+    for (const auto &row : rows) {
+      REQUIRE(rows.status() == SQLITE_ROW);
+      REQUIRE(std::get<1>(row) == names[std::get<0>(row) - 1]);
+      visited.push_back(std::get<1>(row).str());
+    }
+    REQUIRE(rows.status() == SQLITE_DONE);
+    REQUIRE(visited.size() == 4);
+  }
+
+  SECTION("aggregates and algorithms") {
+    Stmt stmt = db.prepare("SELECT id, name, score FROM players ORDER BY id");
+    auto players = stmt.rowsAs<Player, int64_t, std::string, double>();
+    double total = std::accumulate(players.begin(), players.end(), 0.0,
+                                   [](double sum, const Player &p) { return sum + p.score; });
+    REQUIRE(total == 9.0);
+    REQUIRE(players.status() == SQLITE_DONE);
+
+    REQUIRE(stmt.reset() == SQLITE_OK);
+    auto again = stmt.rowsAs<Player, int64_t, std::string, double>();
+    auto it = std::find_if(again.begin(), again.end(),
+                           [](const Player &p) { return p.name == "Caio"; });
+    REQUIRE(it != again.end());
+    REQUIRE((*it).id == 3);
+  }
+
+  SECTION("empty results") {
+    Stmt stmt = db.prepare("SELECT id FROM players WHERE id > 100");
+    auto rows = stmt.rows<int>();
+    REQUIRE(rows.begin() == rows.end());
+    REQUIRE(rows.status() == SQLITE_DONE);
+  }
+
+  SECTION("errors stop the iteration") {
+    // The integer overflow is only detected when the row is computed.
+    Stmt stmt = db.prepare("SELECT abs(1 - id - 9223372036854775807) FROM players ORDER BY id");
+    int n = 0;
+    auto rows = stmt.rows<int64_t>();
+    for (const auto &row : rows) {
+      (void)row;
+      n++;
+    }
+    REQUIRE(n == 1);
+    REQUIRE(rows.status() == SQLITE_ERROR);
+  }
+
+  SECTION("typed queries") {
+    Query<std::tuple<foc::StringRef>(double)> by_score;
+    REQUIRE(by_score.prepare(db, "SELECT name FROM players WHERE score > ? ORDER BY id") ==
+            SQLITE_OK);
+    std::vector<std::string> names;
+    for (const auto &row : by_score.rows(2.0)) {
+      names.push_back(std::get<0>(row).str());
+    }
+    REQUIRE(names == std::vector<std::string>({"Caio", "Davi"}));
+
+    Query<int64_t()> count;
+    REQUIRE(count.prepare(db, "SELECT count(*) FROM players") == SQLITE_OK);
+    REQUIRE(*count.rows().begin() == 4);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+}  // namespace sqlkit
+
+namespace app {
+
+struct Employee {
+  int64_t id;
+  std::string name;
+  double salary;
+  foc::StringRef team;
+};
+SQLKIT_FIELDS(Employee, id, name, salary, team)
+
+struct Unmapped {
+  int x;
+};
+
+}  // namespace app
+
+namespace sqlkit {
+
+static_assert(detail::HasFields<app::Employee>::value, "");
+static_assert(!detail::HasFields<app::Unmapped>::value, "");
+static_assert(!detail::HasFields<int>::value, "");
+static_assert(!detail::HasFields<std::string>::value, "");
+
+TEST_CASE("SQLKit struct mapping", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE employees(id INTEGER PRIMARY KEY, name TEXT, salary REAL, "
+                     "team TEXT)") == SQLITE_OK);
+  {
+    Stmt insert = db.prepare("INSERT INTO employees VALUES (?, ?, ?, ?)");
+    app::Employee ana = {1, "Ana", 100.5, "core"};
+    app::Employee bia = {2, "Bia", 200.0, "infra"};
+    REQUIRE(insert.bindStruct(ana) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+    REQUIRE(insert.bindStruct(bia) == SQLITE_OK);
+    REQUIRE(insert.execute(db) == SQLITE_OK);
+  }
+
+  SECTION("row<Struct>()") {
+    Stmt select = db.prepare("SELECT id, name, salary, team FROM employees ORDER BY id");
+    REQUIRE(db.query(select) == SQLITE_ROW);
+    app::Employee employee = select.row<app::Employee>();
+    REQUIRE(employee.id == 1);
+    REQUIRE(employee.name == "Ana");
+    REQUIRE(employee.salary == 100.5);
+    REQUIRE(employee.team == "core");
+    REQUIRE(db.step(select) == SQLITE_ROW);
+    // The untemplated row() is still the positioned row.
+    REQUIRE(select.row().nextInt64() == 2);
+  }
+
+  SECTION("rows<Struct>()") {
+    Stmt select = db.prepare("SELECT id, name, salary, team FROM employees ORDER BY id");
+    std::vector<std::string> names;
+    double total = 0;
+    for (const app::Employee &employee : select.rows<app::Employee>()) {
+      names.push_back(employee.name);
+      total += employee.salary;
+    }
+    REQUIRE(names == std::vector<std::string>({"Ana", "Bia"}));
+    REQUIRE(total == 300.5);
+
+    // A single unmapped type still yields tuples.
+    REQUIRE(select.reset() == SQLITE_OK);
+    auto ids = select.rows<int64_t>();
+    REQUIRE(std::get<0>(*ids.begin()) == 1);
+  }
+
+  SECTION("Query with a struct row") {
+    Query<app::Employee(foc::StringRef)> by_team;
+    static_assert(decltype(by_team)::kNumColumns == 4, "");
+    REQUIRE(by_team.prepare(db, "SELECT id, name, salary, team FROM employees WHERE team = ?") ==
+            SQLITE_OK);
+    REQUIRE(by_team.query(db, "infra") == SQLITE_ROW);
+    REQUIRE(by_team.row().name == "Bia");
+    REQUIRE(by_team.step(db) == SQLITE_DONE);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+namespace {
+
+int countCommit(void *commits) {
+  ++*(int *)commits;
+  return 0;
+}
+
+int countRows(Handle &db) {
+  Stmt count = db.prepare("SELECT count(*) FROM t");
+  return db.query(count) == SQLITE_ROW ? count.column<int>(0) : -1;
+}
+
+}  // namespace
+
+TEST_CASE("SQLKit transactions", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE t(x INTEGER UNIQUE)") == SQLITE_OK);
+  int commits = 0;
+  sqlite3_commit_hook(db.raw(), countCommit, &commits);
+
+  SECTION("commit") {
+    Transaction txn(db, Transaction::kImmediate);
+    REQUIRE(txn.status() == SQLITE_OK);
+    REQUIRE(db.inTransaction());
+    REQUIRE(db.execute("INSERT INTO t VALUES (1)") == SQLITE_OK);
+    REQUIRE(db.execute("INSERT INTO t VALUES (2)") == SQLITE_OK);
+    REQUIRE(txn.commit() == SQLITE_OK);
+    REQUIRE(!txn.isActive());
+    REQUIRE(!db.inTransaction());
+    REQUIRE(commits == 1);
+    REQUIRE(countRows(db) == 2);
+  }
+
+  SECTION("rollback on destruction") {
+    for (Transaction::Mode mode :
+         {Transaction::kDeferred, Transaction::kImmediate, Transaction::kExclusive}) {
+      Transaction txn(db, mode);
+      REQUIRE(txn.isActive());
+      REQUIRE(db.execute("INSERT INTO t VALUES (1)") == SQLITE_OK);
+    }
+    REQUIRE(!db.inTransaction());
+    REQUIRE(commits == 0);
+    REQUIRE(countRows(db) == 0);
+
+    // Nested BEGIN fails.
+    Transaction outer(db);
+    Transaction inner(db);
+    REQUIRE(inner.status() == SQLITE_ERROR);
+    REQUIRE(!inner.isActive());
+  }
+
+  SECTION("savepoints") {
+    Transaction txn(db);
+    REQUIRE(db.execute("INSERT INTO t VALUES (1)") == SQLITE_OK);
+    {
+      Savepoint outer(db);
+      REQUIRE(db.execute("INSERT INTO t VALUES (2)") == SQLITE_OK);
+      {
+        Savepoint inner(db);
+        REQUIRE(db.execute("INSERT INTO t VALUES (3)") == SQLITE_OK);
+        // Rolled back on destruction
+      }
+      REQUIRE(countRows(db) == 2);
+      {
+        Savepoint inner(db);
+        REQUIRE(db.execute("INSERT INTO t VALUES (4)") == SQLITE_OK);
+        REQUIRE(inner.release() == SQLITE_OK);
+      }
+      REQUIRE(outer.release() == SQLITE_OK);
+    }
+    {
+      Savepoint savepoint(db);
+      REQUIRE(db.execute("INSERT INTO t VALUES (5)") == SQLITE_OK);
+      REQUIRE(savepoint.rollback() == SQLITE_OK);
+    }
+    REQUIRE(db.inTransaction());
+    REQUIRE(txn.commit() == SQLITE_OK);
+    REQUIRE(commits == 1);
+    Stmt sum = db.prepare("SELECT sum(x) FROM t");
+    REQUIRE(db.query(sum) == SQLITE_ROW);
+    REQUIRE(sum.column<int>(0) == 1 + 2 + 4);
+  }
+
+  SECTION("savepoints without a transaction") {
+    Savepoint savepoint(db);
+    REQUIRE(db.inTransaction());
+    REQUIRE(db.execute("INSERT INTO t VALUES (1)") == SQLITE_OK);
+    REQUIRE(savepoint.release() == SQLITE_OK);
+    REQUIRE(!db.inTransaction());
+    REQUIRE(commits == 1);
+  }
+
+  SECTION("batch") {
+    Stmt insert = db.prepare("INSERT INTO t VALUES (?)");
+    int status = db.batch(100, [&insert, &db](size_t i) {
+      if (i == 250) {
+        return SQLITE_DONE;
+      }
+      insert.bindAll((int64_t)i);
+      return insert.execute(db);
+    });
+    REQUIRE(status == SQLITE_OK);
+    REQUIRE(commits == 3);
+    REQUIRE(countRows(db) == 250);
+    REQUIRE(!db.inTransaction());
+
+    // An error rolls back the current batch only.
+    status = db.batch(100, [&insert, &db](size_t i) {
+      insert.bindAll((int64_t)(i < 150 ? 1000 + i : 0));
+      return insert.execute(db);
+    });
+    REQUIRE(status == SQLITE_CONSTRAINT);
+    REQUIRE(commits == 4);
+    REQUIRE(countRows(db) == 350);
+    REQUIRE(!db.inTransaction());
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit open options", "[SQLKit]") {
+  remove("test_options.db");
+  remove("test_options.db-wal");
+  remove("test_options.db-shm");
+
+  SECTION("presets") {
+    Handle writer;
+    REQUIRE(writer.open("test_options.db", OpenOptions::ingest()) == SQLITE_OK);
+    std::string value;
+    REQUIRE(writer.pragma("PRAGMA journal_mode", &value) == SQLITE_OK);
+    REQUIRE(value == "wal");
+    REQUIRE(writer.pragma("PRAGMA synchronous", &value) == SQLITE_OK);
+    REQUIRE(value == "1");
+    REQUIRE(writer.pragma("PRAGMA cache_size", &value) == SQLITE_OK);
+    REQUIRE(value == "-65536");
+    REQUIRE(writer.pragma("PRAGMA temp_store", &value) == SQLITE_OK);
+    REQUIRE(value == "2");
+    REQUIRE(writer.execute("CREATE TABLE t(x)") == SQLITE_OK);
+
+    Handle reader;
+    REQUIRE(reader.open("test_options.db", OpenOptions::readHeavy()) == SQLITE_OK);
+    REQUIRE(reader.pragma("PRAGMA mmap_size", &value) == SQLITE_OK);
+    REQUIRE(value == std::to_string(256 << 20));
+    REQUIRE(reader.execute("INSERT INTO t VALUES (1)") == SQLITE_READONLY);
+    REQUIRE(reader.close() == SQLITE_OK);
+
+    Handle durable;
+    REQUIRE(durable.open("test_options.db", OpenOptions::durable()) == SQLITE_OK);
+    REQUIRE(durable.pragma("PRAGMA synchronous", &value) == SQLITE_OK);
+    REQUIRE(value == "2");
+    REQUIRE(durable.close() == SQLITE_OK);
+    REQUIRE(writer.close() == SQLITE_OK);
+  }
+
+  SECTION("defaults leave SQLite alone") {
+    Handle db;
+    REQUIRE(db.open("test_options.db", OpenOptions()) == SQLITE_OK);
+    std::string value;
+    REQUIRE(db.pragma("PRAGMA journal_mode", &value) == SQLITE_OK);
+    REQUIRE(value == "delete");
+    REQUIRE(db.pragma("PRAGMA synchronous", &value) == SQLITE_OK);
+    REQUIRE(value == "2");
+    REQUIRE(db.close() == SQLITE_OK);
+  }
+
+  SECTION("settings that can't be applied fail the open") {
+    Handle db;
+    REQUIRE(db.open(":memory:", OpenOptions::ingest()) == SQLITE_ERROR);
+    REQUIRE(!db.isInitialized());
+  }
+}
+
+TEST_CASE("SQLKit memory configuration", "[SQLKit]") {
+  remove("test_memory.db");
+  remove("test_memory.db-journal");
+
+  sqlite3_mem_methods default_malloc;
+  sqlite3_pcache_methods2 default_pcache;
+  REQUIRE(sqlite3_shutdown() == SQLITE_OK);
+  REQUIRE(sqlite3_config(SQLITE_CONFIG_GETMALLOC, &default_malloc) == SQLITE_OK);
+  REQUIRE(sqlite3_config(SQLITE_CONFIG_GETPCACHE2, &default_pcache) == SQLITE_OK);
+  MemoryOptions options;
+  SECTION("with memory status") {}
+  SECTION("without memory status") { options.memory_status = false; }
+  REQUIRE(configureMemory(options) == SQLITE_OK);
+
+  {
+    Handle db;
+    REQUIRE(db.open("test_memory.db") == SQLITE_OK);
+    // Too late once SQLite is initialized.
+    REQUIRE(configureMemory() == SQLITE_MISUSE);
+
+    // Every byte of sqlite3_msize() survives a realloc, including when
+    // xRoundup() was skipped.
+    char *buffer = (char *)sqlite3_malloc(2400);
+    REQUIRE(buffer != nullptr);
+    int size = (int)sqlite3_msize(buffer);
+    REQUIRE(size >= 2400);
+    for (int i = 0; i < size; i++) {
+      buffer[i] = (char)i;
+    }
+    buffer = (char *)sqlite3_realloc(buffer, 8000);
+    REQUIRE(buffer != nullptr);
+    int mismatches = 0;
+    for (int i = 0; i < size; i++) {
+      mismatches += buffer[i] != (char)i;
+    }
+    REQUIRE(mismatches == 0);
+    sqlite3_free(buffer);
+    // A small cache makes the page cache evict and recycle pages.
+    REQUIRE(db.execute("PRAGMA cache_size = 16") == SQLITE_OK);
+    REQUIRE(db.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, data BLOB)") ==
+            SQLITE_OK);
+    REQUIRE(db.execute("CREATE INDEX t_name ON t(name)") == SQLITE_OK);
+
+    {
+      Query<void(int, std::string, foc::ArrayRef<uint8_t>)> insert;
+      REQUIRE(insert.prepare(db, "INSERT INTO t VALUES (?, ?, ?)") == SQLITE_OK);
+      std::vector<uint8_t> data(6000);
+      REQUIRE(db.execute("BEGIN") == SQLITE_OK);
+      for (int i = 0; i < 2000; i++) {
+        data[0] = (uint8_t)i;
+        // Blobs bigger than the largest size class go to malloc().
+        size_t size = i % 10 == 0 ? data.size() : (size_t)(i % 300);
+        REQUIRE(insert.execute(db, i, "name" + std::to_string(i),
+                               foc::ArrayRef<uint8_t>(data.data(), size)) == SQLITE_OK);
+      }
+      REQUIRE(db.execute("COMMIT") == SQLITE_OK);
+
+      // Rolling back truncates the cache.
+      REQUIRE(db.execute("BEGIN") == SQLITE_OK);
+      REQUIRE(db.execute("INSERT INTO t SELECT id + 2000, name, data FROM t") == SQLITE_OK);
+      REQUIRE(db.execute("ROLLBACK") == SQLITE_OK);
+
+      Query<std::tuple<int, int>(std::string)> lookup;
+      REQUIRE(lookup.prepare(db, "SELECT id, length(data) FROM t WHERE name = ?") == SQLITE_OK);
+      for (int i = 0; i < 2000; i += 7) {
+        REQUIRE(lookup.query(db, "name" + std::to_string(i)) == SQLITE_ROW);
+        REQUIRE(std::get<0>(lookup.row()) == i);
+        REQUIRE(std::get<1>(lookup.row()) == (i % 10 == 0 ? 6000 : i % 300));
+      }
+
+      // group_concat() grows its result with realloc().
+      Query<std::string()> concat;
+      REQUIRE(concat.prepare(db, "SELECT group_concat(name, ',') FROM t") == SQLITE_OK);
+      REQUIRE(concat.query(db) == SQLITE_ROW);
+      REQUIRE(concat.row().size() > 2000 * 5);
+    }
+
+    std::string integrity;
+    REQUIRE(db.pragma("PRAGMA integrity_check", &integrity) == SQLITE_OK);
+    REQUIRE(integrity == "ok");
+    REQUIRE((sqlite3_memory_used() > 0) == options.memory_status);
+
+    // In-memory databases use a cache that never evicts.
+    Handle memory;
+    REQUIRE(memory.open(":memory:") == SQLITE_OK);
+    REQUIRE(memory.execute("PRAGMA cache_size = 4") == SQLITE_OK);
+    REQUIRE(memory.execute("CREATE TABLE t(x)") == SQLITE_OK);
+    REQUIRE(memory.execute("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+                           "WHERE x < 5000) INSERT INTO t SELECT randomblob(100) FROM c") ==
+            SQLITE_OK);
+    REQUIRE(memory.pragma("PRAGMA integrity_check", &integrity) == SQLITE_OK);
+    REQUIRE(integrity == "ok");
+    REQUIRE(memory.close() == SQLITE_OK);
+
+    sqlite3_db_release_memory(db.raw());
+    REQUIRE(db.close() == SQLITE_OK);
+  }
+
+  REQUIRE(sqlite3_shutdown() == SQLITE_OK);
+  REQUIRE(sqlite3_config(SQLITE_CONFIG_MALLOC, &default_malloc) == SQLITE_OK);
+  REQUIRE(sqlite3_config(SQLITE_CONFIG_PCACHE2, &default_pcache) == SQLITE_OK);
+  REQUIRE(sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 1) == SQLITE_OK);
+  remove("test_memory.db");
+}
+
+TEST_CASE("SQLKit columnar batches", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE trades(id INTEGER, price REAL, symbol TEXT, qty INTEGER)") ==
+          SQLITE_OK);
+  {
+    Stmt insert = db.prepare("INSERT INTO trades VALUES (?, ?, ?, ?)");
+    for (int i = 0; i < 1000; i++) {
+      if (i == 7) {
+        insert.bindAll(i, nullptr, nullptr, nullptr);
+      } else {
+        insert.bindAll(i, i * 0.5, std::string(i % 5, 'x'), i % 3);
+      }
+      REQUIRE(insert.execute(db) == SQLITE_OK);
+    }
+  }
+
+  StringColumn symbols;
+  REQUIRE(symbols.empty());
+  REQUIRE(symbols.offsets().size() == 1);
+  // fetchColumns() returns SQLITE_TOOBIG for rows that don't fit.
+  REQUIRE(symbols.fits(StringColumn::kMaxBytes));
+  REQUIRE(!symbols.fits((size_t)StringColumn::kMaxBytes + 1));
+  symbols.push_back("abc");
+  REQUIRE(symbols.fits(StringColumn::kMaxBytes - 3));
+  REQUIRE(!symbols.fits(StringColumn::kMaxBytes - 2));
+  symbols.clear();
+
+  Stmt select = db.prepare("SELECT id, price, symbol, qty FROM trades ORDER BY id");
+  foc::SmallVector<int64_t, 0> ids;
+  foc::SmallVector<double, 0> prices;
+  foc::SmallVector<int, 0> quantities;
+  int status;
+  int batches = 0;
+  int64_t next_id = 0;
+  do {
+    status = select.fetchColumns(300, ids, prices, symbols, quantities);
+    batches++;
+    REQUIRE(ids.size() == (batches < 4 ? 300 : 100));
+    REQUIRE(prices.size() == ids.size());
+    REQUIRE(symbols.size() == ids.size());
+    REQUIRE(quantities.size() == ids.size());
+    for (size_t i = 0; i < ids.size(); i++, next_id++) {
+      REQUIRE(ids[i] == next_id);
+      if (next_id == 7) {
+        REQUIRE(prices[i] == 0.0);
+        REQUIRE(symbols[i].empty());
+        REQUIRE(quantities[i] == 0);
+      } else {
+        REQUIRE(prices[i] == next_id * 0.5);
+        REQUIRE(symbols[i] == std::string(next_id % 5, 'x'));
+        REQUIRE(quantities[i] == next_id % 3);
+      }
+    }
+    REQUIRE(symbols.offsets().back() == symbols.arena().size());
+    ids.clear();
+    prices.clear();
+    symbols.clear();
+    quantities.clear();
+  } while (status == SQLITE_ROW);
+  REQUIRE(status == SQLITE_DONE);
+  REQUIRE(batches == 4);
+  REQUIRE(next_id == 1000);
+
+  // Errors stop the batch but keep the rows before them. The third row
+  // overflows.
+  Stmt overflow = db.prepare("SELECT abs(1 - id - 9223372036854775807) FROM trades");
+  REQUIRE(overflow.fetchColumns(10, ids) == SQLITE_ERROR);
+  REQUIRE(ids.size() == 2);
+  overflow.finalize();
+  select.finalize();
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit statement cache", "[SQLKit]") {
+  Handle db;
+  db.open(":memory:");
+  int status;
+
+  status = db.execute("CREATE TABLE kv(k INTEGER PRIMARY KEY, v TEXT)");
+  REQUIRE(status == SQLITE_OK);
+
+  SECTION("execute() reuses statements") {
+    StmtCache &cache = db.stmtCache();
+    uint64_t misses = cache.misses();
+    for (int i = 0; i < 10; i++) {
+      status = db.execute("INSERT INTO kv(v) VALUES ('x')");
+      REQUIRE(status == SQLITE_OK);
+    }
+    REQUIRE(cache.misses() == misses + 1);
+    REQUIRE(cache.hits() >= 9);
+
+    // Failing to compile is reported and nothing is cached.
+    size_t size = cache.size();
+    status = db.execute("INSERT INTO no_table VALUES (1)");
+    REQUIRE(status == SQLITE_ERROR);
+    REQUIRE(cache.size() == size);
+  }
+
+  SECTION("leases are reset and cleared when returned") {
+    const char *sql = "SELECT ?";
+    sqlite3_stmt *raw;
+    {
+      CachedStmt stmt = db.prepareCached(sql);
+      REQUIRE(stmt.isInitialized());
+      raw = stmt->raw();
+      stmt->bind(1, 42);
+      REQUIRE(stmt->query(db) == SQLITE_ROW);
+      REQUIRE(stmt->column<int>(0) == 42);
+    }
+    CachedStmt stmt = db.prepareCached(std::string(sql));
+    REQUIRE(stmt->raw() == raw);
+    REQUIRE(stmt->query(db) == SQLITE_ROW);
+    REQUIRE(stmt->columnIsNull(0));
+
+    // The same SQL leased twice at once gets two statements.
+    CachedStmt other = db.prepareCached(sql);
+    REQUIRE(other.isInitialized());
+    REQUIRE(other->raw() != raw);
+    other.release();
+    REQUIRE(!other.isInitialized());
+    REQUIRE(db.stmtCache().size() >= 1);
+  }
+
+  SECTION("least recently used statements are evicted") {
+    StmtCache &cache = db.stmtCache();
+    cache.clear();
+    cache.setCapacity(2);
+    db.prepareCached("SELECT 1");
+    db.prepareCached("SELECT 2");
+    db.prepareCached("SELECT 1");
+    db.prepareCached("SELECT 3");
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.evictions() >= 1);
+
+    uint64_t hits = cache.hits();
+    db.prepareCached("SELECT 1");
+    REQUIRE(cache.hits() == hits + 1);
+    db.prepareCached("SELECT 2");
+    REQUIRE(cache.hits() == hits + 1);
+
+    REQUIRE(cache.memoryUsed() > 0);
+    cache.setMemoryBudget(0);
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.memoryUsed() == 0);
+  }
+
+  SECTION("closing finalizes cached statements") {
+    db.prepareCached("SELECT 1");
+    REQUIRE(db.stmtCache().size() > 0);
+    status = db.close();
+    REQUIRE(status == SQLITE_OK);
+  }
+}
+
+TEST_CASE("SQLKit connection pool", "[SQLKit]") {
+  remove("test_pool.db");
+  remove("test_pool.db-wal");
+  remove("test_pool.db-shm");
+
+  Pool pool;
+  int status = pool.open("test_pool.db", 2);
+  REQUIRE(status == SQLITE_OK);
+  REQUIRE(pool.numReaders() == 2);
+
+  {
+    PooledHandle db = pool.writer();
+    REQUIRE(db.isInitialized());
+    REQUIRE(db.isWriter());
+    REQUIRE(db->execute("CREATE TABLE numbers(n INTEGER)") == SQLITE_OK);
+    for (int i = 0; i < 100; i++) {
+      CachedStmt insert = db->prepareCached("INSERT INTO numbers VALUES (?)");
+      insert->bind(1, i);
+      REQUIRE(insert->execute(*db) == SQLITE_OK);
+    }
+  }
+
+  SECTION("readers are read-only") {
+    PooledHandle db = pool.reader();
+    REQUIRE(db.isInitialized());
+    REQUIRE(db->execute("INSERT INTO numbers VALUES (1)") == SQLITE_READONLY);
+  }
+
+  SECTION("waiting for a connection is bounded") {
+    PooledHandle r1 = pool.reader();
+    PooledHandle r2 = pool.reader();
+    REQUIRE(r1.isInitialized());
+    REQUIRE(r2.isInitialized());
+    PooledHandle r3 = pool.reader(std::chrono::milliseconds(10));
+    REQUIRE(!r3.isInitialized());
+
+    PoolStats stats = pool.stats();
+    REQUIRE(stats.reader_timeouts == 1);
+    REQUIRE(stats.reader_waits.count() == 3);
+    REQUIRE(stats.reader_waits.max() >= 10000);
+    REQUIRE(stats.reader_waits.percentile(50) == 0);
+
+    r1.release();
+    r3 = pool.reader(std::chrono::milliseconds(10));
+    REQUIRE(r3.isInitialized());
+  }
+
+  SECTION("concurrent readers and a writer") {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&pool, &failures]() {
+        for (int i = 0; i < 200; i++) {
+          PooledHandle db = pool.reader(std::chrono::milliseconds(5000));
+          CachedStmt count = db->prepareCached("SELECT count(*) FROM numbers");
+          if (count->query(*db) != SQLITE_ROW || count->column<int>(0) < 100) {
+            failures++;
+          }
+        }
+      });
+    }
+    threads.emplace_back([&pool, &failures]() {
+      for (int i = 0; i < 50; i++) {
+        PooledHandle db = pool.writer(std::chrono::milliseconds(5000));
+        if (db->execute("INSERT INTO numbers VALUES (1000)") != SQLITE_OK) {
+          failures++;
+        }
+      }
+    });
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    REQUIRE(failures == 0);
+    REQUIRE(pool.stats().reader_waits.count() == 800);
+
+    PooledHandle db = pool.reader();
+    CachedStmt count = db->prepareCached("SELECT count(*) FROM numbers");
+    REQUIRE(count->query(*db) == SQLITE_ROW);
+    REQUIRE(count->column<int>(0) == 150);
+    // The statement caches of the readers stay warm.
+    REQUIRE(db->stmtCache().hits() > 0);
+  }
+
+  REQUIRE(pool.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit latency histogram", "[SQLKit]") {
+  LatencyHistogram histogram;
+  REQUIRE(histogram.percentile(99) == 0);
+  for (uint64_t i = 1; i <= 100; i++) {
+    histogram.record(i);
+  }
+  REQUIRE(histogram.count() == 100);
+  REQUIRE(histogram.max() == 100);
+  REQUIRE(histogram.mean() == 50.5);
+  // Values below 32 have a bucket each, then every power of two has 16.
+  REQUIRE(histogram.percentile(25) == 25);
+  REQUIRE(histogram.percentile(50) == 51);
+  REQUIRE(histogram.percentile(100) == 100);
+  REQUIRE(histogram.bucketCount(0) == 0);
+  REQUIRE(histogram.bucketCount(1) == 1);
+  REQUIRE(histogram.bucketCount(LatencyHistogram::bucketIndex(64)) == 4);
+  REQUIRE(LatencyHistogram::bucketUpperBound(LatencyHistogram::bucketIndex(64)) == 67);
+
+  // Bounds stay within 1/16 of the values over the whole range.
+  const size_t num_buckets = LatencyHistogram::kNumBuckets;
+  for (uint64_t value = 1; value < UINT64_MAX / 3; value = value * 3 + 1) {
+    size_t i = LatencyHistogram::bucketIndex(value);
+    REQUIRE(i < num_buckets);
+    REQUIRE(LatencyHistogram::bucketUpperBound(i) >= value);
+    REQUIRE(LatencyHistogram::bucketUpperBound(i) - value <= value / 16);
+  }
+  REQUIRE(LatencyHistogram::bucketIndex(UINT64_MAX) == num_buckets - 1);
+  REQUIRE(LatencyHistogram::bucketUpperBound(num_buckets - 1) == UINT64_MAX);
+
+  LatencyHistogram other;
+  other.record(0);
+  histogram.merge(other);
+  REQUIRE(histogram.count() == 101);
+  REQUIRE(histogram.bucketCount(0) == 1);
+}
+
+TEST_CASE("SQLKit deadlines", "[SQLKit]") {
+  using std::chrono::milliseconds;
+  using std::chrono::steady_clock;
+  const char *kRunaway =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) SELECT count(*) FROM c";
+
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE t(x)") == SQLITE_OK);
+
+  SECTION("runaway queries are interrupted") {
+    Stmt runaway = db.prepare(kRunaway);
+    auto start = steady_clock::now();
+    REQUIRE(db.query(runaway, start + milliseconds(50)) == SQLITE_INTERRUPT);
+    auto elapsed = steady_clock::now() - start;
+    REQUIRE(elapsed >= milliseconds(50));
+    REQUIRE(elapsed < milliseconds(2000));
+    // Past deadlines fail without running anything.
+    REQUIRE(db.query(runaway, steady_clock::now()) == SQLITE_INTERRUPT);
+
+    // The deadline only applied to that call.
+    Stmt bounded = db.prepare(
+        "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c LIMIT 100000) "
+        "SELECT count(*) FROM c");
+    REQUIRE(db.query(bounded) == SQLITE_ROW);
+    REQUIRE(bounded.column<int>(0) == 100000);
+    bounded.reset();
+    REQUIRE(db.query(bounded, steady_clock::now() + milliseconds(10000)) == SQLITE_ROW);
+    REQUIRE(db.step(bounded, steady_clock::now() + milliseconds(10000)) == SQLITE_DONE);
+  }
+
+  SECTION("interrupted writes roll back the transaction") {
+    REQUIRE(db.execute("BEGIN") == SQLITE_OK);
+    REQUIRE(db.execute("INSERT INTO t VALUES (1)") == SQLITE_OK);
+    Stmt insert = db.prepare(
+        "INSERT INTO t WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+        "SELECT x FROM c");
+    REQUIRE(db.execute(insert, steady_clock::now() + milliseconds(20)) == SQLITE_INTERRUPT);
+    REQUIRE(!db.inTransaction());
+    Query<int()> count;
+    REQUIRE(count.prepare(db, "SELECT count(*) FROM t") == SQLITE_OK);
+    REQUIRE(count.query(db) == SQLITE_ROW);
+    REQUIRE(count.row() == 0);
+  }
+
+  SECTION("withDeadline") {
+    Query<int()> runaway;
+    REQUIRE(runaway.prepare(db, kRunaway) == SQLITE_OK);
+    int status = db.withDeadline(steady_clock::now() + milliseconds(1000), [&]() {
+      // The earliest deadline applies.
+      return db.withDeadline(steady_clock::now() + milliseconds(20),
+                             [&]() { return runaway.query(db); });
+    });
+    REQUIRE(status == SQLITE_INTERRUPT);
+    runaway.reset();
+  }
+
+  SECTION("interrupt() from another thread") {
+    Stmt runaway = db.prepare(kRunaway);
+    std::thread canceller([&db]() {
+      std::this_thread::sleep_for(milliseconds(50));
+      db.interrupt();
+    });
+    REQUIRE(db.query(runaway) == SQLITE_INTERRUPT);
+    canceller.join();
+    runaway.reset();
+    REQUIRE(db.execute("INSERT INTO t VALUES (1)") == SQLITE_OK);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit profiler", "[SQLKit]") {
+  SECTION("SQL normalization") {
+    REQUIRE(normalizeSql("SELECT * FROM t  WHERE id = 42 -- by id") ==
+            "SELECT * FROM t WHERE id = ?");
+    REQUIRE(normalizeSql("  INSERT INTO t1(a,b)\n\tVALUES ('it''s', x'00ff') ") ==
+            "INSERT INTO t1(a,b) VALUES (?, ?)");
+    REQUIRE(normalizeSql("SELECT 1.5e-3, .5, 0x1F, -7, col2 FROM \"t 2\" /* c */ WHERE a=?3") ==
+            "SELECT ?, ?, ?, -?, col2 FROM \"t 2\" WHERE a=?");
+    REQUIRE(normalizeSql("SELECT :name, @p, $v") == "SELECT ?, ?, ?");
+  }
+
+  SECTION("statements are timed and grouped") {
+    Handle db;
+    REQUIRE(db.open(":memory:") == SQLITE_OK);
+    REQUIRE(db.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER)") == SQLITE_OK);
+
+    Profiler profiler;
+    REQUIRE(profiler.attach(db) == SQLITE_OK);
+    {
+      Query<void(int, int)> insert;
+      REQUIRE(insert.prepare(db, "INSERT INTO t VALUES (?, ?)") == SQLITE_OK);
+      for (int i = 0; i < 100; i++) {
+        REQUIRE(insert.execute(db, i, i % 10) == SQLITE_OK);
+      }
+    }
+    // Literals don't make different statements.
+    REQUIRE(db.execute("UPDATE t SET v = 1 WHERE id = 1") == SQLITE_OK);
+    REQUIRE(db.execute("UPDATE t SET v = 2 WHERE id = 2") == SQLITE_OK);
+    {
+      Stmt scan = db.prepare("SELECT count(*) FROM t WHERE v = 3 ORDER BY v");
+      for (int i = 0; i < 3; i++) {
+        REQUIRE(db.query(scan) == SQLITE_ROW);
+        REQUIRE(scan.column<int>(0) == 10);
+        scan.reset();
+      }
+    }
+    REQUIRE(profiler.detach(db) == SQLITE_OK);
+    // Not recorded.
+    REQUIRE(db.execute("DELETE FROM t") == SQLITE_OK);
+
+    REQUIRE(profiler.numStatements() == 3);
+    std::vector<StmtProfile> by_calls = profiler.top(2, Profiler::kCalls);
+    REQUIRE(by_calls.size() == 2);
+    REQUIRE(by_calls[0].sql == "INSERT INTO t VALUES (?, ?)");
+    REQUIRE(by_calls[0].latency.count() == 100);
+    REQUIRE(by_calls[0].fullscan_steps == 0);
+    REQUIRE(by_calls[1].sql == "SELECT count(*) FROM t WHERE v = ? ORDER BY v");
+    REQUIRE(by_calls[1].latency.count() == 3);
+    REQUIRE(by_calls[1].fullscan_steps == 3 * 99);
+    REQUIRE(by_calls[1].vm_steps > by_calls[1].fullscan_steps);
+
+    std::vector<StmtProfile> by_scans = profiler.top(10, Profiler::kFullscanSteps);
+    REQUIRE(by_scans.size() == 3);
+    REQUIRE(by_scans[0].sql == by_calls[1].sql);
+    auto update = std::find_if(by_scans.begin(), by_scans.end(), [](const StmtProfile &p) {
+      return p.sql == "UPDATE t SET v = ? WHERE id = ?";
+    });
+    REQUIRE(update != by_scans.end());
+    REQUIRE(update->latency.count() == 2);
+    // Timed in nanoseconds, so point updates don't round down to 0.
+    REQUIRE(update->latency.max() > 0);
+    REQUIRE(update->latency.percentile(50) > 0);
+
+    std::string report = profiler.report(2, Profiler::kCalls);
+    REQUIRE(std::count(report.begin(), report.end(), '\n') == 3);
+    REQUIRE(report.find("INSERT INTO t VALUES (?, ?)\n") != std::string::npos);
+
+    profiler.reset();
+    REQUIRE(profiler.numStatements() == 0);
+    REQUIRE(db.close() == SQLITE_OK);
+  }
+}
+
+TEST_CASE("SQLKit batch writer", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE events(id INTEGER PRIMARY KEY, name TEXT NOT NULL)") ==
+          SQLITE_OK);
+
+  BatchWriter<int64_t, std::string> writer;
+  REQUIRE(writer.write(0, "before start").get() == SQLITE_MISUSE);
+  REQUIRE(writer.start(db, "INSERT INTO events(id, name) VALUES (?, ?)", 64,
+                       std::chrono::milliseconds(50)) == SQLITE_OK);
+
+  SECTION("rows from many threads are committed in batches") {
+    std::atomic<int> committed(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([t, &writer, &committed]() {
+        for (int64_t i = 0; i < 250; i++) {
+          writer.write(
+              [&committed](int status) {
+                if (status == SQLITE_OK) {
+                  committed++;
+                }
+              },
+              t * 1000 + i, "event");
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    REQUIRE(writer.write(5000, "last").get() == SQLITE_OK);
+    REQUIRE(committed == 1000);
+    REQUIRE(writer.numRows() == 1001);
+    REQUIRE(writer.numBatches() < 1001);
+    writer.stop();
+
+    Stmt count = db.prepare("SELECT count(*), sum(length(name)) FROM events");
+    REQUIRE(db.query(count) == SQLITE_ROW);
+    REQUIRE(count.column<int>(0) == 1001);
+    REQUIRE(count.column<int>(1) == 1000 * 5 + 4);
+  }
+
+  SECTION("a failed row doesn't fail its batch") {
+    std::future<int> first = writer.write(1, "first");
+    std::future<int> duplicate = writer.write(1, "duplicate");
+    std::future<int> second = writer.write(2, "second");
+    REQUIRE(first.get() == SQLITE_OK);
+    REQUIRE(duplicate.get() == SQLITE_CONSTRAINT);
+    REQUIRE(second.get() == SQLITE_OK);
+    writer.stop();
+
+    Stmt names = db.prepare("SELECT name FROM events ORDER BY id");
+    REQUIRE(db.query(names) == SQLITE_ROW);
+    REQUIRE(names.column<std::string>(0) == "first");
+    REQUIRE(db.query(names) == SQLITE_ROW);
+    REQUIRE(names.column<std::string>(0) == "second");
+    REQUIRE(db.query(names) == SQLITE_DONE);
+  }
+
+  SECTION("stop() commits the queued rows") {
+    std::vector<std::future<int>> results;
+    for (int64_t i = 0; i < 100; i++) {
+      results.push_back(writer.write(i, "queued"));
+    }
+    writer.stop();
+    REQUIRE(!writer.isRunning());
+    for (auto &result : results) {
+      REQUIRE(result.get() == SQLITE_OK);
+    }
+    REQUIRE(writer.write(200, "after stop").get() == SQLITE_MISUSE);
+  }
+
+  SECTION("views are copied") {
+    writer.stop();
+    BatchWriter<int64_t, foc::StringRef, const char *> views;
+    REQUIRE(views.start(db, "INSERT INTO events(id, name) VALUES (?, ? || ?)") == SQLITE_OK);
+    std::vector<std::future<int>> results;
+    for (int64_t i = 0; i < 10; i++) {
+      // Both strings are gone before the writer binds them.
+      std::string name = "temporary name " + std::to_string(i);
+      std::string suffix = "!";
+      results.push_back(views.write(i, foc::StringRef(name), suffix.c_str()));
+    }
+    views.stop();
+    for (auto &result : results) {
+      REQUIRE(result.get() == SQLITE_OK);
+    }
+
+    Stmt name = db.prepare("SELECT name FROM events WHERE id = 7");
+    REQUIRE(db.query(name) == SQLITE_ROW);
+    REQUIRE(name.column<std::string>(0) == "temporary name 7!");
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit array parameters", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE users(id INTEGER PRIMARY KEY, name TEXT, score REAL)") ==
+          SQLITE_OK);
+  {
+    Query<void(int, std::string, double)> insert;
+    REQUIRE(insert.prepare(db, "INSERT INTO users VALUES (?, ?, ?)") == SQLITE_OK);
+    for (int i = 0; i < 1000; i++) {
+      REQUIRE(insert.execute(db, i, "user" + std::to_string(i), i / 2.0) == SQLITE_OK);
+    }
+  }
+
+  SECTION("IN lists of any length") {
+    CachedStmt stmt = db.prepareCached(
+        "SELECT count(*), coalesce(sum(id), 0) FROM users WHERE id IN sqlkit_array(?)");
+    REQUIRE(stmt.isInitialized());
+    for (size_t n : {0, 1, 7, 500, 5000}) {
+      std::vector<int64_t> ids;
+      for (size_t i = 0; i < n; i++) {
+        ids.push_back((int64_t)(i * 2));  // Half of them past the last id for n = 5000
+      }
+      REQUIRE(stmt->bindArray(1, foc::ArrayRef<int64_t>(ids)) == SQLITE_OK);
+      REQUIRE(db.query(*stmt) == SQLITE_ROW);
+      int64_t expected_count = 0;
+      int64_t expected_sum = 0;
+      for (int64_t id : ids) {
+        if (id < 1000) {
+          expected_count++;
+          expected_sum += id;
+        }
+      }
+      REQUIRE(stmt->column<int64_t>(0) == expected_count);
+      REQUIRE(stmt->column<int64_t>(1) == expected_sum);
+      stmt->reset();
+    }
+  }
+
+  SECTION("text and real arrays") {
+    std::string owned = "user42";
+    foc::StringRef names_array[] = {"user1", foc::StringRef(owned), "nobody"};
+    Stmt by_name = db.prepare(
+        "SELECT u.id FROM sqlkit_array(?) a JOIN users u ON u.name = a.value ORDER BY u.id");
+    REQUIRE(by_name.bindArray(1, foc::ArrayRef<foc::StringRef>(names_array)) == SQLITE_OK);
+    std::vector<int> ids;
+    for (const std::tuple<int> &row : by_name.rows<int>()) {
+      ids.push_back(std::get<0>(row));
+    }
+    REQUIRE(ids == std::vector<int>({1, 42}));
+
+    const double scores[] = {0.5, 2.0, 1e9};
+    Stmt by_score = db.prepare("SELECT count(*) FROM users WHERE score IN sqlkit_array(:s)");
+    REQUIRE(by_score.bindArray(":s", foc::ArrayRef<double>(scores)) == SQLITE_OK);
+    REQUIRE(db.query(by_score) == SQLITE_ROW);
+    REQUIRE(by_score.column<int>(0) == 2);
+  }
+
+  SECTION("values of the table") {
+    const int64_t values[] = {3, 1, 2};
+    Stmt stmt = db.prepare("SELECT rowid, value FROM sqlkit_array(?)");
+    REQUIRE(stmt.bindArray(1, foc::ArrayRef<int64_t>(values)) == SQLITE_OK);
+    std::vector<std::tuple<int, int>> rows;
+    for (const std::tuple<int, int> &row : stmt.rows<int, int>()) {
+      rows.push_back(row);
+    }
+    REQUIRE(rows == std::vector<std::tuple<int, int>>(
+                        {std::make_tuple(1, 3), std::make_tuple(2, 1), std::make_tuple(3, 2)}));
+
+    // Anything other than a bound array is an empty table.
+    Stmt unbound = db.prepare("SELECT count(*) FROM sqlkit_array(?)");
+    REQUIRE(db.query(unbound) == SQLITE_ROW);
+    REQUIRE(unbound.column<int>(0) == 0);
+    unbound.reset();
+    REQUIRE(unbound.bind(1, 42) == SQLITE_OK);
+    REQUIRE(db.query(unbound) == SQLITE_ROW);
+    REQUIRE(unbound.column<int>(0) == 0);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+}  // namespace sqlkit
+
+namespace app {
+
+struct Price {
+  double amount;
+  std::string currency;
+};
+SQLKIT_FIELDS(Price, amount, currency)
+
+}  // namespace app
+
+namespace sqlkit {
+
+TEST_CASE("SQLKit virtual tables", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE orders(id INTEGER PRIMARY KEY, product_id INTEGER)") ==
+          SQLITE_OK);
+  REQUIRE(db.execute("INSERT INTO orders VALUES (1, 10), (2, 20), (3, 10), (4, 99)") ==
+          SQLITE_OK);
+
+  // Tables outlive the connection.
+  foc::HashArrayMappedTrie<int64_t, app::Price> prices;
+  for (int64_t id = 0; id < 1000; id += 10) {
+    prices[id] = app::Price{id * 1.5, id % 20 ? "EUR" : "USD"};
+  }
+  std::unordered_map<std::string, int64_t> stock = {{"apple", 3}, {"pear", 0}};
+  std::vector<app::Employee> employees = {{7, "Ana", 10.0, "red"}, {9, "Bob", 20.0, "blue"}};
+  const int64_t values[] = {5, 6};
+  std::unordered_map<uint32_t, long long> counts = {{1, 5000000000LL}, {4000000000u, -3}};
+
+  REQUIRE(registerMapTable(db.raw(), "prices", prices) == SQLITE_OK);
+  REQUIRE(registerMapTable(db.raw(), "stock", stock) == SQLITE_OK);
+  REQUIRE(registerArrayTable(db.raw(), "employees", foc::ArrayRef<app::Employee>(employees)) ==
+          SQLITE_OK);
+  REQUIRE(registerArrayTable(db.raw(), "vals", foc::ArrayRef<int64_t>(values)) == SQLITE_OK);
+  REQUIRE(registerMapTable(db.raw(), "counts", counts) == SQLITE_OK);
+
+  SECTION("scans") {
+    Stmt count = db.prepare("SELECT count(*), sum(amount) FROM prices WHERE currency = 'USD'");
+    REQUIRE(db.query(count) == SQLITE_ROW);
+    REQUIRE(count.column<int>(0) == 50);
+    REQUIRE(count.column<double>(1) == 1.5 * 20 * (49 * 50 / 2));
+
+    Stmt employee = db.prepare("SELECT rowid, id, name, salary, team FROM employees");
+    REQUIRE(db.query(employee) == SQLITE_ROW);
+    REQUIRE(employee.column<int>(0) == 1);
+    REQUIRE(employee.column<int>(1) == 7);
+    REQUIRE(employee.column<std::string>(2) == "Ana");
+    REQUIRE(employee.column<double>(3) == 10.0);
+    REQUIRE(employee.column<std::string>(4) == "red");
+    REQUIRE(db.query(employee) == SQLITE_ROW);
+    REQUIRE(employee.column<std::string>(2) == "Bob");
+    REQUIRE(db.query(employee) == SQLITE_DONE);
+
+    Stmt sum = db.prepare("SELECT sum(value) FROM vals");
+    REQUIRE(db.query(sum) == SQLITE_ROW);
+    REQUIRE(sum.column<int>(0) == 11);
+  }
+
+  SECTION("integers of any width") {
+    Stmt lookup = db.prepare("SELECT key, value FROM counts WHERE key = ?");
+    REQUIRE(lookup.bindAll(4000000000u) == SQLITE_OK);
+    REQUIRE(db.query(lookup) == SQLITE_ROW);
+    REQUIRE(lookup.column<int64_t>(0) == 4000000000LL);
+    REQUIRE(lookup.column<int64_t>(1) == -3);
+    lookup.reset();
+    REQUIRE(lookup.bindAll(1) == SQLITE_OK);
+    REQUIRE(db.query(lookup) == SQLITE_ROW);
+    REQUIRE(lookup.column<int64_t>(1) == 5000000000LL);
+  }
+
+  SECTION("joins look keys up") {
+    Stmt plan = db.prepare(
+        "EXPLAIN QUERY PLAN "
+        "SELECT o.id, p.amount FROM orders o JOIN prices p ON p.key = o.product_id");
+    bool lookup = false;
+    while (db.query(plan) == SQLITE_ROW) {
+      lookup = lookup || plan.column<std::string>(3).find("VIRTUAL TABLE INDEX 1") !=
+                             std::string::npos;
+    }
+    REQUIRE(lookup);
+
+    Stmt join = db.prepare(
+        "SELECT o.id, p.amount, p.currency FROM orders o JOIN prices p ON p.key = o.product_id "
+        "ORDER BY o.id");
+    std::vector<std::tuple<int, double, std::string>> rows;
+    for (const std::tuple<int, double, std::string> &row :
+         join.rows<int, double, std::string>()) {
+      rows.push_back(row);
+    }
+    REQUIRE(rows == std::vector<std::tuple<int, double, std::string>>(
+                        {std::make_tuple(1, 15.0, std::string("EUR")),
+                         std::make_tuple(2, 30.0, std::string("USD")),
+                         std::make_tuple(3, 15.0, std::string("EUR"))}));
+  }
+
+  SECTION("key lookups compare like SQL") {
+    Stmt by_key = db.prepare("SELECT count(*) FROM prices WHERE key = ?");
+    auto count = [&](int status) {
+      REQUIRE(status == SQLITE_OK);
+      REQUIRE(db.query(by_key) == SQLITE_ROW);
+      int n = by_key.column<int>(0);
+      by_key.reset();
+      return n;
+    };
+    REQUIRE(count(by_key.bind(1, 20)) == 1);
+    REQUIRE(count(by_key.bind(1, 21)) == 0);
+    REQUIRE(count(by_key.bind(1, 20.0)) == 1);
+    REQUIRE(count(by_key.bind(1, 20.5)) == 0);
+    REQUIRE(count(by_key.bind(1, "20")) == 0);
+    REQUIRE(count(by_key.bindNull(1)) == 0);
+
+    Stmt apples = db.prepare("SELECT value FROM stock WHERE key = 'apple'");
+    REQUIRE(db.query(apples) == SQLITE_ROW);
+    REQUIRE(apples.column<int>(0) == 3);
+    REQUIRE(db.query(apples) == SQLITE_DONE);
+
+    Stmt by_rowid = db.prepare("SELECT name FROM employees WHERE rowid = ?");
+    REQUIRE(by_rowid.bind(1, 2) == SQLITE_OK);
+    REQUIRE(db.query(by_rowid) == SQLITE_ROW);
+    REQUIRE(by_rowid.column<std::string>(0) == "Bob");
+    REQUIRE(db.query(by_rowid) == SQLITE_DONE);
+    by_rowid.reset();
+    REQUIRE(by_rowid.bind(1, 3) == SQLITE_OK);
+    REQUIRE(db.query(by_rowid) == SQLITE_DONE);
+  }
+
+  SECTION("tables are read-only") {
+    REQUIRE(db.execute("DELETE FROM prices") != SQLITE_OK);
+    REQUIRE(registerMapTable(db.raw(), "prices", prices) != SQLITE_OK);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+namespace {
+
+double halve(double x) { return x / 2; }
+
+struct Median {
+  std::vector<double> values;
+};
+
+}  // namespace
+
+TEST_CASE("SQLKit functions", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE items(name TEXT, price REAL, team INTEGER)") == SQLITE_OK);
+  REQUIRE(db.execute("INSERT INTO items VALUES ('apple', 1.0, 1), ('pear', 3.0, 1), "
+                     "('plum', 2.0, 1), ('fig', 10.0, 2), ('kiwi', 20.0, 2)") == SQLITE_OK);
+
+  SECTION("scalar functions") {
+    int calls = 0;
+    REQUIRE(db.function("discount", [&calls](double price, int64_t pct) {
+      calls++;
+      return price * (100 - pct) / 100;
+    }) == SQLITE_OK);
+    REQUIRE(db.function("initial", [](foc::StringRef name) {
+      return name.empty() ? std::string() : name.substr(0, 1).str();
+    }) == SQLITE_OK);
+    REQUIRE(db.function("halve", halve) == SQLITE_OK);
+    REQUIRE(db.function("answer", []() { return 42; }) == SQLITE_OK);
+    REQUIRE(db.function("nothing", [](sqlite3_value *) {}) == SQLITE_OK);
+
+    Stmt stmt = db.prepare(
+        "SELECT discount(price, 50), initial(name), halve(price), answer(), nothing(name) "
+        "FROM items WHERE name = 'pear'");
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<double>(0) == 1.5);
+    REQUIRE(stmt.column<std::string>(1) == "p");
+    REQUIRE(stmt.column<double>(2) == 1.5);
+    REQUIRE(stmt.column<int>(3) == 42);
+    REQUIRE(sqlite3_column_type(stmt.raw(), 4) == SQLITE_NULL);
+    REQUIRE(calls == 1);
+
+    // The number of arguments is checked when preparing.
+    REQUIRE(db.execute("SELECT discount(1.0)") != SQLITE_OK);
+    REQUIRE(calls == 1);
+  }
+
+  SECTION("integers of any width") {
+    REQUIRE(db.function("twice", [](uint32_t x) { return (size_t)x * 2; }) == SQLITE_OK);
+    REQUIRE(db.function("pick", [](bool flag, long long a, unsigned short b) {
+      return flag ? a : (long long)b;
+    }) == SQLITE_OK);
+
+    Stmt stmt = db.prepare("SELECT twice(4000000000), pick(1, -5000000000, 7), pick(0, 1, 7)");
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<int64_t>(0) == 8000000000LL);
+    REQUIRE(stmt.column<int64_t>(1) == -5000000000LL);
+    REQUIRE(stmt.column<int64_t>(2) == 7);
+  }
+
+  SECTION("flags") {
+    // Only deterministic functions can be used in indexes.
+    REQUIRE(db.function("lower_initial", [](foc::StringRef s) { return s.substr(0, 1).str(); }) ==
+            SQLITE_OK);
+    REQUIRE(db.function("random_initial", [](foc::StringRef s) { return s.substr(0, 1).str(); },
+                        0) == SQLITE_OK);
+    REQUIRE(db.execute("CREATE INDEX items_initial ON items(lower_initial(name))") == SQLITE_OK);
+    REQUIRE(db.execute("CREATE INDEX items_random ON items(random_initial(name))") != SQLITE_OK);
+
+    // Calls with constant arguments run once per statement.
+    int calls = 0;
+    REQUIRE(db.function("constant", [&calls](int x) { return x + calls++; }) == SQLITE_OK);
+    Stmt stmt = db.prepare("SELECT count(*) FROM items WHERE team = constant(1)");
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<int>(0) == 3);
+    REQUIRE(calls == 1);
+  }
+
+  SECTION("aggregates") {
+    REQUIRE(db.aggregate<Median>(
+                "median", [](Median &m, double x) { m.values.push_back(x); },
+                [](Median &m) {
+                  if (m.values.empty()) {
+                    return 0.0;
+                  }
+                  std::sort(m.values.begin(), m.values.end());
+                  return m.values[m.values.size() / 2];
+                }) == SQLITE_OK);
+    Stmt stmt = db.prepare("SELECT team, median(price) FROM items GROUP BY team ORDER BY team");
+    std::vector<std::tuple<int, double>> rows;
+    for (const std::tuple<int, double> &row : stmt.rows<int, double>()) {
+      rows.push_back(row);
+    }
+    REQUIRE(rows == std::vector<std::tuple<int, double>>(
+                        {std::make_tuple(1, 2.0), std::make_tuple(2, 20.0)}));
+
+    // Empty groups and aggregations cut short don't leak the state.
+    Stmt empty = db.prepare("SELECT median(price) FROM items WHERE team = 3");
+    REQUIRE(db.query(empty) == SQLITE_ROW);
+    REQUIRE(empty.column<double>(0) == 0.0);
+    Stmt grouped = db.prepare("SELECT team, median(price) FROM items GROUP BY team");
+    REQUIRE(db.query(grouped) == SQLITE_ROW);
+    grouped.reset();
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit BLOB streaming", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+  REQUIRE(db.execute("CREATE TABLE files(id INTEGER PRIMARY KEY, data BLOB)") == SQLITE_OK);
+
+  const size_t kSize = 1000 * 1000 + 7;
+  auto byte = [](size_t i) { return (uint8_t)(i * 31 + i / 4096); };
+  {
+    Stmt insert = db.prepare("INSERT INTO files(id, data) VALUES (?, ?)");
+    REQUIRE(insert.bind(1, 1) == SQLITE_OK);
+    REQUIRE(insert.bindZeroblob(2, kSize) == SQLITE_OK);
+    REQUIRE(db.execute(insert) == SQLITE_OK);
+  }
+  REQUIRE(db.execute("INSERT INTO files(id, data) VALUES (2, x'00010203')") == SQLITE_OK);
+
+  SECTION("streaming writes and reads") {
+    Blob blob;
+    REQUIRE(blob.open(db, "files", "data", 1, Blob::kReadWrite) == SQLITE_OK);
+    REQUIRE(blob.size() == kSize);
+    size_t produced = 0;
+    size_t max_capacity = 0;
+    size_t written = 0;
+    REQUIRE(blob.writeChunks(
+                [&](uint8_t *buffer, size_t capacity) {
+                  max_capacity = std::max(max_capacity, capacity);
+                  for (size_t i = 0; i < capacity; i++) {
+                    buffer[i] = byte(produced + i);
+                  }
+                  produced += capacity;
+                  return capacity;
+                },
+                0, 4096, &written) == SQLITE_OK);
+    REQUIRE(written == kSize);
+    REQUIRE(max_capacity == 4096);
+
+    size_t consumed = 0;
+    bool equal = true;
+    REQUIRE(blob.readChunks([&](foc::ArrayRef<uint8_t> chunk) {
+      for (size_t i = 0; i < chunk.size(); i++) {
+        equal = equal && chunk[i] == byte(consumed + i);
+      }
+      consumed += chunk.size();
+    }) == SQLITE_OK);
+    REQUIRE(consumed == kSize);
+    REQUIRE(equal);
+
+    // The source can stop early, the rest of the BLOB is unchanged.
+    REQUIRE(blob.writeChunks([](uint8_t *, size_t) { return (size_t)0; }, 10, 4096,
+                             &written) == SQLITE_OK);
+    REQUIRE(written == 0);
+
+    uint8_t bytes[4];
+    REQUIRE(blob.read(bytes, 4, kSize - 4) == SQLITE_OK);
+    REQUIRE(bytes[3] == byte(kSize - 1));
+    REQUIRE(blob.read(bytes, 4, kSize - 3) == SQLITE_ERROR);
+
+    // Same column of another row.
+    REQUIRE(blob.reopen(2) == SQLITE_OK);
+    REQUIRE(blob.size() == 4);
+    REQUIRE(blob.write("\xff", 1, 0) == SQLITE_OK);
+    REQUIRE(blob.read(bytes, 4, 0) == SQLITE_OK);
+    REQUIRE(bytes[0] == 0xff);
+    REQUIRE(bytes[3] == 3);
+    REQUIRE(blob.close() == SQLITE_OK);
+
+    Stmt stmt = db.prepare("SELECT length(data), hex(substr(data, 1, 2)) FROM files WHERE id = 2");
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<int>(0) == 4);
+    REQUIRE(stmt.column<std::string>(1) == "FF01");
+  }
+
+  SECTION("errors") {
+    Blob blob;
+    REQUIRE(blob.open(db, "files", "nope", 1) != SQLITE_OK);
+    REQUIRE(!blob.isOpen());
+    REQUIRE(blob.open(db, "files", "data", 3) != SQLITE_OK);
+
+    REQUIRE(blob.open(db, "files", "data", 2) == SQLITE_OK);
+    REQUIRE(blob.write("x", 1, 0) == SQLITE_READONLY);
+
+    // Changing the row expires the handle.
+    Blob moved(std::move(blob));
+    REQUIRE(!blob.isOpen());
+    REQUIRE(db.execute("UPDATE files SET data = x'0102' WHERE id = 2") == SQLITE_OK);
+    uint8_t byte;
+    REQUIRE(moved.read(&byte, 1, 0) == SQLITE_ABORT);
+    REQUIRE(moved.reopen(1) == SQLITE_ABORT);
+    REQUIRE(moved.open(db, "files", "data", 2) == SQLITE_OK);
+    REQUIRE(moved.read(&byte, 1, 0) == SQLITE_OK);
+    REQUIRE(byte == 1);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit owned parameters", "[SQLKit]") {
+  Handle db;
+  REQUIRE(db.open(":memory:") == SQLITE_OK);
+
+  SECTION("strings and vectors") {
+    Stmt stmt = db.prepare("SELECT typeof(?1), length(?1), substr(?1, 1, 3)");
+    std::string text(5000, 'a');
+    text[1] = 'b';
+    REQUIRE(stmt.bindOwned(1, std::move(text)) == SQLITE_OK);
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<std::string>(0) == "text");
+    REQUIRE(stmt.column<int>(1) == 5000);
+    REQUIRE(stmt.column<std::string>(2) == "aba");
+    stmt.reset();
+
+    foc::SmallVector<char, 16> chars(2000, 'c');
+    REQUIRE(stmt.bindOwned(1, std::move(chars)) == SQLITE_OK);
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<int>(1) == 2000);
+    REQUIRE(stmt.column<std::string>(2) == "ccc");
+    stmt.reset();
+
+    std::vector<uint8_t> bytes(3000, 7);
+    REQUIRE(stmt.bindOwned(1, std::move(bytes)) == SQLITE_OK);
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<std::string>(0) == "blob");
+    REQUIRE(stmt.column<int>(1) == 3000);
+    stmt.reset();
+
+    // Small values are copied.
+    REQUIRE(stmt.bindOwned(1, std::string("xyz!")) == SQLITE_OK);
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<int>(1) == 4);
+    stmt.reset();
+    REQUIRE(stmt.bindOwned(1, std::vector<uint8_t>()) == SQLITE_OK);
+    REQUIRE(db.query(stmt) == SQLITE_ROW);
+    REQUIRE(stmt.column<std::string>(0) == "blob");
+    REQUIRE(stmt.column<int>(1) == 0);
+  }
+
+  SECTION("release callbacks") {
+    std::vector<char> arena(8192, 'r');
+    int releases = 0;
+    auto release = [&releases]() { releases++; };
+    {
+      Stmt stmt = db.prepare("SELECT length(:text), length(:blob)");
+      REQUIRE(stmt.bindOwned(":text", foc::StringRef(arena.data(), 4096), release) == SQLITE_OK);
+      REQUIRE(stmt.bindOwned(
+                  ":blob", foc::ArrayRef<uint8_t>((const uint8_t *)arena.data() + 4096, 4096),
+                  release) == SQLITE_OK);
+      REQUIRE(db.query(stmt) == SQLITE_ROW);
+      REQUIRE(stmt.column<int>(0) == 4096);
+      REQUIRE(stmt.column<int>(1) == 4096);
+      stmt.reset();
+      REQUIRE(releases == 0);
+
+      // Binding another value releases the previous one.
+      REQUIRE(stmt.bindNull(1) == SQLITE_OK);
+      REQUIRE(releases == 1);
+
+      // Failed bindings release right away, small values after the copy.
+      REQUIRE(stmt.bindOwned(3, foc::StringRef(arena.data(), 4096), release) == SQLITE_RANGE);
+      REQUIRE(releases == 2);
+      REQUIRE(stmt.bindOwned(1, foc::StringRef(arena.data(), 10), release) == SQLITE_OK);
+      REQUIRE(releases == 3);
+    }
+    // Finalizing releases the rest.
+    REQUIRE(releases == 4);
+  }
+
+  SECTION("the same bytes bound twice") {
+    std::string arena(4096, 's');
+    int releases = 0;
+    auto release = [&releases]() { releases++; };
+    foc::StringRef text(arena);
+    {
+      Stmt first = db.prepare("SELECT length(?) + length(?)");
+      Stmt second = db.prepare("SELECT length(?)");
+      REQUIRE(first.bindOwned(1, text, release) == SQLITE_OK);
+      REQUIRE(first.bindOwned(2, text, release) == SQLITE_OK);
+      REQUIRE(second.bindOwned(1, text, release) == SQLITE_OK);
+      REQUIRE(db.query(first) == SQLITE_ROW);
+      REQUIRE(first.column<int>(0) == 8192);
+      REQUIRE(db.query(second) == SQLITE_ROW);
+      REQUIRE(second.column<int>(0) == 4096);
+      first.reset();
+      second.reset();
+
+      REQUIRE(first.bindNull(2) == SQLITE_OK);
+      REQUIRE(releases == 1);
+      second.finalize();
+      REQUIRE(releases == 2);
+    }
+    REQUIRE(releases == 3);
+  }
+
+  REQUIRE(db.close() == SQLITE_OK);
+}
+
+TEST_CASE("SQLKit backup", "[SQLKit]") {
+  const char *const kFiles[] = {"test_backup.db", "test_backup.db-journal", "test_backup_copy.db",
+                                "test_backup_copy.db-journal", "test_snapshot.db"};
+  for (const char *file : kFiles) {
+    remove(file);
+  }
+  auto count = [](Handle &db) {
+    std::string n;
+    REQUIRE(db.pragma("SELECT count(*) FROM t", &n) == SQLITE_OK);
+    return atoi(n.c_str());
+  };
+
+  Handle source;
+  REQUIRE(source.open("test_backup.db") == SQLITE_OK);
+  REQUIRE(source.execute("CREATE TABLE t(x INTEGER PRIMARY KEY, payload TEXT)") == SQLITE_OK);
+  {
+    Transaction txn(source);
+    Query<void(int, std::string)> insert;
+    REQUIRE(insert.prepare(source, "INSERT INTO t VALUES (?, ?)") == SQLITE_OK);
+    for (int i = 0; i < 2000; i++) {
+      REQUIRE(insert.execute(source, i, std::string(200, 'a' + i % 26)) == SQLITE_OK);
+    }
+    REQUIRE(txn.commit() == SQLITE_OK);
+  }
+
+  SECTION("incremental steps") {
+    Handle dest;
+    REQUIRE(dest.open("test_backup_copy.db") == SQLITE_OK);
+    Backup backup;
+    REQUIRE(backup.init(dest, source) == SQLITE_OK);
+    REQUIRE(backup.step(10) == SQLITE_OK);
+    REQUIRE(backup.pageCount() > 100);
+    REQUIRE(backup.remaining() == backup.pageCount() - 10);
+
+    // Writes through the source connection go to the copy as well.
+    REQUIRE(source.execute("INSERT INTO t VALUES (5000, 'x')") == SQLITE_OK);
+    int steps = 0;
+    BackupOptions options;
+    options.pages_per_step = 10;
+    options.progress = [&steps](const Backup &b) {
+      steps++;
+      REQUIRE(b.remaining() <= b.pageCount());
+    };
+    REQUIRE(backup.run(options) == SQLITE_OK);
+    REQUIRE(!backup.isActive());
+    REQUIRE(steps > 5);
+    REQUIRE(backup.restarts() == 0);
+    REQUIRE(count(dest) == 2001);
+    REQUIRE(dest.close() == SQLITE_OK);
+  }
+
+  SECTION("writes from other connections restart the copy") {
+    Handle writer;
+    REQUIRE(writer.open("test_backup.db") == SQLITE_OK);
+    Handle dest;
+    REQUIRE(dest.open("test_backup_copy.db") == SQLITE_OK);
+    Backup backup;
+    REQUIRE(backup.init(dest, source) == SQLITE_OK);
+    int next = 10000;
+    BackupOptions options;
+    options.pages_per_step = 20;
+    options.max_restarts = 2;
+    options.progress = [&](const Backup &) {
+      REQUIRE(writer.execute("INSERT INTO t VALUES (" + std::to_string(next++) + ", 'w')") ==
+              SQLITE_OK);
+    };
+    REQUIRE(backup.run(options) == SQLITE_OK);
+    // Then the rest was copied in one step.
+    REQUIRE(backup.restarts() == 3);
+    // The copy has the writes made before the last step.
+    REQUIRE(count(dest) == 2000 + (next - 10000) - 1);
+    REQUIRE(dest.close() == SQLITE_OK);
+    REQUIRE(writer.close() == SQLITE_OK);
+  }
+
+  SECTION("locked destinations give up") {
+    Handle dest;
+    REQUIRE(dest.open("test_backup_copy.db") == SQLITE_OK);
+    Handle locker;
+    REQUIRE(locker.open("test_backup_copy.db") == SQLITE_OK);
+    REQUIRE(locker.execute("BEGIN IMMEDIATE") == SQLITE_OK);
+    REQUIRE(locker.execute("CREATE TABLE other(x)") == SQLITE_OK);
+    Backup backup;
+    REQUIRE(backup.init(dest, source) == SQLITE_OK);
+    BackupOptions options;
+    options.busy_sleep_ms = 1;
+    options.max_busy_retries = 3;
+    REQUIRE(backup.run(options) == SQLITE_BUSY);
+    REQUIRE(!backup.isActive());
+
+    // Once the lock is released, the backup goes through.
+    REQUIRE(locker.execute("COMMIT") == SQLITE_OK);
+    REQUIRE(backup.init(dest, source) == SQLITE_OK);
+    REQUIRE(backup.run(options) == SQLITE_OK);
+    REQUIRE(count(dest) == 2000);
+    REQUIRE(locker.close() == SQLITE_OK);
+    REQUIRE(dest.close() == SQLITE_OK);
+  }
+
+  SECTION("throttling") {
+    Handle dest;
+    REQUIRE(dest.open("test_backup_copy.db") == SQLITE_OK);
+    Backup backup;
+    REQUIRE(backup.init(dest, source) == SQLITE_OK);
+    REQUIRE(backup.step(1) == SQLITE_OK);
+    int64_t bytes = (int64_t)backup.pageCount() * 4096;
+    BackupOptions options;
+    options.pages_per_step = 16;
+    options.max_bytes_per_second = bytes * 10;  // ~100ms
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(backup.run(options) == SQLITE_OK);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(80));
+    REQUIRE(count(dest) == 2000);
+    REQUIRE(dest.close() == SQLITE_OK);
+  }
+
+  SECTION("snapshots") {
+    Handle memory;
+    REQUIRE(memory.open(":memory:") == SQLITE_OK);
+    REQUIRE(memory.execute("CREATE TABLE t(x)") == SQLITE_OK);
+    REQUIRE(memory.execute("INSERT INTO t VALUES (1), (2), (3)") == SQLITE_OK);
+    REQUIRE(Backup::snapshot(memory, "test_snapshot.db") == SQLITE_OK);
+    REQUIRE(memory.execute("INSERT INTO t VALUES (4)") == SQLITE_OK);
+    // Replaces the previous snapshot.
+    REQUIRE(Backup::snapshot(memory, "test_snapshot.db") == SQLITE_OK);
+    REQUIRE(memory.close() == SQLITE_OK);
+
+    Handle copy;
+    REQUIRE(copy.open("test_snapshot.db") == SQLITE_OK);
+    REQUIRE(count(copy) == 4);
+    REQUIRE(copy.close() == SQLITE_OK);
+    FILE *tmp = fopen("test_snapshot.db.tmp", "r");
+    REQUIRE(tmp == nullptr);
+
+    REQUIRE(Backup::snapshot(source, "no_such_dir/test_snapshot.db") != SQLITE_OK);
+  }
+
+  REQUIRE(source.close() == SQLITE_OK);
+  for (const char *file : kFiles) {
+    remove(file);
+  }
+}
+
+TEST_CASE("SQLKit executor", "[SQLKit]") {
+  remove("test_executor.db");
+  {
+    Handle db;
+    REQUIRE(db.open("test_executor.db") == SQLITE_OK);
+    REQUIRE(db.execute("CREATE TABLE users(id INTEGER PRIMARY KEY, name TEXT)") == SQLITE_OK);
+    Query<void(int, std::string)> insert;
+    REQUIRE(insert.prepare(db, "INSERT INTO users VALUES (?, ?)") == SQLITE_OK);
+    for (int i = 0; i < 100; i++) {
+      REQUIRE(insert.execute(db, i, "user" + std::to_string(i)) == SQLITE_OK);
+    }
+  }
+
+  Executor executor;
+  std::atomic<int> notifications(0);
+  executor.setNotifier([&notifications]() { notifications++; });
+  OpenOptions options;
+  options.busy_timeout_ms = 5000;
+  REQUIRE(executor.start("test_executor.db", 3, options) == SQLITE_OK);
+  REQUIRE(executor.isRunning());
+
+  SECTION("futures") {
+    typedef std::tuple<int64_t, std::string> User;
+    std::vector<std::future<QueryResult<User>>> futures;
+    for (int i = 0; i < 100; i++) {
+      // The parameters are copied, the temporary can go away.
+      std::string name = "user" + std::to_string(i);
+      futures.push_back(
+          executor.submit<User>("SELECT id, name FROM users WHERE name = ?", foc::StringRef(name)));
+    }
+    for (int i = 0; i < 100; i++) {
+      QueryResult<User> result = futures[i].get();
+      REQUIRE(result.status == SQLITE_OK);
+      REQUIRE(result.rows.size() == 1);
+      REQUIRE(std::get<0>(result.rows[0]) == i);
+    }
+
+    QueryResult<int64_t> count =
+        executor.submit<int64_t>("SELECT count(*) FROM users WHERE id < ?", 10).get();
+    REQUIRE(count.rows == std::vector<int64_t>({10}));
+
+    QueryResult<void> update =
+        executor.submit("UPDATE users SET name = upper(name) WHERE id >= ?", 90).get();
+    REQUIRE(update.status == SQLITE_OK);
+    REQUIRE(update.changes == 10);
+
+    REQUIRE(executor.submit<int>("SELECT * FROM no_table").get().status == SQLITE_ERROR);
+    // Futures don't go through the completion queue.
+    REQUIRE(notifications == 0);
+  }
+
+  SECTION("callbacks run on the polling thread") {
+    std::thread::id poller = std::this_thread::get_id();
+    int num_callbacks = 0;
+    size_t num_rows = 0;
+    for (int i = 0; i < 50; i++) {
+      executor.post<std::string>(
+          [&](QueryResult<std::string> &result) {
+            REQUIRE(std::this_thread::get_id() == poller);
+            REQUIRE(result.status == SQLITE_OK);
+            num_rows += result.rows.size();
+            num_callbacks++;
+          },
+          "SELECT name FROM users WHERE id % 10 = ?", i % 10);
+    }
+    while (num_callbacks < 50) {
+      if (executor.poll() == 0) {
+        std::this_thread::yield();
+      }
+    }
+    REQUIRE(num_rows == 50 * 10);
+    REQUIRE(notifications == 50);
+    REQUIRE(executor.poll() == 0);
+  }
+
+  SECTION("statements submitted after stop() fail") {
+    executor.stop();
+    REQUIRE(!executor.isRunning());
+    REQUIRE(executor.submit("DELETE FROM users").get().status == SQLITE_MISUSE);
+    int status = SQLITE_OK;
+    executor.post<void>([&status](QueryResult<void> &result) { status = result.status; },
+                        "DELETE FROM users");
+    REQUIRE(executor.poll() == 1);
+    REQUIRE(status == SQLITE_MISUSE);
+  }
+
+  executor.stop();
+  remove("test_executor.db");
+}
+
 }  // namespace sqlkit
@@ -0,0 +1,188 @@
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#include "../foc/array_algorithms.h"
+
+using foc::ArrayRef;
+using foc::MutableArrayRef;
+using foc::SimdLevel;
+using foc::detail::ArrayKernels;
+using foc::detail::array_kernels_for;
+
+namespace {
+
+// Every instruction set the CPU running the tests supports.
+std::vector<SimdLevel> supportedLevels() {
+  std::vector<SimdLevel> levels = {SimdLevel::kScalar};
+  SimdLevel best = foc::simd_level();
+  if (best == SimdLevel::kNEON) {
+    levels.push_back(SimdLevel::kNEON);
+  } else {
+    for (SimdLevel level : {SimdLevel::kSSE42, SimdLevel::kAVX2, SimdLevel::kAVX512}) {
+      if ((int)level <= (int)best) {
+        levels.push_back(level);
+      }
+    }
+  }
+  return levels;
+}
+
+// Small values so the floating-point sums are exact in any order.
+template <typename T>
+std::vector<T> randomValues(std::mt19937 &rng, size_t n) {
+  std::uniform_int_distribution<int> dist(-50, 50);
+  std::vector<T> values(n);
+  for (auto &value : values) {
+    value = (T)dist(rng);
+  }
+  return values;
+}
+
+template <typename T>
+void checkKernels(SimdLevel level) {
+  INFO("level " << foc::simd_level_name(level));
+  ArrayKernels<T> kernels = array_kernels_for<T>(level);
+  std::mt19937 rng(42);
+  // Sizes around the vector widths exercise the tails of the kernels.
+  for (size_t n = 0; n < 100; n++) {
+    INFO("size " << n);
+    std::vector<T> values = randomValues<T>(rng, n);
+
+    typename foc::detail::ArraySum<T>::type expected_sum = 0;
+    for (T value : values) {
+      expected_sum += value;
+    }
+    REQUIRE(kernels.sum(values.data(), n) == expected_sum);
+
+    if (n > 0) {
+      REQUIRE(kernels.min(values.data(), n) == *std::min_element(values.begin(), values.end()));
+      REQUIRE(kernels.max(values.data(), n) == *std::max_element(values.begin(), values.end()));
+      T needle = values[n / 2];
+      REQUIRE(kernels.count(values.data(), n, needle) ==
+              (size_t)std::count(values.begin(), values.end(), needle));
+    }
+
+    std::vector<T> copy = values;
+    REQUIRE(kernels.equals(values.data(), copy.data(), n));
+    for (size_t i = 0; i < n; i += 7) {
+      copy[i] += 1;
+      REQUIRE_FALSE(kernels.equals(values.data(), copy.data(), n));
+      copy[i] -= 1;
+    }
+
+    std::vector<int32_t> indices(n);
+    for (auto &index : indices) {
+      index = (int32_t)(rng() % (n + 1));
+    }
+    std::vector<T> source = randomValues<T>(rng, n + 1);
+    std::vector<T> gathered(n);
+    kernels.gather(source.data(), indices.data(), n, gathered.data());
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(gathered[i] == source[indices[i]]);
+    }
+
+    std::vector<uint8_t> selection(n);
+    std::vector<T> expected;
+    for (size_t i = 0; i < n; i++) {
+      selection[i] = (uint8_t)(rng() % 3 == 0 ? 0 : rng() % 256);
+      if (selection[i]) {
+        expected.push_back(values[i]);
+      }
+    }
+    std::vector<T> out(n);
+    REQUIRE(kernels.filter(values.data(), selection.data(), n, out.data()) == expected.size());
+    out.resize(expected.size());
+    REQUIRE(out == expected);
+
+    // In place.
+    std::vector<T> in_place = values;
+    size_t k = kernels.filter(in_place.data(), selection.data(), n, in_place.data());
+    in_place.resize(k);
+    REQUIRE(in_place == expected);
+  }
+}
+
+}  // namespace
+
+TEST_CASE("array kernels match the scalar definitions", "[ArrayAlgorithms]") {
+  for (SimdLevel level : supportedLevels()) {
+    checkKernels<int32_t>(level);
+    checkKernels<int64_t>(level);
+    checkKernels<float>(level);
+    checkKernels<double>(level);
+  }
+}
+
+TEST_CASE("array algorithms edge cases", "[ArrayAlgorithms]") {
+  for (SimdLevel level : supportedLevels()) {
+    INFO("level " << foc::simd_level_name(level));
+
+    // int32_t sums don't overflow.
+    std::vector<int32_t> big(1000, INT32_MAX);
+    REQUIRE(array_kernels_for<int32_t>(level).sum(big.data(), big.size()) ==
+            1000 * (int64_t)INT32_MAX);
+
+    // int64_t sums wrap around.
+    std::vector<int64_t> wrap(64, INT64_MAX);
+    REQUIRE(array_kernels_for<int64_t>(level).sum(wrap.data(), wrap.size()) ==
+            (int64_t)((uint64_t)INT64_MAX * 64));
+
+    std::vector<int64_t> extremes(37, 0);
+    extremes[3] = INT64_MIN;
+    extremes[36] = INT64_MAX;
+    REQUIRE(array_kernels_for<int64_t>(level).min(extremes.data(), extremes.size()) == INT64_MIN);
+    REQUIRE(array_kernels_for<int64_t>(level).max(extremes.data(), extremes.size()) == INT64_MAX);
+
+    // Floating-point equality follows operator==.
+    std::vector<double> a(20, 0.0);
+    std::vector<double> b(20, -0.0);
+    REQUIRE(array_kernels_for<double>(level).equals(a.data(), b.data(), a.size()));
+    a[17] = b[17] = NAN;
+    REQUIRE_FALSE(array_kernels_for<double>(level).equals(a.data(), b.data(), a.size()));
+  }
+}
+
+TEST_CASE("array algorithms over ArrayRef", "[ArrayAlgorithms]") {
+  std::vector<int32_t> values = {5, -3, 9, 9, 1, 0, 7, 9, 2, -8, 4, 6, 9, 3, 1, 2, 0};
+  ArrayRef<int32_t> ref(values);
+  REQUIRE(foc::sum(ref) == 56);
+  REQUIRE(foc::min_value(ref) == -8);
+  REQUIRE(foc::max_value(ref) == 9);
+  REQUIRE(foc::count(ref, 9) == 4);
+  REQUIRE(foc::equals(ref, ref));
+  REQUIRE_FALSE(foc::equals(ref, ref.drop_back()));
+
+  std::vector<int32_t> indices = {16, 2, 0};
+  std::vector<int32_t> gathered(3);
+  foc::gather(ref, ArrayRef<int32_t>(indices), MutableArrayRef<int32_t>(gathered));
+  REQUIRE(gathered == std::vector<int32_t>({0, 9, 5}));
+
+  std::vector<uint8_t> selection(values.size(), 0);
+  selection[1] = selection[9] = 1;
+  std::vector<int32_t> out(values.size());
+  size_t n = foc::filter(ref, ArrayRef<uint8_t>(selection), MutableArrayRef<int32_t>(out));
+  REQUIRE(n == 2);
+  REQUIRE(out[0] == -3);
+  REQUIRE(out[1] == -8);
+
+  std::vector<float> floats = {1.5f, 2.5f};
+  REQUIRE(foc::sum(ArrayRef<float>(floats)) == 4.0f);
+}
+
+TEST_CASE("ArrayRef::equals compares bytes of integers", "[ArrayAlgorithms]") {
+  std::vector<int64_t> a = {1, 2, 3};
+  std::vector<int64_t> b = {1, 2, 3};
+  REQUIRE(ArrayRef<int64_t>(a).equals(b));
+  b[2] = 4;
+  REQUIRE_FALSE(ArrayRef<int64_t>(a).equals(b));
+  REQUIRE(ArrayRef<int64_t>().equals(ArrayRef<int64_t>()));
+
+  std::vector<double> zeros = {0.0};
+  std::vector<double> negative_zeros = {-0.0};
+  REQUIRE(ArrayRef<double>(zeros).equals(negative_zeros));
+}
@@ -0,0 +1,102 @@
+#include <set>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#define HAMT_IMPLEMENTATION
+#include "../foc/hash_array_mapped_trie.h"
+#include "../foc/hashing.h"
+#include "../foc/string_ref.h"
+
+using foc::ArrayRef;
+using foc::Hash;
+using foc::HashArrayMappedTrie;
+using foc::StringRef;
+using foc::hash_bytes;
+using foc::hash_value;
+
+TEST_CASE("hash_bytes is deterministic and seedable", "[Hashing]") {
+  const char data[] = "The quick brown fox jumps over the lazy dog";
+  REQUIRE(hash_bytes(data, sizeof(data)) == hash_bytes(data, sizeof(data)));
+  REQUIRE(hash_bytes(data, sizeof(data), 1) != hash_bytes(data, sizeof(data), 2));
+  REQUIRE(hash_bytes(data, sizeof(data)) == hash_bytes(data, sizeof(data), FOC_GET_HASH_SEED));
+
+  // Doesn't read outside of the range.
+  std::string copy(data, 10);
+  REQUIRE(hash_bytes(data, 10) == hash_bytes(copy.data(), copy.size()));
+}
+
+TEST_CASE("hash_bytes distinguishes lengths and single bit flips", "[Hashing]") {
+  std::vector<uint8_t> buffer(300, 0);
+  std::set<uint64_t> hashes;
+  // Every prefix of a buffer of zeros gets a different hash.
+  for (size_t len = 0; len <= buffer.size(); len++) {
+    hashes.insert(hash_bytes(buffer.data(), len));
+  }
+  REQUIRE(hashes.size() == buffer.size() + 1);
+
+  // Flipping any bit of inputs in all the size classes (<4, <=16, <=48, >48)
+  // changes the hash.
+  const size_t lengths[] = {3, 16, 48, 200};
+  for (size_t len : lengths) {
+    hashes.clear();
+    hashes.insert(hash_bytes(buffer.data(), len));
+    for (size_t i = 0; i < len; i++) {
+      for (int bit = 0; bit < 8; bit++) {
+        buffer[i] ^= 1 << bit;
+        hashes.insert(hash_bytes(buffer.data(), len));
+        buffer[i] ^= 1 << bit;
+      }
+    }
+    REQUIRE(hashes.size() == len * 8 + 1);
+  }
+}
+
+TEST_CASE("hash_value of ArrayRef and StringRef", "[Hashing]") {
+  std::vector<int32_t> ints = {1, 2, 3, 4, 5};
+  ArrayRef<int32_t> ref(ints);
+  REQUIRE(hash_value(ref) == hash_bytes(ints.data(), ints.size() * sizeof(int32_t)));
+  REQUIRE(hash_value(ref) != hash_value(ref.drop_back()));
+  REQUIRE(Hash<ArrayRef<int32_t>>()(ref) == (size_t)hash_value(ref));
+
+  std::string s = "hello";
+  REQUIRE(hash_value(StringRef(s)) == hash_value(s));
+  REQUIRE(Hash<StringRef>()("hello") == Hash<std::string>()(s));
+
+  // Element-wise hashing for types that aren't hashed as bytes.
+  std::vector<std::string> strings = {"a", "b"};
+  std::vector<std::string> reversed = {"b", "a"};
+  REQUIRE(hash_value(ArrayRef<std::string>(strings)) ==
+          hash_value(ArrayRef<std::string>(std::vector<std::string>{"a", "b"})));
+  REQUIRE(hash_value(ArrayRef<std::string>(strings)) !=
+          hash_value(ArrayRef<std::string>(reversed)));
+}
+
+TEST_CASE("foc::Hash mixes integers", "[Hashing]") {
+  // The low 5 bits (the first HAMT level) of consecutive integers are spread.
+  std::set<size_t> low_bits;
+  for (int64_t i = 0; i < 32; i++) {
+    low_bits.insert(Hash<int64_t>()(i * 32) & 0x1f);
+  }
+  REQUIRE(low_bits.size() > 16);
+}
+
+TEST_CASE("foc::Hash works as the HashArrayMappedTrie hasher", "[Hashing]") {
+  HashArrayMappedTrie<std::string, int, Hash<std::string>> hamt;
+  for (int i = 0; i < 5000; i++) {
+    hamt.insert(std::make_pair(std::to_string(i), i));
+  }
+  for (int i = 0; i < 5000; i++) {
+    REQUIRE(*hamt.findValue(std::to_string(i)) == i);
+  }
+
+  std::vector<std::string> storage = {"foo", "bar", "baz"};
+  HashArrayMappedTrie<StringRef, size_t, Hash<StringRef>> refs;
+  for (size_t i = 0; i < storage.size(); i++) {
+    refs.insert(std::make_pair(StringRef(storage[i]), i));
+  }
+  REQUIRE(*refs.findValue("bar") == 1);
+  REQUIRE(refs.findValue("qux") == nullptr);
+}
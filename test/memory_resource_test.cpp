@@ -0,0 +1,128 @@
+#include <functional>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#define HAMT_IMPLEMENTATION
+#include "../foc/hash_array_mapped_trie.h"
+#include "../foc/memory_resource.h"
+
+#if FOC_HAS_MEMORY_RESOURCE
+
+using foc::AllocatorMemoryResource;
+using foc::HashArrayMappedTrie;
+using foc::MallocAllocator;
+using foc::MemoryResourceAllocator;
+
+namespace {
+
+// Counts the bytes that are live in a memory_resource.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t live_bytes = 0;
+  size_t num_allocations = 0;
+
+ private:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    live_bytes += bytes;
+    num_allocations++;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *ptr, size_t bytes, size_t alignment) override {
+    REQUIRE(live_bytes >= bytes);
+    live_bytes -= bytes;
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+// A foc allocator that keeps track of the bytes it hands out.
+struct CountingAllocator {
+  size_t *live_bytes;
+
+  void *allocate(size_t size, size_t) {
+    *live_bytes += size;
+    return malloc(size);
+  }
+
+  void deallocate(void *ptr, size_t size) {
+    REQUIRE(*live_bytes >= size);
+    *live_bytes -= size;
+    free(ptr);
+  }
+};
+
+using PmrHAMT = HashArrayMappedTrie<int64_t,
+                                    int64_t,
+                                    std::hash<int64_t>,
+                                    std::equal_to<int64_t>,
+                                    MemoryResourceAllocator>;
+
+}  // namespace
+
+TEST_CASE("MemoryResourceAllocator backs a HashArrayMappedTrie", "[MemoryResource]") {
+  CountingResource resource;
+  {
+    PmrHAMT hamt{MemoryResourceAllocator(&resource)};
+    for (int64_t i = 0; i < 10000; i++) {
+      hamt.insert(std::make_pair(i, i * 2));
+    }
+    REQUIRE(hamt.size() == 10000);
+    REQUIRE(*hamt.findValue(4242) == 8484);
+    REQUIRE(resource.num_allocations > 0);
+    REQUIRE(resource.live_bytes > 0);
+  }
+  // Sizes passed to deallocate() must match the sizes that were allocated.
+  REQUIRE(resource.live_bytes == 0);
+}
+
+TEST_CASE("A single arena serves std::pmr containers and foc containers", "[MemoryResource]") {
+  CountingResource upstream;
+  {
+    std::pmr::monotonic_buffer_resource arena(4096, &upstream);
+    std::pmr::vector<int64_t> keys(&arena);
+    PmrHAMT hamt{MemoryResourceAllocator(&arena)};
+    for (int64_t i = 0; i < 1000; i++) {
+      keys.push_back(i);
+      hamt[i] = -i;
+    }
+    for (auto key : keys) {
+      REQUIRE(*hamt.findValue(key) == -key);
+    }
+    REQUIRE(upstream.live_bytes > 0);
+  }
+  REQUIRE(upstream.live_bytes == 0);
+}
+
+TEST_CASE("AllocatorMemoryResource forwards to a foc allocator", "[MemoryResource]") {
+  size_t live_bytes = 0;
+  {
+    AllocatorMemoryResource<CountingAllocator> resource(CountingAllocator{&live_bytes});
+    std::pmr::vector<int32_t> v(&resource);
+    for (int32_t i = 0; i < 1000; i++) {
+      v.push_back(i);
+    }
+    REQUIRE(live_bytes >= 1000 * sizeof(int32_t));
+
+    // Over-aligned allocations
+    void *p = resource.allocate(100, 256);
+    REQUIRE(((uintptr_t)p % 256) == 0);
+    resource.deallocate(p, 100, 256);
+
+    std::pmr::polymorphic_allocator<int32_t> a(&resource);
+    REQUIRE(a.resource()->is_equal(resource));
+  }
+  REQUIRE(live_bytes == 0);
+
+  AllocatorMemoryResource<MallocAllocator> malloc_resource;
+  std::pmr::vector<std::pmr::string> strings(&malloc_resource);
+  strings.emplace_back("a string long enough to not fit in the small string buffer");
+  REQUIRE(strings.back().get_allocator().resource() == &malloc_resource);
+}
+
+#endif  // FOC_HAS_MEMORY_RESOURCE
@@ -0,0 +1,90 @@
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#include "../foc/mpsc_queue.h"
+
+using foc::MpscNode;
+using foc::MpscQueue;
+
+namespace {
+
+struct Item : MpscNode {
+  int producer;
+  int seq;
+};
+
+}  // namespace
+
+TEST_CASE("MpscQueue is FIFO", "[MpscQueue]") {
+  MpscQueue<Item> queue;
+  REQUIRE(queue.empty());
+  REQUIRE(queue.pop() == nullptr);
+
+  std::vector<Item> items(10);
+  for (int i = 0; i < 10; i++) {
+    items[i].seq = i;
+    queue.push(&items[i]);
+  }
+  REQUIRE(!queue.empty());
+  for (int i = 0; i < 10; i++) {
+    Item *item = queue.pop();
+    REQUIRE(item == &items[i]);
+  }
+  REQUIRE(queue.pop() == nullptr);
+  REQUIRE(queue.empty());
+
+  // The stub node is recycled correctly after the queue drains.
+  queue.push(&items[0]);
+  REQUIRE(queue.pop() == &items[0]);
+  queue.push(&items[1]);
+  queue.push(&items[2]);
+  REQUIRE(queue.pop() == &items[1]);
+  REQUIRE(queue.pop() == &items[2]);
+  REQUIRE(queue.empty());
+}
+
+TEST_CASE("MpscQueue with concurrent producers", "[MpscQueue]") {
+  const int num_producers = 4;
+  const int num_items = 50000;
+  MpscQueue<Item> queue;
+  std::vector<std::unique_ptr<Item[]>> items;
+  for (int p = 0; p < num_producers; p++) {
+    items.emplace_back(new Item[num_items]);
+  }
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; p++) {
+    producers.emplace_back([&queue, &items, p]() {
+      for (int i = 0; i < num_items; i++) {
+        items[p][i].producer = p;
+        items[p][i].seq = i;
+        queue.push(&items[p][i]);
+      }
+    });
+  }
+
+  // Items from each producer come out in the order they were pushed.
+  std::vector<int> next(num_producers, 0);
+  int received = 0;
+  bool in_order = true;
+  while (received < num_producers * num_items) {
+    Item *item = queue.pop();
+    if (item == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    in_order = in_order && item->seq == next[item->producer];
+    next[item->producer] = item->seq + 1;
+    received++;
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  REQUIRE(in_order);
+  REQUIRE(queue.pop() == nullptr);
+  REQUIRE(queue.empty());
+}
@@ -0,0 +1,145 @@
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#include "test_classes.h"
+
+#include "../foc/object_pool.h"
+
+using foc::Constructable;
+using foc::LocalObjectPool;
+using foc::ObjectPool;
+using foc::SharedObjectPool;
+
+namespace {
+
+struct alignas(64) OverAligned {
+  char bytes[3];
+};
+
+struct Small {
+  char c;
+};
+
+}  // namespace
+
+TEST_CASE("ObjectPool slot layout", "[ObjectPool]") {
+  // Slots must fit the free list link even for tiny objects.
+  REQUIRE(foc::detail::PoolSlotLayout<Small>::size >= sizeof(void *));
+  REQUIRE(foc::detail::PoolSlotLayout<OverAligned>::size == 64);
+  REQUIRE(foc::detail::PoolSlotLayout<OverAligned>::alignment == 64);
+
+  ObjectPool<OverAligned> pool(3);
+  std::vector<OverAligned *> objects;
+  for (int i = 0; i < 10; i++) {
+    OverAligned *object = pool.create();
+    REQUIRE(((uintptr_t)object % 64) == 0);
+    objects.push_back(object);
+  }
+  for (auto object : objects) {
+    pool.destroy(object);
+  }
+}
+
+TEST_CASE("ObjectPool create and destroy", "[ObjectPool]") {
+  Constructable::reset();
+  {
+    ObjectPool<Constructable> pool(4);
+    REQUIRE(pool.numLiveObjects() == 0);
+    REQUIRE(pool.numSlabs() == 0);
+
+    std::vector<Constructable *> objects;
+    for (int i = 0; i < 10; i++) {
+      objects.push_back(pool.create(i));
+      REQUIRE(objects.back()->getValue() == i);
+    }
+    REQUIRE(pool.numLiveObjects() == 10);
+    REQUIRE(pool.numSlabs() == 3);
+    REQUIRE(pool.capacity() == 12);
+    REQUIRE(Constructable::getNumConstructorCalls() == 10);
+
+    for (auto object : objects) {
+      pool.destroy(object);
+    }
+    REQUIRE(pool.numLiveObjects() == 0);
+    REQUIRE(Constructable::getNumDestructorCalls() == 10);
+
+    // Destroyed objects are recycled (LIFO) instead of growing the pool.
+    Constructable *last = objects.back();
+    Constructable *recycled = pool.create(42);
+    REQUIRE(recycled == last);
+    pool.destroy(recycled);
+    for (int i = 0; i < 12; i++) {
+      objects.push_back(pool.create(i));
+    }
+    REQUIRE(pool.numSlabs() == 3);
+    for (size_t i = 10; i < objects.size(); i++) {
+      pool.destroy(objects[i]);
+    }
+
+    pool.destroy(nullptr);  // no-op
+    REQUIRE(pool.numLiveObjects() == 0);
+  }
+  REQUIRE(Constructable::getNumConstructorCalls() == Constructable::getNumDestructorCalls());
+}
+
+TEST_CASE("LocalObjectPool batches to SharedObjectPool", "[ObjectPool]") {
+  SharedObjectPool<int64_t> shared(16);
+  {
+    LocalObjectPool<int64_t> local(shared, 4);
+
+    int64_t *a = local.create(1);
+    REQUIRE(*a == 1);
+    // A whole batch was taken from the shared pool.
+    REQUIRE(shared.numLiveObjects() == 4);
+    REQUIRE(local.numCachedSlots() == 3);
+
+    std::vector<int64_t *> objects;
+    for (int i = 0; i < 12; i++) {
+      objects.push_back(local.create(i));
+    }
+    REQUIRE(shared.numLiveObjects() == 16);
+    for (auto object : objects) {
+      local.destroy(object);
+    }
+    // Free slots beyond 2 * batch_size went back to the shared pool.
+    REQUIRE(local.numCachedSlots() <= 8);
+    REQUIRE(shared.numLiveObjects() == 1 + local.numCachedSlots());
+
+    local.destroy(a);
+  }
+  // The destructor returns all cached slots.
+  REQUIRE(shared.numLiveObjects() == 0);
+}
+
+TEST_CASE("LocalObjectPool across threads", "[ObjectPool]") {
+  SharedObjectPool<std::pair<int, int>> shared(64);
+  const int num_threads = 4;
+  const int num_objects = 10000;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&shared, t]() {
+      LocalObjectPool<std::pair<int, int>> local(shared, 16);
+      std::vector<std::pair<int, int> *> objects;
+      for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < num_objects; i++) {
+          objects.push_back(local.create(t, i));
+        }
+        for (int i = 0; i < num_objects; i++) {
+          if (objects[i]->first != t || objects[i]->second != i) {
+            abort();
+          }
+          local.destroy(objects[i]);
+        }
+        objects.clear();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(shared.numLiveObjects() == 0);
+}
@@ -0,0 +1,102 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#include "../foc/size_class_allocator.h"
+
+using foc::SizeClassAllocator;
+
+TEST_CASE("SizeClassAllocator size classes", "[SizeClassAllocator]") {
+  REQUIRE(SizeClassAllocator::sizeClass(0) == 0);
+  REQUIRE(SizeClassAllocator::sizeClass(1) == 0);
+  REQUIRE(SizeClassAllocator::sizeClass(16) == 0);
+  REQUIRE(SizeClassAllocator::sizeClass(17) == 1);
+  REQUIRE(SizeClassAllocator::sizeClass(32) == 1);
+  REQUIRE(SizeClassAllocator::sizeClass(33) == 2);
+  REQUIRE(SizeClassAllocator::sizeClass(4095) == SizeClassAllocator::kNumSizeClasses - 1);
+  REQUIRE(SizeClassAllocator::sizeClass(4096) == SizeClassAllocator::kNumSizeClasses - 1);
+
+  REQUIRE(SizeClassAllocator::roundUp(1) == 16);
+  REQUIRE(SizeClassAllocator::roundUp(100) == 128);
+  REQUIRE(SizeClassAllocator::roundUp(1024) == 1024);
+  REQUIRE(SizeClassAllocator::roundUp(1025) == 2048);
+  REQUIRE(SizeClassAllocator::roundUp(5000) == 5000);
+}
+
+TEST_CASE("SizeClassAllocator allocates aligned, reusable blocks", "[SizeClassAllocator]") {
+  SizeClassAllocator allocator;
+  std::vector<std::pair<void *, size_t>> blocks;
+  for (size_t size = 1; size <= 10000; size = size * 3 / 2 + 1) {
+    void *ptr = allocator.allocate(size);
+    REQUIRE(ptr != nullptr);
+    REQUIRE(((uintptr_t)ptr % SizeClassAllocator::kAlignment) == 0);
+    // The whole rounded up size is usable.
+    memset(ptr, (int)(size & 0xff), SizeClassAllocator::roundUp(size));
+    blocks.emplace_back(ptr, size);
+  }
+  for (auto &block : blocks) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(block.first);
+    REQUIRE(bytes[0] == (block.second & 0xff));
+    REQUIRE(bytes[SizeClassAllocator::roundUp(block.second) - 1] == (block.second & 0xff));
+    allocator.deallocate(block.first, block.second);
+  }
+
+  // A freed block is the next one handed out by its size class.
+  void *a = allocator.allocate(200);
+  allocator.deallocate(a, 200);
+  void *b = allocator.allocate(256);
+  REQUIRE(a == b);
+  allocator.deallocate(b, 256);
+
+  allocator.deallocate(nullptr, 64);
+}
+
+TEST_CASE("SizeClassAllocator is thread-safe", "[SizeClassAllocator]") {
+  const int kNumThreads = 4;
+  const int kNumBlocks = 20000;
+  // Blocks allocated by one thread and freed by another.
+  std::vector<std::vector<void *>> handoff(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([t, &handoff]() {
+      SizeClassAllocator allocator;
+      std::vector<void *> own;
+      for (int i = 0; i < kNumBlocks; i++) {
+        void *ptr = allocator.allocate(48);
+        memset(ptr, t, 48);
+        if (i % 2) {
+          own.push_back(ptr);
+        } else {
+          handoff[t].push_back(ptr);
+        }
+      }
+      for (void *ptr : own) {
+        allocator.deallocate(ptr, 48);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([t, &handoff]() {
+      SizeClassAllocator allocator;
+      for (void *ptr : handoff[(t + 1) % kNumThreads]) {
+        allocator.deallocate(ptr, 48);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  SizeClassAllocator allocator;
+  void *ptr = allocator.allocate(48);
+  REQUIRE(ptr != nullptr);
+  allocator.deallocate(ptr, 48);
+}
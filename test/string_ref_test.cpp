@@ -0,0 +1,145 @@
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "../catch.hpp"
+
+#define SMALL_VECTOR_IMPLEMENTATION
+#include "../foc/string_ref.h"
+
+using foc::SmallVector;
+using foc::StringRef;
+
+namespace {
+
+// Strings long enough to exercise the vector loops and their scalar tails
+// with matches in every position.
+std::vector<std::string> makeHaystacks() {
+  std::vector<std::string> haystacks;
+  for (size_t len = 0; len < 100; len++) {
+    std::string s;
+    for (size_t i = 0; i < len; i++) {
+      s.push_back("abcdefgh"[(i * 7 + len) % 8]);
+    }
+    haystacks.push_back(s);
+  }
+  return haystacks;
+}
+
+size_t toNpos(size_t pos) { return pos == std::string::npos ? (size_t)StringRef::npos : pos; }
+
+}  // namespace
+
+TEST_CASE("StringRef construction and comparison", "[StringRef]") {
+  StringRef empty;
+  REQUIRE(empty.empty());
+  REQUIRE(empty.str() == "");
+  REQUIRE(StringRef(nullptr).empty());
+
+  std::string std_str = "hello";
+  StringRef a("hello");
+  StringRef b(std_str);
+  StringRef c("hello, world", 5);
+  REQUIRE(a.size() == 5);
+  REQUIRE(a == b);
+  REQUIRE(b == c);
+  REQUIRE(a != "hell");
+  REQUIRE(a.str() == std_str);
+
+  REQUIRE(StringRef("aab") < StringRef("abb"));
+  REQUIRE(StringRef("ab") < StringRef("abb"));
+  REQUIRE(StringRef("abb") > StringRef("ab"));
+  REQUIRE(StringRef("ab").compare("ab") == 0);
+  REQUIRE(StringRef("").compare("") == 0);
+
+  REQUIRE(StringRef("hello").startswith("he"));
+  REQUIRE(!StringRef("hello").startswith("hello!"));
+  REQUIRE(StringRef("hello").endswith("llo"));
+  REQUIRE(StringRef("hello").endswith(""));
+
+  REQUIRE(StringRef("hello").substr(1, 3) == "ell");
+  REQUIRE(StringRef("hello").substr(3) == "lo");
+  REQUIRE(StringRef("hello").substr(10).empty());
+  REQUIRE(StringRef("hello").drop_front(2) == "llo");
+  REQUIRE(StringRef("hello").drop_back(2) == "hel");
+}
+
+TEST_CASE("StringRef byte search matches std::string", "[StringRef]") {
+  for (const auto &haystack : makeHaystacks()) {
+    StringRef s(haystack);
+    for (char c = 'a'; c <= 'i'; c++) {
+      for (size_t from = 0; from <= haystack.size() + 1; from += 3) {
+        REQUIRE(s.find(c, from) == toNpos(haystack.find(c, from)));
+        // Like llvm::StringRef, rfind() only looks at positions before `from`.
+        size_t expected = from == 0 ? std::string::npos : haystack.rfind(c, from - 1);
+        REQUIRE(s.rfind(c, from) == toNpos(expected));
+      }
+      REQUIRE(s.rfind(c) == toNpos(haystack.rfind(c)));
+    }
+  }
+}
+
+TEST_CASE("StringRef set search matches std::string", "[StringRef]") {
+  const char *sets[] = {"", "h", "gh", "xyzh", "\\/", "abcdefgh", "xyzwvutsrqh", "ihgfedcbaxyz"};
+  for (const auto &haystack : makeHaystacks()) {
+    StringRef s(haystack);
+    for (const char *set : sets) {
+      for (size_t from = 0; from <= haystack.size(); from += 5) {
+        REQUIRE(s.find_first_of(set, from) == toNpos(haystack.find_first_of(set, from)));
+        size_t expected = from == 0 ? std::string::npos : haystack.find_last_of(set, from - 1);
+        REQUIRE(s.find_last_of(set, from) == toNpos(expected));
+      }
+      REQUIRE(s.find_last_of(set) == toNpos(haystack.find_last_of(set)));
+    }
+  }
+  REQUIRE(StringRef("/usr/src/foc/logging.h").find_last_of("\\/") == 12);
+  REQUIRE(StringRef("C:\\foc\\logging.h").find_last_of("\\/") == 6);
+}
+
+TEST_CASE("StringRef substring search matches std::string", "[StringRef]") {
+  const char *needles[] = {"", "a", "ab", "hab", "fgh", "abcdefgh", "bcdefghabcdefgha", "zz"};
+  for (const auto &haystack : makeHaystacks()) {
+    StringRef s(haystack);
+    for (const char *needle : needles) {
+      for (size_t from = 0; from <= haystack.size() + 1; from += 7) {
+        REQUIRE(s.find(needle, from) == toNpos(haystack.find(needle, from)));
+      }
+      REQUIRE(s.rfind(StringRef(needle)) == toNpos(haystack.rfind(needle)));
+      REQUIRE(s.contains(needle) == (haystack.find(needle) != std::string::npos));
+    }
+  }
+}
+
+TEST_CASE("StringRef split", "[StringRef]") {
+  auto parts = StringRef("key=value=more").split('=');
+  REQUIRE(parts.first == "key");
+  REQUIRE(parts.second == "value=more");
+
+  parts = StringRef("no separator").split('=');
+  REQUIRE(parts.first == "no separator");
+  REQUIRE(parts.second.empty());
+
+  parts = StringRef("a::b::c").split("::");
+  REQUIRE(parts.first == "a");
+  REQUIRE(parts.second == "b::c");
+
+  SmallVector<StringRef, 8> pieces;
+  StringRef(",a,,b,").split(pieces, ',');
+  REQUIRE(pieces.size() == 5);
+  REQUIRE(pieces[0] == "");
+  REQUIRE(pieces[1] == "a");
+  REQUIRE(pieces[2] == "");
+  REQUIRE(pieces[3] == "b");
+  REQUIRE(pieces[4] == "");
+
+  pieces.clear();
+  StringRef(",a,,b,").split(pieces, ',', -1, /*keep_empty=*/false);
+  REQUIRE(pieces.size() == 2);
+  REQUIRE(pieces[0] == "a");
+  REQUIRE(pieces[1] == "b");
+
+  pieces.clear();
+  StringRef("a,b,c,d").split(pieces, ',', 2);
+  REQUIRE(pieces.size() == 3);
+  REQUIRE(pieces[2] == "c,d");
+}